@@ -35,6 +35,7 @@
 #ifdef _KERNEL
 #include <types.h>
 #include <lib.h>
+#include <vm.h>
 #else
 #include <stdint.h>
 #include <string.h>
@@ -49,28 +50,74 @@ void
 bzero(void *vblock, size_t len)
 {
 	char *block = vblock;
-	size_t i;
+	long *lb;
 
 	/*
-	 * For performance, optimize the common case where the pointer
-	 * and the length are word-aligned, and write word-at-a-time
-	 * instead of byte-at-a-time. Otherwise, write bytes.
+	 * For performance, write bytes up to the first word boundary,
+	 * then write whole words, eight per loop iteration, then
+	 * finish off the tail by bytes.
 	 *
 	 * The alignment logic here should be portable. We rely on the
 	 * compiler to be reasonably intelligent about optimizing the
 	 * divides and moduli out. Fortunately, it is.
 	 */
 
-	if ((uintptr_t)block % sizeof(long) == 0 &&
-	    len % sizeof(long) == 0) {
-		long *lb = (long *)block;
-		for (i=0; i<len/sizeof(long); i++) {
-			lb[i] = 0;
+	if (len >= sizeof(long)) {
+		while ((uintptr_t)block % sizeof(long) != 0) {
+			*block++ = 0;
+			len--;
 		}
-	}
-	else {
-		for (i=0; i<len; i++) {
-			block[i] = 0;
+
+		lb = (long *)block;
+		while (len >= 8 * sizeof(long)) {
+			lb[0] = 0;
+			lb[1] = 0;
+			lb[2] = 0;
+			lb[3] = 0;
+			lb[4] = 0;
+			lb[5] = 0;
+			lb[6] = 0;
+			lb[7] = 0;
+			lb += 8;
+			len -= 8 * sizeof(long);
 		}
+		while (len >= sizeof(long)) {
+			*lb++ = 0;
+			len -= sizeof(long);
+		}
+		block = (char *)lb;
+	}
+
+	while (len > 0) {
+		*block++ = 0;
+		len--;
 	}
 }
+
+#ifdef _KERNEL
+
+/*
+ * Kernel only - zero one whole page. The pointer must be
+ * page-aligned.
+ */
+void
+pagezero(void *vpage)
+{
+	long *lp = vpage;
+	size_t i;
+
+	KASSERT((uintptr_t)vpage % PAGE_SIZE == 0);
+
+	for (i=0; i<PAGE_SIZE/sizeof(long); i+=8) {
+		lp[i+0] = 0;
+		lp[i+1] = 0;
+		lp[i+2] = 0;
+		lp[i+3] = 0;
+		lp[i+4] = 0;
+		lp[i+5] = 0;
+		lp[i+6] = 0;
+		lp[i+7] = 0;
+	}
+}
+
+#endif /* _KERNEL */
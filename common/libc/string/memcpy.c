@@ -35,6 +35,7 @@
 #ifdef _KERNEL
 #include <types.h>
 #include <lib.h>
+#include <vm.h>
 #else
 #include <stdint.h>
 #include <string.h>
@@ -47,40 +48,105 @@
 void *
 memcpy(void *dst, const void *src, size_t len)
 {
-	size_t i;
+	char *d = dst;
+	const char *s = src;
+	long *ld;
+	const long *ls;
 
 	/*
 	 * memcpy does not support overlapping buffers, so always do it
 	 * forwards. (Don't change this without adjusting memmove.)
 	 *
-	 * For speedy copying, optimize the common case where both pointers
-	 * and the length are word-aligned, and copy word-at-a-time instead
-	 * of byte-at-a-time. Otherwise, copy by bytes.
+	 * For speedy copying, if the two pointers are equally
+	 * misaligned (which includes the common case where both are
+	 * aligned), copy bytes up to the first word boundary, then
+	 * copy eight words per loop iteration, then single words, and
+	 * finish off the tail by bytes. If the pointers can never be
+	 * aligned at the same time, word copies would need unaligned
+	 * accesses, so copy by bytes, four per iteration.
 	 *
 	 * The alignment logic below should be portable. We rely on
 	 * the compiler to be reasonably intelligent about optimizing
 	 * the divides and modulos out. Fortunately, it is.
 	 */
 
-	if ((uintptr_t)dst % sizeof(long) == 0 &&
-	    (uintptr_t)src % sizeof(long) == 0 &&
-	    len % sizeof(long) == 0) {
+	if (len >= sizeof(long) &&
+	    ((uintptr_t)d - (uintptr_t)s) % sizeof(long) == 0) {
+
+		while ((uintptr_t)d % sizeof(long) != 0) {
+			*d++ = *s++;
+			len--;
+		}
 
-		long *d = dst;
-		const long *s = src;
+		ld = (long *)d;
+		ls = (const long *)s;
 
-		for (i=0; i<len/sizeof(long); i++) {
-			d[i] = s[i];
+		while (len >= 8 * sizeof(long)) {
+			ld[0] = ls[0];
+			ld[1] = ls[1];
+			ld[2] = ls[2];
+			ld[3] = ls[3];
+			ld[4] = ls[4];
+			ld[5] = ls[5];
+			ld[6] = ls[6];
+			ld[7] = ls[7];
+			ld += 8;
+			ls += 8;
+			len -= 8 * sizeof(long);
 		}
+		while (len >= sizeof(long)) {
+			*ld++ = *ls++;
+			len -= sizeof(long);
+		}
+
+		d = (char *)ld;
+		s = (const char *)ls;
 	}
-	else {
-		char *d = dst;
-		const char *s = src;
 
-		for (i=0; i<len; i++) {
-			d[i] = s[i];
-		}
+	while (len >= 4) {
+		d[0] = s[0];
+		d[1] = s[1];
+		d[2] = s[2];
+		d[3] = s[3];
+		d += 4;
+		s += 4;
+		len -= 4;
+	}
+	while (len > 0) {
+		*d++ = *s++;
+		len--;
 	}
 
 	return dst;
 }
+
+#ifdef _KERNEL
+
+/*
+ * Kernel only - copy one whole page. Both pointers must be
+ * page-aligned, so none of the alignment checks in memcpy are
+ * needed.
+ */
+void
+pagecopy(void *dst, const void *src)
+{
+	long *d = dst;
+	const long *s = src;
+	size_t i;
+
+	KASSERT((uintptr_t)dst % PAGE_SIZE == 0);
+	KASSERT((uintptr_t)src % PAGE_SIZE == 0);
+
+	for (i=0; i<PAGE_SIZE/sizeof(long); i+=8) {
+		d[i+0] = s[i+0];
+		d[i+1] = s[i+1];
+		d[i+2] = s[i+2];
+		d[i+3] = s[i+3];
+		d[i+4] = s[i+4];
+		d[i+5] = s[i+5];
+		d[i+6] = s[i+6];
+		d[i+7] = s[i+7];
+	}
+}
+
+#endif /* _KERNEL */
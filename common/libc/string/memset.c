@@ -27,10 +27,16 @@
  * SUCH DAMAGE.
  */
 
+/*
+ * This file is shared between libc and the kernel, so don't put anything
+ * in here that won't work in both contexts.
+ */
+
 #ifdef _KERNEL
 #include <types.h>
 #include <lib.h>
 #else
+#include <stdint.h>
 #include <string.h>
 #endif
 
@@ -42,10 +48,50 @@ void *
 memset(void *ptr, int ch, size_t len)
 {
 	char *p = ptr;
-	size_t i;
+	unsigned long pattern;
+	unsigned long *lp;
+	unsigned i;
+
+	/*
+	 * Write bytes up to the first word boundary, then fill whole
+	 * words with copies of the byte, eight per loop iteration,
+	 * then finish off the tail by bytes. See bzero.c.
+	 */
+
+	if (len >= sizeof(long)) {
+		while ((uintptr_t)p % sizeof(long) != 0) {
+			*p++ = ch;
+			len--;
+		}
+
+		pattern = (unsigned char)ch;
+		for (i = 8; i < 8 * sizeof(long); i *= 2) {
+			pattern |= pattern << i;
+		}
+
+		lp = (unsigned long *)p;
+		while (len >= 8 * sizeof(long)) {
+			lp[0] = pattern;
+			lp[1] = pattern;
+			lp[2] = pattern;
+			lp[3] = pattern;
+			lp[4] = pattern;
+			lp[5] = pattern;
+			lp[6] = pattern;
+			lp[7] = pattern;
+			lp += 8;
+			len -= 8 * sizeof(long);
+		}
+		while (len >= sizeof(long)) {
+			*lp++ = pattern;
+			len -= sizeof(long);
+		}
+		p = (char *)lp;
+	}
 
-	for (i=0; i<len; i++) {
-		p[i] = ch;
+	while (len > 0) {
+		*p++ = ch;
+		len--;
 	}
 
 	return ptr;
@@ -125,14 +125,20 @@ paddr_t ram_getfirstfree(void);
 /*
  * TLB shootdown bits.
  *
- * We'll take up to 16 invalidations before just flushing the whole TLB.
+ * One request flushes one address space from the target's TLB.
+ * With ts_detach set the target also forgets the address space
+ * altogether, because it's about to be destroyed. When it's
+ * finished, the target sets ts_done[its cpu number].
+ *
+ * Up to TLBSHOOTDOWN_MAX requests can be queued on a cpu at once.
  */
 
+struct addrspace;
+
 struct tlbshootdown {
-	/*
-	 * Change this to what you need for your VM design.
-	 */
-	int ts_placeholder;
+	struct addrspace *ts_as;	/* address space changed */
+	bool ts_detach;			/* drop the address space too */
+	volatile bool *ts_done;		/* acknowledgements, by cpu */
 };
 
 #define TLBSHOOTDOWN_MAX 16
@@ -203,6 +203,19 @@ mips_trap(struct trapframe *tf)
 		}
 
 		curthread->t_in_interrupt = old_in;
+
+		/*
+		 * If another thread has exited our process, this
+		 * thread might never make a syscall or fault; the
+		 * clock interrupt is its chance to leave. Get the
+		 * interrupt state back to where it was in user mode
+		 * (on) first, as for the other cases below.
+		 */
+		if (!iskern && curproc->p_exiting) {
+			spl = splhigh();
+			splx(spl);
+			goto done;
+		}
 		goto done2;
 	}
 
@@ -323,6 +336,14 @@ mips_trap(struct trapframe *tf)
 	panic("I can't handle this... I think I'll just die now...\n");
 
  done:
+	/*
+	 * If the process is exiting, don't go back to user mode; this
+	 * thread leaves instead.
+	 */
+	if (!iskern && curproc->p_exiting) {
+		proc_threadexit();
+	}
+
 	/*
 	 * Turn interrupts off on the processor, without affecting the
 	 * stored interrupt state.
@@ -371,6 +392,7 @@ mips_trap(struct trapframe *tf)
  * following places:
  *    - enter_new_process, for use by exec and equivalent.
  *    - enter_forked_process, in syscall.c, for use by fork.
+ *    - enter_new_thread, for use by threadfork.
  */
 void
 mips_usermode(struct trapframe *tf)
@@ -444,3 +466,24 @@ enter_new_process(int argc, userptr_t argv, userptr_t env,
 
 	mips_usermode(&tf);
 }
+
+/*
+ * enter_new_thread: go to user mode in a new thread of an existing
+ * process, calling ENTRY with ARG on the stack STACK.
+ *
+ * Works the same way as enter_new_process.
+ */
+void
+enter_new_thread(userptr_t arg, vaddr_t stack, vaddr_t entry)
+{
+	struct trapframe tf;
+
+	bzero(&tf, sizeof(tf));
+
+	tf.tf_status = CST_IRQMASK | CST_IEp | CST_KUp;
+	tf.tf_epc = entry;
+	tf.tf_a0 = (vaddr_t)arg;
+	tf.tf_sp = stack;
+
+	mips_usermode(&tf);
+}
@@ -113,6 +113,11 @@ syscall(struct trapframe *tf)
 				 (userptr_t)tf->tf_a1);
 		break;
 
+	    case SYS_nanosleep:
+		err = sys_nanosleep((const_userptr_t)tf->tf_a0,
+				    (userptr_t)tf->tf_a1);
+		break;
+
 
 	    /* process calls */
 
@@ -142,6 +147,34 @@ syscall(struct trapframe *tf)
 		err = sys_getpid(&retval);
 		break;
 
+	    case SYS_getppid:
+		err = sys_getppid(&retval);
+		break;
+
+	    case SYS_futex_wait:
+		err = sys_futex_wait(
+			(userptr_t)tf->tf_a0,
+			tf->tf_a1,
+			(const_userptr_t)tf->tf_a2);
+		break;
+
+	    case SYS_futex_wake:
+		err = sys_futex_wake(
+			(userptr_t)tf->tf_a0,
+			tf->tf_a1,
+			&retval);
+		break;
+
+	    case SYS___threadfork:
+		err = sys___threadfork(
+			(userptr_t)tf->tf_a0,
+			(userptr_t)tf->tf_a1);
+		break;
+
+	    case SYS_threadexit:
+		sys_threadexit();
+		panic("Returning from threadexit\n");
+
 
 	    /* file calls */
 
@@ -147,8 +147,55 @@ free_kpages(vaddr_t addr)
 	(void)addr;
 }
 
+unsigned
+kpages_nfree(void)
+{
+	/*
+	 * Stolen memory is never given back, so there's nothing for
+	 * reclaim to work with; alloc_kpages never kicks it anyway.
+	 */
+	return 0;
+}
+
 #endif
 
+/*
+ * dumbvm can't remap pages: the stack is one physically contiguous
+ * block. So just copy the frame into place and release it.
+ */
+int
+vm_mapframe(struct addrspace *as, vaddr_t vaddr, vaddr_t kframe,
+	    bool writeable)
+{
+	vaddr_t stackbase;
+
+	(void)writeable;
+
+	stackbase = USERSTACK - DUMBVM_STACKPAGES * PAGE_SIZE;
+	KASSERT(as->as_stackpbase != 0);
+	if (vaddr < stackbase || vaddr >= USERSTACK) {
+		return EFAULT;
+	}
+	pagecopy((void *)PADDR_TO_KVADDR(as->as_stackpbase +
+					 (vaddr - stackbase)),
+		 (const void *)kframe);
+	free_kpages(kframe);
+	return 0;
+}
+
+/*
+ * dumbvm's faults are already cheap (no page table to fill in), so
+ * there's nothing worth doing ahead of time.
+ */
+int
+vm_prefault(vaddr_t start, size_t len, int faulttype)
+{
+	(void)start;
+	(void)len;
+	(void)faulttype;
+	return 0;
+}
+
 void
 vm_tlbshootdown(const struct tlbshootdown *ts)
 {
@@ -400,6 +447,27 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 	return 0;
 }
 
+/*
+ * dumbvm has room for just the one stack, so no multithreaded
+ * processes.
+ */
+int
+as_define_threadstack(struct addrspace *as, unsigned *slot, vaddr_t *stackptr)
+{
+	(void)as;
+	(void)slot;
+	(void)stackptr;
+	return ENOSYS;
+}
+
+void
+as_release_threadstack(struct addrspace *as, unsigned slot)
+{
+	(void)as;
+	(void)slot;
+	panic("dumbvm has no thread stacks\n");
+}
+
 int
 as_copy(struct addrspace *old, struct addrspace **ret)
 {
@@ -32,6 +32,8 @@
 #include <vm.h>
 #include <mainbus.h>
 #include <spinlock.h>
+#include <reclaim.h>
+#include <vmstat.h>
 
 vaddr_t firstfree;   /* first free virtual address; set by start.S */
 
@@ -49,6 +51,7 @@ typedef struct ft_entry {
 static ft_entry_t * frame_table = NULL; /* base of frame table */
 static uint32_t first_frame;
 static uint32_t last_frame;
+static uint32_t nfree_frames; /* number of unallocated frames */
 
 #define PAGE_BITS 12
 #define TRUE 1
@@ -141,6 +144,7 @@ ram_bootstrap(void)
         for (i = first_frame; i < (lastpaddr >> PAGE_BITS); i++) {
                 frame_table[i].allocated = FALSE;
         }
+        nfree_frames = last_frame - first_frame;
 
         
 }
@@ -212,6 +216,7 @@ static paddr_t alloc_one_frame(unsigned int npages)
                 if (frame_table[i].allocated == FALSE) {
                         frame_table[i].allocated = TRUE;
                         frame_table[i].not_last = FALSE;
+                        nfree_frames--;
 
                         spinlock_release(&frame_table_spinlock);
 
@@ -257,6 +262,7 @@ static paddr_t alloc_multiple_frames(unsigned int npages)
                 }
                 frame_table[j].allocated = TRUE;
                 frame_table[j].not_last = FALSE;
+                nfree_frames -= npages;
 
                 spinlock_release(&frame_table_spinlock);
                 
@@ -288,6 +294,7 @@ static void free_frames(vaddr_t vaddr)
         
         while (frame_table[i].allocated == TRUE) { /* otherwise mark block free */
                 frame_table[i].allocated = FALSE;
+                nfree_frames++;
                 if (frame_table[i].not_last == TRUE) {
                         i++;
                 }
@@ -295,27 +302,54 @@ static void free_frames(vaddr_t vaddr)
         spinlock_release(&frame_table_spinlock);
 }
         
+static paddr_t alloc_frames(unsigned npages)
+{
+        if (npages > 1 ) {
+                return alloc_multiple_frames(npages);
+        }
+        else {
+                return alloc_one_frame(npages);
+        }
+}
+
 /* Allocate/free some kernel-space virtual pages */
 vaddr_t
 alloc_kpages(unsigned npages)
 {
         paddr_t paddr;
-        if (npages > 1 ) {
-                paddr = alloc_multiple_frames(npages);
-        }
-        else {
-                paddr = alloc_one_frame(npages);
+
+        vmstat_inc(VMS_KPAGEALLOC);
+        paddr = alloc_frames(npages);
+
+        /*
+         * Out of frames: ask the reclaimers for memory and retry for
+         * as long as they keep giving some back. (reclaim_pages does
+         * nothing if we're in a context that can't sleep.)
+         */
+        while (paddr == 0 && reclaim_pages(npages) > 0) {
+                paddr = alloc_frames(npages);
         }
-        
+
+        /* Wake the background reclaimer if we're running low. */
+        reclaim_check(nfree_frames);
+
 	if (paddr == 0) {
 		return 0;
 	}
 	return PADDR_TO_KVADDR(paddr);
 }
 
+/* Number of free pages, for the reclaim watermarks. */
+unsigned
+kpages_nfree(void)
+{
+        return nfree_frames;
+}
+
 void
 free_kpages(vaddr_t addr)
 {
+        vmstat_inc(VMS_KPAGEFREE);
         free_frames(addr);
 }
 
@@ -76,6 +76,39 @@ mips_timer_set(uint32_t count)
 		:: "r" (count));
 }
 
+/*
+ * Restart c0_count from zero.
+ */
+static
+void
+mips_timer_restart(void)
+{
+	/* $9 == c0_count */
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 registers */
+		"mtc0 $0, $9;"		/* do it */
+		".set pop"		/* restore assembler mode */
+		);
+}
+
+/*
+ * Schedule the current cpu's next clock interrupt. The interrupt
+ * handler goes back to one per hardclock afterwards.
+ *
+ * The compare value is absolute, and this can be called anywhere
+ * in a period (or, coming out of tickless idle, several periods
+ * in), when count may already be past it. So restart count too,
+ * which makes the interrupt come NTICKS hardclocks from now.
+ */
+void
+mainbus_settimer(unsigned nticks)
+{
+	KASSERT(nticks > 0 && nticks <= HZ);
+	mips_timer_restart();
+	mips_timer_set(nticks * (CPU_FREQUENCY / HZ));
+}
+
 /*
  * LAMEbus data for the system. (We have only one LAMEbus per system.)
  * This does not need to be locked, because it's constant once
@@ -68,3 +68,9 @@ gettime(struct timespec *ts)
 	KASSERT(the_clock!=NULL);
 	the_clock->rtc_gettime(the_clock->rtc_devdata, ts);
 }
+
+bool
+gettime_available(void)
+{
+	return the_clock != NULL;
+}
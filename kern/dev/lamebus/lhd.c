@@ -35,8 +35,10 @@
 #include <kern/errno.h>
 #include <lib.h>
 #include <uio.h>
+#include <clock.h>
 #include <membar.h>
-#include <synch.h>
+#include <spinlock.h>
+#include <wchan.h>
 #include <platform/bus.h>
 #include <vfs.h>
 #include <lamebus/lhd.h>
@@ -60,6 +62,60 @@
 /* Buffer (offset within slot)  */
 #define LHD_BUFFER      32768
 
+/* Most disks we keep statistics for */
+#define LHD_MAXUNITS    8
+
+/*
+ * Disk request queue.
+ *
+ * Each call to lhd_io becomes one request covering a run of
+ * consecutive sectors. Requests that arrive while the disk is busy
+ * are kept on lh_queue sorted by starting sector; when the active
+ * request finishes, the next one is chosen by C-LOOK: the first
+ * request past the current head position, or if there is none, the
+ * lowest-numbered one. Requests for sectors adjacent to the one
+ * just finished are thus dispatched back to back.
+ *
+ * The card has only a single sector of buffer, and the data has to
+ * be copied to or from the caller's uio in the caller's context, so
+ * the request stays with its thread: the thread waits on
+ * lh_waitwchan until it is given the disk (lr_go), starts each
+ * sector itself, and sleeps on lh_donewchan until the completion
+ * callback, which is called from lhd_irq, sets lr_done.
+ */
+struct lhd_req {
+	struct lhd_req *lr_next;	/* Next in lh_queue */
+	uint32_t lr_sector;		/* First sector */
+	uint32_t lr_nsect;		/* Number of sectors */
+	bool lr_go;			/* Has been given the disk */
+	bool lr_done;			/* Current sector finished */
+	int lr_result;			/* Result of current sector */
+	struct timespec lr_start;	/* When dispatched */
+	void (*lr_callback)(struct lhd_softc *, struct lhd_req *);
+};
+
+/*
+ * Statistics, per disk.
+ */
+enum lhdstat_counter {
+	LHS_REQS,		/* requests completed */
+	LHS_DEPTHSUM,		/* sum of queue depth seen on arrival */
+	LHS_SVCUSEC,		/* sum of dispatch-to-done times */
+	LHS_SEEKSUM,		/* sum of sectors moved per request */
+	LHS_NCOUNTERS
+};
+
+static const char *const lhdstat_names[LHS_NCOUNTERS] = {
+	[LHS_REQS] = "requests",
+	[LHS_DEPTHSUM] = "depthsum",
+	[LHS_SVCUSEC] = "serviceusec",
+	[LHS_SEEKSUM] = "seeksum",
+};
+
+/* All the disks, for lhd_printstats */
+static struct lhd_softc *lhd_units[LHD_MAXUNITS];
+static unsigned lhd_nunits;
+
 /*
  * Shortcut for reading a register.
  */
@@ -96,15 +152,25 @@ int lhd_code_to_errno(struct lhd_softc *lh, int code)
 }
 
 /*
- * Record that an I/O has completed: save the result and poke the
- * completion semaphore.
+ * Record that an I/O has completed: save the result in the active
+ * request and call its completion callback.
  */
 static
 void
 lhd_iodone(struct lhd_softc *lh, int err)
 {
-	lh->lh_result = err;
-	V(lh->lh_done);
+	struct lhd_req *req;
+
+	spinlock_acquire(&lh->lh_lock);
+	req = lh->lh_active;
+	if (req == NULL) {
+		kprintf("lhd%d: Spurious completion\n", lh->lh_unit);
+	}
+	else {
+		req->lr_result = err;
+		req->lr_callback(lh, req);
+	}
+	spinlock_release(&lh->lh_lock);
 }
 
 /*
@@ -179,6 +245,129 @@ lhd_reset(struct lhd_softc *lh)
 }
 #endif
 
+/*
+ * Completion callback for requests made by lhd_io. Called from the
+ * interrupt handler with lh_lock held.
+ */
+static
+void
+lhd_wakeup(struct lhd_softc *lh, struct lhd_req *req)
+{
+	req->lr_done = true;
+	wchan_wakeall(lh->lh_donewchan, &lh->lh_lock);
+}
+
+/*
+ * Give the disk to REQ. Call with lh_lock held.
+ */
+static
+void
+lhd_dispatch(struct lhd_softc *lh, struct lhd_req *req)
+{
+	KASSERT(lh->lh_active == NULL);
+
+	gettime(&req->lr_start);
+	req->lr_go = true;
+	lh->lh_active = req;
+}
+
+/*
+ * Wait for the disk. If it's idle, take it right away; otherwise
+ * insert REQ in the queue in sector order and sleep until
+ * lhd_release hands the disk over.
+ */
+static
+void
+lhd_acquire(struct lhd_softc *lh, struct lhd_req *req)
+{
+	struct lhd_req **pp;
+	unsigned depth;
+
+	spinlock_acquire(&lh->lh_lock);
+
+	depth = lh->lh_nqueued + (lh->lh_active != NULL ? 1 : 0) + 1;
+	statcounter_add(&lh->lh_stats, LHS_DEPTHSUM, depth);
+	if (depth > lh->lh_maxdepth) {
+		lh->lh_maxdepth = depth;
+	}
+
+	if (lh->lh_active == NULL) {
+		lhd_dispatch(lh, req);
+	}
+	else {
+		pp = &lh->lh_queue;
+		while (*pp != NULL && (*pp)->lr_sector <= req->lr_sector) {
+			pp = &(*pp)->lr_next;
+		}
+		req->lr_next = *pp;
+		*pp = req;
+		lh->lh_nqueued++;
+
+		while (!req->lr_go) {
+			wchan_sleep(lh->lh_waitwchan, &lh->lh_lock);
+		}
+	}
+
+	spinlock_release(&lh->lh_lock);
+}
+
+/*
+ * Done with the disk. Account for REQ, which got as far as starting
+ * NSTARTED of its sectors (fewer than it asked for if it failed), and
+ * pass the disk on to the next request, chosen by C-LOOK from where
+ * the head actually ended up.
+ */
+static
+void
+lhd_release(struct lhd_softc *lh, struct lhd_req *req, uint32_t nstarted)
+{
+	struct timespec now, diff;
+	struct lhd_req **pp, **pick;
+	uint32_t dist;
+
+	gettime(&now);
+	timespec_sub(&now, &req->lr_start, &diff);
+
+	spinlock_acquire(&lh->lh_lock);
+	KASSERT(lh->lh_active == req);
+	lh->lh_active = NULL;
+	statcounter_add(&lh->lh_stats, LHS_REQS, 1);
+	statcounter_add(&lh->lh_stats, LHS_SVCUSEC,
+			diff.tv_sec * 1000000 + diff.tv_nsec / 1000);
+
+	KASSERT(nstarted <= req->lr_nsect);
+	if (nstarted > 0) {
+		dist = req->lr_sector > lh->lh_headpos ?
+			req->lr_sector - lh->lh_headpos :
+			lh->lh_headpos - req->lr_sector;
+		statcounter_add(&lh->lh_stats, LHS_SEEKSUM, dist);
+		lh->lh_headpos = req->lr_sector + nstarted - 1;
+	}
+
+	if (lh->lh_queue != NULL) {
+		/*
+		 * First request past the head, else wrap around. A
+		 * request for the sector just transferred waits for the
+		 * next sweep, so a stream of them can't starve the rest.
+		 */
+		pick = &lh->lh_queue;
+		for (pp = &lh->lh_queue; *pp != NULL; pp = &(*pp)->lr_next) {
+			if ((*pp)->lr_sector > lh->lh_headpos) {
+				pick = pp;
+				break;
+			}
+		}
+		req = *pick;
+		*pick = req->lr_next;
+		req->lr_next = NULL;
+		lh->lh_nqueued--;
+
+		lhd_dispatch(lh, req);
+		wchan_wakeall(lh->lh_waitwchan, &lh->lh_lock);
+	}
+	spinlock_release(&lh->lh_lock);
+}
+
 /*
  * I/O function (for both reads and writes)
  */
@@ -187,14 +376,15 @@ int
 lhd_io(struct device *d, struct uio *uio)
 {
 	struct lhd_softc *lh = d->d_data;
+	struct lhd_req req;
 
 	uint32_t sector = uio->uio_offset / LHD_SECTSIZE;
 	uint32_t sectoff = uio->uio_offset % LHD_SECTSIZE;
 	uint32_t len = uio->uio_resid / LHD_SECTSIZE;
 	uint32_t lenoff = uio->uio_resid % LHD_SECTSIZE;
-	uint32_t i;
+	uint32_t i, nstarted;
 	uint32_t statval = LHD_WORKING;
-	int result;
+	int result = 0;
 
 	/* Don't allow I/O that isn't sector-aligned. */
 	if (sectoff != 0 || lenoff != 0) {
@@ -207,17 +397,29 @@ lhd_io(struct device *d, struct uio *uio)
 		return EINVAL;
 	}
 
+	if (len == 0) {
+		return 0;
+	}
+
 	/* Set up the value to write into the status register. */
 	if (uio->uio_rw==UIO_WRITE) {
 		statval |= LHD_ISWRITE;
 	}
 
+	/* Queue up and wait until we have the device. */
+	req.lr_next = NULL;
+	req.lr_sector = sector;
+	req.lr_nsect = len;
+	req.lr_go = false;
+	req.lr_done = false;
+	req.lr_result = 0;
+	req.lr_callback = lhd_wakeup;
+	lhd_acquire(lh, &req);
+	nstarted = 0;
+
 	/* Loop over all the sectors we were asked to do. */
 	for (i=0; i<len; i++) {
 
-		/* Wait until nobody else is using the device. */
-		P(lh->lh_clear);
-
 		/*
 		 * Are we writing? If so, transfer the data to the
 		 * on-card buffer.
@@ -226,22 +428,28 @@ lhd_io(struct device *d, struct uio *uio)
 			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
 			membar_store_store();
 			if (result) {
-				V(lh->lh_clear);
-				return result;
+				break;
 			}
 		}
 
+		spinlock_acquire(&lh->lh_lock);
+		req.lr_done = false;
+
 		/* Tell it what sector we want... */
+		nstarted++;
 		lhd_wreg(lh, LHD_REG_SECT, sector+i);
 
 		/* and start the operation. */
 		lhd_wreg(lh, LHD_REG_STAT, statval);
 
 		/* Now wait until the interrupt handler tells us we're done. */
-		P(lh->lh_done);
+		while (!req.lr_done) {
+			wchan_sleep(lh->lh_donewchan, &lh->lh_lock);
+		}
 
 		/* Get the result value saved by the interrupt handler. */
-		result = lh->lh_result;
+		result = req.lr_result;
+		spinlock_release(&lh->lh_lock);
 
 		/*
 		 * Are we reading? If so, and if we succeeded,
@@ -252,16 +460,16 @@ lhd_io(struct device *d, struct uio *uio)
 			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
 		}
 
-		/* Tell another thread it's cleared to go ahead. */
-		V(lh->lh_clear);
-
-		/* If we failed, return the error. */
+		/* If we failed, stop. */
 		if (result) {
-			return result;
+			break;
 		}
 	}
 
-	return 0;
+	/* Let the next request go ahead. */
+	lhd_release(lh, &req, nstarted);
+
+	return result;
 }
 
 static const struct device_ops lhd_devops = {
@@ -284,17 +492,30 @@ config_lhd(struct lhd_softc *lh, int lhdno)
 	/* Get a pointer to the on-chip buffer. */
 	lh->lh_buf = bus_map_area(lh->lh_busdata, lh->lh_buspos, LHD_BUFFER);
 
-	/* Create the semaphores. */
-	lh->lh_clear = sem_create("lhd-clear", 1);
-	if (lh->lh_clear == NULL) {
+	/* Set up the request queue. */
+	spinlock_init(&lh->lh_lock);
+	lh->lh_waitwchan = wchan_create("lhd-wait");
+	if (lh->lh_waitwchan == NULL) {
+		spinlock_cleanup(&lh->lh_lock);
 		return ENOMEM;
 	}
-	lh->lh_done = sem_create("lhd-done", 0);
-	if (lh->lh_done == NULL) {
-		sem_destroy(lh->lh_clear);
-		lh->lh_clear = NULL;
+	lh->lh_donewchan = wchan_create("lhd-done");
+	if (lh->lh_donewchan == NULL) {
+		wchan_destroy(lh->lh_waitwchan);
+		lh->lh_waitwchan = NULL;
+		spinlock_cleanup(&lh->lh_lock);
 		return ENOMEM;
 	}
+	lh->lh_queue = NULL;
+	lh->lh_nqueued = 0;
+	lh->lh_active = NULL;
+	lh->lh_headpos = 0;
+	lh->lh_maxdepth = 0;
+	statcounters_init(&lh->lh_stats, lhdstat_names, LHS_NCOUNTERS);
+
+	if (lhd_nunits < LHD_MAXUNITS) {
+		lhd_units[lhd_nunits++] = lh;
+	}
 
 	/* Set up the VFS device structure. */
 	lh->lh_dev.d_ops = &lhd_devops;
@@ -306,3 +527,58 @@ config_lhd(struct lhd_softc *lh, int lhdno)
 	/* Add the VFS device structure to the VFS device list. */
 	return vfs_adddev(name, &lh->lh_dev, 1);
 }
+
+/*
+ * Print the queue statistics for each disk.
+ */
+void
+lhd_printstats(void)
+{
+	struct lhd_softc *lh;
+	unsigned counts[LHS_NCOUNTERS];
+	unsigned i, nreqs, maxdepth, nqueued;
+	char prefix[16];
+
+	for (i=0; i<lhd_nunits; i++) {
+		lh = lhd_units[i];
+
+		spinlock_acquire(&lh->lh_lock);
+		maxdepth = lh->lh_maxdepth;
+		nqueued = lh->lh_nqueued;
+		spinlock_release(&lh->lh_lock);
+
+		statcounters_sum(&lh->lh_stats, counts);
+		snprintf(prefix, sizeof(prefix), "lhd%d", lh->lh_unit);
+		statcounters_print(&lh->lh_stats, prefix, counts);
+
+		kprintf("%s queued %u\n", prefix, nqueued);
+		kprintf("%s maxdepth %u\n", prefix, maxdepth);
+		nreqs = counts[LHS_REQS];
+		if (nreqs > 0) {
+			kprintf("%s avgdepth %u\n", prefix,
+				counts[LHS_DEPTHSUM] / nreqs);
+			kprintf("%s avgserviceusec %u\n", prefix,
+				counts[LHS_SVCUSEC] / nreqs);
+			kprintf("%s avgseek %u\n", prefix,
+				counts[LHS_SEEKSUM] / nreqs);
+		}
+	}
+}
+
+/*
+ * Clear the queue statistics for each disk.
+ */
+void
+lhd_resetstats(void)
+{
+	struct lhd_softc *lh;
+	unsigned i;
+
+	for (i=0; i<lhd_nunits; i++) {
+		lh = lhd_units[i];
+		spinlock_acquire(&lh->lh_lock);
+		lh->lh_maxdepth = 0;
+		spinlock_release(&lh->lh_lock);
+		statcounters_reset(&lh->lh_stats);
+	}
+}
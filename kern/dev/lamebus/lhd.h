@@ -30,6 +30,8 @@
 #ifndef _LAMEBUS_LHD_H_
 #define _LAMEBUS_LHD_H_
 
+#include <spinlock.h>
+#include <statcounter.h>
 #include <device.h>
 
 /*
@@ -51,9 +53,19 @@ struct lhd_softc {
 	 */
 
 	void *lh_buf;			/* Pointer to on-card I/O buffer */
-	int lh_result;			/* Result from I/O operation */
-	struct semaphore *lh_clear;	/* Synchronization */
-	struct semaphore *lh_done;
+
+	/* Request queue (see lhd.c) */
+	struct spinlock lh_lock;	/* Protects the queue */
+	struct wchan *lh_waitwchan;	/* For waiting for the device */
+	struct wchan *lh_donewchan;	/* For waiting for completion */
+	struct lhd_req *lh_queue;	/* Waiting requests, by sector */
+	unsigned lh_nqueued;		/* Number of waiting requests */
+	struct lhd_req *lh_active;	/* Request that has the device */
+	uint32_t lh_headpos;		/* Sector last transferred */
+
+	/* Statistics */
+	unsigned lh_maxdepth;		/* Most requests outstanding (lh_lock) */
+	struct statcounters lh_stats;	/* Counters (see lhd.c) */
 
 	struct device lh_dev;		/* VFS device structure */
 };
@@ -61,4 +73,8 @@ struct lhd_softc {
 /* Functions called by lower-level drivers */
 void lhd_irq(/*struct lhd_softc*/ void *);	/* Interrupt handler */
 
+/* Per-disk queue statistics (for the kernel menu) */
+void lhd_printstats(void);
+void lhd_resetstats(void);
+
 #endif /* _LAMEBUS_LHD_H_ */
@@ -35,9 +35,29 @@
 #include <types.h>
 #include <lib.h>
 #include <bitmap.h>
+#include <synch.h>
+#include <buf.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
+/*
+ * Longest run of blocks set aside for a file that is being written
+ * sequentially.
+ */
+#define SFS_PREALLOC	16
+
+/*
+ * Note that the freemap block holding BLOCK's bit has changed and
+ * needs writing out. Call with the freemap lock held.
+ */
+static
+void
+sfs_freemap_dirty(struct sfs_fs *sfs, daddr_t block)
+{
+	KASSERT(lock_do_i_hold(sfs->sfs_freemaplock));
+	sfs->sfs_freemapdirty[block / SFS_BITSPERBLOCK] = true;
+}
+
 /*
  * Zero out a disk block.
  */
@@ -45,47 +65,178 @@ static
 int
 sfs_clearblock(struct sfs_fs *sfs, daddr_t block)
 {
-	/* static -> automatically initialized to zero */
-	static char zeros[SFS_BLOCKSIZE];
+	struct buf *b;
+	int result;
 
-	return sfs_writeblock(sfs, block, zeros, SFS_BLOCKSIZE);
+	/* No need to read it; we're overwriting all of it */
+	result = buf_get(sfs->sfs_device, block, &b);
+	if (result) {
+		return result;
+	}
+	bzero(buf_map(b), SFS_BLOCKSIZE);
+	buf_markdirty(b);
+	buf_release(b);
+	return 0;
 }
 
 /*
- * Allocate a block.
+ * Allocate a block, as close after GOAL as possible. If ZERO is
+ * false the caller promises to overwrite all of it, and it isn't
+ * cleared.
  */
 int
-sfs_balloc(struct sfs_fs *sfs, daddr_t *diskblock)
+sfs_balloc(struct sfs_fs *sfs, daddr_t goal, bool zero, daddr_t *diskblock)
 {
 	int result;
 
-	result = bitmap_alloc(sfs->sfs_freemap, diskblock);
+	lock_acquire(sfs->sfs_freemaplock);
+	result = bitmap_alloc_near(sfs->sfs_freemap, goal, diskblock);
 	if (result) {
+		lock_release(sfs->sfs_freemaplock);
 		return result;
 	}
-	sfs->sfs_freemapdirty = true;
+	sfs_freemap_dirty(sfs, *diskblock);
+	lock_release(sfs->sfs_freemaplock);
 
 	if (*diskblock >= sfs->sfs_sb.sb_nblocks) {
 		panic("sfs: %s: balloc: invalid block %u\n",
 		      sfs->sfs_sb.sb_volname, *diskblock);
 	}
 
-	/* Clear block before returning it */
+	if (!zero) {
+		return 0;
+	}
+
+	/*
+	 * Clear block before returning it. (Outside the freemap lock;
+	 * the block is ours now, and this may have to wait for I/O.)
+	 */
 	result = sfs_clearblock(sfs, *diskblock);
 	if (result) {
+		lock_acquire(sfs->sfs_freemaplock);
 		bitmap_unmark(sfs->sfs_freemap, *diskblock);
+		lock_release(sfs->sfs_freemaplock);
 	}
 	return result;
 }
 
+/*
+ * Allocate a block for file SV, as close after GOAL as possible.
+ *
+ * If SEQ is set the file is being written in order, and as in ext2
+ * the free blocks following the one handed out (up to SFS_PREALLOC
+ * of them) are set aside for it in sv_panext/sv_pacount. The next
+ * request whose goal is sv_panext gets the next of these; anything
+ * else throws the rest back. This keeps files written at the same
+ * time from interleaving their blocks.
+ *
+ * Set-aside blocks are marked in use in the freemap, so if the
+ * freemap is written out while they're held and the system then
+ * crashes, sfsck will find them allocated but unused. sfs_sync
+ * throws them back first to keep that window small.
+ */
+int
+sfs_balloc_file(struct sfs_vnode *sv, daddr_t goal, bool seq, bool zero,
+		daddr_t *diskblock)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	daddr_t block;
+	unsigned run;
+	int result;
+
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
+	if (sv->sv_pacount > 0 && goal == sv->sv_panext) {
+		/* Carrying on in order; take the next one set aside */
+		block = sv->sv_panext++;
+		sv->sv_pacount--;
+	}
+	else {
+		/* Whatever was set aside is in the wrong place now */
+		sfs_bdiscard(sv);
+
+		lock_acquire(sfs->sfs_freemaplock);
+		result = bitmap_alloc_near(sfs->sfs_freemap, goal, &block);
+		if (result) {
+			lock_release(sfs->sfs_freemaplock);
+			return result;
+		}
+		if (block >= sfs->sfs_sb.sb_nblocks) {
+			panic("sfs: %s: balloc: invalid block %u\n",
+			      sfs->sfs_sb.sb_volname, block);
+		}
+		sfs_freemap_dirty(sfs, block);
+		run = 1;
+		if (seq) {
+			while (run < SFS_PREALLOC &&
+			       block + run < sfs->sfs_sb.sb_nblocks &&
+			       !bitmap_isset(sfs->sfs_freemap, block + run)) {
+				bitmap_mark(sfs->sfs_freemap, block + run);
+				sfs_freemap_dirty(sfs, block + run);
+				run++;
+			}
+		}
+		lock_release(sfs->sfs_freemaplock);
+
+		sv->sv_panext = block + 1;
+		sv->sv_pacount = run - 1;
+	}
+
+	if (zero) {
+		result = sfs_clearblock(sfs, block);
+		if (result) {
+			sfs_bfree(sfs, block);
+			return result;
+		}
+	}
+
+	*diskblock = block;
+	return 0;
+}
+
+/*
+ * Give back the blocks set aside for SV by sfs_balloc_file.
+ */
+void
+sfs_bdiscard(struct sfs_vnode *sv)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	unsigned i;
+
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
+	if (sv->sv_pacount == 0) {
+		return;
+	}
+
+	/* (Nothing was ever put in the cache for these.) */
+	lock_acquire(sfs->sfs_freemaplock);
+	for (i=0; i<sv->sv_pacount; i++) {
+		bitmap_unmark(sfs->sfs_freemap, sv->sv_panext + i);
+		sfs_freemap_dirty(sfs, sv->sv_panext + i);
+	}
+	lock_release(sfs->sfs_freemaplock);
+
+	sv->sv_pacount = 0;
+}
+
 /*
  * Free a block.
  */
 void
 sfs_bfree(struct sfs_fs *sfs, daddr_t diskblock)
 {
+	/*
+	 * Whatever is cached for it no longer needs writing. Do this
+	 * first: once the block is marked free someone else may
+	 * allocate it and put new contents in the cache.
+	 */
+	buf_invalidate(sfs->sfs_device, diskblock);
+
+	lock_acquire(sfs->sfs_freemaplock);
 	bitmap_unmark(sfs->sfs_freemap, diskblock);
-	sfs->sfs_freemapdirty = true;
+	sfs_freemap_dirty(sfs, diskblock);
+	lock_release(sfs->sfs_freemaplock);
 }
 
 /*
@@ -94,10 +245,16 @@ sfs_bfree(struct sfs_fs *sfs, daddr_t diskblock)
 int
 sfs_bused(struct sfs_fs *sfs, daddr_t diskblock)
 {
+	int ret;
+
 	if (diskblock >= sfs->sfs_sb.sb_nblocks) {
 		panic("sfs: %s: sfs_bused called on out of range block %u\n",
 		      sfs->sfs_sb.sb_volname, diskblock);
 	}
-	return bitmap_isset(sfs->sfs_freemap, diskblock);
+
+	lock_acquire(sfs->sfs_freemaplock);
+	ret = bitmap_isset(sfs->sfs_freemap, diskblock);
+	lock_release(sfs->sfs_freemaplock);
+	return ret;
 }
 
@@ -35,39 +35,56 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <synch.h>
 #include <vfs.h>
+#include <buf.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
+/*
+ * Where to put a new block of a file: right after PREV, the disk
+ * block holding the file block before it, or if that isn't there,
+ * right after the inode. Set *SEQ if the file seems to be being
+ * written in order (that is, if this is the first block or the one
+ * before it exists).
+ */
+static
+daddr_t
+sfs_bmap_goal(struct sfs_vnode *sv, uint32_t fileblock, daddr_t prev,
+	      bool *seq)
+{
+	*seq = (fileblock == 0 || prev != 0);
+	return (prev != 0 ? prev : sv->sv_ino) + 1;
+}
+
 /*
  * Look up the disk block number (from 0 up to the number of blocks on
  * the disk) given a file and the logical block number within that
  * file. If DOALLOC is set, and no such block exists, one will be
- * allocated.
+ * allocated, close to the blocks before it; it is zeroed if ZERO is
+ * set, and *FRESH (if not NULL) says whether this happened.
  */
+static
 int
-sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
-	 daddr_t *diskblock)
+sfs_bmap_common(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
+		bool zero, daddr_t *diskblock, bool *fresh)
 {
-	/*
-	 * I/O buffer for handling indirect blocks.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static uint32_t idbuf[SFS_DBPERIDB];
-
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
-	daddr_t block;
+	struct buf *idbuf;
+	uint32_t *idptrs;
+	daddr_t block, prev, goal;
 	daddr_t idblock;
 	uint32_t idnum, idoff;
+	bool seq;
 	int result;
 
-	KASSERT(sizeof(idbuf)==SFS_BLOCKSIZE);
+	COMPILE_ASSERT(SFS_DBPERIDB * sizeof(uint32_t) == SFS_BLOCKSIZE);
 
-	/* Since we're using a static buffer, we'd better be locked. */
-	KASSERT(vfs_biglock_do_i_hold());
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
+	if (fresh != NULL) {
+		*fresh = false;
+	}
 
 	/*
 	 * If the block we want is one of the direct blocks...
@@ -82,7 +99,10 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 		 * Do we need to allocate?
 		 */
 		if (block==0 && doalloc) {
-			result = sfs_balloc(sfs, &block);
+			prev = fileblock > 0 ?
+				sv->sv_i.sfi_direct[fileblock-1] : 0;
+			goal = sfs_bmap_goal(sv, fileblock, prev, &seq);
+			result = sfs_balloc_file(sv, goal, seq, zero, &block);
 			if (result) {
 				return result;
 			}
@@ -90,6 +110,9 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 			/* Remember what we allocated; mark inode dirty */
 			sv->sv_i.sfi_direct[fileblock] = block;
 			sv->sv_dirty = true;
+			if (fresh != NULL) {
+				*fresh = true;
+			}
 		}
 
 		/*
@@ -141,9 +164,11 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 		 * There's no indirect block allocated, but we need to
 		 * allocate a block whose number needs to be stored in
 		 * the indirect block. Thus, we need to allocate an
-		 * indirect block.
+		 * indirect block. Put it in line with the data.
 		 */
-		result = sfs_balloc(sfs, &idblock);
+		prev = sv->sv_i.sfi_direct[SFS_NDIRECT-1];
+		goal = sfs_bmap_goal(sv, SFS_NDIRECT, prev, &seq);
+		result = sfs_balloc_file(sv, goal, seq, true, &idblock);
 		if (result) {
 			return result;
 		}
@@ -154,38 +179,48 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 		/* Mark the inode dirty */
 		sv->sv_dirty = true;
 
-		/* Clear the indirect block buffer */
-		bzero(idbuf, sizeof(idbuf));
+		/* (sfs_balloc zeroed it, so it's now in the cache) */
 	}
-	else {
-		/*
-		 * We already have an indirect block allocated; load it.
-		 */
-		result = sfs_readblock(sfs, idblock, idbuf, sizeof(idbuf));
-		if (result) {
-			return result;
-		}
+
+	/* Load the indirect block. */
+	result = buf_read(sfs->sfs_device, idblock, &idbuf);
+	if (result) {
+		return result;
 	}
+	idptrs = buf_map(idbuf);
 
 	/* Get the block out of the indirect block buffer */
-	block = idbuf[idoff];
+	block = idptrs[idoff];
 
 	/* If there's no block there, allocate one */
 	if (block==0 && doalloc) {
-		result = sfs_balloc(sfs, &block);
+		if (idoff > 0) {
+			prev = idptrs[idoff-1];
+		}
+		else {
+			/* After the last direct block, or the indirect one */
+			prev = sv->sv_i.sfi_direct[SFS_NDIRECT-1];
+			if (prev != 0 && idblock == prev + 1) {
+				prev = idblock;
+			}
+		}
+		goal = sfs_bmap_goal(sv, SFS_NDIRECT + fileblock, prev, &seq);
+		result = sfs_balloc_file(sv, goal, seq, zero, &block);
 		if (result) {
+			buf_release(idbuf);
 			return result;
 		}
 
 		/* Remember the block we allocated */
-		idbuf[idoff] = block;
+		idptrs[idoff] = block;
 
-		/* The indirect block is now dirty; write it back */
-		result = sfs_writeblock(sfs, idblock, idbuf, sizeof(idbuf));
-		if (result) {
-			return result;
+		/* The indirect block is now dirty */
+		buf_markdirty(idbuf);
+		if (fresh != NULL) {
+			*fresh = true;
 		}
 	}
+	buf_release(idbuf);
 
 	/* Hand back the result and return. */
 	if (block != 0 && !sfs_bused(sfs, block)) {
@@ -198,21 +233,101 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 }
 
 /*
- * Called for ftruncate() and from sfs_reclaim.
+ * The usual case: newly allocated blocks are zeroed.
  */
 int
-sfs_itrunc(struct sfs_vnode *sv, off_t len)
+sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
+	 daddr_t *diskblock)
+{
+	return sfs_bmap_common(sv, fileblock, doalloc, true, diskblock, NULL);
+}
+
+/*
+ * For a caller about to write the whole block: allocate it if
+ * needed, but don't zero it. If *FRESH comes back true the caller
+ * must fill in all of it (with zeros, if its own write fails), since
+ * what's on disk there is left over from whatever used it before.
+ */
+int
+sfs_bmap_overwrite(struct sfs_vnode *sv, uint32_t fileblock,
+		   daddr_t *diskblock, bool *fresh)
+{
+	return sfs_bmap_common(sv, fileblock, true, false, diskblock, fresh);
+}
+
+/*
+ * Write back the file's own blocks: its data blocks and its indirect
+ * block. (The inode and the freemap are up to the caller.) This is
+ * for fsync, which shouldn't have to write out everything else dirty
+ * on the volume as well.
+ */
+int
+sfs_bmap_sync(struct sfs_vnode *sv)
 {
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct buf *idbuf;
+	uint32_t *idptrs;
+	daddr_t idblock;
+	unsigned i;
+	int result;
+
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
+	for (i=0; i<SFS_NDIRECT; i++) {
+		if (sv->sv_i.sfi_direct[i] != 0) {
+			result = buf_syncblock(sfs->sfs_device,
+					       sv->sv_i.sfi_direct[i]);
+			if (result) {
+				return result;
+			}
+		}
+	}
+
+	idblock = sv->sv_i.sfi_indirect;
+	if (idblock == 0) {
+		return 0;
+	}
+
 	/*
-	 * I/O buffer for handling the indirect block.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
+	 * Copy the pointers out so we don't sit on the indirect block
+	 * while waiting for other buffers. It can't change under us;
+	 * we hold the vnode.
 	 */
-	static uint32_t idbuf[SFS_DBPERIDB];
+	idptrs = kmalloc(SFS_BLOCKSIZE);
+	if (idptrs == NULL) {
+		return ENOMEM;
+	}
+	result = buf_read(sfs->sfs_device, idblock, &idbuf);
+	if (result) {
+		kfree(idptrs);
+		return result;
+	}
+	memcpy(idptrs, buf_map(idbuf), SFS_BLOCKSIZE);
+	buf_release(idbuf);
 
+	for (i=0; i<SFS_DBPERIDB; i++) {
+		if (idptrs[i] != 0) {
+			result = buf_syncblock(sfs->sfs_device, idptrs[i]);
+			if (result) {
+				kfree(idptrs);
+				return result;
+			}
+		}
+	}
+	kfree(idptrs);
+
+	return buf_syncblock(sfs->sfs_device, idblock);
+}
+
+/*
+ * Called for ftruncate() and from sfs_reclaim.
+ */
+int
+sfs_itrunc(struct sfs_vnode *sv, off_t len)
+{
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct buf *idbuf;
+	uint32_t *idptrs;
 
 	/* Length in blocks (divide rounding up) */
 	uint32_t blocklen = DIVROUNDUP(len, SFS_BLOCKSIZE);
@@ -223,9 +338,10 @@ sfs_itrunc(struct sfs_vnode *sv, off_t len)
 	int result;
 	int hasnonzero, iddirty;
 
-	KASSERT(sizeof(idbuf)==SFS_BLOCKSIZE);
+	KASSERT(lock_do_i_hold(sv->sv_lock));
 
-	vfs_biglock_acquire();
+	/* Give back any blocks set aside for writing past the end */
+	sfs_bdiscard(sv);
 
 	/*
 	 * Go through the direct blocks. Discard any that are
@@ -253,51 +369,50 @@ sfs_itrunc(struct sfs_vnode *sv, off_t len)
 		/* We're past the proposed EOF; may need to free stuff */
 
 		/* Read the indirect block */
-		result = sfs_readblock(sfs, idblock, idbuf, sizeof(idbuf));
+		result = buf_read(sfs->sfs_device, idblock, &idbuf);
 		if (result) {
-			vfs_biglock_release();
 			return result;
 		}
+		idptrs = buf_map(idbuf);
 
 		hasnonzero = 0;
 		iddirty = 0;
 		for (j=0; j<SFS_DBPERIDB; j++) {
 			/* Discard any blocks that are past the new EOF */
-			if (blocklen < baseblock+j && idbuf[j] != 0) {
-				sfs_bfree(sfs, idbuf[j]);
-				idbuf[j] = 0;
+			if (blocklen < baseblock+j && idptrs[j] != 0) {
+				sfs_bfree(sfs, idptrs[j]);
+				idptrs[j] = 0;
 				iddirty = 1;
 			}
 			/* Remember if we see any nonzero blocks in here */
-			if (idbuf[j]!=0) {
+			if (idptrs[j]!=0) {
 				hasnonzero=1;
 			}
 		}
 
+		if (iddirty) {
+			buf_markdirty(idbuf);
+		}
+		/* (release it first; sfs_bfree discards its buffer) */
+		buf_release(idbuf);
+
 		if (!hasnonzero) {
 			/* The whole indirect block is empty now; free it */
 			sfs_bfree(sfs, idblock);
 			sv->sv_i.sfi_indirect = 0;
 			sv->sv_dirty = true;
 		}
-		else if (iddirty) {
-			/* The indirect block is dirty; write it back */
-			result = sfs_writeblock(sfs, idblock, idbuf,
-						sizeof(idbuf));
-			if (result) {
-				vfs_biglock_release();
-				return result;
-			}
-		}
 	}
 
 	/* Set the file size */
 	sv->sv_i.sfi_size = len;
 
+	/* Blocks we read ahead may be gone; start over */
+	sv->sv_raend = 0;
+
 	/* Mark the inode dirty */
 	sv->sv_dirty = true;
 
-	vfs_biglock_release();
 	return 0;
 }
 
@@ -95,14 +95,250 @@ sfs_dir_nentries(struct sfs_vnode *sv)
 	return size / sizeof(struct sfs_direntry);
 }
 
+////////////////////////////////////////////////////////////
+// Directory index
+
 /*
- * Search a directory for a particular filename in a directory, and
- * return its inode number, its slot, and/or the slot number of an
- * empty directory slot if one is found.
+ * So that lookups don't have to scan the whole directory, each
+ * directory vnode gets an in-memory index the first time it's
+ * searched: a hash table from a hash of each name to the slot it's
+ * in, plus a list of the free slots so creating a file doesn't have
+ * to look for one. Only the hash is kept, not the name, so a match
+ * is confirmed by reading the slot (which will normally be in the
+ * buffer cache).
+ *
+ * sfs_dir_link and sfs_dir_unlink are the only things that change
+ * directories, and they keep the index up to date. If memory runs
+ * out the index is just thrown away, and searches fall back to
+ * scanning until it can be rebuilt.
+ */
+
+/* Initial number of chains. */
+#define SFS_DIRHASH_INIT	16
+
+struct sfs_dirhent {
+	struct sfs_dirhent *dhe_next;
+	uint32_t dhe_hash;		/* hash of the name (unused if free) */
+	int dhe_slot;			/* slot it's in */
+};
+
+struct sfs_dirhash {
+	struct sfs_dirhent **dh_table;
+	unsigned dh_size;		/* number of chains (power of 2) */
+	unsigned dh_count;		/* number of names */
+	struct sfs_dirhent *dh_free;	/* free slots */
+};
+
+/*
+ * Hash a name (FNV-1a).
+ */
+static
+uint32_t
+sfs_dirhash_name(const char *name)
+{
+	uint32_t hash = 2166136261U;
+
+	while (*name != 0) {
+		hash ^= (unsigned char)*name++;
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+static
+void
+sfs_dirhash_freelist(struct sfs_dirhent *he)
+{
+	struct sfs_dirhent *next;
+
+	for (; he != NULL; he = next) {
+		next = he->dhe_next;
+		kfree(he);
+	}
+}
+
+void
+sfs_dirhash_destroy(struct sfs_vnode *sv)
+{
+	struct sfs_dirhash *dh = sv->sv_dirhash;
+	unsigned i;
+
+	if (dh == NULL) {
+		return;
+	}
+	for (i=0; i<dh->dh_size; i++) {
+		sfs_dirhash_freelist(dh->dh_table[i]);
+	}
+	sfs_dirhash_freelist(dh->dh_free);
+	kfree(dh->dh_table);
+	kfree(dh);
+	sv->sv_dirhash = NULL;
+}
+
+/*
+ * Double the number of chains. If there's no memory, carry on with
+ * longer chains.
+ */
+static
+void
+sfs_dirhash_grow(struct sfs_dirhash *dh)
+{
+	struct sfs_dirhent **newtable, *he;
+	unsigned newsize, i, j;
+
+	newsize = dh->dh_size * 2;
+	newtable = kmalloc(newsize * sizeof(newtable[0]));
+	if (newtable == NULL) {
+		return;
+	}
+	for (i=0; i<newsize; i++) {
+		newtable[i] = NULL;
+	}
+	for (i=0; i<dh->dh_size; i++) {
+		while ((he = dh->dh_table[i]) != NULL) {
+			dh->dh_table[i] = he->dhe_next;
+			j = he->dhe_hash & (newsize - 1);
+			he->dhe_next = newtable[j];
+			newtable[j] = he;
+		}
+	}
+	kfree(dh->dh_table);
+	dh->dh_table = newtable;
+	dh->dh_size = newsize;
+}
+
+/*
+ * Record that NAME is in SLOT.
  */
+static
 int
-sfs_dir_findname(struct sfs_vnode *sv, const char *name,
-		uint32_t *ino, int *slot, int *emptyslot)
+sfs_dirhash_add(struct sfs_dirhash *dh, const char *name, int slot)
+{
+	struct sfs_dirhent *he;
+	unsigned ix;
+
+	he = kmalloc(sizeof(*he));
+	if (he == NULL) {
+		return ENOMEM;
+	}
+	if (dh->dh_count >= 2 * dh->dh_size) {
+		sfs_dirhash_grow(dh);
+	}
+	he->dhe_hash = sfs_dirhash_name(name);
+	he->dhe_slot = slot;
+	ix = he->dhe_hash & (dh->dh_size - 1);
+	he->dhe_next = dh->dh_table[ix];
+	dh->dh_table[ix] = he;
+	dh->dh_count++;
+	return 0;
+}
+
+/*
+ * Record that SLOT, which held NAME, is now free.
+ */
+static
+void
+sfs_dirhash_remove(struct sfs_dirhash *dh, const char *name, int slot)
+{
+	struct sfs_dirhent **hep, *he;
+
+	hep = &dh->dh_table[sfs_dirhash_name(name) & (dh->dh_size - 1)];
+	while ((he = *hep) != NULL && he->dhe_slot != slot) {
+		hep = &he->dhe_next;
+	}
+	KASSERT(he != NULL);
+	*hep = he->dhe_next;
+	dh->dh_count--;
+
+	/* Reuse the entry for the free list. */
+	he->dhe_next = dh->dh_free;
+	dh->dh_free = he;
+}
+
+/*
+ * Record that SLOT is free.
+ */
+static
+int
+sfs_dirhash_addfree(struct sfs_dirhash *dh, int slot)
+{
+	struct sfs_dirhent *he;
+
+	he = kmalloc(sizeof(*he));
+	if (he == NULL) {
+		return ENOMEM;
+	}
+	he->dhe_hash = 0;
+	he->dhe_slot = slot;
+	he->dhe_next = dh->dh_free;
+	dh->dh_free = he;
+	return 0;
+}
+
+/*
+ * Build the index for a directory.
+ */
+static
+int
+sfs_dirhash_build(struct sfs_vnode *sv)
+{
+	struct sfs_dirhash *dh;
+	struct sfs_direntry tsd;
+	int nentries, i, result;
+
+	KASSERT(sv->sv_dirhash == NULL);
+
+	dh = kmalloc(sizeof(*dh));
+	if (dh == NULL) {
+		return ENOMEM;
+	}
+	dh->dh_table = kmalloc(SFS_DIRHASH_INIT * sizeof(dh->dh_table[0]));
+	if (dh->dh_table == NULL) {
+		kfree(dh);
+		return ENOMEM;
+	}
+	dh->dh_size = SFS_DIRHASH_INIT;
+	for (i=0; i<SFS_DIRHASH_INIT; i++) {
+		dh->dh_table[i] = NULL;
+	}
+	dh->dh_count = 0;
+	dh->dh_free = NULL;
+	sv->sv_dirhash = dh;
+
+	nentries = sfs_dir_nentries(sv);
+	for (i=0; i<nentries; i++) {
+		result = sfs_readdir(sv, i, &tsd);
+		if (result) {
+			sfs_dirhash_destroy(sv);
+			return result;
+		}
+		if (tsd.sfd_ino == SFS_NOINO) {
+			result = sfs_dirhash_addfree(dh, i);
+		}
+		else {
+			/* Ensure null termination, just in case */
+			tsd.sfd_name[sizeof(tsd.sfd_name)-1] = 0;
+			result = sfs_dirhash_add(dh, tsd.sfd_name, i);
+		}
+		if (result) {
+			sfs_dirhash_destroy(sv);
+			return result;
+		}
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// Directory operations
+
+/*
+ * Search a directory for a particular filename by scanning every
+ * slot. Used when there's no index.
+ */
+static
+int
+sfs_dir_scan(struct sfs_vnode *sv, const char *name,
+	     uint32_t *ino, int *slot, int *emptyslot)
 {
 	struct sfs_direntry tsd;
 	int found, nentries, i, result;
@@ -146,6 +382,65 @@ sfs_dir_findname(struct sfs_vnode *sv, const char *name,
 	return found ? 0 : ENOENT;
 }
 
+/*
+ * Search a directory for a particular filename in a directory, and
+ * return its inode number, its slot, and/or the slot number of an
+ * empty directory slot if one is found.
+ */
+int
+sfs_dir_findname(struct sfs_vnode *sv, const char *name,
+		uint32_t *ino, int *slot, int *emptyslot)
+{
+	struct sfs_dirhash *dh;
+	struct sfs_dirhent *he;
+	struct sfs_direntry tsd;
+	uint32_t hash;
+	int result;
+
+	if (sv->sv_dirhash == NULL) {
+		result = sfs_dirhash_build(sv);
+		if (result == ENOMEM) {
+			return sfs_dir_scan(sv, name, ino, slot, emptyslot);
+		}
+		if (result) {
+			return result;
+		}
+	}
+	dh = sv->sv_dirhash;
+
+	/* Free slot - report it back if one was requested */
+	if (emptyslot != NULL && dh->dh_free != NULL) {
+		*emptyslot = dh->dh_free->dhe_slot;
+	}
+
+	hash = sfs_dirhash_name(name);
+	for (he = dh->dh_table[hash & (dh->dh_size - 1)]; he != NULL;
+	     he = he->dhe_next) {
+		if (he->dhe_hash != hash) {
+			continue;
+		}
+
+		/* Read the entry to make sure it's really the name */
+		result = sfs_readdir(sv, he->dhe_slot, &tsd);
+		if (result) {
+			return result;
+		}
+		KASSERT(tsd.sfd_ino != SFS_NOINO);
+		tsd.sfd_name[sizeof(tsd.sfd_name)-1] = 0;
+		if (!strcmp(tsd.sfd_name, name)) {
+			if (slot != NULL) {
+				*slot = he->dhe_slot;
+			}
+			if (ino != NULL) {
+				*ino = tsd.sfd_ino;
+			}
+			return 0;
+		}
+	}
+
+	return ENOENT;
+}
+
 /*
  * Create a link in a directory to the specified inode by number, with
  * the specified name, and optionally hand back the slot.
@@ -156,6 +451,8 @@ sfs_dir_link(struct sfs_vnode *sv, const char *name, uint32_t ino, int *slot)
 	int emptyslot = -1;
 	int result;
 	struct sfs_direntry sd;
+	struct sfs_dirhash *dh;
+	struct sfs_dirhent *he;
 
 	/* Look up the name. We want to make sure it *doesn't* exist. */
 	result = sfs_dir_findname(sv, name, NULL, NULL, &emptyslot);
@@ -186,7 +483,25 @@ sfs_dir_link(struct sfs_vnode *sv, const char *name, uint32_t ino, int *slot)
 	}
 
 	/* Write the entry. */
-	return sfs_writedir(sv, emptyslot, &sd);
+	result = sfs_writedir(sv, emptyslot, &sd);
+	if (result) {
+		return result;
+	}
+
+	/* Update the index. */
+	dh = sv->sv_dirhash;
+	if (dh != NULL) {
+		/* If we used the first free slot, it isn't any more */
+		he = dh->dh_free;
+		if (he != NULL && he->dhe_slot == emptyslot) {
+			dh->dh_free = he->dhe_next;
+			kfree(he);
+		}
+		if (sfs_dirhash_add(dh, name, emptyslot)) {
+			sfs_dirhash_destroy(sv);
+		}
+	}
+	return 0;
 }
 
 /*
@@ -195,14 +510,32 @@ sfs_dir_link(struct sfs_vnode *sv, const char *name, uint32_t ino, int *slot)
 int
 sfs_dir_unlink(struct sfs_vnode *sv, int slot)
 {
-	struct sfs_direntry sd;
+	struct sfs_direntry sd, oldsd;
+	int result;
+
+	/* Get the old name, to take it out of the index */
+	if (sv->sv_dirhash != NULL) {
+		result = sfs_readdir(sv, slot, &oldsd);
+		if (result) {
+			return result;
+		}
+		oldsd.sfd_name[sizeof(oldsd.sfd_name)-1] = 0;
+	}
 
 	/* Initialize a suitable directory entry... */
 	bzero(&sd, sizeof(sd));
 	sd.sfd_ino = SFS_NOINO;
 
 	/* ... and write it */
-	return sfs_writedir(sv, slot, &sd);
+	result = sfs_writedir(sv, slot, &sd);
+	if (result) {
+		return result;
+	}
+
+	if (sv->sv_dirhash != NULL) {
+		sfs_dirhash_remove(sv->sv_dirhash, oldsd.sfd_name, slot);
+	}
+	return 0;
 }
 
 /*
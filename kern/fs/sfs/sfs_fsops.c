@@ -38,9 +38,11 @@
 #include <lib.h>
 #include <array.h>
 #include <bitmap.h>
+#include <synch.h>
 #include <uio.h>
 #include <vfs.h>
 #include <device.h>
+#include <buf.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
@@ -52,8 +54,9 @@
 
 /*
  * Routine for doing I/O (reads or writes) on the free block bitmap.
- * We always do the whole bitmap at once; writing individual sectors
- * might or might not be a worthwhile optimization.
+ * Reads do the whole bitmap; writes only do the blocks marked in
+ * sfs_freemapdirty, so a sync after a few allocations costs a
+ * block or two however big the volume is.
  *
  * The free block bitmap consists of SFS_FREEMAPBLOCKS 512-byte
  * sectors of bits, one bit for each sector on the filesystem. The
@@ -92,9 +95,15 @@ sfs_freemapio(struct sfs_fs *sfs, enum uio_rw rw)
 			result = sfs_readblock(sfs, SFS_FREEMAP_START+j, ptr,
 					       SFS_BLOCKSIZE);
 		}
-		else {
+		else if (sfs->sfs_freemapdirty[j]) {
 			result = sfs_writeblock(sfs, SFS_FREEMAP_START+j, ptr,
 						SFS_BLOCKSIZE);
+			if (result == 0) {
+				sfs->sfs_freemapdirty[j] = false;
+			}
+		}
+		else {
+			result = 0;
 		}
 
 		/* If we failed, stop. */
@@ -112,35 +121,91 @@ static
 int
 sfs_sync_vnodes(struct sfs_fs *sfs)
 {
-	unsigned i, num;
+	struct sfs_vnode **svs, *sv;
+	unsigned i, num, max;
 
-	/* Go over the array of loaded vnodes, syncing as we go. */
-	num = vnodearray_num(sfs->sfs_vnodes);
+	/*
+	 * Collect the loaded vnodes, with a reference to each, so they
+	 * can be synced without holding sfs_vnlock (which comes after
+	 * the vnode locks). Vnodes that are busy are skipped: ones
+	 * being loaded aren't dirty yet and ones being reclaimed sync
+	 * themselves. Anything loaded after we count doesn't need it.
+	 */
+	lock_acquire(sfs->sfs_vnlock);
+	max = vnodearray_num(sfs->sfs_vnodes);
+	lock_release(sfs->sfs_vnlock);
+	if (max == 0) {
+		return 0;
+	}
+
+	svs = kmalloc(max * sizeof(svs[0]));
+	if (svs == NULL) {
+		return ENOMEM;
+	}
+
+	num = 0;
+	lock_acquire(sfs->sfs_vnlock);
+	for (i=0; i<sfs->sfs_vnhashsize && num < max; i++) {
+		for (sv = sfs->sfs_vnhash[i]; sv != NULL && num < max;
+		     sv = sv->sv_hashnext) {
+			if (!sv->sv_busy) {
+				VOP_INCREF(&sv->sv_absvn);
+				svs[num++] = sv;
+			}
+		}
+	}
+	lock_release(sfs->sfs_vnlock);
+
+	/*
+	 * Sync them. (Not with VOP_FSYNC, which would write each one's
+	 * blocks out separately; sfs_sync writes the whole volume's
+	 * dirty buffers once at the end.)
+	 * Blocks set aside for writers are given back first so the
+	 * freemap that follows only shows blocks really in use.
+	 */
 	for (i=0; i<num; i++) {
-		struct vnode *v = vnodearray_get(sfs->sfs_vnodes, i);
-		VOP_FSYNC(v);
+		lock_acquire(svs[i]->sv_lock);
+		sfs_bdiscard(svs[i]);
+		sfs_sync_inode(svs[i]);
+		lock_release(svs[i]->sv_lock);
+		VOP_DECREF(&svs[i]->sv_absvn);
 	}
+
+	kfree(svs);
 	return 0;
 }
 
 /*
- * Sync routine for the freemap.
+ * Sync routine for the freemap. (This only goes as far as the
+ * buffer cache.)
  */
-static
 int
 sfs_sync_freemap(struct sfs_fs *sfs)
 {
 	int result;
 
-	if (sfs->sfs_freemapdirty) {
-		result = sfs_freemapio(sfs, UIO_WRITE);
-		if (result) {
-			return result;
-		}
-		sfs->sfs_freemapdirty = false;
-	}
+	lock_acquire(sfs->sfs_freemaplock);
+	result = sfs_freemapio(sfs, UIO_WRITE);
+	lock_release(sfs->sfs_freemaplock);
 
-	return 0;
+	return result;
+}
+
+/*
+ * Sync the freemap and write its blocks on through to disk, without
+ * flushing the rest of the buffer cache. For fsync.
+ */
+int
+sfs_writeback_freemap(struct sfs_fs *sfs)
+{
+	uint32_t j;
+	int result;
+
+	result = sfs_sync_freemap(sfs);
+	for (j=0; result == 0 && j<SFS_FS_FREEMAPBLOCKS(sfs); j++) {
+		result = buf_syncblock(sfs->sfs_device, SFS_FREEMAP_START+j);
+	}
+	return result;
 }
 
 /*
@@ -152,14 +217,17 @@ sfs_sync_superblock(struct sfs_fs *sfs)
 {
 	int result;
 
+	lock_acquire(sfs->sfs_freemaplock);
 	if (sfs->sfs_superdirty) {
 		result = sfs_writeblock(sfs, SFS_SUPER_BLOCK, &sfs->sfs_sb,
 					sizeof(sfs->sfs_sb));
 		if (result) {
+			lock_release(sfs->sfs_freemaplock);
 			return result;
 		}
 		sfs->sfs_superdirty = false;
 	}
+	lock_release(sfs->sfs_freemaplock);
 	return 0;
 }
 
@@ -174,8 +242,6 @@ sfs_sync(struct fs *fs)
 	struct sfs_fs *sfs;
 	int result;
 
-	vfs_biglock_acquire();
-
 	/*
 	 * Get the sfs_fs from the generic abstract fs.
 	 *
@@ -211,25 +277,27 @@ sfs_sync(struct fs *fs)
 	/* If any vnodes need to be written, write them. */
 	result = sfs_sync_vnodes(sfs);
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
 	/* If the free block map needs to be written, write it. */
 	result = sfs_sync_freemap(sfs);
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
 	/* If the superblock needs to be written, write it. */
 	result = sfs_sync_superblock(sfs);
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
-	vfs_biglock_release();
+	/* All of the above only went as far as the buffer cache. */
+	result = buf_sync(sfs->sfs_device);
+	if (result) {
+		return result;
+	}
+
 	return 0;
 }
 
@@ -243,13 +311,9 @@ const char *
 sfs_getvolname(struct fs *fs)
 {
 	struct sfs_fs *sfs = fs->fs_data;
-	const char *ret;
-
-	vfs_biglock_acquire();
-	ret = sfs->sfs_sb.sb_volname;
-	vfs_biglock_release();
 
-	return ret;
+	/* The volume name never changes while mounted. */
+	return sfs->sfs_sb.sb_volname;
 }
 
 /*
@@ -262,7 +326,14 @@ sfs_fs_destroy(struct sfs_fs *sfs)
 	if (sfs->sfs_freemap != NULL) {
 		bitmap_destroy(sfs->sfs_freemap);
 	}
+	if (sfs->sfs_freemapdirty != NULL) {
+		kfree(sfs->sfs_freemapdirty);
+	}
+	sfs_vnhash_destroy(sfs);
 	vnodearray_destroy(sfs->sfs_vnodes);
+	lock_destroy(sfs->sfs_freemaplock);
+	cv_destroy(sfs->sfs_vncv);
+	lock_destroy(sfs->sfs_vnlock);
 	KASSERT(sfs->sfs_device == NULL);
 	kfree(sfs);
 }
@@ -277,18 +348,28 @@ int
 sfs_unmount(struct fs *fs)
 {
 	struct sfs_fs *sfs = fs->fs_data;
-
-	vfs_biglock_acquire();
+	unsigned i;
+	int result;
 
 	/* Do we have any files open? If so, can't unmount. */
+	lock_acquire(sfs->sfs_vnlock);
 	if (vnodearray_num(sfs->sfs_vnodes) > 0) {
-		vfs_biglock_release();
+		lock_release(sfs->sfs_vnlock);
 		return EBUSY;
 	}
+	lock_release(sfs->sfs_vnlock);
 
 	/* We should have just had sfs_sync called. */
 	KASSERT(sfs->sfs_superdirty == false);
-	KASSERT(sfs->sfs_freemapdirty == false);
+	for (i=0; i<SFS_FS_FREEMAPBLOCKS(sfs); i++) {
+		KASSERT(sfs->sfs_freemapdirty[i] == false);
+	}
+
+	/* Drop our blocks from the buffer cache. */
+	result = buf_detach(sfs->sfs_device);
+	if (result) {
+		return result;
+	}
 
 	/* The vfs layer takes care of the device for us */
 	sfs->sfs_device = NULL;
@@ -297,7 +378,6 @@ sfs_unmount(struct fs *fs)
 	sfs_fs_destroy(sfs);
 
 	/* nothing else to do */
-	vfs_biglock_release();
 	return 0;
 }
 
@@ -311,6 +391,36 @@ static const struct fs_ops sfs_fsops = {
 	.fsop_unmount = sfs_unmount,
 };
 
+/*
+ * Count the vnodes FS has loaded, both in sfs_vnodes and by walking
+ * the inode hash, for tests that check the two agree. Returns EINVAL
+ * if FS isn't an SFS volume.
+ */
+int
+sfs_countvnodes(struct fs *fs, unsigned *nloaded, unsigned *nhashed)
+{
+	struct sfs_fs *sfs;
+	struct sfs_vnode *sv;
+	unsigned i;
+
+	if (fs->fs_ops != &sfs_fsops) {
+		return EINVAL;
+	}
+	sfs = fs->fs_data;
+
+	lock_acquire(sfs->sfs_vnlock);
+	*nloaded = vnodearray_num(sfs->sfs_vnodes);
+	*nhashed = 0;
+	for (i=0; i<sfs->sfs_vnhashsize; i++) {
+		for (sv = sfs->sfs_vnhash[i]; sv != NULL;
+		     sv = sv->sv_hashnext) {
+			(*nhashed)++;
+		}
+	}
+	lock_release(sfs->sfs_vnlock);
+	return 0;
+}
+
 /*
  * Basic constructor for struct sfs_fs. This initializes all fields
  * but skips stuff that requires reading the volume, like allocating
@@ -351,17 +461,40 @@ sfs_fs_create(void)
 	sfs->sfs_device = NULL;
 
 	/* vnode table */
+	sfs->sfs_vnlock = lock_create("sfs_vnlock");
+	if (sfs->sfs_vnlock == NULL) {
+		goto cleanup_object;
+	}
+	sfs->sfs_vncv = cv_create("sfs_vncv");
+	if (sfs->sfs_vncv == NULL) {
+		goto cleanup_vnlock;
+	}
 	sfs->sfs_vnodes = vnodearray_create();
 	if (sfs->sfs_vnodes == NULL) {
-		goto cleanup_object;
+		goto cleanup_vncv;
+	}
+	if (sfs_vnhash_create(sfs)) {
+		goto cleanup_vnodes;
 	}
 
 	/* freemap */
+	sfs->sfs_freemaplock = lock_create("sfs_freemaplock");
+	if (sfs->sfs_freemaplock == NULL) {
+		goto cleanup_vnhash;
+	}
 	sfs->sfs_freemap = NULL;
-	sfs->sfs_freemapdirty = false;
+	sfs->sfs_freemapdirty = NULL;
 
 	return sfs;
 
+cleanup_vnhash:
+	sfs_vnhash_destroy(sfs);
+cleanup_vnodes:
+	vnodearray_destroy(sfs->sfs_vnodes);
+cleanup_vncv:
+	cv_destroy(sfs->sfs_vncv);
+cleanup_vnlock:
+	lock_destroy(sfs->sfs_vnlock);
 cleanup_object:
 	kfree(sfs);
 fail:
@@ -387,8 +520,7 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 {
 	int result;
 	struct sfs_fs *sfs;
-
-	vfs_biglock_acquire();
+	unsigned i, nfreemapblocks;
 
 	/* We don't pass any options through mount */
 	(void)options;
@@ -402,7 +534,6 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	 * don't do that in sfs.)
 	 */
 	if (dev->d_blocksize != SFS_BLOCKSIZE) {
-		vfs_biglock_release();
 		kprintf("sfs: Cannot mount on device with blocksize %zu\n",
 			dev->d_blocksize);
 		return ENXIO;
@@ -410,20 +541,29 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 
 	sfs = sfs_fs_create();
 	if (sfs == NULL) {
-		vfs_biglock_release();
 		return ENOMEM;
 	}
 
 	/* Set the device so we can use sfs_readblock() */
 	sfs->sfs_device = dev;
 
+	/*
+	 * Throw away anything cached for the device, in case it was
+	 * written through the raw device since it was last mounted.
+	 */
+	result = buf_detach(dev);
+	if (result) {
+		sfs->sfs_device = NULL;
+		sfs_fs_destroy(sfs);
+		return result;
+	}
+
 	/* Load superblock */
 	result = sfs_readblock(sfs, SFS_SUPER_BLOCK, &sfs->sfs_sb,
 			       sizeof(sfs->sfs_sb));
 	if (result) {
 		sfs->sfs_device = NULL;
 		sfs_fs_destroy(sfs);
-		vfs_biglock_release();
 		return result;
 	}
 
@@ -436,7 +576,6 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 			SFS_MAGIC);
 		sfs->sfs_device = NULL;
 		sfs_fs_destroy(sfs);
-		vfs_biglock_release();
 		return EINVAL;
 	}
 
@@ -453,21 +592,28 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	if (sfs->sfs_freemap == NULL) {
 		sfs->sfs_device = NULL;
 		sfs_fs_destroy(sfs);
-		vfs_biglock_release();
 		return ENOMEM;
 	}
+	nfreemapblocks = SFS_FS_FREEMAPBLOCKS(sfs);
+	sfs->sfs_freemapdirty = kmalloc(nfreemapblocks * sizeof(bool));
+	if (sfs->sfs_freemapdirty == NULL) {
+		sfs->sfs_device = NULL;
+		sfs_fs_destroy(sfs);
+		return ENOMEM;
+	}
+	for (i=0; i<nfreemapblocks; i++) {
+		sfs->sfs_freemapdirty[i] = false;
+	}
 	result = sfs_freemapio(sfs, UIO_READ);
 	if (result) {
 		sfs->sfs_device = NULL;
 		sfs_fs_destroy(sfs);
-		vfs_biglock_release();
 		return result;
 	}
 
 	/* Hand back the abstract fs */
 	*ret = &sfs->sfs_absfs;
 
-	vfs_biglock_release();
 	return 0;
 }
 
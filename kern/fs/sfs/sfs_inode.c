@@ -35,10 +35,173 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <synch.h>
 #include <vfs.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
+/* Initial number of inode hash chains. */
+#define SFS_VNHASH_INIT		64
+
+////////////////////////////////////////////////////////////
+// Inode hash
+
+/*
+ * The loaded vnodes are kept both in sfs_vnodes, for walking all of
+ * them (sync, unmount), and in a hash table keyed by inode number,
+ * for finding one. The table doubles whenever the average chain
+ * gets longer than 2, so lookups stay O(1) however many vnodes are
+ * loaded. Each vnode remembers its slot in sfs_vnodes so it can be
+ * removed from there in O(1) too.
+ *
+ * All of this is under sfs_vnlock.
+ */
+
+int
+sfs_vnhash_create(struct sfs_fs *sfs)
+{
+	struct sfs_vnode **hash;
+	unsigned i;
+
+	hash = kmalloc(SFS_VNHASH_INIT * sizeof(hash[0]));
+	if (hash == NULL) {
+		return ENOMEM;
+	}
+	for (i=0; i<SFS_VNHASH_INIT; i++) {
+		hash[i] = NULL;
+	}
+	sfs->sfs_vnhash = hash;
+	sfs->sfs_vnhashsize = SFS_VNHASH_INIT;
+	return 0;
+}
+
+void
+sfs_vnhash_destroy(struct sfs_fs *sfs)
+{
+	kfree(sfs->sfs_vnhash);
+	sfs->sfs_vnhash = NULL;
+}
+
+static
+unsigned
+sfs_vnhash_chain(uint32_t ino, unsigned size)
+{
+	/* inode numbers are block numbers; the low bits spread fine */
+	return ino & (size - 1);
+}
+
+/*
+ * Double the number of chains. If there's no memory, carry on with
+ * longer chains.
+ */
+static
+void
+sfs_vnhash_grow(struct sfs_fs *sfs)
+{
+	struct sfs_vnode **newhash, *sv;
+	unsigned newsize, i, j;
+
+	newsize = sfs->sfs_vnhashsize * 2;
+	newhash = kmalloc(newsize * sizeof(newhash[0]));
+	if (newhash == NULL) {
+		return;
+	}
+	for (i=0; i<newsize; i++) {
+		newhash[i] = NULL;
+	}
+	for (i=0; i<sfs->sfs_vnhashsize; i++) {
+		while ((sv = sfs->sfs_vnhash[i]) != NULL) {
+			sfs->sfs_vnhash[i] = sv->sv_hashnext;
+			j = sfs_vnhash_chain(sv->sv_ino, newsize);
+			sv->sv_hashnext = newhash[j];
+			newhash[j] = sv;
+		}
+	}
+	kfree(sfs->sfs_vnhash);
+	sfs->sfs_vnhash = newhash;
+	sfs->sfs_vnhashsize = newsize;
+}
+
+static
+struct sfs_vnode *
+sfs_vnhash_find(struct sfs_fs *sfs, uint32_t ino)
+{
+	struct sfs_vnode *sv;
+
+	KASSERT(lock_do_i_hold(sfs->sfs_vnlock));
+
+	sv = sfs->sfs_vnhash[sfs_vnhash_chain(ino, sfs->sfs_vnhashsize)];
+	while (sv != NULL && sv->sv_ino != ino) {
+		sv = sv->sv_hashnext;
+	}
+	return sv;
+}
+
+/*
+ * Add a vnode to sfs_vnodes and the hash table.
+ */
+static
+int
+sfs_vnhash_add(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	unsigned ix;
+	int result;
+
+	KASSERT(lock_do_i_hold(sfs->sfs_vnlock));
+
+	result = vnodearray_add(sfs->sfs_vnodes, &sv->sv_absvn, &ix);
+	if (result) {
+		return result;
+	}
+	sv->sv_index = ix;
+
+	if (vnodearray_num(sfs->sfs_vnodes) > 2 * sfs->sfs_vnhashsize) {
+		sfs_vnhash_grow(sfs);
+	}
+	ix = sfs_vnhash_chain(sv->sv_ino, sfs->sfs_vnhashsize);
+	sv->sv_hashnext = sfs->sfs_vnhash[ix];
+	sfs->sfs_vnhash[ix] = sv;
+	return 0;
+}
+
+/*
+ * Remove a vnode from sfs_vnodes and the hash table.
+ */
+static
+void
+sfs_vnhash_remove(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	struct sfs_vnode **svp;
+	struct vnode *last;
+	unsigned num;
+
+	KASSERT(lock_do_i_hold(sfs->sfs_vnlock));
+
+	svp = &sfs->sfs_vnhash[sfs_vnhash_chain(sv->sv_ino,
+						 sfs->sfs_vnhashsize)];
+	while (*svp != sv) {
+		if (*svp == NULL) {
+			panic("sfs: %s: reclaim vnode %u not in vnode pool\n",
+			      sfs->sfs_sb.sb_volname, sv->sv_ino);
+		}
+		svp = &(*svp)->sv_hashnext;
+	}
+	*svp = sv->sv_hashnext;
+	sv->sv_hashnext = NULL;
+
+	/* Move the last vnode into our slot. */
+	num = vnodearray_num(sfs->sfs_vnodes);
+	KASSERT(sv->sv_index < num);
+	KASSERT(vnodearray_get(sfs->sfs_vnodes, sv->sv_index) ==
+		&sv->sv_absvn);
+	last = vnodearray_get(sfs->sfs_vnodes, num - 1);
+	vnodearray_set(sfs->sfs_vnodes, sv->sv_index, last);
+	((struct sfs_vnode *)last->vn_data)->sv_index = sv->sv_index;
+	vnodearray_remove(sfs->sfs_vnodes, num - 1);
+}
+
+////////////////////////////////////////////////////////////
+// Inodes
 
 /*
  * Write an on-disk inode structure back out to disk.
@@ -49,6 +212,8 @@ sfs_sync_inode(struct sfs_vnode *sv)
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
 	int result;
 
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
 	if (sv->sv_dirty) {
 		result = sfs_writeblock(sfs, sv->sv_ino, &sv->sv_i,
 					sizeof(sv->sv_i));
@@ -70,15 +235,14 @@ sfs_reclaim(struct vnode *v)
 {
 	struct sfs_vnode *sv = v->vn_data;
 	struct sfs_fs *sfs = v->vn_fs->fs_data;
-	unsigned ix, i, num;
 	int result;
 
-	vfs_biglock_acquire();
+	lock_acquire(sfs->sfs_vnlock);
 
 	/*
 	 * Make sure someone else hasn't picked up the vnode since the
-	 * decision was made to reclaim it. (You must also synchronize
-	 * this with sfs_loadvnode.)
+	 * decision was made to reclaim it. (sfs_loadvnode hands out
+	 * references under sfs_vnlock, so holding it is enough.)
 	 */
 	spinlock_acquire(&v->vn_countlock);
 	if (v->vn_refcount != 1) {
@@ -88,104 +252,123 @@ sfs_reclaim(struct vnode *v)
 		v->vn_refcount--;
 
 		spinlock_release(&v->vn_countlock);
-		vfs_biglock_release();
+		lock_release(sfs->sfs_vnlock);
 		return EBUSY;
 	}
 	spinlock_release(&v->vn_countlock);
 
+	/*
+	 * Mark it busy, so anyone looking the inode up waits for us
+	 * instead of reading the old copy off disk, and do the work
+	 * without holding up the rest of the vnode table.
+	 */
+	sv->sv_busy = true;
+	lock_release(sfs->sfs_vnlock);
+
+	lock_acquire(sv->sv_lock);
+
+	/* Give back any blocks set aside for writing. */
+	sfs_bdiscard(sv);
+
 	/* If there are no on-disk references to the file either, erase it. */
 	if (sv->sv_i.sfi_linkcount == 0) {
 		result = sfs_itrunc(sv, 0);
 		if (result) {
-			vfs_biglock_release();
-			return result;
+			goto fail;
 		}
 	}
 
 	/* Sync the inode to disk */
 	result = sfs_sync_inode(sv);
 	if (result) {
-		vfs_biglock_release();
-		return result;
+		goto fail;
 	}
 
+	lock_release(sv->sv_lock);
+
 	/* If there are no on-disk references, discard the inode */
 	if (sv->sv_i.sfi_linkcount==0) {
 		sfs_bfree(sfs, sv->sv_ino);
 	}
 
-	/* Remove the vnode structure from the table in the struct sfs_fs. */
-	num = vnodearray_num(sfs->sfs_vnodes);
-	ix = num;
-	for (i=0; i<num; i++) {
-		struct vnode *v2 = vnodearray_get(sfs->sfs_vnodes, i);
-		struct sfs_vnode *sv2 = v2->vn_data;
-		if (sv2 == sv) {
-			ix = i;
-			break;
-		}
-	}
-	if (ix == num) {
-		panic("sfs: %s: reclaim vnode %u not in vnode pool\n",
-		      sfs->sfs_sb.sb_volname, sv->sv_ino);
-	}
-	vnodearray_remove(sfs->sfs_vnodes, ix);
+	/* Remove the vnode structure from the tables in the struct sfs_fs. */
+	lock_acquire(sfs->sfs_vnlock);
+	sfs_vnhash_remove(sfs, sv);
+	cv_broadcast(sfs->sfs_vncv, sfs->sfs_vnlock);
+	lock_release(sfs->sfs_vnlock);
 
 	vnode_cleanup(&sv->sv_absvn);
 
-	vfs_biglock_release();
+	/* Drop the directory index, if any. */
+	sfs_dirhash_destroy(sv);
 
 	/* Release the storage for the vnode structure itself. */
+	lock_destroy(sv->sv_lock);
 	kfree(sv);
 
 	/* Done */
 	return 0;
+
+ fail:
+	lock_release(sv->sv_lock);
+	lock_acquire(sfs->sfs_vnlock);
+	sv->sv_busy = false;
+	cv_broadcast(sfs->sfs_vncv, sfs->sfs_vnlock);
+	lock_release(sfs->sfs_vnlock);
+	return result;
 }
 
 /*
  * Function to load a inode into memory as a vnode, or dig up one
  * that's already resident.
+ *
+ * A vnode being loaded is put in the table marked busy before its
+ * inode is read, so that the read doesn't hold sfs_vnlock and
+ * anyone else after the same inode waits for it.
  */
 int
 sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 		 struct sfs_vnode **ret)
 {
-	struct vnode *v;
 	struct sfs_vnode *sv;
 	const struct vnode_ops *ops;
-	unsigned i, num;
 	int result;
 
-	/* Look in the vnodes table */
-	num = vnodearray_num(sfs->sfs_vnodes);
-
-	/* Linear search. Is this too slow? You decide. */
-	for (i=0; i<num; i++) {
-		v = vnodearray_get(sfs->sfs_vnodes, i);
-		sv = v->vn_data;
+	lock_acquire(sfs->sfs_vnlock);
 
+	/* Look in the vnodes table */
+	while ((sv = sfs_vnhash_find(sfs, ino)) != NULL && sv->sv_busy) {
+		/* Being loaded or reclaimed; wait and look again */
+		cv_wait(sfs->sfs_vncv, sfs->sfs_vnlock);
+	}
+	if (sv != NULL) {
 		/* Every inode in memory must be in an allocated block */
 		if (!sfs_bused(sfs, sv->sv_ino)) {
 			panic("sfs: %s: Found inode %u in unallocated block\n",
 			      sfs->sfs_sb.sb_volname, sv->sv_ino);
 		}
 
-		if (sv->sv_ino==ino) {
-			/* Found */
-
-			/* forcetype is only allowed when creating objects */
-			KASSERT(forcetype==SFS_TYPE_INVAL);
+		/* forcetype is only allowed when creating objects */
+		KASSERT(forcetype==SFS_TYPE_INVAL);
 
-			VOP_INCREF(&sv->sv_absvn);
-			*ret = sv;
-			return 0;
-		}
+		VOP_INCREF(&sv->sv_absvn);
+		lock_release(sfs->sfs_vnlock);
+		*ret = sv;
+		return 0;
 	}
 
 	/* Didn't have it loaded; load it */
 
 	sv = kmalloc(sizeof(struct sfs_vnode));
 	if (sv==NULL) {
+		lock_release(sfs->sfs_vnlock);
+		return ENOMEM;
+	}
+
+	sv->sv_lock = lock_create("sfs_vnode");
+	if (sv->sv_lock == NULL) {
+		kfree(sv);
+		lock_release(sfs->sfs_vnlock);
 		return ENOMEM;
 	}
 
@@ -195,12 +378,23 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 		      "unallocated block\n", sfs->sfs_sb.sb_volname, ino);
 	}
 
-	/* Read the block the inode is in */
-	result = sfs_readblock(sfs, ino, &sv->sv_i, sizeof(sv->sv_i));
+	/* Claim the inode number */
+	sv->sv_ino = ino;
+	sv->sv_busy = true;
+	result = sfs_vnhash_add(sfs, sv);
 	if (result) {
+		lock_release(sfs->sfs_vnlock);
+		lock_destroy(sv->sv_lock);
 		kfree(sv);
 		return result;
 	}
+	lock_release(sfs->sfs_vnlock);
+
+	/* Read the block the inode is in */
+	result = sfs_readblock(sfs, ino, &sv->sv_i, sizeof(sv->sv_i));
+	if (result) {
+		goto fail;
+	}
 
 	/* Not dirty yet */
 	sv->sv_dirty = false;
@@ -235,31 +429,44 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	/* Call the common vnode initializer */
 	result = vnode_init(&sv->sv_absvn, ops, &sfs->sfs_absfs, sv);
 	if (result) {
-		kfree(sv);
-		return result;
+		goto fail;
 	}
 
 	/* Set the other fields in our vnode structure */
-	sv->sv_ino = ino;
-
-	/* Add it to our table */
-	result = vnodearray_add(sfs->sfs_vnodes, &sv->sv_absvn, NULL);
-	if (result) {
-		vnode_cleanup(&sv->sv_absvn);
-		kfree(sv);
-		return result;
-	}
+	sv->sv_ranext = 0;
+	sv->sv_raend = 0;
+	sv->sv_rawindow = 0;
+	sv->sv_panext = 0;
+	sv->sv_pacount = 0;
+	sv->sv_dirhash = NULL;
+
+	/* Open for business */
+	lock_acquire(sfs->sfs_vnlock);
+	sv->sv_busy = false;
+	cv_broadcast(sfs->sfs_vncv, sfs->sfs_vnlock);
+	lock_release(sfs->sfs_vnlock);
 
 	/* Hand it back */
 	*ret = sv;
 	return 0;
+
+ fail:
+	lock_acquire(sfs->sfs_vnlock);
+	sfs_vnhash_remove(sfs, sv);
+	cv_broadcast(sfs->sfs_vncv, sfs->sfs_vnlock);
+	lock_release(sfs->sfs_vnlock);
+	lock_destroy(sv->sv_lock);
+	kfree(sv);
+	return result;
 }
 
 /*
- * Create a new filesystem object and hand back its vnode.
+ * Create a new filesystem object and hand back its vnode. The inode
+ * is placed as near after NEAR (the directory's inode) as possible.
  */
 int
-sfs_makeobj(struct sfs_fs *sfs, int type, struct sfs_vnode **ret)
+sfs_makeobj(struct sfs_fs *sfs, daddr_t near, int type,
+	    struct sfs_vnode **ret)
 {
 	uint32_t ino;
 	int result;
@@ -269,7 +476,7 @@ sfs_makeobj(struct sfs_fs *sfs, int type, struct sfs_vnode **ret)
 	 * number is the block number, so just get a block.)
 	 */
 
-	result = sfs_balloc(sfs, &ino);
+	result = sfs_balloc(sfs, near + 1, true, &ino);
 	if (result) {
 		return result;
 	}
@@ -296,25 +503,20 @@ sfs_getroot(struct fs *fs, struct vnode **ret)
 	struct sfs_vnode *sv;
 	int result;
 
-	vfs_biglock_acquire();
-
 	result = sfs_loadvnode(sfs, SFS_ROOTDIR_INO, SFS_TYPE_INVAL, &sv);
 	if (result) {
 		kprintf("sfs: %s: getroot: Cannot load root vnode\n",
 			sfs->sfs_sb.sb_volname);
-		vfs_biglock_release();
 		return result;
 	}
 
 	if (sv->sv_i.sfi_type != SFS_TYPE_DIR) {
 		kprintf("sfs: %s: getroot: not directory (type %u)\n",
 			sfs->sfs_sb.sb_volname, sv->sv_i.sfi_type);
-		vfs_biglock_release();
+		VOP_DECREF(&sv->sv_absvn);
 		return EINVAL;
 	}
 
-	vfs_biglock_release();
-
 	*ret = &sv->sv_absvn;
 	return 0;
 }
@@ -38,9 +38,20 @@
 
 
 #include <vm.h>
+#include <spinlock.h>
 #include "opt-dumbvm.h"
 
 struct vnode;
+struct lock;
+struct rwlock;
+
+/*
+ * User stacks for the threads of a multithreaded process. Slot 0 is
+ * the main stack from as_define_stack; slot N (threadfork) sits N
+ * stack sizes plus a guard page each further down.
+ */
+#define THREADSTACK_MAX         32
+#define THREADSTACK_STRIDE      (USER_STACK_SIZE + PAGE_SIZE)
 
 /*
  * Address space - data structure associated with the virtual memory
@@ -62,6 +73,29 @@ struct addrspace {
         /* Put stuff here for your VM system */
         paddr_t ***pagetable;
         struct region *as_regions;
+        /*
+         * Faults only read the region list, so a reader-writer lock
+         * lets concurrent faults on a shared address space proceed
+         * together. Defining regions and changing their permissions
+         * take it for writing.
+         */
+        struct rwlock *as_regionlock;
+        /*
+         * Serializes filling in the page table, so two threads of
+         * one process faulting on the same page at once don't both
+         * allocate it.
+         */
+        struct lock *as_ptlock;
+        /* Thread stack slots in use, and ones with a region defined. */
+        uint32_t as_stackslots;
+        uint32_t as_stacksdefined;
+        /*
+         * CPUs whose TLB may hold entries for this address space
+         * (their c_tlbas points here), one bit per cpu number. These
+         * are the ones vm_shootdown has to reach.
+         */
+        struct spinlock as_tlblock;
+        uint32_t as_cpus;
 #endif
 };
 
@@ -113,6 +147,13 @@ struct region {
  *                (Normally called after as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
  *
+ *    as_define_threadstack - find a free user stack for a new thread,
+ *                setting up its region if it's never been used.
+ *                Hands back the slot number and initial stack pointer.
+ *
+ *    as_release_threadstack - give back a thread stack slot when its
+ *                thread exits. The memory stays, for the next thread.
+ *
  * Note that when using dumbvm, addrspace.c is not used and these
  * functions are found in dumbvm.c.
  */
@@ -131,6 +172,11 @@ int               as_define_region(struct addrspace *as,
 int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
+int               as_define_threadstack(struct addrspace *as,
+                                        unsigned *slot,
+                                        vaddr_t *initstackptr);
+void              as_release_threadstack(struct addrspace *as,
+                                         unsigned slot);
 
 
 /*
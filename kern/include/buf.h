@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2016
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _BUF_H_
+#define _BUF_H_
+
+/*
+ * Block buffer cache.
+ *
+ * Caches disk blocks in memory, keyed by (device, block number).
+ * All filesystem block I/O goes through here, so that metadata such
+ * as inodes, indirect blocks and directory blocks, and file data
+ * that is used repeatedly, only has to be read from disk once.
+ *
+ * Writes are write-back: buf_markdirty just marks the buffer, and it
+ * goes to disk later from a background flusher thread, when it is
+ * evicted, or when buf_sync is called.
+ *
+ * To use a block, get it with buf_read (or buf_get, if the whole
+ * block is about to be overwritten), use buf_map to get at the data,
+ * call buf_markdirty if it was changed, and then buf_release it.
+ * Between getting and releasing the buffer is held exclusively by
+ * the calling thread (other threads that want the same block wait)
+ * and it will not be evicted. Don't hold more than a few buffers at
+ * once, and never ask for a block you already hold.
+ *
+ * Buffers are BUF_SIZE bytes; only devices with that block size can
+ * be cached.
+ */
+
+#define BUF_SIZE	512
+
+struct buf;		/* Opaque. */
+struct device;
+
+/* Get a block, reading it from disk if it isn't cached. */
+int buf_read(struct device *dev, daddr_t block, struct buf **ret);
+
+/*
+ * Start reading a block into the cache in the background, if it
+ * isn't there already. Doesn't wait; if the read-ahead queue is
+ * full the request is just dropped.
+ */
+void buf_prefetch(struct device *dev, daddr_t block);
+
+/*
+ * Get a block without reading it. Unless it happened to be cached
+ * already the contents are garbage; the caller must fill in the
+ * whole block and call buf_markdirty.
+ */
+int buf_get(struct device *dev, daddr_t block, struct buf **ret);
+
+/* Get the data of a held buffer. */
+void *buf_map(struct buf *b);
+
+/* Mark a held buffer modified (and its contents valid). */
+void buf_markdirty(struct buf *b);
+
+/* Give back a buffer. */
+void buf_release(struct buf *b);
+
+/*
+ * Discard a block without writing it, e.g. because it was freed. The
+ * caller must not be holding it.
+ */
+void buf_invalidate(struct device *dev, daddr_t block);
+
+/* Write back all dirty buffers for DEV, or all devices if DEV is NULL. */
+int buf_sync(struct device *dev);
+
+/*
+ * Write back one block, if it's cached and dirty. The caller must not
+ * be holding it.
+ */
+int buf_syncblock(struct device *dev, daddr_t block);
+
+/*
+ * Write back and then discard everything cached for DEV. For use on
+ * mount and unmount; nobody may be using the device's blocks.
+ */
+int buf_detach(struct device *dev);
+
+/*
+ * Set the maximum number of buffers (rounded up to a whole page of
+ * buffers), shrinking the cache if needed. Returns the new maximum.
+ */
+unsigned buf_setmax(unsigned nbufs);
+
+/*
+ * Set (or get) the flusher's settings: buffers dirty for AGE seconds
+ * get written back, and so do the oldest ones whenever more than
+ * DIRTYPCT percent of the cache is dirty.
+ */
+void buf_setflush(unsigned age, unsigned dirtypct);
+void buf_getflush(unsigned *age, unsigned *dirtypct);
+
+/* Set up the buffer cache and start its threads. */
+void buf_bootstrap(void);
+
+/* Statistics. */
+void buf_printstats(void);
+void buf_resetstats(void);
+
+/* Blocks read ahead so far, and how many of those were then used. */
+void buf_getrastats(unsigned *nread, unsigned *nhit);
+
+#endif /* _BUF_H_ */
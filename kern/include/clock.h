@@ -50,14 +50,18 @@ void hardclock(void);
 
 /*
  * timerclock() is called on one CPU once a second to allow simple
- * timed operations. (This is a fairly simpleminded interface.)
+ * timed operations. (This is a fairly simpleminded interface; use
+ * the timers in <timer.h> instead.)
  */
 void timerclock(void);
 
 /*
  * gettime() may be used to fetch the current time of day.
+ * gettime_available() says whether there is a clock to ask yet; code
+ * that can run early in boot should check it first.
  */
 void gettime(struct timespec *ret);
+bool gettime_available(void);
 
 /*
  * arithmetic on times
@@ -73,11 +77,26 @@ void timespec_sub(const struct timespec *t1,
 		  const struct timespec *t2,
 		  struct timespec *ret);
 
+/*
+ * timespec_ticks() converts a time interval to the number of
+ * hardclocks to sleep for to wait at least that long.
+ */
+uint64_t timespec_ticks(const struct timespec *ts);
+
 /*
  * clocksleep() suspends execution for the requested number of seconds,
  * like userlevel sleep(3). (Don't confuse it with wchan_sleep.)
+ * clocksleep_ticks() does the same for a number of hardclocks.
  */
 void clocksleep(int seconds);
+void clocksleep_ticks(unsigned ticks);
+
+/*
+ * The idle loop calls these around waiting for an interrupt, so an
+ * idle cpu can skip hardclocks while it has no timers due.
+ */
+void clock_idle_enter(void);
+void clock_idle_exit(void);
 
 
 #endif /* _CLOCK_H_ */
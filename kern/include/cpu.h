@@ -32,9 +32,18 @@
 
 
 #include <spinlock.h>
+#include <timer.h>
 #include <threadlist.h>
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
 
+struct addrspace;
+
+
+/*
+ * Scheduler priority levels (see schedule() in thread.c). Each cpu
+ * has one run queue per level; level 0 is the highest priority.
+ */
+#define SCHED_NPRIO	4
 
 /*
  * Per-cpu structure
@@ -61,13 +70,34 @@ struct cpu {
 	struct threadlist c_zombies;	/* List of exited threads */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
 	unsigned c_spinlocks;		/* Counter of spinlocks held */
+	unsigned c_idleclocks;		/* hardclock() calls while idle */
+	unsigned c_steals;		/* Threads stolen from other cpus */
+	struct addrspace *c_tlbas;	/* Address space the TLB may hold */
+
+	/*
+	 * Timers. c_timers has its own lock, since other cpus cancel
+	 * timers on it; the tickless fields are this cpu's only.
+	 *
+	 * While c_tickless is set the cpu is idle with its clock
+	 * interrupt pushed out to its next timer; c_ticklessstart is
+	 * when that began, in nanoseconds, so the skipped hardclocks
+	 * can be made up afterwards.
+	 */
+	struct timerwheel c_timers;	/* Pending timers */
+	bool c_tickless;		/* Periodic tick stopped */
+	uint64_t c_ticklessstart;	/* Time it stopped */
 
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the runqueue lock.
+	 *
+	 * c_nready is the total number of threads on the run queues.
+	 * Other cpus also read it without the lock, as a hint of how
+	 * busy this cpu is when looking for work to steal.
 	 */
 	bool c_isidle;			/* True if this cpu is idle */
-	struct threadlist c_runqueue;	/* Run queue for this cpu */
+	struct threadlist c_runqueue[SCHED_NPRIO]; /* Run queues, by priority */
+	volatile unsigned c_nready;	/* Threads on the run queues */
 	struct spinlock c_runqueue_lock;
 
 	/*
@@ -85,7 +115,7 @@ struct cpu {
 	 */
 	uint32_t c_ipi_pending;		/* One bit for each IPI number */
 	struct tlbshootdown c_shootdown[TLBSHOOTDOWN_MAX];
-	unsigned c_numshootdown;
+	volatile unsigned c_numshootdown;
 	struct spinlock c_ipi_lock;
 
 	/*
@@ -155,6 +185,8 @@ void cpu_halt(void);
  * ipi_send sends an IPI to one CPU.
  * ipi_broadcast sends an IPI to all CPUs except the current one.
  * ipi_tlbshootdown is like ipi_send but carries TLB shootdown data.
+ * ipi_tlbshootdown_mask sends it to each cpu whose number's bit is
+ * set in CPUS.
  *
  * interprocessor_interrupt is called on the target CPU when an IPI is
  * received.
@@ -169,6 +201,8 @@ void cpu_halt(void);
 void ipi_send(struct cpu *target, int code);
 void ipi_broadcast(int code);
 void ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping);
+void ipi_tlbshootdown_mask(uint32_t cpus,
+			   const struct tlbshootdown *mapping);
 
 void interprocessor_interrupt(void);
 
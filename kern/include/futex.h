@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2016
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _FUTEX_H_
+#define _FUTEX_H_
+
+/*
+ * Wait and wake on a user address ("futex"), for user-level locks
+ * and semaphores that only need the kernel when there's contention.
+ *
+ * A futex is named by the address space and user address of an int;
+ * the kernel keeps nothing about it except the threads waiting on it.
+ */
+
+struct addrspace;
+
+/*
+ * Initialize the futex wait table.
+ */
+void futex_bootstrap(void);
+
+/*
+ * If the int at ADDR in address space AS still holds VAL, sleep
+ * until futex_wake is called on it or TICKS hardclocks pass (0
+ * means no timeout). Returns EAGAIN if the value was different,
+ * ETIMEDOUT if the time ran out, and EINTR if the process is exiting.
+ */
+int futex_wait(struct addrspace *as, userptr_t addr, int val,
+	       unsigned ticks);
+
+/*
+ * Wake up to NUM threads waiting on ADDR in AS, oldest first.
+ * Returns how many were woken.
+ */
+unsigned futex_wake(struct addrspace *as, userptr_t addr, unsigned num);
+
+/*
+ * Wake every thread waiting on a futex in AS. Used when a process is
+ * exiting; futex_wait refuses to sleep once p_exiting is set, so
+ * nobody can slip in behind this.
+ */
+void futex_wakeall(struct addrspace *as);
+
+#endif /* _FUTEX_H_ */
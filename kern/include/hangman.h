@@ -51,6 +51,8 @@ struct hangman_lockable {
 
 void hangman_wait(struct hangman_actor *a, struct hangman_lockable *l);
 void hangman_acquire(struct hangman_actor *a, struct hangman_lockable *l);
+void hangman_acquireshared(struct hangman_actor *a,
+			   struct hangman_lockable *l);
 void hangman_release(struct hangman_actor *a, struct hangman_lockable *l);
 
 #define HANGMAN_ACTOR(sym)	struct hangman_actor sym
@@ -63,6 +65,7 @@ void hangman_release(struct hangman_actor *a, struct hangman_lockable *l);
 
 #define HANGMAN_WAIT(a, l)	hangman_wait(a, l)
 #define HANGMAN_ACQUIRE(a, l)	hangman_acquire(a, l)
+#define HANGMAN_ACQUIRESHARED(a, l) hangman_acquireshared(a, l)
 #define HANGMAN_RELEASE(a, l)	hangman_release(a, l)
 
 #else
@@ -77,6 +80,7 @@ void hangman_release(struct hangman_actor *a, struct hangman_lockable *l);
 
 #define HANGMAN_WAIT(a, l)
 #define HANGMAN_ACQUIRE(a, l)
+#define HANGMAN_ACQUIRESHARED(a, l)
 #define HANGMAN_RELEASE(a, l)
 
 #endif
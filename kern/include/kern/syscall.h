@@ -197,6 +197,12 @@
 #define SYS_reboot       119
 //#define SYS___sysctl   120
 
+//                              -- OS/161 extensions --
+#define SYS_futex_wait   121
+#define SYS_futex_wake   122
+#define SYS___threadfork 123
+#define SYS_threadexit   124
+
 /*CALLEND*/
 
 
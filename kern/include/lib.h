@@ -125,9 +125,12 @@ uint32_t random(void);
  *
  * kheap_nextgeneration, dump, and dumpall do nothing unless heap
  * labeling (for leak detection) in kmalloc.c (q.v.) is enabled.
+ *
+ * kheap_bootstrap registers kmalloc's memory-pressure reclaim hook.
  */
 void *kmalloc(size_t size);
 void kfree(void *ptr);
+void kheap_bootstrap(void);
 void kheap_printstats(void);
 void kheap_nextgeneration(void);
 void kheap_dump(void);
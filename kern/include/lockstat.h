@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2016
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _LOCKSTAT_H_
+#define _LOCKSTAT_H_
+
+/*
+ * Lock contention profiler. Enable with "options lockstat" in the
+ * kernel config.
+ *
+ * Spinlocks, sleep locks, and semaphores each get a statistics
+ * record the first time they're used. The record counts
+ * acquisitions and contended acquisitions, total time spent waiting
+ * and holding the lock, and the call sites that most often had to
+ * wait. All hooks are called with the lock's own spinlock held, which
+ * is what protects the record.
+ *
+ * When the option is off all of this compiles away to nothing.
+ */
+
+#include "opt-lockstat.h"
+
+#define LOCKSTAT_SPINLOCK	0
+#define LOCKSTAT_LOCK		1
+#define LOCKSTAT_SEM		2
+
+#if OPT_LOCKSTAT
+
+struct lockstat;
+
+/*
+ * Per-acquisition state, on the acquirer's stack.
+ */
+struct lockstat_wait {
+	bool lw_contended;	/* had to wait */
+	uint64_t lw_start;	/* when waiting started (ns) */
+};
+
+void lockstat_contended(struct lockstat_wait *w);
+void lockstat_acquired(struct lockstat **sp, const void *lock,
+		       unsigned kind, const char *name, const void *site,
+		       const struct lockstat_wait *w);
+void lockstat_release(struct lockstat *s);
+void lockstat_cleanup(struct lockstat **sp);
+
+void lockstat_print(void);
+void lockstat_reset(void);
+
+#define LOCKSTAT_HOOK(sym)		struct lockstat *sym
+#define LOCKSTAT_INITIALIZER		NULL,
+#define LOCKSTAT_INIT(sp)		(*(sp) = NULL)
+
+#define LOCKSTAT_WAITVAR(w)		struct lockstat_wait w = { false, 0 }
+#define LOCKSTAT_CONTENDED(w)		lockstat_contended(&(w))
+#define LOCKSTAT_ACQUIRED(sp, lk, kind, name, w) \
+	lockstat_acquired(sp, lk, kind, name, \
+			  __builtin_return_address(0), &(w))
+#define LOCKSTAT_RELEASE(s)		lockstat_release(s)
+#define LOCKSTAT_CLEANUP(sp)		lockstat_cleanup(sp)
+
+#else
+
+#define LOCKSTAT_HOOK(sym)
+#define LOCKSTAT_INITIALIZER
+#define LOCKSTAT_INIT(sp)
+
+#define LOCKSTAT_WAITVAR(w)
+#define LOCKSTAT_CONTENDED(w)
+#define LOCKSTAT_ACQUIRED(sp, lk, kind, name, w)
+#define LOCKSTAT_RELEASE(s)
+#define LOCKSTAT_CLEANUP(sp)
+
+#endif
+
+#endif /* _LOCKSTAT_H_ */
@@ -52,6 +52,9 @@ void mainbus_interrupt(struct trapframe *);
 /* XXX this interface is not adequately MI */
 size_t mainbus_ramsize(void);
 
+/* Make the current cpu's next clock interrupt come NTICKS hardclocks out. */
+void mainbus_settimer(unsigned nticks);
+
 /* Switch on an inter-processor interrupt. (Low-level.) */
 void mainbus_send_ipi(struct cpu *target);
 
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2016
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _NAMECACHE_H_
+#define _NAMECACHE_H_
+
+/*
+ * Name lookup cache.
+ *
+ * Remembers the result of looking up one pathname component in a
+ * directory: (directory vnode, name) -> vnode, or -> "doesn't exist"
+ * (a negative entry). vfs_lookup and vfs_lookparent walk paths one
+ * component at a time through it, so only misses reach VOP_LOOKUP.
+ *
+ * Each entry holds a reference to its directory and to the vnode it
+ * names. The high-level VFS operations that change the namespace
+ * (vfs_open with O_CREAT, vfs_remove, vfs_rename, vfs_link,
+ * vfs_symlink, vfs_mkdir, vfs_rmdir) remove the entries they make
+ * stale, and unmount purges the filesystem's entries. Changes that
+ * bypass the VFS layer (e.g. to emufs files on the host side) aren't
+ * seen until the entry falls out of the cache.
+ *
+ * No lock is held across a lookup that misses, so a change to the
+ * directory can finish while the filesystem is being asked. To keep
+ * the stale answer out, each directory vnode has a generation number
+ * (vn_ncgen) that namecache_remove and namecache_purge bump; a miss
+ * hands back the generation it saw, and namecache_enter drops the
+ * entry if the generation has moved on since.
+ */
+
+struct vnode;
+struct fs;
+
+/*
+ * Look up NAME in DIR. Returns true if the cache knows the answer,
+ * in which case *RET is set to the vnode (with a reference added)
+ * or to NULL if NAME doesn't exist. Otherwise *GEN is set to DIR's
+ * generation, to pass to namecache_enter.
+ */
+bool namecache_lookup(struct vnode *dir, const char *name,
+		      struct vnode **ret, unsigned *gen);
+
+/*
+ * Remember that NAME in DIR is VN (NULL if it doesn't exist), as
+ * found by a lookup that started at generation GEN.
+ */
+void namecache_enter(struct vnode *dir, const char *name, struct vnode *vn,
+		     unsigned gen);
+
+/* Forget NAME in DIR. Call after the change to DIR is made. */
+void namecache_remove(struct vnode *dir, const char *name);
+
+/* Forget every entry that refers to VN, as directory or result. */
+void namecache_purge(struct vnode *vn);
+
+/* Forget every entry on FS (for unmount). */
+void namecache_purgefs(struct fs *fs);
+
+void namecache_bootstrap(void);
+void namecache_printstats(void);
+void namecache_resetstats(void);
+
+#endif /* _NAMECACHE_H_ */
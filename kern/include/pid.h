@@ -70,5 +70,10 @@ void pid_setexitstatus(int status);
  */
 int pid_wait(pid_t targetpid, int *status, int flags, pid_t *retpid);
 
+/*
+ * Get the parent of process PID (INVALID_PID if it has none).
+ */
+int pid_getppid(pid_t pid, pid_t *retppid);
+
 
 #endif /* _PID_H_ */
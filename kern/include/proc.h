@@ -45,11 +45,15 @@ struct vnode;
 /*
  * Process structure.
  *
- * Note that unless you implement multithreaded processes, p_threads
- * will only contain one thread for all processes other than kproc.
+ * A user process can have several threads (see threadfork), which
+ * share everything here.
  *
  * Note: you can't protect p_threads with a spinlock because it needs
  * to be able to call kmalloc.
+ *
+ * Once one thread calls proc_exit, p_exiting is set and the others
+ * leave too as they next head back to user mode; the last one out
+ * posts p_exitstatus and destroys the process.
  */
 struct proc {
 	char *p_name;			/* Name of this process */
@@ -57,6 +61,8 @@ struct proc {
 	struct threadarray p_threads;	/* Threads in this process */
 	struct spinlock p_lock;		/* Lock for rest of this structure */
 	pid_t p_pid;			/* Process ID */
+	volatile bool p_exiting;	/* All threads should exit */
+	int p_exitstatus;		/* Status to exit with, if so */
 
 	/* VM */
 	struct addrspace *p_addrspace;	/* virtual address space */
@@ -95,6 +101,16 @@ void proc_destroy(struct proc *proc);
  */
 void proc_exit(int status);
 
+/*
+ * Cause the current thread to leave its process, which goes on
+ * running until its last thread leaves. The last one exits the
+ * process, with status 0 unless proc_exit was called.
+ */
+__DEAD void proc_threadexit(void);
+
+/* Number of threads in a process. */
+unsigned proc_nthreads(struct proc *proc);
+
 /* Attach a thread to a process. Must not already have a process. */
 int proc_addthread(struct proc *proc, struct thread *t);
 
@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2016
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _RECLAIM_H_
+#define _RECLAIM_H_
+
+/*
+ * Memory-pressure reclaim hooks.
+ *
+ * Subsystems that hold memory they could give back (caches, pools of
+ * empty pages) register a reclaimer. When the page allocator runs
+ * out, or the free page count drops below the low watermark, the
+ * reclaimers are called in order of increasing cost until enough
+ * pages have been returned.
+ *
+ * rc_func is asked to free up to NPAGES pages and returns how many it
+ * actually freed. It is called without spinlocks held and may sleep,
+ * but it must not wait for a lock the allocating thread might already
+ * hold; if it cannot get what it needs right away, it should just
+ * free less. rc_cost is a relative estimate of how expensive the
+ * reclaim is (e.g. dropping clean cache contents is cheap, writing
+ * back dirty data is not); lower costs run first.
+ *
+ * The struct reclaimer is owned by the caller and must stay valid
+ * until reclaim_unregister returns.
+ */
+struct reclaimer {
+	const char *rc_name;
+	unsigned rc_cost;
+	unsigned (*rc_func)(unsigned npages);
+
+	/* private to reclaim.c */
+	unsigned rc_calls;			/* times called */
+	unsigned rc_pages;			/* total pages freed */
+	bool rc_busy;				/* currently running */
+	struct reclaimer *rc_next;
+};
+
+/* Typical cost values. */
+#define RECLAIM_COST_FREE	0	/* already-free memory held back */
+#define RECLAIM_COST_CLEAN	10	/* clean data that can be dropped */
+#define RECLAIM_COST_DIRTY	100	/* data that must be written first */
+
+void reclaim_register(struct reclaimer *rc);
+void reclaim_unregister(struct reclaimer *rc);
+
+/*
+ * Call the reclaimers until NPAGES pages have been freed or nothing
+ * more can be reclaimed. Returns the number of pages freed. May
+ * sleep; returns 0 without doing anything if called from a context
+ * that can't (interrupt handler, spinlock held, early boot).
+ */
+unsigned reclaim_pages(unsigned npages);
+
+/*
+ * Called by the page allocator after each allocation with the number
+ * of free pages left; wakes the background reclaim thread when this
+ * falls below the low watermark. Safe to call from any context.
+ */
+void reclaim_check(unsigned nfree);
+
+/*
+ * Start the background reclaim thread, and print statistics.
+ */
+void reclaim_bootstrap(void);
+void reclaim_printstats(void);
+
+#endif /* _RECLAIM_H_ */
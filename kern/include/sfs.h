@@ -48,14 +48,52 @@
  */
 #include <kern/sfs.h>
 
+/*
+ * Locking
+ *
+ * SFS doesn't use the VFS big lock. Instead:
+ *
+ *    sv_lock (one per vnode) covers the in-memory inode, the file's
+ *    contents and block map, and for directories the entries and
+ *    the directory index. It is held across disk I/O, but only
+ *    stalls users of the same file.
+ *
+ *    sfs_vnlock covers sfs_vnodes, the inode hash, and sv_busy. A
+ *    vnode is busy while it is being read in or reclaimed; anyone
+ *    finding it busy waits on sfs_vncv and looks again. sfs_vnlock
+ *    is never held across I/O.
+ *
+ *    sfs_freemaplock covers the freemap and the superblock.
+ *
+ *    Block buffers are locked individually by the buffer cache:
+ *    a buffer is private to whoever got it from buf_read or
+ *    buf_get until buf_release.
+ *
+ * Lock order: directory sv_lock, then the sv_lock of a file in it,
+ * then sfs_vnlock, then sfs_freemaplock, then buffers. The only
+ * place two buffers are held at once is sfs_bmap, which holds the
+ * indirect block while zeroing a newly allocated block that nobody
+ * else can be using.
+ */
+
 /*
  * In-memory inode
  */
 struct sfs_vnode {
 	struct vnode sv_absvn;          /* abstract vnode structure */
+	struct lock *sv_lock;		/* protects the fields below */
 	struct sfs_dinode sv_i;		/* copy of on-disk inode */
 	uint32_t sv_ino;                /* inode number */
 	bool sv_dirty;                  /* true if sv_i modified */
+	bool sv_busy;			/* loading/reclaiming (sfs_vnlock) */
+	struct sfs_vnode *sv_hashnext;	/* next in chain (sfs_vnlock) */
+	unsigned sv_index;		/* slot in sfs_vnodes (sfs_vnlock) */
+	uint32_t sv_ranext;		/* read-ahead: next block expected */
+	uint32_t sv_raend;		/* read-ahead: issued up to here */
+	unsigned sv_rawindow;		/* read-ahead: blocks to stay ahead */
+	daddr_t sv_panext;		/* first block set aside for us */
+	unsigned sv_pacount;		/* number of blocks set aside */
+	struct sfs_dirhash *sv_dirhash;	/* directory index, or NULL */
 };
 
 /*
@@ -66,9 +104,14 @@ struct sfs_fs {
 	struct sfs_superblock sfs_sb;	/* copy of on-disk superblock */
 	bool sfs_superdirty;            /* true if superblock modified */
 	struct device *sfs_device;      /* device mounted on */
+	struct lock *sfs_vnlock;	/* protects the vnode tables */
+	struct cv *sfs_vncv;		/* for waiting on busy vnodes */
 	struct vnodearray *sfs_vnodes;  /* vnodes loaded into memory */
+	struct sfs_vnode **sfs_vnhash;	/* same, hashed by inode number */
+	unsigned sfs_vnhashsize;	/* number of chains (power of 2) */
+	struct lock *sfs_freemaplock;	/* protects freemap and superblock */
 	struct bitmap *sfs_freemap;     /* blocks in use are marked 1 */
-	bool sfs_freemapdirty;          /* true if freemap modified */
+	bool *sfs_freemapdirty;		/* per freemap block: modified */
 };
 
 /*
@@ -76,5 +119,10 @@ struct sfs_fs {
  */
 int sfs_mount(const char *device);
 
+/*
+ * For tests: number of vnodes loaded, and number in the inode hash
+ */
+int sfs_countvnodes(struct fs *fs, unsigned *nloaded, unsigned *nhashed);
+
 
 #endif /* _SFS_H_ */
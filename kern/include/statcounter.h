@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2016
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _STATCOUNTER_H_
+#define _STATCOUNTER_H_
+
+/*
+ * Event counters for the statistics various subsystems print.
+ *
+ * A counter set is a table of named counters, each of which only
+ * goes up (until reset). Each cpu adds into its own row of the table,
+ * with interrupts off but no lock, so that counting on hot paths
+ * doesn't bounce a lock between cpus; readers add the rows up. A
+ * reader running while counts change gets a sum that's a little out
+ * of date, which is fine for statistics.
+ *
+ * Usage: define the counters as an enum and their names as a table,
+ * and declare the set with STATCOUNTERS_INITIALIZER, or with
+ * statcounters_init for one that's allocated. Then:
+ *
+ *    statcounter_add     - add to a counter
+ *    statcounters_sum    - get the totals, as an array of sc_num
+ *    statcounters_print  - print totals one per line as
+ *                              <prefix> <name> <value>
+ *                          so test scripts can pick them out
+ *    statcounters_reset  - zero all the counters
+ */
+
+/* Most cpus and counters per set; each row is then 64 bytes. */
+#define STATCOUNTER_MAXCPUS	32
+#define STATCOUNTER_MAX		16
+
+struct statcounters {
+	const char *const *sc_names;	/* names of the counters */
+	unsigned sc_num;		/* number of counters */
+	unsigned sc_counts[STATCOUNTER_MAXCPUS][STATCOUNTER_MAX];
+};
+
+#define STATCOUNTERS_INITIALIZER(names, num) { names, num, { { 0 } } }
+
+void statcounters_init(struct statcounters *sc,
+		       const char *const *names, unsigned num);
+void statcounter_add(struct statcounters *sc, unsigned which,
+		     unsigned amount);
+void statcounters_sum(const struct statcounters *sc, unsigned *counts);
+void statcounters_print(const struct statcounters *sc, const char *prefix,
+			const unsigned *counts);
+void statcounters_reset(struct statcounters *sc);
+
+#endif /* _STATCOUNTER_H_ */
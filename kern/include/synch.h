@@ -48,6 +48,7 @@ struct semaphore {
         struct wchan *sem_wchan;
         struct spinlock sem_lock;
         volatile unsigned sem_count;
+        LOCKSTAT_HOOK(sem_stat);        /* Contention profiler hook. */
 };
 
 struct semaphore *sem_create(const char *name, unsigned initial_count);
@@ -71,6 +72,15 @@ void V(struct semaphore *);
  *
  * The name field is for easier debugging. A copy of the name is
  * (should be) made internally.
+ *
+ * Locks are adaptive: a thread that finds the lock held by a thread
+ * that is running on another CPU spins for a while, since the holder
+ * is likely to release it soon, and only sleeps if the holder is not
+ * running (or spinning goes on too long).
+ *
+ * Each lock keeps contention statistics, protected by lk_lock.
+ * Contended acquisitions are those that found the lock held; spin
+ * and sleep times are summed over those, in nanoseconds.
  */
 struct lock {
         char *lk_name;
@@ -78,6 +88,17 @@ struct lock {
         struct wchan *lk_wchan;
         struct spinlock lk_lock;
         struct thread *volatile lk_holder;
+        LOCKSTAT_HOOK(lk_stat);         /* Contention profiler hook. */
+
+        /* statistics */
+        unsigned lk_nacquire;           /* acquisitions */
+        unsigned lk_ncontended;         /* ...that found it held */
+        unsigned lk_nsleep;             /* ...that had to sleep */
+        uint64_t lk_spinns;             /* total time spinning */
+        uint64_t lk_sleepns;            /* total time asleep */
+
+        /* list of all locks, for lock_printstats */
+        struct lock *lk_prev, *lk_next;
 };
 
 struct lock *lock_create(const char *name);
@@ -98,6 +119,64 @@ void lock_acquire(struct lock *);
 void lock_release(struct lock *);
 bool lock_do_i_hold(struct lock *);
 
+/*
+ * Print contention statistics for every lock that has been contended
+ * (or, if ALL is true, every lock that has been acquired), or reset
+ * them all.
+ */
+void lock_printstats(bool all);
+void lock_resetstats(void);
+
+
+/*
+ * Reader-writer lock.
+ *
+ * Any number of readers, or one writer, may hold the lock at once.
+ * Writers are preferred: once a writer is waiting, new readers wait
+ * too. When a writer releases the lock, though, the readers already
+ * waiting all get it before the next writer does, so neither side
+ * can starve the other.
+ *
+ * Readers can't be recorded in the deadlock detector, as there may be
+ * many of them, so only deadlocks involving a writer are caught.
+ *
+ * The name field is for easier debugging. A copy of the name is
+ * made internally.
+ */
+struct rwlock {
+        char *rwlock_name;
+        HANGMAN_LOCKABLE(rw_hangman);   /* Deadlock detector hook. */
+        struct spinlock rw_lock;        /* protects the rest */
+        struct wchan *rw_readwchan;     /* readers sleep here */
+        struct wchan *rw_writewchan;    /* writers sleep here */
+        unsigned rw_readers;            /* readers holding the lock */
+        unsigned rw_readwait;           /* readers waiting */
+        unsigned rw_writewait;          /* writers waiting */
+        unsigned rw_readgen;            /* bumped to let readers in */
+        struct thread *rw_writer;       /* writer holding the lock */
+};
+
+struct rwlock *rwlock_create(const char *name);
+void rwlock_destroy(struct rwlock *);
+
+/*
+ * Operations:
+ *    rwlock_acquire_read  - Get the lock for reading.
+ *    rwlock_release_read  - Release a read hold.
+ *    rwlock_acquire_write - Get the lock for writing; excludes
+ *                           everyone else.
+ *    rwlock_release_write - Release a write hold.
+ *    rwlock_do_i_hold_write - Return true if the current thread
+ *                           holds the lock for writing.
+ *
+ * Neither kind of hold is recursive.
+ */
+void rwlock_acquire_read(struct rwlock *);
+void rwlock_release_read(struct rwlock *);
+void rwlock_acquire_write(struct rwlock *);
+void rwlock_release_write(struct rwlock *);
+bool rwlock_do_i_hold_write(struct rwlock *);
+
 
 /*
  * Condition variable.
@@ -51,6 +51,10 @@ void enter_forked_process(struct trapframe *tf);
 __DEAD void enter_new_process(int argc, userptr_t argv, userptr_t env,
 		       vaddr_t stackptr, vaddr_t entrypoint);
 
+/* Enter user mode in a new thread. Does not return. */
+__DEAD void enter_new_thread(userptr_t arg, vaddr_t stackptr,
+			     vaddr_t entrypoint);
+
 /* Setup function for exec. */
 void exec_bootstrap(void);
 
@@ -64,12 +68,18 @@ void exec_bootstrap(void);
 
 int sys_reboot(int code);
 int sys___time(userptr_t user_seconds, userptr_t user_nanoseconds);
+int sys_nanosleep(const_userptr_t req, userptr_t rem);
 
 int sys_fork(struct trapframe *tf, pid_t *retval);
 int sys_execv(userptr_t prog, userptr_t args);
 __DEAD void sys__exit(int code);
 int sys_waitpid(pid_t pid, userptr_t returncode, int flags, pid_t *retval);
 int sys_getpid(pid_t *retval);
+int sys_getppid(pid_t *retval);
+int sys___threadfork(userptr_t entry, userptr_t arg);
+__DEAD void sys_threadexit(void);
+int sys_futex_wait(userptr_t addr, int val, const_userptr_t timeout);
+int sys_futex_wake(userptr_t addr, int num, int *retval);
 
 int sys_open(const_userptr_t filename, int flags, mode_t mode, int *retval);
 int sys_dup2(int oldfd, int newfd, int *retval);
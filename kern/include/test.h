@@ -89,6 +89,13 @@ int writestress(int, char **);
 int writestress2(int, char **);
 int longstress(int, char **);
 int createstress(int, char **);
+int readahead(int, char **);
+int bigdir(int, char **);
+int namecachetest(int, char **);
+int nsstress(int, char **);
+int interleave(int, char **);
+int freemapsync(int, char **);
+int vnhash(int, char **);
 int printfile(int, char **);
 
 /* other tests */
@@ -97,6 +104,11 @@ int kmallocstress(int, char **);
 int kmalloctest3(int, char **);
 int kmalloctest4(int, char **);
 int nettest(int, char **);
+int membench(int, char **);
+int vmbench(int, char **);
+int lookupbench(int, char **);
+int disktest(int, char **);
+int timertest(int, char **);
 
 /* Routine for running a user-level program. */
 int runprogram(char *progname);
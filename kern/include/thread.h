@@ -83,8 +83,23 @@ struct thread {
 	struct switchframe *t_context;	/* Saved register context (on stack) */
 	struct cpu *t_cpu;		/* CPU thread runs on */
 	struct proc *t_proc;		/* Process thread belongs to */
+	unsigned t_ustack;		/* User stack slot, 0 for main stack */
+	struct wchan *t_sleepchan;	/* Private wchan for clocksleep */
 	HANGMAN_ACTOR(t_hangman);	/* Deadlock detector hook */
 
+	/*
+	 * Scheduler fields. Protected by the runqueue lock of t_cpu.
+	 * Times are counted in hardclocks.
+	 */
+	unsigned t_prio;		/* Priority level, 0 is highest */
+	unsigned t_quantum;		/* Time left before demotion */
+	unsigned t_readystamp;		/* t_cpu->c_hardclocks when queued */
+	unsigned t_runticks;		/* Total time spent running */
+	unsigned t_waitticks;		/* Total time spent ready to run */
+	struct cpu *t_lastcpu;		/* CPU thread last ran on */
+	unsigned t_lastran;		/* t_lastcpu->c_hardclocks then */
+	unsigned t_migrations;		/* Times moved to another CPU */
+
 	/*
 	 * Interrupt state fields.
 	 *
@@ -158,11 +173,31 @@ __DEAD void thread_exit(void);
  */
 void thread_yield(void);
 
+/*
+ * Charge the current thread for a clock tick, and switch away from it
+ * if its quantum is used up or something more important is waiting.
+ * Called from the timer interrupt.
+ */
+void thread_timeslice(void);
+
 /*
  * Reshuffle the run queue. Called from the timer interrupt.
  */
 void schedule(void);
 
+/*
+ * Print the run queues and per-thread scheduler accounting.
+ */
+void thread_printsched(void);
+
+/*
+ * Migration cost threshold, in hardclocks. A thread that last ran
+ * more recently than this is assumed to still have a warm cache on
+ * its CPU and is not moved to another one unless nothing else can be.
+ * Settable from the kernel menu ("ts migcost").
+ */
+extern unsigned sched_migrate_cost;
+
 /*
  * Potentially migrate ready threads to other CPUs. Called from the
  * timer interrupt.
@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2016
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _TIMER_H_
+#define _TIMER_H_
+
+/*
+ * Timers: call a function some number of hardclock ticks from now.
+ *
+ * Each cpu has its own hierarchical timer wheel, advanced by
+ * hardclock(). Level 0 has one slot per tick for the next
+ * TW_SLOTS ticks; each level above covers TW_SLOTS times as much
+ * time with the same number of slots, and its timers are cascaded
+ * down a level as their time approaches. Starting and cancelling a
+ * timer are O(1); firing costs a cascade of each timer at most once
+ * per level.
+ *
+ * A timer goes on the wheel of the cpu that starts it and its
+ * function is called by that cpu's hardclock, in interrupt context,
+ * with no locks held. The function may restart the timer.
+ */
+
+#include <spinlock.h>
+
+#define TW_LEVELS	4
+#define TW_SLOTBITS	6
+#define TW_SLOTS	(1 << TW_SLOTBITS)
+
+struct cpu;
+
+struct timer {
+	struct timer *tm_next;		/* next on the same slot */
+	struct timer **tm_pprev;	/* link pointing at us */
+	uint64_t tm_expire;		/* tick on which to fire */
+	struct cpu *tm_cpu;		/* cpu whose wheel we're on, or NULL */
+	void (*tm_func)(void *);	/* function to call */
+	void *tm_data;			/* argument for it */
+};
+
+struct timerwheel {
+	struct spinlock tw_lock;	/* protects everything here */
+	uint64_t tw_now;		/* last tick processed */
+	unsigned tw_count;		/* timers on the wheel */
+	struct timer *tw_slots[TW_LEVELS][TW_SLOTS];
+};
+
+/*
+ * Timer functions.
+ *
+ * init		Set up a timer to call FUNC(DATA).
+ * start	Start it, to fire after TICKS ticks (at least 1). It
+ *		must not already be pending.
+ * cancel	Stop it. Returns true if it was pending and now won't
+ *		fire; false if it had already fired or was never
+ *		started (in which case the function may be running
+ *		right now on another cpu).
+ */
+void timer_init(struct timer *t, void (*func)(void *), void *data);
+void timer_start(struct timer *t, unsigned ticks);
+bool timer_cancel(struct timer *t);
+
+/*
+ * Wheel functions, used by the cpu and clock code.
+ *
+ * init		Set up a wheel.
+ * advance	Process NTICKS ticks on the current cpu's wheel,
+ *		firing whatever comes due.
+ * idleticks	Return how many ticks the current cpu can skip (at
+ *		most MAX) before its wheel needs attention.
+ */
+void timerwheel_init(struct timerwheel *tw);
+void timerwheel_advance(unsigned nticks);
+unsigned timerwheel_idleticks(unsigned max);
+
+#endif /* _TIMER_H_ */
@@ -36,7 +36,7 @@
  *
  * You'll probably want to add stuff here.
  */
-#define USER_STACK_SIZE 16 * PAGE_SIZE
+#define USER_STACK_SIZE (16 * PAGE_SIZE)
 
 struct addrspace *as;
 // Helper Function declarations.
@@ -62,14 +62,35 @@ int vm_fault(int faulttype, vaddr_t faultaddress);
 /* Allocate/free kernel heap pages (called by kmalloc/kfree) */
 vaddr_t alloc_kpages(unsigned npages);
 void free_kpages(vaddr_t addr);
+unsigned kpages_nfree(void);
+
+/* Copy or zero one whole page-aligned page (see memcpy.c, bzero.c) */
+void pagecopy(void *dst, const void *src);
+void pagezero(void *page);
 
 /* TLB shootdown handling called from interprocessor_interrupt */
 void vm_tlbshootdown(const struct tlbshootdown *);
 
+/*
+ * Point this cpu's TLB at an address space (from as_activate).
+ * vm_shootdown flushes AS from every cpu's TLB and waits until it's
+ * done; vm_shootdown_detach also makes every cpu forget AS, before
+ * it's destroyed. Both need interrupts on and no spinlocks held.
+ */
+void vm_tlbactivate(struct addrspace *as);
+void vm_shootdown(struct addrspace *as);
+void vm_shootdown_detach(struct addrspace *as);
+
 void vm_freePTE(paddr_t ***pte);
 vaddr_t alloc_frame(void);
 int copyPTE(struct addrspace *old, struct addrspace *newas);
 int vm_initPT(paddr_t ***oldPTE, vaddr_t vaddr);
 int vm_addPTE(paddr_t ***oldPTE, vaddr_t faultaddress, uint32_t dirty);
+int vm_mapframe(struct addrspace *as, vaddr_t vaddr, vaddr_t kframe,
+                bool writeable);
 int lookup_region(struct addrspace *as, vaddr_t vaddr, int faulttype);
+
+/* Pre-fault a user range ahead of copyin/copyout (see vm.c) */
+#define VM_PREFAULT_PAGES 16
+int vm_prefault(vaddr_t start, size_t len, int faulttype);
 #endif /* VM_H */
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2016
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _VMSTAT_H_
+#define _VMSTAT_H_
+
+/*
+ * VM event counters, for benchmarking.
+ *
+ * Counters are kept per cpu (see statcounter.h), since they're bumped
+ * on every fault and page allocation, and only ever go up (until
+ * reset). vmstat_print prints the totals one per line as
+ *	vmstat <name> <value>
+ * so that test scripts can pick them out of the console output.
+ *
+ * There is no backing store, so "page-ins" are the demand-zero pages
+ * handed out by the fault handler and "page-outs" are the pages given
+ * back under memory pressure by the reclaim hooks.
+ *
+ * vmstat_print also prints the average shootdown wait.
+ */
+
+enum vmstat_counter {
+	VMS_TLBFAULT,		/* calls to vm_fault (TLB misses) */
+	VMS_ZEROFILL,		/* pages zero-filled on demand (page-ins) */
+	VMS_PREFAULT,		/* TLB entries loaded by vm_prefault */
+	VMS_FORKCOPY,		/* pages copied by as_copy */
+	VMS_RECLAIM,		/* pages freed by reclaim (page-outs) */
+	VMS_KPAGEALLOC,		/* alloc_kpages calls */
+	VMS_KPAGEFREE,		/* free_kpages calls */
+	VMS_SHOOTDOWN,		/* TLB shootdowns */
+	VMS_SHOOTDOWNWAIT,	/* shootdowns that had to wait for other cpus */
+	VMS_SHOOTDOWNIPI,	/* shootdown IPIs sent */
+	VMS_SHOOTDOWNUSEC,	/* microseconds spent waiting for them */
+	VMS_NCOUNTERS		/* (number of counters) */
+};
+
+void vmstat_add(enum vmstat_counter which, unsigned amount);
+#define vmstat_inc(which) vmstat_add(which, 1)
+
+void vmstat_reset(void);
+void vmstat_print(void);
+
+#endif /* _VMSTAT_H_ */
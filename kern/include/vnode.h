@@ -57,6 +57,8 @@ struct vnode {
 	void *vn_data;                  /* Filesystem-specific data */
 
 	const struct vnode_ops *vn_ops; /* Functions on this vnode */
+
+	unsigned vn_ncgen;              /* Name cache generation */
 };
 
 /*
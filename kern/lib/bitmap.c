@@ -120,6 +120,44 @@ bitmap_alloc(struct bitmap *b, unsigned *index)
         return ENOSPC;
 }
 
+int
+bitmap_alloc_near(struct bitmap *b, unsigned goal, unsigned *index)
+{
+        unsigned i, ix, bitno;
+        unsigned maxix = DIVROUNDUP(b->nbits, BITS_PER_WORD);
+        unsigned offset;
+
+        if (goal >= b->nbits) {
+                goal = 0;
+        }
+
+        /*
+         * Start in GOAL's word, skipping the bits before GOAL; go
+         * round once, and finish with the bits we skipped.
+         */
+        for (i=0; i<=maxix; i++) {
+                ix = (goal / BITS_PER_WORD + i) % maxix;
+                if (b->v[ix]==WORD_ALLBITS) {
+                        continue;
+                }
+                for (offset = 0; offset < BITS_PER_WORD; offset++) {
+                        WORD_TYPE mask = ((WORD_TYPE)1) << offset;
+
+                        bitno = ix*BITS_PER_WORD + offset;
+                        if (i == 0 && bitno < goal) {
+                                continue;
+                        }
+                        if ((b->v[ix] & mask)==0) {
+                                b->v[ix] |= mask;
+                                *index = bitno;
+                                KASSERT(*index < b->nbits);
+                                return 0;
+                        }
+                }
+        }
+        return ENOSPC;
+}
+
 static
 inline
 void
@@ -67,3 +67,21 @@ timespec_sub(const struct timespec *ts1,
 	r.tv_sec -= ts2->tv_sec;
 	*ret = r;
 }
+
+/*
+ * Number of hardclocks to sleep to be sure of waiting at least ts.
+ * Round up, and add one because the current tick is already partly
+ * over. A zero interval stays zero.
+ */
+uint64_t
+timespec_ticks(const struct timespec *ts)
+{
+	uint64_t ticks;
+
+	ticks = (uint64_t)ts->tv_sec * HZ;
+	ticks += (ts->tv_nsec + (1000000000 / HZ) - 1) / (1000000000 / HZ);
+	if (ticks > 0) {
+		ticks++;
+	}
+	return ticks;
+}
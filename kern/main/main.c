@@ -43,10 +43,13 @@
 #include <current.h>
 #include <synch.h>
 #include <vm.h>
+#include <reclaim.h>
+#include <buf.h>
 #include <mainbus.h>
 #include <vfs.h>
 #include <device.h>
 #include <pid.h>
+#include <futex.h>
 #include <syscall.h>
 #include <test.h>
 #include <version.h>
@@ -112,6 +115,7 @@ boot(void)
 	proc_bootstrap();
 	thread_bootstrap();
 	pid_bootstrap();
+	futex_bootstrap();
 	hardclock_bootstrap();
 	vfs_bootstrap();
 	kheap_nextgeneration();
@@ -128,6 +132,9 @@ boot(void)
 
 	/* Late phase of initialization. */
 	vm_bootstrap();
+	reclaim_bootstrap();
+	kheap_bootstrap();
+	buf_bootstrap();
 	kprintf_bootstrap();
 	exec_bootstrap();
 	thread_start_cpus();
@@ -38,10 +38,16 @@
 #include <clock.h>
 #include <mainbus.h>
 #include <synch.h>
+#include <lockstat.h>
 #include <thread.h>
 #include <proc.h>
 #include <vfs.h>
 #include <sfs.h>
+#include <reclaim.h>
+#include <vmstat.h>
+#include <buf.h>
+#include <namecache.h>
+#include <lamebus/lhd.h>
 #include <pid.h>
 #include <syscall.h>
 #include <test.h>
@@ -500,6 +506,159 @@ cmd_kheapdump(int nargs, char **args)
 	return 0;
 }
 
+static
+int
+cmd_reclaimstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	reclaim_printstats();
+
+	return 0;
+}
+
+static
+int
+cmd_vmstats(int nargs, char **args)
+{
+	if (nargs == 1) {
+		vmstat_print();
+	}
+	else if (nargs == 2 && !strcmp(args[1], "reset")) {
+		vmstat_reset();
+	}
+	else {
+		kprintf("Usage: vs [reset]\n");
+	}
+
+	return 0;
+}
+
+static
+int
+cmd_bufstats(int nargs, char **args)
+{
+	unsigned age, pct;
+
+	if (nargs == 1) {
+		buf_printstats();
+	}
+	else if (nargs == 2 && !strcmp(args[1], "reset")) {
+		buf_resetstats();
+	}
+	else if (nargs == 3 && !strcmp(args[1], "size")) {
+		kprintf("buffer cache size: %u buffers\n",
+			buf_setmax(atoi(args[2])));
+	}
+	else if (nargs == 2 && !strcmp(args[1], "flush")) {
+		buf_getflush(&age, &pct);
+		kprintf("flush after %u seconds or %u%% dirty\n", age, pct);
+	}
+	else if (nargs == 4 && !strcmp(args[1], "flush")) {
+		buf_setflush(atoi(args[2]), atoi(args[3]));
+	}
+	else {
+		kprintf("Usage: bc [reset|size nbufs|flush [secs pct]]\n");
+	}
+
+	return 0;
+}
+
+static
+int
+cmd_ncstats(int nargs, char **args)
+{
+	if (nargs == 1) {
+		namecache_printstats();
+	}
+	else if (nargs == 2 && !strcmp(args[1], "reset")) {
+		namecache_resetstats();
+	}
+	else {
+		kprintf("Usage: nc [reset]\n");
+	}
+
+	return 0;
+}
+
+static
+int
+cmd_lhdstats(int nargs, char **args)
+{
+	if (nargs == 1) {
+		lhd_printstats();
+	}
+	else if (nargs == 2 && !strcmp(args[1], "reset")) {
+		lhd_resetstats();
+	}
+	else {
+		kprintf("Usage: lhd [reset]\n");
+	}
+
+	return 0;
+}
+
+static
+int
+cmd_schedstats(int nargs, char **args)
+{
+	if (nargs == 1) {
+		thread_printsched();
+	}
+	else if (nargs == 2 && !strcmp(args[1], "migcost")) {
+		kprintf("migration cost: %u hardclocks\n",
+			sched_migrate_cost);
+	}
+	else if (nargs == 3 && !strcmp(args[1], "migcost")) {
+		sched_migrate_cost = atoi(args[2]);
+	}
+	else {
+		kprintf("Usage: ts [migcost [hardclocks]]\n");
+	}
+
+	return 0;
+}
+
+static
+int
+cmd_lockstats(int nargs, char **args)
+{
+	if (nargs == 1) {
+		lock_printstats(false);
+	}
+	else if (nargs == 2 && !strcmp(args[1], "all")) {
+		lock_printstats(true);
+	}
+	else if (nargs == 2 && !strcmp(args[1], "reset")) {
+		lock_resetstats();
+	}
+	else {
+		kprintf("Usage: lks [all|reset]\n");
+	}
+
+	return 0;
+}
+
+#if OPT_LOCKSTAT
+static
+int
+cmd_lockstat(int nargs, char **args)
+{
+	if (nargs == 1) {
+		lockstat_print();
+	}
+	else if (nargs == 2 && !strcmp(args[1], "reset")) {
+		lockstat_reset();
+	}
+	else {
+		kprintf("Usage: lst [reset]\n");
+	}
+
+	return 0;
+}
+#endif
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -566,6 +725,11 @@ static const char *testmenu[] = {
 	"[km2] kmalloc stress test           ",
 	"[km3] Large kmalloc test            ",
 	"[km4] Multipage kmalloc test        ",
+	"[mb]  memcpy/memset benchmark       ",
+	"[vb]  VM allocator benchmark        ",
+	"[lkb] Concurrent lookup benchmark   ",
+	"[dqt] Disk queue test (destructive) ",
+	"[tmt] Timer test                    ",
 	"[tt1] Thread test 1                 ",
 	"[tt2] Thread test 2                 ",
 	"[tt3] Thread test 3                 ",
@@ -584,6 +748,13 @@ static const char *testmenu[] = {
 	"[fs4] FS write stress 2             ",
 	"[fs5] FS long stress                ",
 	"[fs6] FS create stress              ",
+	"[fs7] FS read-ahead test            ",
+	"[fs8] FS big directory test         ",
+	"[fs9] FS name cache test            ",
+	"[fs10] FS namespace stress          ",
+	"[fs11] FS interleaved writes        ",
+	"[fs12] FS freemap writeback         ",
+	"[fs13] FS vnode hash                ",
 	NULL
 };
 
@@ -606,6 +777,16 @@ static const char *mainmenu[] = {
 	"[kh] Kernel heap stats              ",
 	"[khgen] Next kernel heap generation ",
 	"[khdump] Dump kernel heap           ",
+	"[kr] Memory reclaim stats           ",
+	"[vs] VM event counters [reset]      ",
+	"[bc] Buffer cache [reset|size n]    ",
+	"[nc] Name cache stats [reset]       ",
+	"[lhd] Disk queue stats [reset]      ",
+	"[ts] Scheduler queues [migcost [n]] ",
+	"[lks] Lock contention [all|reset]   ",
+#if OPT_LOCKSTAT
+	"[lst] Lock profile [reset]          ",
+#endif
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -657,6 +838,16 @@ static struct {
 	{ "kh",         cmd_kheapstats },
 	{ "khgen",      cmd_kheapgeneration },
 	{ "khdump",     cmd_kheapdump },
+	{ "kr",		cmd_reclaimstats },
+	{ "vs",		cmd_vmstats },
+	{ "bc",		cmd_bufstats },
+	{ "nc",		cmd_ncstats },
+	{ "lhd",	cmd_lhdstats },
+	{ "ts",		cmd_schedstats },
+	{ "lks",	cmd_lockstats },
+#if OPT_LOCKSTAT
+	{ "lst",	cmd_lockstat },
+#endif
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -667,6 +858,11 @@ static struct {
 	{ "km2",	kmallocstress },
 	{ "km3",	kmalloctest3 },
 	{ "km4",	kmalloctest4 },
+	{ "mb",		membench },
+	{ "vb",		vmbench },
+	{ "lkb",	lookupbench },
+	{ "dqt",	disktest },
+	{ "tmt",	timertest },
 #if OPT_NET
 	{ "net",	nettest },
 #endif
@@ -715,6 +911,13 @@ static struct {
 	{ "fs4",	writestress2 },
 	{ "fs5",	longstress },
 	{ "fs6",	createstress },
+	{ "fs7",	readahead },
+	{ "fs8",	bigdir },
+	{ "fs9",	namecachetest },
+	{ "fs10",	nsstress },
+	{ "fs11",	interleave },
+	{ "fs12",	freemapsync },
+	{ "fs13",	vnhash },
 
 	{ NULL, NULL }
 };
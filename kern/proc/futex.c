@@ -0,0 +1,305 @@
+/*
+ * Copyright (c) 2016
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Futex wait table.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <clock.h>
+#include <timer.h>
+#include <thread.h>
+#include <current.h>
+#include <proc.h>
+#include <synch.h>
+#include <copyinout.h>
+#include <futex.h>
+
+/*
+ * A thread waiting on a futex. This lives on the waiting thread's
+ * stack, and it sleeps on its own wchan so a wakeup reaches exactly
+ * the threads picked.
+ *
+ * The links and fw_queued are protected by the bucket's sleep lock;
+ * fw_woken and fw_timedout by its spinlock, which can be taken from
+ * the timeout function in interrupt context.
+ */
+struct futexwaiter {
+	struct futexwaiter *fw_next;	/* next in bucket, oldest first */
+	struct futexwaiter **fw_pprev;	/* link pointing at us */
+	struct addrspace *fw_as;	/* key: address space */
+	userptr_t fw_addr;		/* key: user address */
+	struct wchan *fw_wchan;		/* thread's private wchan */
+	struct futexbucket *fw_bucket;	/* bucket we're in */
+	struct timer fw_timer;		/* timeout, if any */
+	bool fw_queued;			/* still in the bucket */
+	bool fw_woken;			/* futex_wake picked us */
+	bool fw_timedout;		/* timeout went off */
+};
+
+/*
+ * A hash bucket. The sleep lock is held while the user's value is
+ * checked, since copyin may fault, and is what makes checking the
+ * value and queueing atomic with respect to futex_wake.
+ */
+struct futexbucket {
+	struct lock *fb_lock;		/* protects the queue */
+	struct spinlock fb_spinlock;	/* protects the wakeup flags */
+	struct futexwaiter *fb_head;	/* oldest waiter */
+	struct futexwaiter **fb_tailp;	/* where to add the next */
+};
+
+#define FUTEX_NBUCKETS	64
+
+static struct futexbucket futextable[FUTEX_NBUCKETS];
+
+/*
+ * Pick the bucket for a key. The address is int-aligned, so drop
+ * the low bits; mix in the address space so processes using the same
+ * addresses spread out.
+ */
+static
+struct futexbucket *
+futex_bucket(struct addrspace *as, userptr_t addr)
+{
+	uintptr_t h;
+
+	h = (uintptr_t)addr >> 2;
+	h ^= (uintptr_t)as >> 4;
+	h ^= h >> 11;
+	return &futextable[h % FUTEX_NBUCKETS];
+}
+
+void
+futex_bootstrap(void)
+{
+	struct futexbucket *fb;
+	unsigned i;
+
+	for (i=0; i<FUTEX_NBUCKETS; i++) {
+		fb = &futextable[i];
+		fb->fb_lock = lock_create("futex");
+		if (fb->fb_lock == NULL) {
+			panic("futex_bootstrap: Out of memory\n");
+		}
+		spinlock_init(&fb->fb_spinlock);
+		fb->fb_head = NULL;
+		fb->fb_tailp = &fb->fb_head;
+	}
+}
+
+/*
+ * Take FW off its bucket's queue. Bucket sleep lock must be held.
+ */
+static
+void
+futex_dequeue(struct futexbucket *fb, struct futexwaiter *fw)
+{
+	KASSERT(lock_do_i_hold(fb->fb_lock));
+	KASSERT(fw->fw_queued);
+
+	*fw->fw_pprev = fw->fw_next;
+	if (fw->fw_next != NULL) {
+		fw->fw_next->fw_pprev = fw->fw_pprev;
+	}
+	else {
+		fb->fb_tailp = fw->fw_pprev;
+	}
+	fw->fw_next = NULL;
+	fw->fw_pprev = NULL;
+	fw->fw_queued = false;
+}
+
+/*
+ * Timeout function. Once the spinlock is let go, FW may be gone.
+ */
+static
+void
+futex_timeout(void *data)
+{
+	struct futexwaiter *fw = data;
+	struct futexbucket *fb = fw->fw_bucket;
+
+	spinlock_acquire(&fb->fb_spinlock);
+	fw->fw_timedout = true;
+	wchan_wakeall(fw->fw_wchan, &fb->fb_spinlock);
+	spinlock_release(&fb->fb_spinlock);
+}
+
+int
+futex_wait(struct addrspace *as, userptr_t addr, int val, unsigned ticks)
+{
+	struct futexbucket *fb;
+	struct futexwaiter fw;
+	int cur, result;
+
+	if ((uintptr_t)addr % sizeof(int) != 0) {
+		return EINVAL;
+	}
+
+	fb = futex_bucket(as, addr);
+	fw.fw_next = NULL;
+	fw.fw_pprev = NULL;
+	fw.fw_as = as;
+	fw.fw_addr = addr;
+	fw.fw_wchan = curthread->t_sleepchan;
+	fw.fw_bucket = fb;
+	timer_init(&fw.fw_timer, futex_timeout, &fw);
+	fw.fw_queued = false;
+	fw.fw_woken = false;
+	fw.fw_timedout = false;
+
+	lock_acquire(fb->fb_lock);
+	result = copyin(addr, &cur, sizeof(cur));
+	if (result) {
+		lock_release(fb->fb_lock);
+		return result;
+	}
+	if (cur != val) {
+		lock_release(fb->fb_lock);
+		return EAGAIN;
+	}
+	/*
+	 * If the process is exiting, futex_wakeall may already have
+	 * been through this bucket, so don't sleep. Checking under the
+	 * bucket lock means it either was set before we got here or
+	 * futex_wakeall will find us queued.
+	 */
+	if (curproc->p_exiting) {
+		lock_release(fb->fb_lock);
+		return EINTR;
+	}
+	fw.fw_pprev = fb->fb_tailp;
+	*fb->fb_tailp = &fw;
+	fb->fb_tailp = &fw.fw_next;
+	fw.fw_queued = true;
+
+	/*
+	 * Get the spinlock before letting go of the sleep lock, so a
+	 * futex_wake that comes in between finds us either still
+	 * queued and not asleep yet (and sets fw_woken, which we'll
+	 * see) or asleep.
+	 */
+	spinlock_acquire(&fb->fb_spinlock);
+	lock_release(fb->fb_lock);
+	if (ticks > 0) {
+		timer_start(&fw.fw_timer, ticks);
+	}
+	while (!fw.fw_woken && !fw.fw_timedout) {
+		wchan_sleep(fw.fw_wchan, &fb->fb_spinlock);
+	}
+	spinlock_release(&fb->fb_spinlock);
+
+	/*
+	 * If the timer couldn't be cancelled it has fired, or is
+	 * firing right now; wait for it to be done with us.
+	 */
+	if (ticks > 0 && !timer_cancel(&fw.fw_timer)) {
+		spinlock_acquire(&fb->fb_spinlock);
+		while (!fw.fw_timedout) {
+			wchan_sleep(fw.fw_wchan, &fb->fb_spinlock);
+		}
+		spinlock_release(&fb->fb_spinlock);
+	}
+
+	/* Still queued means nobody woke us, so we timed out. */
+	result = 0;
+	lock_acquire(fb->fb_lock);
+	if (fw.fw_queued) {
+		futex_dequeue(fb, &fw);
+		result = ETIMEDOUT;
+	}
+	lock_release(fb->fb_lock);
+	return result;
+}
+
+unsigned
+futex_wake(struct addrspace *as, userptr_t addr, unsigned num)
+{
+	struct futexbucket *fb;
+	struct futexwaiter *fw, *next;
+	unsigned count;
+
+	fb = futex_bucket(as, addr);
+	count = 0;
+
+	lock_acquire(fb->fb_lock);
+	for (fw = fb->fb_head; fw != NULL && count < num; fw = next) {
+		next = fw->fw_next;
+		if (fw->fw_as != as || fw->fw_addr != addr) {
+			continue;
+		}
+		futex_dequeue(fb, fw);
+		spinlock_acquire(&fb->fb_spinlock);
+		fw->fw_woken = true;
+		wchan_wakeall(fw->fw_wchan, &fb->fb_spinlock);
+		spinlock_release(&fb->fb_spinlock);
+		count++;
+	}
+	lock_release(fb->fb_lock);
+	return count;
+}
+
+/*
+ * Wake every thread waiting on any futex in AS.
+ */
+static
+void
+futex_wakebucket(struct futexbucket *fb, struct addrspace *as)
+{
+	struct futexwaiter *fw, *next;
+
+	lock_acquire(fb->fb_lock);
+	for (fw = fb->fb_head; fw != NULL; fw = next) {
+		next = fw->fw_next;
+		if (fw->fw_as != as) {
+			continue;
+		}
+		futex_dequeue(fb, fw);
+		spinlock_acquire(&fb->fb_spinlock);
+		fw->fw_woken = true;
+		wchan_wakeall(fw->fw_wchan, &fb->fb_spinlock);
+		spinlock_release(&fb->fb_spinlock);
+	}
+	lock_release(fb->fb_lock);
+}
+
+void
+futex_wakeall(struct addrspace *as)
+{
+	unsigned i;
+
+	for (i=0; i<FUTEX_NBUCKETS; i++) {
+		futex_wakebucket(&futextable[i], as);
+	}
+}
@@ -49,14 +49,17 @@
  *
  * If pi_ppid is INVALID_PID, the parent has gone away and will not be
  * waiting. If pi_ppid is INVALID_PID and pi_exited is true, the
- * structure can be freed.
+ * structure can be freed, unless pi_waiting is set: then a thread is
+ * in pid_wait sleeping on pi_exitsem, and it frees the structure once
+ * it has taken the V.
  */
 struct pidinfo {
 	pid_t pi_pid;			// process id of this thread
 	pid_t pi_ppid;			// process id of parent thread
 	volatile bool pi_exited;	// true if thread has exited
 	int pi_exitstatus;		// status (only valid if exited)
-	struct cv *pi_cv;		// use to wait for thread exit
+	struct semaphore *pi_exitsem;	// V'd once when thread exits
+	bool pi_waiting;		// a thread is waiting on pi_exitsem
 };
 
 
@@ -67,8 +70,15 @@ struct pidinfo {
  * (pid % PROCS_MAX), and only allows one process per slot. If a
  * new pid allocation would cause a hash collision, we just don't
  * use that pid.
+ *
+ * Lookups vastly outnumber changes, so the table is protected by a
+ * reader-writer lock. Waiting for exit is done on the per-pid
+ * semaphore with the table unlocked. A process can have several
+ * threads, so only one of them may wait for a given child: pid_wait
+ * sets pi_waiting under the write lock, and while it is set nobody
+ * but that waiter drops the pidinfo.
  */
-static struct lock *pidlock;		// lock for global exit data
+static struct rwlock *pidlock;		// lock for global exit data
 static struct pidinfo *pidinfo[PROCS_MAX]; // actual pid info
 static pid_t nextpid;			// next candidate pid
 static int nprocs;			// number of allocated pids
@@ -91,8 +101,8 @@ pidinfo_create(pid_t pid, pid_t ppid)
 		return NULL;
 	}
 
-	pi->pi_cv = cv_create("pidinfo cv");
-	if (pi->pi_cv == NULL) {
+	pi->pi_exitsem = sem_create("pidinfo", 0);
+	if (pi->pi_exitsem == NULL) {
 		kfree(pi);
 		return NULL;
 	}
@@ -101,6 +111,7 @@ pidinfo_create(pid_t pid, pid_t ppid)
 	pi->pi_ppid = ppid;
 	pi->pi_exited = false;
 	pi->pi_exitstatus = 0xbeef;  /* Recognizably invalid value */
+	pi->pi_waiting = false;
 
 	return pi;
 }
@@ -114,7 +125,8 @@ pidinfo_destroy(struct pidinfo *pi)
 {
 	KASSERT(pi->pi_exited == true);
 	KASSERT(pi->pi_ppid == INVALID_PID);
-	cv_destroy(pi->pi_cv);
+	KASSERT(pi->pi_waiting == false);
+	sem_destroy(pi->pi_exitsem);
 	kfree(pi);
 }
 
@@ -128,7 +140,7 @@ pid_bootstrap(void)
 {
 	int i;
 
-	pidlock = lock_create("pidlock");
+	pidlock = rwlock_create("pidlock");
 	if (pidlock == NULL) {
 		panic("Out of memory creating pid lock\n");
 	}
@@ -148,7 +160,8 @@ pid_bootstrap(void)
 }
 
 /*
- * pi_get: look up a pidinfo in the process table.
+ * pi_get: look up a pidinfo in the process table. Must hold pidlock,
+ * for either reading or writing.
  */
 static
 struct pidinfo *
@@ -158,7 +171,6 @@ pi_get(pid_t pid)
 
 	KASSERT(pid>=0);
 	KASSERT(pid != INVALID_PID);
-	KASSERT(lock_do_i_hold(pidlock));
 
 	pi = pidinfo[pid % PROCS_MAX];
 	if (pi==NULL) {
@@ -178,7 +190,7 @@ static
 void
 pi_put(pid_t pid, struct pidinfo *pi)
 {
-	KASSERT(lock_do_i_hold(pidlock));
+	KASSERT(rwlock_do_i_hold_write(pidlock));
 
 	KASSERT(pid != INVALID_PID);
 
@@ -198,7 +210,7 @@ pi_drop(pid_t pid)
 {
 	struct pidinfo *pi;
 
-	KASSERT(lock_do_i_hold(pidlock));
+	KASSERT(rwlock_do_i_hold_write(pidlock));
 
 	pi = pidinfo[pid % PROCS_MAX];
 	KASSERT(pi != NULL);
@@ -209,6 +221,22 @@ pi_drop(pid_t pid)
 	nprocs--;
 }
 
+/*
+ * pi_disown: the parent of PI is giving up interest in it. Free it if
+ * it has already exited and nobody is still waiting for it.
+ */
+static
+void
+pi_disown(struct pidinfo *pi)
+{
+	KASSERT(rwlock_do_i_hold_write(pidlock));
+
+	pi->pi_ppid = INVALID_PID;
+	if (pi->pi_exited && !pi->pi_waiting) {
+		pi_drop(pi->pi_pid);
+	}
+}
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -218,7 +246,7 @@ static
 void
 inc_nextpid(void)
 {
-	KASSERT(lock_do_i_hold(pidlock));
+	KASSERT(rwlock_do_i_hold_write(pidlock));
 
 	nextpid++;
 	if (nextpid > PID_MAX) {
@@ -239,10 +267,10 @@ pid_alloc(pid_t *retval)
 	KASSERT(curproc->p_pid != INVALID_PID);
 
 	/* lock the table */
-	lock_acquire(pidlock);
+	rwlock_acquire_write(pidlock);
 
 	if (nprocs == PROCS_MAX) {
-		lock_release(pidlock);
+		rwlock_release_write(pidlock);
 		return EAGAIN;
 	}
 
@@ -265,7 +293,7 @@ pid_alloc(pid_t *retval)
 
 	pi = pidinfo_create(pid, curproc->p_pid);
 	if (pi==NULL) {
-		lock_release(pidlock);
+		rwlock_release_write(pidlock);
 		return ENOMEM;
 	}
 
@@ -273,7 +301,7 @@ pid_alloc(pid_t *retval)
 
 	inc_nextpid();
 
-	lock_release(pidlock);
+	rwlock_release_write(pidlock);
 
 	*retval = pid;
 	return 0;
@@ -290,7 +318,7 @@ pid_unalloc(pid_t theirpid)
 
 	KASSERT(theirpid >= PID_MIN && theirpid <= PID_MAX);
 
-	lock_acquire(pidlock);
+	rwlock_acquire_write(pidlock);
 
 	them = pi_get(theirpid);
 	KASSERT(them != NULL);
@@ -300,11 +328,17 @@ pid_unalloc(pid_t theirpid)
 	/* keep pidinfo_destroy from complaining */
 	them->pi_exitstatus = 0xdead;
 	them->pi_exited = true;
-	them->pi_ppid = INVALID_PID;
 
-	pi_drop(theirpid);
+	if (them->pi_waiting) {
+		/* another thread guessed the pid; let it collect 0xdead */
+		V(them->pi_exitsem);
+	}
+	else {
+		them->pi_ppid = INVALID_PID;
+		pi_drop(theirpid);
+	}
 
-	lock_release(pidlock);
+	rwlock_release_write(pidlock);
 }
 
 /*
@@ -318,18 +352,15 @@ pid_disown(pid_t theirpid)
 
 	KASSERT(theirpid >= PID_MIN && theirpid <= PID_MAX);
 
-	lock_acquire(pidlock);
+	rwlock_acquire_write(pidlock);
 
 	them = pi_get(theirpid);
 	KASSERT(them != NULL);
 	KASSERT(them->pi_ppid==curproc->p_pid);
 
-	them->pi_ppid = INVALID_PID;
-	if (them->pi_exited) {
-		pi_drop(them->pi_pid);
-	}
+	pi_disown(them);
 
-	lock_release(pidlock);
+	rwlock_release_write(pidlock);
 }
 
 /*
@@ -346,7 +377,7 @@ pid_setexitstatus(int status)
 	struct pidinfo *us;
 	int i;
 
-	lock_acquire(pidlock);
+	rwlock_acquire_write(pidlock);
 	KASSERT(curproc->p_pid != INVALID_PID);
 
 	/* First, disown all children */
@@ -355,10 +386,7 @@ pid_setexitstatus(int status)
 			continue;
 		}
 		if (pidinfo[i]->pi_ppid == curproc->p_pid) {
-			pidinfo[i]->pi_ppid = INVALID_PID;
-			if (pidinfo[i]->pi_exited) {
-				pi_drop(pidinfo[i]->pi_pid);
-			}
+			pi_disown(pidinfo[i]);
 		}
 	}
 
@@ -369,16 +397,53 @@ pid_setexitstatus(int status)
 	us->pi_exitstatus = status;
 	us->pi_exited = true;
 
-	if (us->pi_ppid == INVALID_PID) {
+	if (us->pi_ppid == INVALID_PID && !us->pi_waiting) {
 		/* no parent */
 		pi_drop(curproc->p_pid);
 	}
 	else {
-		cv_broadcast(us->pi_cv, pidlock);
+		V(us->pi_exitsem);
 	}
 
 	curproc->p_pid = INVALID_PID;
-	lock_release(pidlock);
+	rwlock_release_write(pidlock);
+}
+
+/*
+ * pi_waitcheck: the checks pid_wait makes before waiting. Must hold
+ * pidlock, for either reading or writing. Returns an error, or 0 with
+ * *ret set to the process to wait for, or to NULL if WNOHANG is set
+ * and it hasn't exited yet.
+ */
+static
+int
+pi_waitcheck(pid_t theirpid, int flags, struct pidinfo **ret)
+{
+	struct pidinfo *them;
+
+	them = pi_get(theirpid);
+	if (them==NULL) {
+		return ESRCH;
+	}
+
+	KASSERT(them->pi_pid==theirpid);
+
+	/* Only allow waiting for own children. */
+	if (them->pi_ppid != curproc->p_pid) {
+		return EPERM;
+	}
+
+	/* Another thread of this process is already waiting for it. */
+	if (them->pi_waiting) {
+		return ECHILD;
+	}
+
+	if (them->pi_exited == false && flags == WNOHANG) {
+		*ret = NULL;
+		return 0;
+	}
+	*ret = them;
+	return 0;
 }
 
 /*
@@ -393,6 +458,7 @@ int
 pid_wait(pid_t theirpid, int *status, int flags, pid_t *ret)
 {
 	struct pidinfo *them;
+	int result;
 
 	KASSERT(curproc->p_pid != INVALID_PID);
 
@@ -415,33 +481,44 @@ pid_wait(pid_t theirpid, int *status, int flags, pid_t *ret)
 		return EINVAL;
 	}
 
-	lock_acquire(pidlock);
-
-	them = pi_get(theirpid);
-	if (them==NULL) {
-		lock_release(pidlock);
-		return ESRCH;
+	/*
+	 * Do the checks for reading first, so failed waits and
+	 * WNOHANG polls of running children don't hold up everyone
+	 * else. If we're going to wait, take the table for writing
+	 * and check again, since it may have changed in between.
+	 */
+	rwlock_acquire_read(pidlock);
+	result = pi_waitcheck(theirpid, flags, &them);
+	rwlock_release_read(pidlock);
+	if (result == 0 && them != NULL) {
+		rwlock_acquire_write(pidlock);
+		result = pi_waitcheck(theirpid, flags, &them);
+		if (result || them == NULL) {
+			rwlock_release_write(pidlock);
+		}
 	}
-
-	KASSERT(them->pi_pid==theirpid);
-
-	/* Only allow waiting for own children. */
-	if (them->pi_ppid != curproc->p_pid) {
-		lock_release(pidlock);
-		return EPERM;
+	if (result) {
+		return result;
 	}
-
-	if (them->pi_exited == false) {
-		if (flags == WNOHANG) {
-			lock_release(pidlock);
-			KASSERT(ret != NULL);
-			*ret = 0;
-			return 0;
-		}
-		/* don't need to loop on this */
-		cv_wait(them->pi_cv, pidlock);
-		KASSERT(them->pi_exited == true);
+	if (them == NULL) {
+		KASSERT(ret != NULL);
+		*ret = 0;
+		return 0;
 	}
+	them->pi_waiting = true;
+	rwlock_release_write(pidlock);
+
+	/*
+	 * Wait for the exit (or, if it already happened, just take
+	 * the V it left). THEM can't go away meanwhile: with
+	 * pi_waiting set, nobody else drops it.
+	 */
+	P(them->pi_exitsem);
+
+	rwlock_acquire_write(pidlock);
+	KASSERT(them->pi_exited == true);
+	KASSERT(them->pi_waiting == true);
+	them->pi_waiting = false;
 
 	if (status != NULL) {
 		*status = them->pi_exitstatus;
@@ -460,6 +537,32 @@ pid_wait(pid_t theirpid, int *status, int flags, pid_t *ret)
 	them->pi_ppid = 0;
 	pi_drop(them->pi_pid);
 
-	lock_release(pidlock);
+	rwlock_release_write(pidlock);
+	return 0;
+}
+
+/*
+ * pid_getppid: look up the parent of a process. Returns ESRCH if
+ * there's no such process and hands back INVALID_PID if it has no
+ * parent. This only needs the table for reading.
+ */
+int
+pid_getppid(pid_t pid, pid_t *ret)
+{
+	struct pidinfo *pi;
+
+	if (pid == INVALID_PID || pid < 0) {
+		return ESRCH;
+	}
+
+	rwlock_acquire_read(pidlock);
+	pi = pi_get(pid);
+	if (pi == NULL) {
+		rwlock_release_read(pidlock);
+		return ESRCH;
+	}
+	*ret = pi->pi_ppid;
+	rwlock_release_read(pidlock);
+
 	return 0;
 }
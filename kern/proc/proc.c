@@ -38,12 +38,13 @@
  * things they point to. Rearrange this (and/or change it to be a
  * regular lock) as needed.
  *
- * Unless you're implementing multithreaded user processes, the only
- * process that will have more than one thread is the kernel process.
+ * User processes can have more than one thread; see proc_exit and
+ * proc_threadexit for how they leave.
  */
 
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/wait.h>
 #include <spl.h>
 #include <synch.h>
 #include <proc.h>
@@ -51,6 +52,7 @@
 #include <addrspace.h>
 #include <vnode.h>
 #include <pid.h>
+#include <futex.h>
 #include <filetable.h>
 
 /*
@@ -87,6 +89,8 @@ proc_create(const char *name)
 
 	spinlock_init(&proc->p_lock);
 	proc->p_pid = INVALID_PID;
+	proc->p_exiting = false;
+	proc->p_exitstatus = 0;
 
 	/* VM fields */
 	proc->p_addrspace = NULL;
@@ -345,7 +349,33 @@ proc_unfork(struct proc *newproc)
 }
 
 /*
- * Make the current process exit.
+ * Take thread T out of PROC's thread array. Caller holds
+ * p_threadslock.
+ */
+static
+void
+proc_unlinkthread(struct proc *proc, struct thread *t)
+{
+	unsigned num, i;
+
+	KASSERT(lock_do_i_hold(proc->p_threadslock));
+
+	/* ugh: find the thread in the array */
+	num = threadarray_num(&proc->p_threads);
+	for (i=0; i<num; i++) {
+		if (threadarray_get(&proc->p_threads, i) == t) {
+			threadarray_remove(&proc->p_threads, i);
+			return;
+		}
+	}
+	/* Did not find it. */
+	panic("Thread (%p) has escaped from its process (%p)\n", t, proc);
+}
+
+/*
+ * Make the current process exit. Other threads in it leave as they
+ * next return to user mode (see mips_trap); any waiting on futexes
+ * are woken so they get there.
  */
 void
 proc_exit(int status)
@@ -355,11 +385,70 @@ proc_exit(int status)
 	/* The kernel isn't supposed to exit. */
 	KASSERT(proc != kproc);
 
+	/* If two threads exit at once, the first one's status wins. */
+	spinlock_acquire(&proc->p_lock);
+	if (!proc->p_exiting) {
+		proc->p_exiting = true;
+		proc->p_exitstatus = status;
+	}
+	spinlock_release(&proc->p_lock);
+
+	if (proc->p_addrspace != NULL && proc_nthreads(proc) > 1) {
+		futex_wakeall(proc->p_addrspace);
+	}
+
+	proc_threadexit();
+}
+
+/*
+ * Make the current thread leave its process. If it's the last one,
+ * the process exits.
+ */
+void
+proc_threadexit(void)
+{
+	struct proc *proc = curproc;
+	bool last;
+	int status;
+	int spl;
+
+	KASSERT(proc != kproc);
+	KASSERT(curthread->t_proc == proc);
+
+	/* Give back our user stack for the next thread to use. */
+	if (curthread->t_ustack != 0) {
+		as_release_threadstack(proc->p_addrspace, curthread->t_ustack);
+		curthread->t_ustack = 0;
+	}
+
+	/*
+	 * Decide whether we're last and, if not, leave, in one go, so
+	 * two threads leaving at once can't both think the other will
+	 * clean up. Nobody can join once we're the only one left.
+	 */
+	lock_acquire(proc->p_threadslock);
+	last = threadarray_num(&proc->p_threads) == 1;
+	if (!last) {
+		proc_unlinkthread(proc, curthread);
+	}
+	lock_release(proc->p_threadslock);
+
+	if (!last) {
+		spl = splhigh();
+		curthread->t_proc = NULL;
+		splx(spl);
+		proc_addthread(kproc, curthread);
+		thread_exit();
+	}
+
+	spinlock_acquire(&proc->p_lock);
+	status = proc->p_exiting ? proc->p_exitstatus : _MKWAIT_EXIT(0);
+	spinlock_release(&proc->p_lock);
+
 	/* Set exit status and wake up anyone waiting for us. */
 	pid_setexitstatus(status);
 
 	/* Detach from the process and attach to the kernel process. */
-	KASSERT(curthread->t_proc == proc);
 	proc_remthread(curthread);
 	proc_addthread(kproc, curthread);
 
@@ -372,6 +461,20 @@ proc_exit(int status)
 	thread_exit();
 }
 
+/*
+ * Count the threads in a process.
+ */
+unsigned
+proc_nthreads(struct proc *proc)
+{
+	unsigned num;
+
+	lock_acquire(proc->p_threadslock);
+	num = threadarray_num(&proc->p_threads);
+	lock_release(proc->p_threadslock);
+	return num;
+}
+
 /*
  * Add a thread to a process. Either the thread or the process might
  * or might not be current.
@@ -416,27 +519,15 @@ void
 proc_remthread(struct thread *t)
 {
 	struct proc *proc;
-	unsigned num, i;
 	int spl;
 
 	proc = t->t_proc;
 	KASSERT(proc != NULL);
 
 	lock_acquire(proc->p_threadslock);
-	/* ugh: find the thread in the array */
-	num = threadarray_num(&proc->p_threads);
-	for (i=0; i<num; i++) {
-		if (threadarray_get(&proc->p_threads, i) == t) {
-			threadarray_remove(&proc->p_threads, i);
-			lock_release(proc->p_threadslock);
-			goto finish;
-		}
-	}
-	/* Did not find it. */
+	proc_unlinkthread(proc, t);
 	lock_release(proc->p_threadslock);
-	panic("Thread (%p) has escaped from its process (%p)\n", t, proc);
 
-finish:
 	spl = splhigh();
 	t->t_proc = NULL;
 	splx(spl);
@@ -445,10 +536,9 @@ finish:
 /*
  * Fetch the address space of (the current) process.
  *
- * Caution: address spaces aren't refcounted. If you implement
- * multithreaded processes, make sure to set up a refcount scheme or
- * some other method to make this safe. Otherwise the returned address
- * space might disappear under you.
+ * Address spaces aren't refcounted; this is safe because a process's
+ * address space lasts until its last thread has left (or execv, which
+ * refuses to run with other threads around, replaces it).
  */
 struct addrspace *
 proc_getas(void)
@@ -36,12 +36,14 @@
 #include <kern/wait.h>
 #include <lib.h>
 #include <machine/trapframe.h>
+#include <addrspace.h>
 #include <clock.h>
 #include <thread.h>
 #include <proc.h>
 #include <current.h>
 #include <copyinout.h>
 #include <pid.h>
+#include <futex.h>
 #include <syscall.h>
 
 /* note that sys_execv is in runprogram.c */
@@ -58,6 +60,16 @@ sys_getpid(pid_t *retval)
 	return 0;
 }
 
+/*
+ * sys_getppid
+ * Our parent's pid, or 0 (INVALID_PID) if it's gone.
+ */
+int
+sys_getppid(pid_t *retval)
+{
+	return pid_getppid(curproc->p_pid, retval);
+}
+
 /*
  * sys__exit()
  *
@@ -81,12 +93,13 @@ sys__exit(int status)
 
 static
 void
-fork_newthread(void *vtf, unsigned long junk)
+fork_newthread(void *vtf, unsigned long slot)
 {
 	struct trapframe mytf;
 	struct trapframe *ntf = vtf;
 
-	(void)junk;
+	/* We're on the copy of the parent thread's user stack. */
+	curthread->t_ustack = slot;
 
 	/*
 	 * Now copy the trapframe to our stack, so we can free the one
@@ -127,7 +140,7 @@ sys_fork(struct trapframe *tf, pid_t *retval)
 	*retval = newproc->p_pid;
 
 	result = thread_fork(curthread->t_name, newproc,
-			     fork_newthread, ntf, 0);
+			     fork_newthread, ntf, curthread->t_ustack);
 	if (result) {
 		proc_unfork(newproc);
 		kfree(ntf);
@@ -137,6 +150,88 @@ sys_fork(struct trapframe *tf, pid_t *retval)
 	return 0;
 }
 
+/*
+ * sys___threadfork
+ *
+ * Start a new thread in the current process, which calls ENTRY(ARG)
+ * on a stack of its own. Userlevel wraps this as threadfork(); ENTRY
+ * is a libc stub that calls threadexit() when the function returns.
+ */
+
+struct threadstart {
+	vaddr_t ts_entry;
+	userptr_t ts_arg;
+	vaddr_t ts_stack;
+};
+
+static
+void
+threadfork_newthread(void *vts, unsigned long slot)
+{
+	struct threadstart ts;
+
+	ts = *(struct threadstart *)vts;
+	kfree(vts);
+
+	curthread->t_ustack = slot;
+
+	/* The process may have exited while we were being set up. */
+	if (curproc->p_exiting) {
+		proc_threadexit();
+	}
+
+	enter_new_thread(ts.ts_arg, ts.ts_stack, ts.ts_entry);
+}
+
+int
+sys___threadfork(userptr_t entry, userptr_t arg)
+{
+	struct threadstart *ts;
+	unsigned slot;
+	vaddr_t stack;
+	int result;
+
+	if (curproc->p_exiting) {
+		/* Don't bother; we're about to leave. */
+		return EINTR;
+	}
+
+	ts = kmalloc(sizeof(*ts));
+	if (ts == NULL) {
+		return ENOMEM;
+	}
+
+	result = as_define_threadstack(proc_getas(), &slot, &stack);
+	if (result) {
+		kfree(ts);
+		return result;
+	}
+	ts->ts_entry = (vaddr_t)entry;
+	ts->ts_arg = arg;
+	ts->ts_stack = stack;
+
+	result = thread_fork(curthread->t_name, curproc,
+			     threadfork_newthread, ts, slot);
+	if (result) {
+		as_release_threadstack(proc_getas(), slot);
+		kfree(ts);
+		return result;
+	}
+
+	return 0;
+}
+
+/*
+ * sys_threadexit
+ * only the current thread goes; see proc_threadexit.
+ */
+__DEAD
+void
+sys_threadexit(void)
+{
+	proc_threadexit();
+}
+
 /*
  * sys_waitpid
  * just pass off the work to the pid code.
@@ -157,3 +252,55 @@ sys_waitpid(pid_t pid, userptr_t retstatus, int flags, pid_t *retval)
 	}
 	return result;
 }
+
+/*
+ * sys_futex_wait
+ * sleep while the int at ADDR holds VAL, for at most TIMEOUT if
+ * that's not NULL.
+ */
+int
+sys_futex_wait(userptr_t addr, int val, const_userptr_t timeout)
+{
+	struct timespec ts;
+	uint64_t ticks;
+	int result;
+
+	ticks = 0;
+	if (timeout != NULL) {
+		result = copyin(timeout, &ts, sizeof(ts));
+		if (result) {
+			return result;
+		}
+		if (ts.tv_sec < 0 || ts.tv_nsec < 0 ||
+		    ts.tv_nsec >= 1000000000) {
+			return EINVAL;
+		}
+		ticks = timespec_ticks(&ts);
+		if (ticks == 0) {
+			/* Zero still waits out the current tick. */
+			ticks = 1;
+		}
+		if (ticks > (unsigned)-1) {
+			ticks = (unsigned)-1;
+		}
+	}
+
+	return futex_wait(proc_getas(), addr, val, ticks);
+}
+
+/*
+ * sys_futex_wake
+ * wake up to NUM threads sleeping on ADDR.
+ */
+int
+sys_futex_wake(userptr_t addr, int num, int *retval)
+{
+	if ((uintptr_t)addr % sizeof(int) != 0) {
+		return EINVAL;
+	}
+	if (num < 0) {
+		return EINVAL;
+	}
+	*retval = futex_wake(proc_getas(), addr, num);
+	return 0;
+}
@@ -55,19 +55,34 @@
  *
  * This is an abstraction that holds an argv while it's being shuffled
  * through the kernel during exec.
+ *
+ * The argv is assembled directly in whole pages, laid out exactly as
+ * it will appear at the top of the new process's user stack: the
+ * strings start on a page boundary and run upward (strpages[] holds
+ * them bottom to top), and the argv pointer array goes in the pages
+ * immediately below (ptrpages[], also bottom to top). Once the new
+ * address space exists the pages are handed over to it as its top
+ * stack pages, so the strings are copied exactly once, straight from
+ * the old process into their final location.
  */
+#define ARGBUF_STRPAGES	DIVROUNDUP(ARG_MAX, PAGE_SIZE)
+#define ARGBUF_PTRPAGES	DIVROUNDUP((ARG_MAX + 1) * sizeof(userptr_t), \
+				   PAGE_SIZE)
+
 struct argbuf {
-	char *data;
+	vaddr_t strpages[ARGBUF_STRPAGES];
+	vaddr_t ptrpages[ARGBUF_PTRPAGES];
+	unsigned nstrpages;
+	unsigned nptrpages;
 	size_t len;
-	size_t max;
 	int nargs;
 	bool tooksem;
 };
 
 /*
  * Throttle to limit the number of processes in exec at once. Or,
- * rather, the number trying to use large exec buffers at once. See
- * design notes for the rationale.
+ * rather, the number trying to use large exec buffers (more than one
+ * page of strings) at once. See design notes for the rationale.
  */
 #define EXEC_BIGBUF_THROTTLE	1
 static struct semaphore *execthrottle;
@@ -91,26 +106,47 @@ static
 void
 argbuf_init(struct argbuf *buf)
 {
-	buf->data = NULL;
+	unsigned i;
+
+	for (i=0; i<ARGBUF_STRPAGES; i++) {
+		buf->strpages[i] = 0;
+	}
+	for (i=0; i<ARGBUF_PTRPAGES; i++) {
+		buf->ptrpages[i] = 0;
+	}
+	buf->nstrpages = 0;
+	buf->nptrpages = 0;
 	buf->len = 0;
-	buf->max = 0;
 	buf->nargs = 0;
 	buf->tooksem = false;
 }
 
 /*
- * Clean up an argv buffer when done.
+ * Clean up an argv buffer when done. Pages that have been handed
+ * over to an address space are no longer ours and have already been
+ * cleared out of the arrays.
  */
 static
 void
 argbuf_cleanup(struct argbuf *buf)
 {
-	if (buf->data != NULL) {
-		kfree(buf->data);
-		buf->data = NULL;
+	unsigned i;
+
+	for (i=0; i<buf->nstrpages; i++) {
+		if (buf->strpages[i] != 0) {
+			free_kpages(buf->strpages[i]);
+			buf->strpages[i] = 0;
+		}
 	}
+	for (i=0; i<buf->nptrpages; i++) {
+		if (buf->ptrpages[i] != 0) {
+			free_kpages(buf->ptrpages[i]);
+			buf->ptrpages[i] = 0;
+		}
+	}
+	buf->nstrpages = 0;
+	buf->nptrpages = 0;
 	buf->len = 0;
-	buf->max = 0;
 	buf->nargs = 0;
 	if (buf->tooksem) {
 		V(execthrottle);
@@ -119,20 +155,52 @@ argbuf_cleanup(struct argbuf *buf)
 }
 
 /*
- * Allocate the memory for an argv buffer.
+ * Make sure there's room for at least one more byte of strings,
+ * adding a page if needed. Returns the space left in the current
+ * page, limited to what's left of ARG_MAX.
  */
 static
 int
-argbuf_allocate(struct argbuf *buf, size_t size)
+argbuf_makeroom(struct argbuf *buf, size_t *room)
 {
-	buf->data = kmalloc(size);
-	if (buf->data == NULL) {
-		return ENOMEM;
+	vaddr_t page;
+
+	if (buf->len >= ARG_MAX) {
+		return E2BIG;
+	}
+
+	if (buf->len == buf->nstrpages * PAGE_SIZE) {
+		KASSERT(buf->nstrpages < ARGBUF_STRPAGES);
+		if (buf->nstrpages > 0 && !buf->tooksem) {
+			/* Wait on the semaphore, to throttle big argvs */
+			P(execthrottle);
+			buf->tooksem = true;
+		}
+		page = alloc_kpages(1);
+		if (page == 0) {
+			return ENOMEM;
+		}
+		buf->strpages[buf->nstrpages++] = page;
+	}
+
+	*room = PAGE_SIZE - buf->len % PAGE_SIZE;
+	if (*room > ARG_MAX - buf->len) {
+		*room = ARG_MAX - buf->len;
 	}
-	buf->max = size;
 	return 0;
 }
 
+/*
+ * Kernel address of the string byte at offset POS.
+ */
+static
+char *
+argbuf_strptr(struct argbuf *buf, size_t pos)
+{
+	KASSERT(pos / PAGE_SIZE < buf->nstrpages);
+	return (char *)buf->strpages[pos / PAGE_SIZE] + pos % PAGE_SIZE;
+}
+
 /*
  * Prepare an argv buffer for runprogram, using a kernel pointer.
  *
@@ -143,31 +211,70 @@ static
 int
 argbuf_fromkernel(struct argbuf *buf, const char *progname)
 {
-	size_t len;
+	size_t len, done, room;
 	int result;
 
 	len = strlen(progname) + 1;
 
-	result = argbuf_allocate(buf, len);
-	if (result) {
-		return result;
+	for (done = 0; done < len; done += room) {
+		result = argbuf_makeroom(buf, &room);
+		if (result) {
+			return result;
+		}
+		if (room > len - done) {
+			room = len - done;
+		}
+		memcpy(argbuf_strptr(buf, buf->len), progname + done, room);
+		buf->len += room;
 	}
-	strcpy(buf->data, progname);
-	buf->len = len;
 	buf->nargs = 1;
 
 	return 0;
 }
 
 /*
- * Copy an argv array into kernel space, using an argvdata buffer.
+ * Copy one argument string in from user space. If it doesn't fit in
+ * the current page, copyinstr fills the page and fails with
+ * ENAMETOOLONG, and we carry on with the rest in the next page.
  */
 static
 int
-argbuf_copyin(struct argbuf *buf, userptr_t uargv)
+argbuf_copyinstr(struct argbuf *buf, userptr_t thisarg)
+{
+	size_t room, thisarglen;
+	int result;
+
+	while (1) {
+		result = argbuf_makeroom(buf, &room);
+		if (result) {
+			return result;
+		}
+
+		result = copyinstr(thisarg, argbuf_strptr(buf, buf->len),
+				   room, &thisarglen);
+		if (result == 0) {
+			/* Note: thisarglen includes the \0. */
+			buf->len += thisarglen;
+			return 0;
+		}
+		if (result != ENAMETOOLONG) {
+			return result;
+		}
+
+		/* Filled all the room there was; keep going. */
+		buf->len += room;
+		thisarg += room;
+	}
+}
+
+/*
+ * Get an argv from user space.
+ */
+static
+int
+argbuf_fromuser(struct argbuf *buf, userptr_t uargv)
 {
 	userptr_t thisarg;
-	size_t thisarglen;
 	int result;
 
 	/* loop through the argv, grabbing each arg string */
@@ -188,17 +295,11 @@ argbuf_copyin(struct argbuf *buf, userptr_t uargv)
 		}
 
 		/* Use the pointer to fetch the argument string. */
-		result = copyinstr(thisarg, buf->data + buf->len,
-				   buf->max - buf->len, &thisarglen);
-		if (result == ENAMETOOLONG) {
-			return E2BIG;
-		}
-		else if (result) {
+		result = argbuf_copyinstr(buf, thisarg);
+		if (result) {
 			return result;
 		}
 
-		/* Move ahead. Note: thisarglen includes the \0. */
-		buf->len += thisarglen;
 		uargv += sizeof(userptr_t);
 		buf->nargs++;
 	}
@@ -207,127 +308,130 @@ argbuf_copyin(struct argbuf *buf, userptr_t uargv)
 }
 
 /*
- * Get an argv from user space.
+ * Allocate the pages for the argv pointer array, now that we know
+ * how many arguments there are. This is the last step that can fail
+ * for lack of memory or because the argv won't fit in the stack, so
+ * do it before committing to the new executable.
  */
 static
 int
-argbuf_fromuser(struct argbuf *buf, userptr_t uargv)
+argbuf_prepare(struct argbuf *buf)
 {
-	int result;
-
-	/* try with a small buffer */
-	result = argbuf_allocate(buf, PAGE_SIZE);
-	if (result) {
-		return result;
-	}
+	size_t ptrbytes;
+	unsigned n, i;
 
-	/* do the copyin */
-	result = argbuf_copyin(buf, uargv);
-	if (result == E2BIG) {
-		/*
-		 * Try again with the full-size buffer. Just start
-		 * over instead of trying to keep the page we already
-		 * did; this is a bit inefficient but it's not that
-		 * important.
-		 */
-		argbuf_cleanup(buf);
-		argbuf_init(buf);
+	ptrbytes = (buf->nargs + 1) * sizeof(userptr_t);
+	n = DIVROUNDUP(ptrbytes, PAGE_SIZE);
+	KASSERT(n <= ARGBUF_PTRPAGES);
 
-		/* Wait on the semaphore, to throttle this allocation */
-		P(execthrottle);
-		buf->tooksem = true;
+	/* leave at least one page of stack for the program to use */
+	if (buf->nstrpages + n >= USER_STACK_SIZE / PAGE_SIZE) {
+		return E2BIG;
+	}
 
-		result = argbuf_allocate(buf, ARG_MAX);
-		if (result) {
-			return result;
+	for (i=0; i<n; i++) {
+		buf->ptrpages[i] = alloc_kpages(1);
+		if (buf->ptrpages[i] == 0) {
+			return ENOMEM;
 		}
-
-		result = argbuf_copyin(buf, uargv);
+		buf->nptrpages++;
 	}
-	return result;
+	return 0;
 }
 
 /*
- * Copy an argv out of kernel space to user space.
+ * Fill in the argv pointer array and hand all the pages over to the
+ * address space AS as the top of its stack, which begins at *USTACKP.
  *
  * Note: ustackp is an in/out argument.
  */
 static
 int
-argbuf_copyout(struct argbuf *buf, vaddr_t *ustackp,
-	       int *argc_ret, userptr_t *uargv_ret)
+argbuf_map(struct argbuf *buf, struct addrspace *as, vaddr_t *ustackp,
+	   int *argc_ret, userptr_t *uargv_ret)
 {
-	vaddr_t ustack;
-	userptr_t ustringbase, uargvbase, uargv_i;
-	userptr_t thisarg;
-	size_t thisarglen;
-	size_t pos;
+	vaddr_t stringbase, ptrbase, uargvbase;
+	size_t pos, ptroff, tail;
+	userptr_t *slot;
+	char *str;
+	unsigned i;
 	int result;
 
-	/* Begin the stack at the passed in top. */
-	ustack = *ustackp;
+	KASSERT(*ustackp % PAGE_SIZE == 0);
+	KASSERT(buf->nptrpages > 0);
+
+	stringbase = *ustackp - buf->nstrpages * PAGE_SIZE;
+	ptrbase = stringbase - buf->nptrpages * PAGE_SIZE;
+	uargvbase = stringbase - (buf->nargs + 1) * sizeof(userptr_t);
 
 	/*
-	 * Allocate space.
-	 *
-	 * buf->pos is the amount of space used by the strings; put that
-	 * first, then align the stack, then make space for the argv
-	 * pointers. Allow an extra slot for the ending NULL.
+	 * Don't hand the process whatever was in the unused ends of
+	 * the pages.
 	 */
+	tail = buf->len % PAGE_SIZE;
+	if (tail > 0) {
+		bzero(argbuf_strptr(buf, buf->len), PAGE_SIZE - tail);
+	}
+	bzero((void *)buf->ptrpages[0], uargvbase - ptrbase);
 
-	ustack -= buf->len;
-	ustack -= (ustack & (sizeof(void *) - 1));
-	ustringbase = (userptr_t)ustack;
-
-	ustack -= (buf->nargs + 1) * sizeof(userptr_t);
-	uargvbase = (userptr_t)ustack;
-
-	/* Now copy the data out. */
+	/*
+	 * Now fill in the pointers. The user address of each string is
+	 * stringbase + pos; a pointer never straddles a page.
+	 */
 	pos = 0;
-	uargv_i = uargvbase;
-	while (pos < buf->len) {
-		/* The user address of the string will be ustringbase + pos. */
-		thisarg = ustringbase + pos;
+	ptroff = uargvbase - ptrbase;
+	for (i=0; i<=(unsigned)buf->nargs; i++) {
+		slot = (userptr_t *)(buf->ptrpages[ptroff / PAGE_SIZE] +
+				     ptroff % PAGE_SIZE);
+		if (i == (unsigned)buf->nargs) {
+			/* Add the NULL. */
+			*slot = NULL;
+			break;
+		}
+		*slot = (userptr_t)(stringbase + pos);
+		ptroff += sizeof(userptr_t);
+
+		/* Skip to the next string; strings can cross pages. */
+		do {
+			str = argbuf_strptr(buf, pos);
+			pos++;
+		} while (*str != 0);
+	}
+	/* Should have come out even... */
+	KASSERT(pos == buf->len);
 
-		/* Place it in the argv array. */
-		result = copyout(&thisarg, uargv_i, sizeof(thisarg));
+	/* Hand the pages over. */
+	for (i=0; i<buf->nstrpages; i++) {
+		result = vm_mapframe(as, stringbase + i * PAGE_SIZE,
+				     buf->strpages[i], true);
 		if (result) {
 			return result;
 		}
-
-		/* Push out the string. */
-		result = copyoutstr(buf->data + pos, thisarg,
-				    buf->len - pos, &thisarglen);
+		buf->strpages[i] = 0;
+	}
+	for (i=0; i<buf->nptrpages; i++) {
+		result = vm_mapframe(as, ptrbase + i * PAGE_SIZE,
+				     buf->ptrpages[i], true);
 		if (result) {
 			return result;
 		}
-
-		/* thisarglen includes the \0 */
-		pos += thisarglen;
-		uargv_i += sizeof(thisarg);
+		buf->ptrpages[i] = 0;
 	}
-	/* Should have come out even... */
-	KASSERT(pos == buf->len);
 
-	/* Add the NULL. */
-	thisarg = NULL;
-	result = copyout(&thisarg, uargv_i, sizeof(userptr_t));
-	if (result) {
-		return result;
-	}
-
-	*ustackp = ustack;
+	*ustackp = uargvbase;
 	*argc_ret = buf->nargs;
-	*uargv_ret = uargvbase;
+	*uargv_ret = (userptr_t)uargvbase;
 	return 0;
 }
 
 /*
- * Common code for execv and runprogram: loading the executable.
+ * Common code for execv and runprogram: loading the executable and
+ * installing its argv.
  */
 static
 int
-loadexec(char *path, vaddr_t *entrypoint, vaddr_t *stackptr)
+loadexec(char *path, struct argbuf *args, vaddr_t *entrypoint,
+	 vaddr_t *stackptr, int *argc_ret, userptr_t *uargv_ret)
 {
 	struct addrspace *newvm, *oldvm;
 	struct vnode *v;
@@ -385,6 +489,16 @@ loadexec(char *path, vaddr_t *entrypoint, vaddr_t *stackptr)
 		return result;
         }
 
+	/* Put the argv on the stack */
+	result = argbuf_map(args, newvm, stackptr, argc_ret, uargv_ret);
+	if (result) {
+		proc_setas(oldvm);
+		as_activate();
+		as_destroy(newvm);
+		kfree(newname);
+		return result;
+	}
+
 	/*
 	 * Wipe out old address space.
 	 *
@@ -518,20 +632,21 @@ runprogram(char *progname)
 		return result;
 	}
 
-	/* Load the executable. Note: must not fail after this succeeds. */
-	result = loadexec(progname, &entrypoint, &stackptr);
+	result = argbuf_prepare(&kargv);
 	if (result) {
 		argbuf_cleanup(&kargv);
 		return result;
 	}
 
-	result = argbuf_copyout(&kargv, &stackptr, &argc, &uargv);
+	/* Load the executable. Note: must not fail after this succeeds. */
+	result = loadexec(progname, &kargv, &entrypoint, &stackptr,
+			  &argc, &uargv);
 	if (result) {
-		/* If copyout fails, *we* messed up, so panic */
-		panic("execv: copyout_args failed: %s\n", strerror(result));
+		argbuf_cleanup(&kargv);
+		return result;
 	}
 
-	/* free the space */
+	/* release the throttle (the pages now belong to the process) */
 	argbuf_cleanup(&kargv);
 
 	/* Warp to user mode. */
@@ -546,10 +661,13 @@ runprogram(char *progname)
  * execv.
  *
  * 1. Copy in the program name.
- * 2. Copy in the argv with copyin_args.
- * 3. Load the executable.
- * 4. Copy the argv out again with copyout_args.
- * 5. Warp to usermode.
+ * 2. Copy in the argv with argbuf_fromuser, straight into pages
+ *    laid out as the top of the new user stack.
+ * 3. Load the executable and hand it the argv pages.
+ * 4. Warp to usermode.
+ *
+ * Not allowed while the process has other threads, which would be
+ * left running in an address space that's gone.
  */
 int
 sys_execv(userptr_t prog, userptr_t uargv)
@@ -560,6 +678,10 @@ sys_execv(userptr_t prog, userptr_t uargv)
 	int argc;
 	int result;
 
+	if (proc_nthreads(curproc) > 1) {
+		return EBUSY;
+	}
+
 	path = kmalloc(PATH_MAX);
 	if (!path) {
 		return ENOMEM;
@@ -583,25 +705,29 @@ sys_execv(userptr_t prog, userptr_t uargv)
 		return result;
 	}
 
-	/* Load the executable. Note: must not fail after this succeeds. */
-	result = loadexec(path, &entrypoint, &stackptr);
+	result = argbuf_prepare(&kargv);
 	if (result) {
 		argbuf_cleanup(&kargv);
 		kfree(path);
 		return result;
 	}
 
-	/* don't need this any more */
-	kfree(path);
-
-	/* Send the argv strings to the process. */
-	result = argbuf_copyout(&kargv, &stackptr, &argc, &uargv);
+	/*
+	 * Load the executable and hand it the argv pages. Note: must
+	 * not fail after this succeeds.
+	 */
+	result = loadexec(path, &kargv, &entrypoint, &stackptr,
+			  &argc, &uargv);
 	if (result) {
-		/* if copyout fails, *we* messed up, so panic */
-		panic("execv: copyout_args failed: %s\n", strerror(result));
+		argbuf_cleanup(&kargv);
+		kfree(path);
+		return result;
 	}
 
-	/* free the argv buffer space */
+	/* don't need this any more */
+	kfree(path);
+
+	/* release the throttle (the pages now belong to the process) */
 	argbuf_cleanup(&kargv);
 
 	/* Warp to user mode. */
@@ -28,6 +28,7 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <clock.h>
 #include <copyinout.h>
 #include <syscall.h>
@@ -56,3 +57,45 @@ sys___time(userptr_t user_seconds_ptr, userptr_t user_nanoseconds_ptr)
 
 	return 0;
 }
+
+/* Longest single clocksleep_ticks call nanosleep makes: one day. */
+#define NANOSLEEP_CHUNK	(24 * 60 * 60 * HZ)
+
+/*
+ * Sleep for the requested time, in whole hardclocks (rounded up; see
+ * timespec_ticks). Nothing interrupts the sleep, so the time
+ * remaining is always zero.
+ */
+int
+sys_nanosleep(const_userptr_t user_req, userptr_t user_rem)
+{
+	struct timespec ts;
+	uint64_t ticks;
+	unsigned chunk;
+	int result;
+
+	result = copyin(user_req, &ts, sizeof(ts));
+	if (result) {
+		return result;
+	}
+	if (ts.tv_sec < 0 || ts.tv_nsec < 0 || ts.tv_nsec >= 1000000000) {
+		return EINVAL;
+	}
+
+	ticks = timespec_ticks(&ts);
+	while (ticks > 0) {
+		chunk = ticks > NANOSLEEP_CHUNK ? NANOSLEEP_CHUNK : ticks;
+		clocksleep_ticks(chunk);
+		ticks -= chunk;
+	}
+
+	if (user_rem != NULL) {
+		ts.tv_sec = 0;
+		ts.tv_nsec = 0;
+		result = copyout(&ts, user_rem, sizeof(ts));
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
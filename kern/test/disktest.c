@@ -0,0 +1,258 @@
+/*
+ * Copyright (c) 2016
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Disk queue test. Several threads do random reads and writes of
+ * short runs of sectors on a raw disk at once, so that requests pile
+ * up in the driver's queue and get reordered. Each thread owns one
+ * slice of the disk, so it can check everything it reads back: each
+ * sector is stamped with its own number and the writing thread and
+ * pass, and a sector that comes back from the wrong place or from a
+ * stale write is caught. Prints the driver's queue statistics at the
+ * end.
+ *
+ * This overwrites the disk. Give it the raw device (e.g. lhd1raw:),
+ * and don't run it on a disk that is mounted; nothing stops that.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/stat.h>
+#include <lib.h>
+#include <uio.h>
+#include <clock.h>
+#include <thread.h>
+#include <synch.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <lamebus/lhd.h>
+#include <test.h>
+
+#define DT_SECTSIZE	512		/* bytes per sector */
+#define DT_MAXRUN	4		/* longest run of sectors per request */
+#define DT_OPS		64		/* requests per thread */
+#define DT_MAXTHREADS	16
+#define DT_WORDS	(DT_SECTSIZE / sizeof(uint32_t))
+
+static struct vnode *dt_vn;
+static uint32_t dt_nsect;		/* sectors on the disk */
+static unsigned dt_nthreads;
+static unsigned dt_errors[DT_MAXTHREADS];
+static struct semaphore *dt_donesem;
+
+/*
+ * Fill (or check) a run of sectors. Word 0 of each sector is its
+ * sector number, word 1 the thread, word 2 the pass, and the rest
+ * is derived from those.
+ */
+static
+void
+dt_stamp(uint32_t *buf, uint32_t sect, unsigned nsect,
+	 unsigned num, unsigned pass)
+{
+	unsigned i, j;
+
+	for (i=0; i<nsect; i++) {
+		for (j=0; j<DT_WORDS; j++) {
+			buf[i*DT_WORDS + j] = (sect + i) * 2654435761U +
+				num * 40503 + pass * 131 + j;
+		}
+		buf[i*DT_WORDS + 0] = sect + i;
+		buf[i*DT_WORDS + 1] = num;
+		buf[i*DT_WORDS + 2] = pass;
+	}
+}
+
+static
+int
+dt_io(void *buf, uint32_t sect, unsigned nsect, enum uio_rw rw)
+{
+	struct iovec iov;
+	struct uio ku;
+	int err;
+
+	uio_kinit(&iov, &ku, buf, nsect * DT_SECTSIZE,
+		  (off_t)sect * DT_SECTSIZE, rw);
+	if (rw == UIO_READ) {
+		err = VOP_READ(dt_vn, &ku);
+	}
+	else {
+		err = VOP_WRITE(dt_vn, &ku);
+	}
+	if (err == 0 && ku.uio_resid > 0) {
+		err = EIO;
+	}
+	return err;
+}
+
+static
+void
+dt_thread(void *junk, unsigned long num)
+{
+	uint32_t *wbuf, *rbuf;
+	uint32_t base, size, sect;
+	unsigned pass, nsect, i;
+	int err;
+
+	(void)junk;
+
+	wbuf = kmalloc(DT_MAXRUN * DT_SECTSIZE);
+	rbuf = kmalloc(DT_MAXRUN * DT_SECTSIZE);
+	if (wbuf == NULL || rbuf == NULL) {
+		panic("disktest: Out of memory\n");
+	}
+
+	/* This thread's slice of the disk */
+	size = dt_nsect / dt_nthreads;
+	base = num * size;
+
+	for (pass=0; pass<DT_OPS; pass++) {
+		nsect = 1 + random() % DT_MAXRUN;
+		sect = base + random() % (size - nsect + 1);
+
+		dt_stamp(wbuf, sect, nsect, num, pass);
+		err = dt_io(wbuf, sect, nsect, UIO_WRITE);
+		if (err) {
+			kprintf("disktest: thread %lu: write of %u at %u: "
+				"%s\n", num, nsect, sect, strerror(err));
+			dt_errors[num]++;
+			continue;
+		}
+
+		/* Let the other threads' requests get in between. */
+		thread_yield();
+
+		err = dt_io(rbuf, sect, nsect, UIO_READ);
+		if (err) {
+			kprintf("disktest: thread %lu: read of %u at %u: "
+				"%s\n", num, nsect, sect, strerror(err));
+			dt_errors[num]++;
+			continue;
+		}
+		for (i=0; i<nsect * DT_WORDS; i++) {
+			if (rbuf[i] != wbuf[i]) {
+				kprintf("disktest: thread %lu: sector %u "
+					"word %u: got 0x%x, expected 0x%x\n",
+					num, sect + i / DT_WORDS,
+					i % DT_WORDS, rbuf[i], wbuf[i]);
+				dt_errors[num]++;
+				break;
+			}
+		}
+	}
+
+	kfree(rbuf);
+	kfree(wbuf);
+	V(dt_donesem);
+}
+
+int
+disktest(int nargs, char **args)
+{
+	struct timespec before, after, diff;
+	struct stat st;
+	unsigned i, nbad;
+	int err;
+
+	dt_nthreads = 8;
+	if (nargs == 3) {
+		dt_nthreads = atoi(args[2]);
+	}
+	else if (nargs != 2) {
+		kprintf("Usage: dqt rawdevice: [nthreads]\n");
+		return EINVAL;
+	}
+	if (dt_nthreads < 1 || dt_nthreads > DT_MAXTHREADS) {
+		kprintf("disktest: nthreads must be 1-%u\n", DT_MAXTHREADS);
+		return EINVAL;
+	}
+
+	/* vfs_open destroys the string it's passed; args[1] is ours */
+	err = vfs_open(args[1], O_RDWR, 0, &dt_vn);
+	if (err) {
+		kprintf("disktest: open: %s\n", strerror(err));
+		return err;
+	}
+	err = VOP_STAT(dt_vn, &st);
+	if (err) {
+		kprintf("disktest: stat: %s\n", strerror(err));
+		vfs_close(dt_vn);
+		return err;
+	}
+	dt_nsect = st.st_size / DT_SECTSIZE;
+	if (dt_nsect < dt_nthreads * DT_MAXRUN) {
+		kprintf("disktest: not a disk, or too small\n");
+		vfs_close(dt_vn);
+		return EINVAL;
+	}
+
+	dt_donesem = sem_create("disktest", 0);
+	if (dt_donesem == NULL) {
+		panic("disktest: Out of memory\n");
+	}
+
+	kprintf("disktest: %u threads, %u requests each, on %u sectors\n",
+		dt_nthreads, DT_OPS * 2, dt_nsect);
+	lhd_resetstats();
+	gettime(&before);
+	for (i=0; i<dt_nthreads; i++) {
+		dt_errors[i] = 0;
+		err = thread_fork("disktest", NULL, dt_thread, NULL, i);
+		if (err) {
+			panic("disktest: thread_fork failed: %s\n",
+			      strerror(err));
+		}
+	}
+	nbad = 0;
+	for (i=0; i<dt_nthreads; i++) {
+		P(dt_donesem);
+	}
+	gettime(&after);
+	for (i=0; i<dt_nthreads; i++) {
+		nbad += dt_errors[i];
+	}
+
+	timespec_sub(&after, &before, &diff);
+	kprintf("disktest: %u requests in %llu.%09lu seconds\n",
+		dt_nthreads * DT_OPS * 2, (unsigned long long) diff.tv_sec,
+		(unsigned long) diff.tv_nsec);
+	lhd_printstats();
+
+	sem_destroy(dt_donesem);
+	dt_donesem = NULL;
+	vfs_close(dt_vn);
+	dt_vn = NULL;
+
+	if (nbad > 0) {
+		kprintf("disktest: FAILED (%u errors)\n", nbad);
+		return EIO;
+	}
+	kprintf("disktest: passed\n");
+	return 0;
+}
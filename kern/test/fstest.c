@@ -41,23 +41,40 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <kern/fcntl.h>
+#include <kern/stat.h>
 #include <lib.h>
+#include <clock.h>
 #include <uio.h>
 #include <thread.h>
 #include <synch.h>
 #include <vfs.h>
 #include <fs.h>
 #include <vnode.h>
+#include <namecache.h>
+#include <buf.h>
+#include <sfs.h>
 #include <test.h>
 
+#include "opt-sfs.h"
+
 #define SLOGAN   "HODIE MIHI - CRAS TIBI\n"
 #define FILENAME "fstest.tmp"
 #define NCHUNKS  720
 #define NTHREADS 12
 #define NLONG    32
 #define NCREATE  24
+#define NRABLOCKS 128	/* blocks in each read-ahead test file */
+#define RACHUNK  1000	/* read size for the read-ahead test */
+#define NBIGDIR  300	/* entries in the big-directory test */
+#define NNSNAMES 16	/* names shared by the namespace stress threads */
+#define NNSOPS   200	/* operations per namespace stress thread */
+#define NILFILES 4	/* writers in the interleaved write test */
+#define NILBLOCKS 64	/* blocks each of them writes */
+#define NFWBLOCKS 40	/* blocks per file in the freemap writeback test */
+#define NVNHASH  3000	/* files held open in the vnode hash test */
 
 static struct semaphore *threadsem = NULL;
+static unsigned threaderrors[NTHREADS];	/* failures, for tests that count */
 
 static
 void
@@ -674,6 +691,1039 @@ docreatestress(const char *filesys)
 
 ////////////////////////////////////////////////////////////
 
+/*
+ * Pattern files. Byte OFF of the file tagged TAG is a function of
+ * TAG, the block OFF is in, and where in the block it is, so a block
+ * that turns up in the wrong place (or the wrong file) is caught.
+ */
+static
+char
+patternbyte(unsigned tag, off_t off)
+{
+	return (char)(tag + (off / 512) * 31 + (off % 512));
+}
+
+/*
+ * Write a pattern file NBLOCKS blocks long. If INTERLEAVE is set,
+ * yield after each block so concurrent writers take turns. Returns 0
+ * or an error.
+ */
+static
+int
+fstest_writepattern(const char *fs, const char *namesuffix, unsigned tag,
+		    unsigned nblocks, bool interleave)
+{
+	char name[32];
+	struct vnode *vn;
+	struct iovec iov;
+	struct uio ku;
+	char *data;
+	off_t pos;
+	unsigned i;
+	int err;
+
+	data = kmalloc(512);
+	if (data == NULL) {
+		return ENOMEM;
+	}
+
+	MAKENAME();
+	err = vfs_open(name, O_WRONLY|O_CREAT|O_TRUNC, 0664, &vn);
+	if (err) {
+		kprintf("Could not open %s:%s%s for write: %s\n",
+			fs, FILENAME, namesuffix, strerror(err));
+		kfree(data);
+		return err;
+	}
+
+	for (pos = 0; pos < (off_t)nblocks * 512; pos += 512) {
+		for (i=0; i<512; i++) {
+			data[i] = patternbyte(tag, pos + i);
+		}
+		uio_kinit(&iov, &ku, data, 512, pos, UIO_WRITE);
+		err = VOP_WRITE(vn, &ku);
+		if (err == 0 && ku.uio_resid > 0) {
+			err = EIO;
+		}
+		if (err) {
+			kprintf("%s%s: Write error: %s\n", FILENAME,
+				namesuffix, strerror(err));
+			break;
+		}
+		if (interleave) {
+			thread_yield();
+		}
+	}
+	vfs_close(vn);
+	kfree(data);
+	return err;
+}
+
+/*
+ * Read LEN bytes at POS of an open pattern file and check them.
+ * Returns 0, or an error (EIO if the data was wrong).
+ */
+static
+int
+fstest_checkpattern(struct vnode *vn, unsigned tag, off_t pos,
+		    char *data, size_t len)
+{
+	struct iovec iov;
+	struct uio ku;
+	size_t i;
+	int err;
+
+	uio_kinit(&iov, &ku, data, len, pos, UIO_READ);
+	err = VOP_READ(vn, &ku);
+	if (err) {
+		kprintf("Read error at %lld: %s\n", pos, strerror(err));
+		return err;
+	}
+	if (ku.uio_resid > 0) {
+		kprintf("Short read at %lld\n", pos);
+		return EIO;
+	}
+	for (i=0; i<len; i++) {
+		if (data[i] != patternbyte(tag, pos + i)) {
+			kprintf("Wrong data at %lld\n", pos + (off_t)i);
+			return EIO;
+		}
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Read-ahead test. Writes two files each bigger than half the buffer
+ * cache, so that the first is mostly evicted by the time it's read
+ * back. Then reads it sequentially in odd-sized pieces (which should
+ * set off read-ahead), and then backwards a block at a time (which
+ * should wind it down again), checking the data both times.
+ */
+static
+void
+doreadahead(const char *filesys)
+{
+	char name[32];
+	struct vnode *vn;
+	char *data;
+	unsigned ra0, hit0, ra1, hit1;
+	off_t pos, size;
+	size_t len;
+	int err;
+
+	kprintf("*** Starting fs read-ahead test on %s:\n", filesys);
+
+	if (fstest_writepattern(filesys, "ra0", 1, NRABLOCKS, false) ||
+	    fstest_writepattern(filesys, "ra1", 2, NRABLOCKS, false)) {
+		kprintf("*** fs read-ahead test failed\n");
+		return;
+	}
+
+	data = kmalloc(RACHUNK);
+	if (data == NULL) {
+		kprintf("*** fs read-ahead test: Out of memory\n");
+		return;
+	}
+
+	fstest_makename(name, sizeof(name), filesys, "ra0");
+	err = vfs_open(name, O_RDONLY, 0664, &vn);
+	if (err) {
+		kprintf("Could not open %s:%sra0 for read: %s\n", filesys,
+			FILENAME, strerror(err));
+		kfree(data);
+		return;
+	}
+
+	size = NRABLOCKS * 512;
+	buf_getrastats(&ra0, &hit0);
+	for (pos = 0; err == 0 && pos < size; pos += len) {
+		len = size - pos < RACHUNK ? size - pos : RACHUNK;
+		err = fstest_checkpattern(vn, 1, pos, data, len);
+	}
+	buf_getrastats(&ra1, &hit1);
+
+	for (pos = size - 512; err == 0 && pos >= 0; pos -= 512) {
+		err = fstest_checkpattern(vn, 1, pos, data, 512);
+	}
+	vfs_close(vn);
+	kfree(data);
+
+	fstest_remove(filesys, "ra0");
+	fstest_remove(filesys, "ra1");
+
+	kprintf("fs7: %u blocks read ahead, %u of them used\n",
+		ra1 - ra0, hit1 - hit0);
+	if (err) {
+		kprintf("*** fs read-ahead test failed\n");
+		return;
+	}
+	if (ra1 == ra0) {
+		kprintf("*** fs read-ahead test failed: no read-ahead\n");
+		return;
+	}
+	kprintf("*** fs read-ahead test done\n");
+}
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Open and close a file, returning the error from vfs_open.
+ */
+static
+int
+fstest_tryopen(const char *fs, const char *namesuffix, int flags)
+{
+	char name[32];
+	struct vnode *vn;
+	int err;
+
+	MAKENAME();
+	err = vfs_open(name, flags, 0664, &vn);
+	if (err == 0) {
+		vfs_close(vn);
+	}
+	return err;
+}
+
+/*
+ * Get the size of the filesystem's root directory.
+ */
+static
+int
+fstest_rootsize(const char *fs, off_t *ret)
+{
+	char name[32];
+	struct vnode *vn;
+	struct stat st;
+	int err;
+
+	snprintf(name, sizeof(name), "%s:", fs);
+	err = vfs_lookup(name, &vn);
+	if (err) {
+		return err;
+	}
+	err = VOP_STAT(vn, &st);
+	VOP_DECREF(vn);
+	*ret = st.st_size;
+	return err;
+}
+
+/*
+ * Big-directory test. Fills the root directory (SFS has no others)
+ * with more entries than the name cache holds, so that lookups go to
+ * the filesystem, and times looking them all up. Then removes every
+ * other one, checks that the right ones are gone, creates them again
+ * (which should reuse the freed slots rather than grow the
+ * directory), renames everything, and cleans up.
+ */
+static
+void
+dobigdir(const char *filesys)
+{
+	char suffix[16], suffix2[16];
+	char name[32], name2[32];
+	struct timespec before, after, diff;
+	off_t size0, size1;
+	unsigned i, nbad;
+	int err;
+
+	kprintf("*** Starting fs big directory test on %s:\n", filesys);
+
+	nbad = 0;
+	for (i=0; i<NBIGDIR; i++) {
+		snprintf(suffix, sizeof(suffix), "bd%u", i);
+		err = fstest_tryopen(filesys, suffix,
+				     O_WRONLY|O_CREAT|O_EXCL);
+		if (err) {
+			kprintf("Create %s: %s\n", suffix, strerror(err));
+			nbad++;
+		}
+	}
+
+	gettime(&before);
+	for (i=0; i<NBIGDIR; i++) {
+		snprintf(suffix, sizeof(suffix), "bd%u", i);
+		err = fstest_tryopen(filesys, suffix, O_RDONLY);
+		if (err) {
+			kprintf("Lookup %s: %s\n", suffix, strerror(err));
+			nbad++;
+		}
+	}
+	gettime(&after);
+	timespec_sub(&after, &before, &diff);
+	kprintf("fs8: %u lookups in %llu.%09lu seconds\n", NBIGDIR,
+		(unsigned long long) diff.tv_sec,
+		(unsigned long) diff.tv_nsec);
+
+	err = fstest_rootsize(filesys, &size0);
+	if (err) {
+		kprintf("Stat root directory: %s\n", strerror(err));
+		nbad++;
+	}
+
+	for (i=0; i<NBIGDIR; i+=2) {
+		snprintf(suffix, sizeof(suffix), "bd%u", i);
+		if (fstest_remove(filesys, suffix)) {
+			nbad++;
+		}
+	}
+	for (i=0; i<NBIGDIR; i++) {
+		snprintf(suffix, sizeof(suffix), "bd%u", i);
+		err = fstest_tryopen(filesys, suffix, O_RDONLY);
+		if (i % 2 == 0 && err != ENOENT) {
+			kprintf("%s: still there after remove\n", suffix);
+			nbad++;
+		}
+		else if (i % 2 == 1 && err != 0) {
+			kprintf("Lookup %s: %s\n", suffix, strerror(err));
+			nbad++;
+		}
+	}
+
+	for (i=0; i<NBIGDIR; i++) {
+		snprintf(suffix, sizeof(suffix), "bd%u", i);
+		err = fstest_tryopen(filesys, suffix,
+				     O_WRONLY|O_CREAT|O_EXCL);
+		if (i % 2 == 0 && err != 0) {
+			kprintf("Re-create %s: %s\n", suffix,
+				strerror(err));
+			nbad++;
+		}
+		else if (i % 2 == 1 && err != EEXIST) {
+			kprintf("%s: exclusive create did not fail\n",
+				suffix);
+			nbad++;
+		}
+	}
+
+	err = fstest_rootsize(filesys, &size1);
+	if (err == 0 && size1 != size0) {
+		kprintf("Directory grew from %lld to %lld bytes on "
+			"re-create\n", size0, size1);
+		nbad++;
+	}
+
+	for (i=0; i<NBIGDIR; i++) {
+		snprintf(suffix, sizeof(suffix), "bd%u", i);
+		snprintf(suffix2, sizeof(suffix2), "bg%u", i);
+		fstest_makename(name, sizeof(name), filesys, suffix);
+		fstest_makename(name2, sizeof(name2), filesys, suffix2);
+		err = vfs_rename(name, name2);
+		if (err) {
+			kprintf("Rename %s: %s\n", suffix, strerror(err));
+			nbad++;
+			continue;
+		}
+		if (fstest_tryopen(filesys, suffix, O_RDONLY) != ENOENT ||
+		    fstest_tryopen(filesys, suffix2, O_RDONLY) != 0) {
+			kprintf("%s: wrong after rename\n", suffix);
+			nbad++;
+		}
+	}
+
+	for (i=0; i<NBIGDIR; i++) {
+		snprintf(suffix, sizeof(suffix), "bg%u", i);
+		if (fstest_remove(filesys, suffix)) {
+			nbad++;
+		}
+	}
+	if (nbad > 0) {
+		kprintf("*** fs big directory test failed (%u errors)\n",
+			nbad);
+		return;
+	}
+	kprintf("*** fs big directory test done\n");
+}
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Look up a name and check that the result is WANT (0 or an error).
+ * Returns 0 if so and 1 if not, for counting failures.
+ */
+static
+unsigned
+fstest_expect(const char *fs, const char *namesuffix, int want)
+{
+	int err;
+
+	err = fstest_tryopen(fs, namesuffix, O_RDONLY);
+	if (err != want) {
+		kprintf("Lookup %s: got %s, expected %s\n", namesuffix,
+			err ? strerror(err) : "success",
+			want ? strerror(want) : "success");
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * Rename within the test directory.
+ */
+static
+int
+fstest_rename(const char *fs, const char *from, const char *to)
+{
+	char name[32], name2[32];
+	int err;
+
+	fstest_makename(name, sizeof(name), fs, from);
+	fstest_makename(name2, sizeof(name2), fs, to);
+	err = vfs_rename(name, name2);
+	if (err) {
+		kprintf("Rename %s to %s: %s\n", from, to, strerror(err));
+	}
+	return err;
+}
+
+/*
+ * Name cache test. Each step first looks names up so that they (or
+ * their absence) get cached, then changes the directory and checks
+ * that lookups see the change rather than the cached answer.
+ */
+static
+void
+donamecachetest(const char *filesys)
+{
+	char name[32];
+	struct vnode *vn1, *vn2;
+	unsigned nbad;
+	int err;
+
+	kprintf("*** Starting fs name cache test on %s:\n", filesys);
+	nbad = 0;
+
+	/* A negative entry must go away when the name is created. */
+	nbad += fstest_expect(filesys, "nc1", ENOENT);
+	if (fstest_tryopen(filesys, "nc1", O_WRONLY|O_CREAT|O_EXCL)) {
+		kprintf("Could not create nc1\n");
+		nbad++;
+	}
+	nbad += fstest_expect(filesys, "nc1", 0);
+
+	/*
+	 * Renaming onto a name that was just removed must replace its
+	 * entry. (SFS won't rename over an existing file.)
+	 */
+	if (fstest_tryopen(filesys, "nc2", O_WRONLY|O_CREAT|O_EXCL)) {
+		kprintf("Could not create nc2\n");
+		nbad++;
+	}
+	nbad += fstest_expect(filesys, "nc2", 0);
+	if (fstest_remove(filesys, "nc2")) {
+		nbad++;
+	}
+	fstest_makename(name, sizeof(name), filesys, "nc1");
+	err = vfs_lookup(name, &vn1);
+	if (err) {
+		kprintf("Lookup nc1: %s\n", strerror(err));
+		vn1 = NULL;
+		nbad++;
+	}
+	if (fstest_rename(filesys, "nc1", "nc2")) {
+		nbad++;
+	}
+	nbad += fstest_expect(filesys, "nc1", ENOENT);
+	fstest_makename(name, sizeof(name), filesys, "nc2");
+	err = vfs_lookup(name, &vn2);
+	if (err) {
+		kprintf("Lookup nc2: %s\n", strerror(err));
+		nbad++;
+	}
+	else {
+		if (vn2 != vn1) {
+			kprintf("nc2 is not the renamed file\n");
+			nbad++;
+		}
+		VOP_DECREF(vn2);
+	}
+	if (vn1 != NULL) {
+		VOP_DECREF(vn1);
+	}
+
+	/* Removing must leave a miss, not the old file. */
+	if (fstest_remove(filesys, "nc2")) {
+		nbad++;
+	}
+	nbad += fstest_expect(filesys, "nc2", ENOENT);
+
+	/*
+	 * Names under a renamed directory must move with it. SFS has no
+	 * subdirectories, so this part only runs where mkdir works.
+	 */
+	fstest_makename(name, sizeof(name), filesys, "ncd");
+	err = vfs_mkdir(name, 0775);
+	if (err == ENOSYS) {
+		kprintf("fs9: no subdirectories on %s; skipping that part\n",
+			filesys);
+		goto done;
+	}
+	if (err) {
+		kprintf("Could not create directory ncd: %s\n",
+			strerror(err));
+		nbad++;
+		goto done;
+	}
+	if (fstest_tryopen(filesys, "ncd/f", O_WRONLY|O_CREAT|O_EXCL)) {
+		kprintf("Could not create ncd/f\n");
+		nbad++;
+	}
+	nbad += fstest_expect(filesys, "ncd/f", 0);
+	nbad += fstest_expect(filesys, "nce/f", ENOENT);
+	if (fstest_rename(filesys, "ncd", "nce")) {
+		nbad++;
+	}
+	nbad += fstest_expect(filesys, "ncd/f", ENOENT);
+	nbad += fstest_expect(filesys, "nce/f", 0);
+
+	/* And nothing must be found in a removed directory. */
+	if (fstest_remove(filesys, "nce/f")) {
+		nbad++;
+	}
+	fstest_makename(name, sizeof(name), filesys, "nce");
+	if (vfs_rmdir(name)) {
+		kprintf("Could not remove directory nce\n");
+		nbad++;
+	}
+	nbad += fstest_expect(filesys, "nce/f", ENOENT);
+	nbad += fstest_expect(filesys, "nce", ENOENT);
+
+ done:
+	if (nbad > 0) {
+		kprintf("*** fs name cache test failed (%u errors)\n", nbad);
+		return;
+	}
+	kprintf("*** fs name cache test done\n");
+}
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Namespace stress. All the threads create, remove, rename, and read
+ * files drawn from one small set of names, so that they keep racing
+ * each other on the same directory entries. Losing a race gives an
+ * expected error (ENOENT or EEXIST); anything else, or a file with
+ * the wrong contents, is a failure. Afterwards every name should be
+ * either a whole file or absent, and removing them all should leave
+ * none behind.
+ */
+static
+int
+nsstress_create(const char *fs, const char *namesuffix)
+{
+	char name[32];
+	struct vnode *vn;
+	struct iovec iov;
+	struct uio ku;
+	char buf[32];
+	int err;
+
+	MAKENAME();
+	err = vfs_open(name, O_WRONLY|O_CREAT|O_EXCL, 0664, &vn);
+	if (err) {
+		return err;
+	}
+	strcpy(buf, SLOGAN);
+	uio_kinit(&iov, &ku, buf, strlen(SLOGAN), 0, UIO_WRITE);
+	err = VOP_WRITE(vn, &ku);
+	vfs_close(vn);
+	if (err == 0 && ku.uio_resid > 0) {
+		err = EIO;
+	}
+	return err;
+}
+
+static
+int
+nsstress_read(const char *fs, const char *namesuffix)
+{
+	char name[32];
+	struct vnode *vn;
+	struct iovec iov;
+	struct uio ku;
+	char buf[32];
+	size_t len;
+	int err;
+
+	MAKENAME();
+	err = vfs_open(name, O_RDONLY, 0664, &vn);
+	if (err) {
+		return err;
+	}
+	uio_kinit(&iov, &ku, buf, sizeof(buf) - 1, 0, UIO_READ);
+	err = VOP_READ(vn, &ku);
+	vfs_close(vn);
+	if (err) {
+		return err;
+	}
+
+	/* Empty is all right: the creator may not have written yet. */
+	len = sizeof(buf) - 1 - ku.uio_resid;
+	buf[len] = 0;
+	if (len > 0 && strcmp(buf, SLOGAN) != 0) {
+		kprintf("%s: wrong contents\n", namesuffix);
+		return EIO;
+	}
+	return 0;
+}
+
+static
+void
+nsstress_thread(void *fs, unsigned long num)
+{
+	const char *filesys = fs;
+	char suffix[16], suffix2[16];
+	char name[32], name2[32];
+	unsigned i, a, b;
+	int err;
+
+	threaderrors[num] = 0;
+	for (i=0; i<NNSOPS; i++) {
+		a = random() % NNSNAMES;
+		snprintf(suffix, sizeof(suffix), "ns%u", a);
+		switch (random() % 4) {
+		    case 0:
+			err = nsstress_create(filesys, suffix);
+			if (err == EEXIST) {
+				err = 0;
+			}
+			break;
+		    case 1:
+			fstest_makename(name, sizeof(name), filesys, suffix);
+			err = vfs_remove(name);
+			if (err == ENOENT) {
+				err = 0;
+			}
+			break;
+		    case 2:
+			b = (a + 1 + random() % (NNSNAMES - 1)) % NNSNAMES;
+			snprintf(suffix2, sizeof(suffix2), "ns%u", b);
+			fstest_makename(name, sizeof(name), filesys, suffix);
+			fstest_makename(name2, sizeof(name2), filesys,
+					suffix2);
+			err = vfs_rename(name, name2);
+			if (err == ENOENT || err == EEXIST) {
+				err = 0;
+			}
+			break;
+		    default:
+			err = nsstress_read(filesys, suffix);
+			if (err == ENOENT) {
+				err = 0;
+			}
+			break;
+		}
+		if (err) {
+			kprintf("Thread %lu: %s: %s\n", num, suffix,
+				strerror(err));
+			threaderrors[num]++;
+		}
+	}
+	kprintf("Thread %lu: %u operations, %u errors\n", num, NNSOPS,
+		threaderrors[num]);
+
+	V(threadsem);
+}
+
+static
+void
+donsstress(const char *filesys)
+{
+	char suffix[16];
+	unsigned i, nbad, nleft;
+	int err;
+
+	init_threadsem();
+
+	kprintf("*** Starting fs namespace stress test on %s:\n", filesys);
+
+	for (i=0; i<NTHREADS; i++) {
+		err = thread_fork("nsstress", NULL,
+				  nsstress_thread, (char *)filesys, i);
+		if (err) {
+			panic("nsstress: thread_fork failed %s\n",
+			      strerror(err));
+		}
+	}
+
+	nbad = 0;
+	for (i=0; i<NTHREADS; i++) {
+		P(threadsem);
+	}
+	for (i=0; i<NTHREADS; i++) {
+		nbad += threaderrors[i];
+	}
+
+	nleft = 0;
+	for (i=0; i<NNSNAMES; i++) {
+		snprintf(suffix, sizeof(suffix), "ns%u", i);
+		err = nsstress_read(filesys, suffix);
+		if (err == ENOENT) {
+			continue;
+		}
+		if (err) {
+			kprintf("%s: %s\n", suffix, strerror(err));
+			nbad++;
+		}
+		nleft++;
+		if (fstest_remove(filesys, suffix)) {
+			nbad++;
+		}
+		nbad += fstest_expect(filesys, suffix, ENOENT);
+	}
+	kprintf("fs10: %u files left over and removed\n", nleft);
+
+	if (nbad > 0) {
+		kprintf("*** fs namespace stress test failed (%u errors)\n",
+			nbad);
+		return;
+	}
+	kprintf("*** fs namespace stress test done\n");
+}
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Interleaved write test. Several threads each write a file a block
+ * at a time, yielding after every block, which is the worst case for
+ * keeping each file's blocks together on disk. The files are left
+ * behind so the result can be looked at with dumpsfs (whose
+ * "Fragments" line counts the runs of consecutive blocks in each
+ * file); testscripts/fsimage.py does this. Each file is also read
+ * back and checked.
+ */
+static
+void
+interleave_thread(void *fs, unsigned long num)
+{
+	const char *filesys = fs;
+	char suffix[16];
+	char name[32];
+	struct vnode *vn;
+	char *data;
+	off_t pos;
+	int err;
+
+	snprintf(suffix, sizeof(suffix), "il%lu", num);
+	err = fstest_writepattern(filesys, suffix, num, NILBLOCKS, true);
+	if (err) {
+		threaderrors[num]++;
+		V(threadsem);
+		return;
+	}
+
+	data = kmalloc(512);
+	if (data == NULL) {
+		kprintf("%s: Out of memory\n", suffix);
+		threaderrors[num]++;
+		V(threadsem);
+		return;
+	}
+	fstest_makename(name, sizeof(name), filesys, suffix);
+	err = vfs_open(name, O_RDONLY, 0664, &vn);
+	if (err) {
+		kprintf("Could not open %s for read: %s\n", suffix,
+			strerror(err));
+		threaderrors[num]++;
+	}
+	else {
+		for (pos = 0; pos < NILBLOCKS * 512; pos += 512) {
+			if (fstest_checkpattern(vn, num, pos, data, 512)) {
+				threaderrors[num]++;
+				break;
+			}
+		}
+		vfs_close(vn);
+	}
+	kfree(data);
+	V(threadsem);
+}
+
+static
+void
+dointerleave(const char *filesys)
+{
+	unsigned i, nbad;
+	int err;
+
+	init_threadsem();
+
+	kprintf("*** Starting fs interleaved write test on %s:\n", filesys);
+
+	for (i=0; i<NILFILES; i++) {
+		threaderrors[i] = 0;
+		err = thread_fork("interleave", NULL,
+				  interleave_thread, (char *)filesys, i);
+		if (err) {
+			panic("interleave: thread_fork failed %s\n",
+			      strerror(err));
+		}
+	}
+
+	nbad = 0;
+	for (i=0; i<NILFILES; i++) {
+		P(threadsem);
+		nbad += threaderrors[i];
+	}
+
+	kprintf("fs11: %u files of %u blocks left as %s:%sil*\n",
+		NILFILES, NILBLOCKS, filesys, FILENAME);
+	if (nbad > 0) {
+		kprintf("*** fs interleaved write test failed (%u errors)\n",
+			nbad);
+		return;
+	}
+	kprintf("*** fs interleaved write test done\n");
+}
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Write a pattern file, fsync it, and read it back.
+ */
+static
+int
+fstest_writesync(const char *fs, const char *namesuffix, unsigned tag,
+		 unsigned nblocks)
+{
+	char name[32];
+	struct vnode *vn;
+	char *data;
+	off_t pos;
+	int err;
+
+	err = fstest_writepattern(fs, namesuffix, tag, nblocks, false);
+	if (err) {
+		return err;
+	}
+
+	data = kmalloc(512);
+	if (data == NULL) {
+		return ENOMEM;
+	}
+	MAKENAME();
+	err = vfs_open(name, O_RDONLY, 0664, &vn);
+	if (err) {
+		kprintf("Could not open %s for read: %s\n", namesuffix,
+			strerror(err));
+		kfree(data);
+		return err;
+	}
+	err = VOP_FSYNC(vn);
+	if (err) {
+		kprintf("%s: fsync: %s\n", namesuffix, strerror(err));
+	}
+	for (pos = 0; err == 0 && pos < (off_t)nblocks * 512; pos += 512) {
+		err = fstest_checkpattern(vn, tag, pos, data, 512);
+	}
+	vfs_close(vn);
+	kfree(data);
+	return err;
+}
+
+/*
+ * Freemap writeback test. Allocates and frees blocks in a mix of
+ * fsyncs and syncs, so that freemap blocks are written back both
+ * with bits newly set and with bits newly cleared. One file is left
+ * behind; after unmounting, sfsck on the disk image checks that the
+ * freemap on disk matches the blocks actually in use (see
+ * testscripts/fsimage.py).
+ */
+static
+void
+dofreemapsync(const char *filesys)
+{
+	unsigned nbad;
+	int err;
+
+	kprintf("*** Starting fs freemap writeback test on %s:\n",
+		filesys);
+	nbad = 0;
+
+	if (fstest_writesync(filesys, "fw0", 1, NFWBLOCKS)) {
+		nbad++;
+	}
+	if (fstest_writesync(filesys, "fw1", 2, NFWBLOCKS)) {
+		nbad++;
+	}
+	if (fstest_remove(filesys, "fw0")) {
+		nbad++;
+	}
+	err = vfs_sync();
+	if (err) {
+		kprintf("sync: %s\n", strerror(err));
+		nbad++;
+	}
+
+	/* Allocate and free again between syncs. */
+	if (fstest_writepattern(filesys, "fw2", 3, NFWBLOCKS / 2, false)) {
+		nbad++;
+	}
+	if (fstest_remove(filesys, "fw2")) {
+		nbad++;
+	}
+	err = vfs_sync();
+	if (err) {
+		kprintf("sync: %s\n", strerror(err));
+		nbad++;
+	}
+
+	kprintf("fs12: %s:%sfw1 left behind\n", filesys, FILENAME);
+	if (nbad > 0) {
+		kprintf("*** fs freemap writeback test failed (%u errors)\n",
+			nbad);
+		return;
+	}
+	kprintf("*** fs freemap writeback test done\n");
+}
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Count the vnodes loaded on FS, and how many are in its inode hash.
+ */
+static
+int
+fstest_countvnodes(struct fs *fs, unsigned *nloaded, unsigned *nhashed)
+{
+#if OPT_SFS
+	return sfs_countvnodes(fs, nloaded, nhashed);
+#else
+	(void)fs;
+	*nloaded = *nhashed = 0;
+	return EINVAL;
+#endif
+}
+
+/*
+ * Vnode hash test. Creates NVNHASH files and keeps them all open, so
+ * that many vnodes are loaded at once and SFS's inode hash has to
+ * grow to hold them. Then times looking each one up again with
+ * VOP_LOOKUP on the root directory, which skips the name cache so
+ * every lookup goes through sfs_loadvnode, and checks each finds the
+ * vnode already loaded. Finally closes and removes them all and
+ * checks the hash is back down to what it held at the start.
+ */
+static
+void
+dovnhash(const char *filesys)
+{
+	char suffix[16], name[32];
+	struct vnode **vns, *dir, *vn;
+	struct timespec before, after, diff;
+	unsigned i, nopen, nbad, base, nloaded, nhashed;
+	uint64_t nsecs;
+	int err;
+
+	kprintf("*** Starting fs vnode hash test on %s:\n", filesys);
+
+	vns = kmalloc(NVNHASH * sizeof(vns[0]));
+	if (vns == NULL) {
+		kprintf("fs13: Out of memory\n");
+		return;
+	}
+
+	snprintf(name, sizeof(name), "%s:", filesys);
+	err = vfs_lookup(name, &dir);
+	if (err) {
+		kprintf("Lookup %s: %s\n", name, strerror(err));
+		kfree(vns);
+		return;
+	}
+
+	/* Drop the name cache's references so it can't skew the counts. */
+	namecache_purgefs(dir->vn_fs);
+	err = fstest_countvnodes(dir->vn_fs, &base, &nhashed);
+	if (err) {
+		kprintf("fs13: %s: is not an SFS volume\n", filesys);
+		VOP_DECREF(dir);
+		kfree(vns);
+		return;
+	}
+	nbad = 0;
+	if (nhashed != base) {
+		kprintf("fs13: %u vnodes loaded but %u hashed\n",
+			base, nhashed);
+		nbad++;
+	}
+
+	for (nopen=0; nopen<NVNHASH; nopen++) {
+		snprintf(suffix, sizeof(suffix), "vh%u", nopen);
+		fstest_makename(name, sizeof(name), filesys, suffix);
+		err = vfs_open(name, O_RDWR|O_CREAT|O_EXCL, 0664,
+			       &vns[nopen]);
+		if (err) {
+			kprintf("Create %s: %s\n", suffix, strerror(err));
+			nbad++;
+			break;
+		}
+	}
+
+	fstest_countvnodes(dir->vn_fs, &nloaded, &nhashed);
+	kprintf("fs13: %u files open, %u vnodes loaded, %u hashed\n",
+		nopen, nloaded, nhashed);
+	if (nloaded != base + nopen || nhashed != nloaded) {
+		kprintf("fs13: expected %u vnodes loaded and hashed\n",
+			base + nopen);
+		nbad++;
+	}
+
+	gettime(&before);
+	for (i=0; i<nopen; i++) {
+		snprintf(name, sizeof(name), "%svh%u", FILENAME, i);
+		err = VOP_LOOKUP(dir, name, &vn);
+		if (err) {
+			kprintf("Lookup %s: %s\n", name, strerror(err));
+			nbad++;
+			continue;
+		}
+		if (vn != vns[i]) {
+			kprintf("Lookup %s: found a different vnode\n",
+				name);
+			nbad++;
+		}
+		VOP_DECREF(vn);
+	}
+	gettime(&after);
+	timespec_sub(&after, &before, &diff);
+	kprintf("fs13: %u lookups in %llu.%09lu seconds\n", nopen,
+		(unsigned long long) diff.tv_sec,
+		(unsigned long) diff.tv_nsec);
+	if (nopen > 0) {
+		nsecs = diff.tv_sec * 1000000000ULL + diff.tv_nsec;
+		kprintf("fs13: %llu ns per lookup\n",
+			(unsigned long long) (nsecs / nopen));
+	}
+
+	for (i=0; i<nopen; i++) {
+		vfs_close(vns[i]);
+		snprintf(suffix, sizeof(suffix), "vh%u", i);
+		if (fstest_remove(filesys, suffix)) {
+			nbad++;
+		}
+	}
+
+	namecache_purgefs(dir->vn_fs);
+	fstest_countvnodes(dir->vn_fs, &nloaded, &nhashed);
+	if (nloaded != base || nhashed != base) {
+		kprintf("fs13: after removing, %u vnodes loaded and %u "
+			"hashed, expected %u\n", nloaded, nhashed, base);
+		nbad++;
+	}
+
+	VOP_DECREF(dir);
+	kfree(vns);
+	if (nbad > 0) {
+		kprintf("*** fs vnode hash test failed (%u errors)\n", nbad);
+		return;
+	}
+	kprintf("*** fs vnode hash test done\n");
+}
+
+////////////////////////////////////////////////////////////
+
 static
 int
 checkfilesystem(int nargs, char **args)
@@ -681,7 +1731,7 @@ checkfilesystem(int nargs, char **args)
 	char *device;
 
 	if (nargs != 2) {
-		kprintf("Usage: fs[123456] filesystem:\n");
+		kprintf("Usage: fs[1-13] filesystem:\n");
 		return EINVAL;
 	}
 
@@ -714,6 +1764,13 @@ DEFTEST(writestress);
 DEFTEST(writestress2);
 DEFTEST(longstress);
 DEFTEST(createstress);
+DEFTEST(readahead);
+DEFTEST(bigdir);
+DEFTEST(namecachetest);
+DEFTEST(nsstress);
+DEFTEST(interleave);
+DEFTEST(freemapsync);
+DEFTEST(vnhash);
 
 ////////////////////////////////////////////////////////////
 
@@ -0,0 +1,214 @@
+/*
+ * Copyright (c) 2016
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Concurrent lookup benchmark: N threads doing read-mostly lookups
+ * of a small table protected by a plain lock and then by an rwlock,
+ * and of the real pid table.
+ *
+ * Results are printed one per line as
+ *	lookupbench <name><nthreads> <value> ops/s
+ * in the same format as the VM benchmarks.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <thread.h>
+#include <synch.h>
+#include <pid.h>
+#include <test.h>
+
+#define LB_TABLESIZE	64		/* entries in the lookup table */
+#define LB_OPS		4096		/* lookups per thread */
+#define LB_WRITEEVERY	64		/* one update per this many ops */
+#define LB_MAXTHREADS	16
+
+static int lb_table[LB_TABLESIZE];
+static struct lock *lb_lock;
+static struct rwlock *lb_rwlock;
+static struct semaphore *lb_donesem;
+
+enum lbkind {
+	LB_MUTEX,
+	LB_RWLOCK,
+	LB_PID,
+};
+
+static const char *const lb_names[] = {
+	"mutex",
+	"rwlock",
+	"pid",
+};
+#define LB_NKINDS (sizeof(lb_names) / sizeof(lb_names[0]))
+
+/*
+ * Search the table for KEY; the kind of work a lookup does under the
+ * lock.
+ */
+static
+int
+lb_search(int key)
+{
+	unsigned i;
+
+	for (i=0; i<LB_TABLESIZE; i++) {
+		if (lb_table[i] == key) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static
+void
+lb_thread(void *junk, unsigned long kind)
+{
+	unsigned i;
+	pid_t ppid;
+	int key;
+
+	(void)junk;
+
+	for (i=0; i<LB_OPS; i++) {
+		key = i % LB_TABLESIZE;
+		switch (kind) {
+		    case LB_MUTEX:
+			lock_acquire(lb_lock);
+			if (i % LB_WRITEEVERY == 0) {
+				lb_table[key] = key;
+			}
+			else {
+				(void)lb_search(key);
+			}
+			lock_release(lb_lock);
+			break;
+		    case LB_RWLOCK:
+			if (i % LB_WRITEEVERY == 0) {
+				rwlock_acquire_write(lb_rwlock);
+				lb_table[key] = key;
+				rwlock_release_write(lb_rwlock);
+			}
+			else {
+				rwlock_acquire_read(lb_rwlock);
+				(void)lb_search(key);
+				rwlock_release_read(lb_rwlock);
+			}
+			break;
+		    case LB_PID:
+			if (pid_getppid(KERNEL_PID, &ppid)) {
+				panic("lookupbench: kernel pid missing\n");
+			}
+			break;
+		}
+	}
+	V(lb_donesem);
+}
+
+/*
+ * Run NTHREADS threads of KIND; returns lookups per second.
+ */
+static
+uint64_t
+lb_run(enum lbkind kind, unsigned nthreads)
+{
+	struct timespec before, after, diff;
+	unsigned i;
+	uint64_t ns;
+	int result;
+
+	gettime(&before);
+	for (i=0; i<nthreads; i++) {
+		result = thread_fork("lookupbench", NULL, lb_thread, NULL,
+				     kind);
+		if (result) {
+			panic("lookupbench: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<nthreads; i++) {
+		P(lb_donesem);
+	}
+	gettime(&after);
+
+	timespec_sub(&after, &before, &diff);
+	ns = diff.tv_sec * (uint64_t)1000000000 + diff.tv_nsec;
+	if (ns == 0) {
+		ns = 1;
+	}
+	return (uint64_t)nthreads * LB_OPS * 1000000000 / ns;
+}
+
+int
+lookupbench(int nargs, char **args)
+{
+	unsigned maxthreads, nthreads, k, i;
+	uint64_t rate;
+
+	maxthreads = 8;
+	if (nargs == 2) {
+		maxthreads = atoi(args[1]);
+	}
+	else if (nargs > 2) {
+		kprintf("Usage: lkb [maxthreads]\n");
+		return EINVAL;
+	}
+	if (maxthreads < 1 || maxthreads > LB_MAXTHREADS) {
+		kprintf("lookupbench: maxthreads must be 1-%u\n",
+			LB_MAXTHREADS);
+		return EINVAL;
+	}
+
+	lb_lock = lock_create("lookupbench");
+	lb_rwlock = rwlock_create("lookupbench");
+	lb_donesem = sem_create("lookupbench", 0);
+	if (lb_lock == NULL || lb_rwlock == NULL || lb_donesem == NULL) {
+		panic("lookupbench: Out of memory\n");
+	}
+	for (i=0; i<LB_TABLESIZE; i++) {
+		lb_table[i] = i;
+	}
+
+	for (k=0; k<LB_NKINDS; k++) {
+		for (nthreads = 1; nthreads <= maxthreads; nthreads *= 2) {
+			rate = lb_run(k, nthreads);
+			kprintf("lookupbench %s%u %llu ops/s\n",
+				lb_names[k], nthreads, rate);
+		}
+	}
+
+	sem_destroy(lb_donesem);
+	rwlock_destroy(lb_rwlock);
+	lock_destroy(lb_lock);
+	lb_donesem = NULL;
+	lb_rwlock = NULL;
+	lb_lock = NULL;
+
+	return 0;
+}
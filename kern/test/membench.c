@@ -0,0 +1,365 @@
+/*
+ * Copyright (c) 2016
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Microbenchmark for the block memory functions (memcpy, memmove,
+ * memset, bzero, pagecopy, pagezero).
+ *
+ * Each function is checked for correctness against a plain byte loop
+ * and then timed at several sizes and alignments. For comparison the
+ * previous word-only-when-everything-is-aligned versions are kept
+ * here and timed alongside.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <vm.h> /* for PAGE_SIZE, pagecopy, pagezero */
+#include <test.h>
+
+#define MB_MAXSIZE	16384		/* largest block */
+#define MB_SLOP		8		/* room for misalignment */
+#define MB_BUFSIZE	(MB_MAXSIZE + 2 * MB_SLOP)
+#define MB_TOTAL	(2*1024*1024)	/* bytes moved per measurement */
+
+static const size_t mb_sizes[] = { 8, 64, 512, 4096, MB_MAXSIZE };
+#define MB_NSIZES (sizeof(mb_sizes) / sizeof(mb_sizes[0]))
+
+/* destination and source misalignment */
+static const unsigned mb_aligns[][2] = {
+	{ 0, 0 },
+	{ 1, 1 },
+	{ 3, 1 },
+	{ 0, 2 },
+};
+#define MB_NALIGNS (sizeof(mb_aligns) / sizeof(mb_aligns[0]))
+
+////////////////////////////////////////////////////////////
+// old versions
+
+static
+void *
+old_memcpy(void *dst, const void *src, size_t len)
+{
+	size_t i;
+
+	if ((uintptr_t)dst % sizeof(long) == 0 &&
+	    (uintptr_t)src % sizeof(long) == 0 &&
+	    len % sizeof(long) == 0) {
+		long *d = dst;
+		const long *s = src;
+
+		for (i=0; i<len/sizeof(long); i++) {
+			d[i] = s[i];
+		}
+	}
+	else {
+		char *d = dst;
+		const char *s = src;
+
+		for (i=0; i<len; i++) {
+			d[i] = s[i];
+		}
+	}
+	return dst;
+}
+
+static
+void *
+old_memmove(void *dst, const void *src, size_t len)
+{
+	size_t i;
+
+	if ((uintptr_t)dst < (uintptr_t)src) {
+		return old_memcpy(dst, src, len);
+	}
+
+	if ((uintptr_t)dst % sizeof(long) == 0 &&
+	    (uintptr_t)src % sizeof(long) == 0 &&
+	    len % sizeof(long) == 0) {
+		long *d = dst;
+		const long *s = src;
+
+		for (i=len/sizeof(long); i>0; i--) {
+			d[i-1] = s[i-1];
+		}
+	}
+	else {
+		char *d = dst;
+		const char *s = src;
+
+		for (i=len; i>0; i--) {
+			d[i-1] = s[i-1];
+		}
+	}
+	return dst;
+}
+
+static
+void *
+old_memset(void *ptr, int ch, size_t len)
+{
+	char *p = ptr;
+	size_t i;
+
+	for (i=0; i<len; i++) {
+		p[i] = ch;
+	}
+	return ptr;
+}
+
+static
+void
+old_bzero(void *vblock, size_t len)
+{
+	char *block = vblock;
+	size_t i;
+
+	if ((uintptr_t)block % sizeof(long) == 0 &&
+	    len % sizeof(long) == 0) {
+		long *lb = (long *)block;
+		for (i=0; i<len/sizeof(long); i++) {
+			lb[i] = 0;
+		}
+	}
+	else {
+		for (i=0; i<len; i++) {
+			block[i] = 0;
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////
+// uniform wrappers
+
+/*
+ * Every operation is run through one of these so they can all be
+ * timed by the same loop. For the copies, dst and src are separate
+ * areas of the buffer with dst above src, so memmove takes its
+ * backwards path.
+ */
+typedef void (*mb_func)(void *dst, const void *src, size_t len);
+
+static void mb_memcpy(void *d, const void *s, size_t l) { memcpy(d, s, l); }
+static void mb_memmove(void *d, const void *s, size_t l) { memmove(d, s, l); }
+static void mb_memset(void *d, const void *s, size_t l)
+	{ (void)s; memset(d, 0x5a, l); }
+static void mb_bzero(void *d, const void *s, size_t l) { (void)s; bzero(d, l); }
+static void mb_pagecopy(void *d, const void *s, size_t l)
+	{ (void)l; pagecopy(d, s); }
+static void mb_pagezero(void *d, const void *s, size_t l)
+	{ (void)s; (void)l; pagezero(d); }
+
+static void mb_old_memcpy(void *d, const void *s, size_t l)
+	{ old_memcpy(d, s, l); }
+static void mb_old_memmove(void *d, const void *s, size_t l)
+	{ old_memmove(d, s, l); }
+static void mb_old_memset(void *d, const void *s, size_t l)
+	{ (void)s; old_memset(d, 0x5a, l); }
+static void mb_old_bzero(void *d, const void *s, size_t l)
+	{ (void)s; old_bzero(d, l); }
+
+static const struct {
+	const char *name;
+	mb_func newfunc;
+	mb_func oldfunc;
+	bool copies;		/* result should equal source */
+	int fill;		/* otherwise, result should be this */
+	bool pageonly;		/* only whole aligned pages */
+} mb_ops[] = {
+	{ "memcpy",   mb_memcpy,   mb_old_memcpy,  true,  0,    false },
+	{ "memmove",  mb_memmove,  mb_old_memmove, true,  0,    false },
+	{ "memset",   mb_memset,   mb_old_memset,  false, 0x5a, false },
+	{ "bzero",    mb_bzero,    mb_old_bzero,   false, 0,    false },
+	{ "pagecopy", mb_pagecopy, mb_old_memcpy,  true,  0,    true },
+	{ "pagezero", mb_pagezero, mb_old_bzero,   false, 0,    true },
+};
+#define MB_NOPS (sizeof(mb_ops) / sizeof(mb_ops[0]))
+
+////////////////////////////////////////////////////////////
+// test driver
+
+static char *mb_src;
+static char *mb_dst;
+
+/*
+ * Fill the first LEN bytes of both buffers with different junk, so
+ * that a missed byte shows up.
+ */
+static
+void
+mb_scramble(size_t len)
+{
+	size_t i;
+
+	for (i=0; i<len; i++) {
+		mb_src[i] = (char)(i * 7 + 1);
+		mb_dst[i] = (char)(i * 13 + 5);
+	}
+}
+
+/*
+ * Run operation OP once at the given size and alignment and check
+ * the result, including that nothing outside the block was touched.
+ */
+static
+int
+mb_check(unsigned op, size_t size, unsigned dalign, unsigned salign)
+{
+	size_t i, len;
+	char expected;
+
+	/* the block plus a little on either side */
+	len = size + MB_SLOP * 2;
+	mb_scramble(len);
+	mb_ops[op].newfunc(mb_dst + dalign, mb_src + salign, size);
+
+	for (i=0; i<len; i++) {
+		if (i < dalign || i >= dalign + size) {
+			expected = (char)(i * 13 + 5);
+		}
+		else if (mb_ops[op].copies) {
+			expected = mb_src[i - dalign + salign];
+		}
+		else {
+			expected = (char)mb_ops[op].fill;
+		}
+		if (mb_dst[i] != expected) {
+			kprintf("membench: %s size %u align %u/%u: "
+				"wrong byte at offset %u\n",
+				mb_ops[op].name, size, dalign, salign, i);
+			return EINVAL;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Time FUNC at the given size and alignment. Returns KB/s.
+ */
+static
+uint64_t
+mb_time(mb_func func, size_t size, unsigned dalign, unsigned salign)
+{
+	struct timespec before, after, diff;
+	unsigned i, n;
+	uint64_t ns;
+
+	n = MB_TOTAL / size;
+
+	gettime(&before);
+	for (i=0; i<n; i++) {
+		func(mb_dst + dalign, mb_src + salign, size);
+	}
+	gettime(&after);
+
+	timespec_sub(&after, &before, &diff);
+	ns = diff.tv_sec * (uint64_t)1000000000 + diff.tv_nsec;
+	if (ns == 0) {
+		ns = 1;
+	}
+	return ((uint64_t)n * size * 1000000000 / ns) / 1024;
+}
+
+int
+membench(int nargs, char **args)
+{
+	unsigned op, sz, al, dalign, salign;
+	size_t size;
+	uint64_t oldrate, newrate;
+	int result = 0;
+
+	(void)nargs;
+	(void)args;
+
+	/* Page-aligned, so the page entry points can be used. */
+	mb_src = kmalloc(MB_BUFSIZE);
+	mb_dst = kmalloc(MB_BUFSIZE);
+	if (mb_src == NULL || mb_dst == NULL) {
+		kfree(mb_src);
+		kfree(mb_dst);
+		return ENOMEM;
+	}
+	KASSERT((vaddr_t)mb_src % PAGE_SIZE == 0);
+	KASSERT((vaddr_t)mb_dst % PAGE_SIZE == 0);
+
+	kprintf("Checking block memory functions...\n");
+	for (op=0; op<MB_NOPS; op++) {
+		if (mb_ops[op].pageonly) {
+			result = mb_check(op, PAGE_SIZE, 0, 0);
+			if (result) {
+				goto done;
+			}
+			continue;
+		}
+		/* every length up to a few words, then the table */
+		for (size=0; size<=MB_MAXSIZE; size = size < 64 ? size+1 :
+			     size*2) {
+			for (dalign=0; dalign<MB_SLOP; dalign++) {
+				for (salign=0; salign<MB_SLOP; salign++) {
+					result = mb_check(op, size, dalign,
+							  salign);
+					if (result) {
+						goto done;
+					}
+				}
+			}
+		}
+	}
+	kprintf("Passed.\n\n");
+
+	kprintf("%-8s %6s %5s %10s %10s\n", "function", "size", "align",
+		"old KB/s", "new KB/s");
+	for (op=0; op<MB_NOPS; op++) {
+		for (sz=0; sz<MB_NSIZES; sz++) {
+			for (al=0; al<MB_NALIGNS; al++) {
+				size = mb_sizes[sz];
+				dalign = mb_aligns[al][0];
+				salign = mb_aligns[al][1];
+				if (mb_ops[op].pageonly &&
+				    (size != PAGE_SIZE || dalign || salign)) {
+					continue;
+				}
+				oldrate = mb_time(mb_ops[op].oldfunc, size,
+						  dalign, salign);
+				newrate = mb_time(mb_ops[op].newfunc, size,
+						  dalign, salign);
+				kprintf("%-8s %6u   %u/%u %10llu %10llu\n",
+					mb_ops[op].name, size, dalign, salign,
+					oldrate, newrate);
+			}
+		}
+	}
+
+ done:
+	kfree(mb_src);
+	kfree(mb_dst);
+	kprintf("membench done\n");
+	return result;
+}
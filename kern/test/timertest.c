@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2016
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Timer test: start a batch of timers spread across the first two
+ * wheel levels, cancel every other one, and check that the rest
+ * fire on exactly their tick and the cancelled ones don't fire at
+ * all. Then check clocksleep_ticks sleeps for about as long as it
+ * should.
+ */
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <clock.h>
+#include <timer.h>
+#include <synch.h>
+#include <current.h>
+#include <test.h>
+
+#define TT_NTIMERS	32
+#define TT_SPACING	7		/* ticks between successive timers */
+
+static struct timer tt_timers[TT_NTIMERS];
+static volatile unsigned tt_fired[TT_NTIMERS];
+static bool tt_cancelled[TT_NTIMERS];
+static volatile unsigned tt_late;
+static struct semaphore *tt_donesem;
+
+/*
+ * Timer function. Runs in hardclock on the cpu the timer was started
+ * on, so that cpu's wheel time is the tick it fired on.
+ */
+static
+void
+tt_func(void *data)
+{
+	struct timer *t = data;
+	unsigned i = t - tt_timers;
+
+	tt_fired[i]++;
+	if (curcpu->c_timers.tw_now != t->tm_expire) {
+		tt_late++;
+	}
+	V(tt_donesem);
+}
+
+static
+uint64_t
+tt_nsecs(void)
+{
+	struct timespec ts;
+
+	gettime(&ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int
+timertest(int nargs, char **args)
+{
+	static const unsigned sleeps[] = { 1, 2, 5, 10, 50 };
+	unsigned i, ncancelled, nbad;
+	uint64_t start, elapsed;
+
+	(void)nargs;
+	(void)args;
+
+	tt_donesem = sem_create("timertest", 0);
+	if (tt_donesem == NULL) {
+		panic("timertest: sem_create failed\n");
+	}
+	tt_late = 0;
+	nbad = 0;
+
+	kprintf("Starting timer test...\n");
+
+	for (i=0; i<TT_NTIMERS; i++) {
+		tt_fired[i] = 0;
+		tt_cancelled[i] = false;
+		timer_init(&tt_timers[i], tt_func, &tt_timers[i]);
+		timer_start(&tt_timers[i], 1 + i * TT_SPACING);
+	}
+	ncancelled = 0;
+	for (i=1; i<TT_NTIMERS; i+=2) {
+		tt_cancelled[i] = timer_cancel(&tt_timers[i]);
+		if (tt_cancelled[i]) {
+			ncancelled++;
+		}
+	}
+	for (i=0; i<TT_NTIMERS - ncancelled; i++) {
+		P(tt_donesem);
+	}
+	/* Give any wrongly cancelled timer time to fire anyway. */
+	clocksleep_ticks(2 * TT_SPACING);
+
+	for (i=0; i<TT_NTIMERS; i++) {
+		if (tt_fired[i] != (tt_cancelled[i] ? 0 : 1)) {
+			kprintf("timertest: timer %u%s fired %u times\n",
+				i, tt_cancelled[i] ? " (cancelled)" : "",
+				tt_fired[i]);
+			nbad++;
+		}
+	}
+	if (tt_late > 0) {
+		kprintf("timertest: %u timers fired on the wrong tick\n",
+			tt_late);
+		nbad++;
+	}
+
+	for (i=0; i<sizeof(sleeps)/sizeof(sleeps[0]); i++) {
+		start = tt_nsecs();
+		clocksleep_ticks(sleeps[i]);
+		elapsed = tt_nsecs() - start;
+		kprintf("timertest: slept %u ticks in %llu us\n", sleeps[i],
+			(unsigned long long)(elapsed / 1000));
+		if (elapsed < (uint64_t)(sleeps[i] - 1) * (1000000000 / HZ)) {
+			kprintf("timertest: woke too early\n");
+			nbad++;
+		}
+	}
+
+	sem_destroy(tt_donesem);
+	tt_donesem = NULL;
+
+	if (nbad > 0) {
+		kprintf("Timer test FAILED\n");
+		return 1;
+	}
+	kprintf("Timer test done.\n");
+	return 0;
+}
@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2016
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * In-kernel VM benchmarks: page allocator and kmalloc throughput.
+ * (Fault, fork, and exec costs are measured from userland by
+ * /testbin/vmbench.)
+ *
+ * Results are printed one per line as
+ *	vmbench <name> <value> <unit>
+ * for testscripts/vmbench.py to collect.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <vm.h>
+#include <test.h>
+
+#define VB_BATCH	32		/* blocks held at once */
+#define VB_ROUNDS	64		/* batches per measurement */
+
+static const unsigned vb_kpages[] = { 1, 4 };
+#define VB_NKPAGES (sizeof(vb_kpages) / sizeof(vb_kpages[0]))
+
+static const size_t vb_ksizes[] = { 32, 512, 4096 };
+#define VB_NKSIZES (sizeof(vb_ksizes) / sizeof(vb_ksizes[0]))
+
+static void *vb_blocks[VB_BATCH];
+
+/*
+ * Convert a count and an elapsed time to operations per second.
+ */
+static
+uint64_t
+vb_rate(unsigned count, const struct timespec *before,
+	const struct timespec *after)
+{
+	struct timespec diff;
+	uint64_t ns;
+
+	timespec_sub(after, before, &diff);
+	ns = diff.tv_sec * (uint64_t)1000000000 + diff.tv_nsec;
+	if (ns == 0) {
+		ns = 1;
+	}
+	return (uint64_t)count * 1000000000 / ns;
+}
+
+/*
+ * Allocate and free NPAGES-page blocks VB_BATCH at a time. Returns
+ * alloc+free pairs per second, or 0 if memory ran out.
+ */
+static
+uint64_t
+vb_kpages_time(unsigned npages)
+{
+	struct timespec before, after;
+	unsigned i, r;
+	vaddr_t addr;
+
+	gettime(&before);
+	for (r=0; r<VB_ROUNDS; r++) {
+		for (i=0; i<VB_BATCH; i++) {
+			addr = alloc_kpages(npages);
+			if (addr == 0) {
+				while (i > 0) {
+					free_kpages((vaddr_t)vb_blocks[--i]);
+				}
+				return 0;
+			}
+			vb_blocks[i] = (void *)addr;
+		}
+		for (i=0; i<VB_BATCH; i++) {
+			free_kpages((vaddr_t)vb_blocks[i]);
+		}
+	}
+	gettime(&after);
+
+	return vb_rate(VB_ROUNDS * VB_BATCH, &before, &after);
+}
+
+/*
+ * Same for kmalloc/kfree of SIZE bytes.
+ */
+static
+uint64_t
+vb_kmalloc_time(size_t size)
+{
+	struct timespec before, after;
+	unsigned i, r;
+
+	gettime(&before);
+	for (r=0; r<VB_ROUNDS; r++) {
+		for (i=0; i<VB_BATCH; i++) {
+			vb_blocks[i] = kmalloc(size);
+			if (vb_blocks[i] == NULL) {
+				while (i > 0) {
+					kfree(vb_blocks[--i]);
+				}
+				return 0;
+			}
+		}
+		for (i=0; i<VB_BATCH; i++) {
+			kfree(vb_blocks[i]);
+		}
+	}
+	gettime(&after);
+
+	return vb_rate(VB_ROUNDS * VB_BATCH, &before, &after);
+}
+
+int
+vmbench(int nargs, char **args)
+{
+	uint64_t rate;
+	unsigned i;
+
+	(void)nargs;
+	(void)args;
+
+	for (i=0; i<VB_NKPAGES; i++) {
+		rate = vb_kpages_time(vb_kpages[i]);
+		if (rate == 0) {
+			kprintf("vmbench: alloc_kpages(%u): out of memory\n",
+				vb_kpages[i]);
+			return ENOMEM;
+		}
+		kprintf("vmbench kpages%u %llu ops/s\n", vb_kpages[i], rate);
+	}
+	for (i=0; i<VB_NKSIZES; i++) {
+		rate = vb_kmalloc_time(vb_ksizes[i]);
+		if (rate == 0) {
+			kprintf("vmbench: kmalloc(%u): out of memory\n",
+				vb_ksizes[i]);
+			return ENOMEM;
+		}
+		kprintf("vmbench kmalloc%u %llu ops/s\n", vb_ksizes[i], rate);
+	}
+	return 0;
+}
@@ -30,17 +30,21 @@
 #include <types.h>
 #include <lib.h>
 #include <cpu.h>
+#include <spinlock.h>
 #include <wchan.h>
 #include <clock.h>
+#include <timer.h>
 #include <thread.h>
 #include <current.h>
+#include <mainbus.h>
 
 /*
  * Time handling.
  *
- * This is pretty primitive. A real kernel will typically have some
- * kind of support for scheduling callbacks to happen at specific
- * points in the future, usually with more resolution than one second.
+ * Timed events go on the per-cpu timer wheels (see timer.c), which
+ * hardclock() advances, so they happen to the nearest hardclock.
+ * An idle cpu with nothing due soon stops its periodic tick and
+ * makes up the skipped hardclocks when it next wakes.
  *
  * A real kernel also has to maintain the time of day; in OS/161 we
  * skimp on that because we have a known-good hardware clock.
@@ -50,14 +54,17 @@
  * Timing constants. These should be tuned along with any work done on
  * the scheduler.
  */
-#define SCHEDULE_HARDCLOCKS	4	/* Reschedule every 4 hardclocks. */
-#define MIGRATE_HARDCLOCKS	16	/* Migrate every 16 hardclocks. */
+#define SCHEDULE_HARDCLOCKS	4	/* Age run queues every 4 hardclocks. */
+#define MIGRATE_HARDCLOCKS	64	/* Rebalance every 64 hardclocks. */
 
 /*
- * Once a second, everything waiting on lbolt is awakened by CPU 0.
+ * Most hardclocks an idle cpu will skip at once. This bounds how
+ * stale the hardclock counts can get.
  */
-static struct wchan *lbolt;
-static struct spinlock lbolt_lock;
+#define TICKLESS_MAX	HZ
+
+/* Nanoseconds per hardclock. */
+#define TICK_NSECS	(1000000000 / HZ)
 
 /*
  * Setup.
@@ -65,24 +72,95 @@ static struct spinlock lbolt_lock;
 void
 hardclock_bootstrap(void)
 {
-	spinlock_init(&lbolt_lock);
-	lbolt = wchan_create("lbolt");
-	if (lbolt == NULL) {
-		panic("Couldn't create lbolt\n");
-	}
+	/* Nothing global to set up; the timer wheels are per-cpu. */
 }
 
 /*
  * This is called once per second, on one processor, by the timer
- * code.
+ * code. Nothing uses it any more.
  */
 void
 timerclock(void)
 {
-	/* Just broadcast on lbolt */
-	spinlock_acquire(&lbolt_lock);
-	wchan_wakeall(lbolt, &lbolt_lock);
-	spinlock_release(&lbolt_lock);
+}
+
+/*
+ * Current time in nanoseconds, for tickless accounting.
+ */
+static
+uint64_t
+clock_nsecs(void)
+{
+	struct timespec ts;
+
+	gettime(&ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Come out of tickless idle: credit the hardclocks that were
+ * skipped, firing any timers that came due meanwhile. If we were
+ * called from hardclock, that hardclock counts for one of them and
+ * the clock hardware has already been reset to the usual rate.
+ *
+ * The fraction of a tick left over is dropped, so each tickless
+ * stretch can lose up to one hardclock.
+ */
+static
+void
+clock_tickless_end(bool fromclock)
+{
+	unsigned nticks;
+
+	KASSERT(curcpu->c_tickless);
+	curcpu->c_tickless = false;
+
+	nticks = (clock_nsecs() - curcpu->c_ticklessstart) / TICK_NSECS;
+	if (fromclock) {
+		nticks = nticks > 0 ? nticks - 1 : 0;
+	}
+	else {
+		mainbus_settimer(1);
+	}
+	curcpu->c_hardclocks += nticks;
+	curcpu->c_idleclocks += nticks;
+	timerwheel_advance(nticks);
+}
+
+/*
+ * Called with interrupts off by the idle loop just before it waits.
+ * If this cpu's next timer is more than one tick away, stop the
+ * periodic tick until then.
+ */
+void
+clock_idle_enter(void)
+{
+	unsigned nticks;
+
+	KASSERT(!curcpu->c_tickless);
+
+	if (!gettime_available()) {
+		return;
+	}
+	nticks = timerwheel_idleticks(TICKLESS_MAX);
+	if (nticks <= 1) {
+		return;
+	}
+	curcpu->c_tickless = true;
+	curcpu->c_ticklessstart = clock_nsecs();
+	mainbus_settimer(nticks);
+}
+
+/*
+ * Called by the idle loop when it wakes up. If something other
+ * than the clock woke us, restart the periodic tick.
+ */
+void
+clock_idle_exit(void)
+{
+	if (curcpu->c_tickless) {
+		clock_tickless_end(false);
+	}
 }
 
 /*
@@ -92,18 +170,84 @@ timerclock(void)
 void
 hardclock(void)
 {
+	if (curcpu->c_tickless) {
+		clock_tickless_end(true);
+	}
+
 	/*
 	 * Collect statistics here as desired.
 	 */
 
 	curcpu->c_hardclocks++;
+
+	/*
+	 * Advance the timers before anything that might switch
+	 * threads: thread_timeslice can yield from here, and this
+	 * frame doesn't finish until the preempted thread runs again.
+	 */
+	timerwheel_advance(1);
+
 	if ((curcpu->c_hardclocks % MIGRATE_HARDCLOCKS) == 0) {
 		thread_consider_migration();
 	}
 	if ((curcpu->c_hardclocks % SCHEDULE_HARDCLOCKS) == 0) {
 		schedule();
 	}
-	thread_yield();
+	thread_timeslice();
+}
+
+/*
+ * A thread in clocksleep_ticks. It lives on the sleeping thread's
+ * stack and sleeps on the thread's own wchan, so the timer wakes
+ * exactly that thread.
+ */
+struct clocksleeper {
+	struct timer cs_timer;
+	struct spinlock cs_lock;
+	struct wchan *cs_wchan;
+	bool cs_done;
+};
+
+/*
+ * Timer function for clocksleep_ticks.
+ */
+static
+void
+clocksleep_wakeup(void *data)
+{
+	struct clocksleeper *cs = data;
+
+	/* Once we let go of the lock, cs may no longer exist. */
+	spinlock_acquire(&cs->cs_lock);
+	cs->cs_done = true;
+	wchan_wakeall(cs->cs_wchan, &cs->cs_lock);
+	spinlock_release(&cs->cs_lock);
+}
+
+/*
+ * Suspend execution for n hardclocks.
+ */
+void
+clocksleep_ticks(unsigned num_ticks)
+{
+	struct clocksleeper cs;
+
+	if (num_ticks == 0) {
+		return;
+	}
+
+	timer_init(&cs.cs_timer, clocksleep_wakeup, &cs);
+	spinlock_init(&cs.cs_lock);
+	cs.cs_wchan = curthread->t_sleepchan;
+	cs.cs_done = false;
+
+	spinlock_acquire(&cs.cs_lock);
+	timer_start(&cs.cs_timer, num_ticks);
+	while (!cs.cs_done) {
+		wchan_sleep(cs.cs_wchan, &cs.cs_lock);
+	}
+	spinlock_release(&cs.cs_lock);
+	spinlock_cleanup(&cs.cs_lock);
 }
 
 /*
@@ -112,10 +256,7 @@ hardclock(void)
 void
 clocksleep(int num_secs)
 {
-	spinlock_acquire(&lbolt_lock);
-	while (num_secs > 0) {
-		wchan_sleep(lbolt, &lbolt_lock);
-		num_secs--;
+	if (num_secs > 0) {
+		clocksleep_ticks(num_secs * HZ);
 	}
-	spinlock_release(&lbolt_lock);
 }
@@ -156,6 +156,35 @@ hangman_acquire(struct hangman_actor *a,
 	spinlock_release(&hangman_lock);
 }
 
+/*
+ * Note that a has got l in shared mode (e.g. a reader of an rwlock).
+ * Shared holders aren't recorded, since there can be any number of
+ * them; so waiting for a lockable held only in shared mode won't be
+ * detected as a deadlock, but waiting on an exclusive holder that is
+ * itself stuck will be.
+ */
+void
+hangman_acquireshared(struct hangman_actor *a,
+		      struct hangman_lockable *l)
+{
+	if (l == &hangman_lock.splk_hangman) {
+		/* don't recurse */
+		return;
+	}
+
+	spinlock_acquire(&hangman_lock);
+
+	if (a->a_waiting != l) {
+		spinlock_release(&hangman_lock);
+		panic("hangman_acquireshared: not waiting for lock %s (%p)\n",
+		      l->l_name, l);
+	}
+
+	a->a_waiting = NULL;
+
+	spinlock_release(&hangman_lock);
+}
+
 void
 hangman_release(struct hangman_actor *a,
 		struct hangman_lockable *l)
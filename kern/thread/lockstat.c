@@ -0,0 +1,405 @@
+/*
+ * Copyright (c) 2016
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Lock contention profiler. See lockstat.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <membar.h>
+#include <lockstat.h>
+
+#define LOCKSTAT_NRECORDS	256	/* locks we can keep track of */
+#define LOCKSTAT_NSITES		4	/* call sites kept per lock */
+#define LOCKSTAT_NAMELEN	16
+#define LOCKSTAT_NREPORT	24	/* locks shown by lockstat_print */
+
+struct lockstat_site {
+	const void *ss_pc;		/* caller of the acquire */
+	unsigned ss_count;		/* contended acquisitions there */
+};
+
+struct lockstat {
+	const void *ls_lock;		/* the lock, or NULL if free */
+	unsigned ls_kind;		/* LOCKSTAT_* */
+	char ls_name[LOCKSTAT_NAMELEN];
+	unsigned ls_nacquire;		/* acquisitions */
+	unsigned ls_ncontended;		/* ...that had to wait */
+	uint64_t ls_waitns;		/* total time waiting */
+	uint64_t ls_holdns;		/* total time held */
+	uint64_t ls_maxholdns;		/* longest hold */
+	uint64_t ls_holdstart;		/* when the current hold began */
+	struct lockstat_site ls_sites[LOCKSTAT_NSITES];
+};
+
+/*
+ * The records. The first LOCKSTAT_NRETIRED collect the totals for
+ * locks of each kind that have been destroyed; otherwise every lock
+ * that's come and gone (e.g. all the ones in vnodes) would use up a
+ * record.
+ */
+#define LOCKSTAT_NRETIRED	3
+static struct lockstat lockstat_records[LOCKSTAT_NRECORDS];
+
+/* Given out when there are no records left; never updated. */
+static struct lockstat lockstat_full;
+static unsigned lockstat_nfull;
+
+/*
+ * Protects allocating and freeing records, and the retired totals.
+ * This can't be a struct spinlock, since those call into here; it's
+ * a bare lock word used with interrupts off.
+ */
+static volatile spinlock_data_t lockstat_tablelock = SPINLOCK_DATA_INITIALIZER;
+
+static const char *const lockstat_kindnames[] = {
+	"spin",
+	"lock",
+	"sem",
+};
+
+static
+int
+lockstat_table_acquire(void)
+{
+	int s;
+
+	s = splhigh();
+	while (spinlock_data_get(&lockstat_tablelock) != 0 ||
+	       spinlock_data_testandset(&lockstat_tablelock) != 0) {
+		/* spin */
+	}
+	membar_store_any();
+	return s;
+}
+
+static
+void
+lockstat_table_release(int s)
+{
+	membar_any_store();
+	spinlock_data_set(&lockstat_tablelock, 0);
+	splx(s);
+}
+
+/*
+ * Current time in nanoseconds, or 0 if there's no clock yet.
+ */
+static
+uint64_t
+lockstat_now(void)
+{
+	struct timespec ts;
+
+	if (!gettime_available()) {
+		return 0;
+	}
+	gettime(&ts);
+	return ts.tv_sec * (uint64_t)1000000000 + ts.tv_nsec;
+}
+
+static
+void
+lockstat_clear(struct lockstat *s)
+{
+	unsigned i;
+
+	s->ls_nacquire = 0;
+	s->ls_ncontended = 0;
+	s->ls_waitns = 0;
+	s->ls_holdns = 0;
+	s->ls_maxholdns = 0;
+	for (i=0; i<LOCKSTAT_NSITES; i++) {
+		s->ls_sites[i].ss_pc = NULL;
+		s->ls_sites[i].ss_count = 0;
+	}
+}
+
+/*
+ * Get a record for LOCK.
+ */
+static
+struct lockstat *
+lockstat_alloc(const void *lock, unsigned kind, const char *name)
+{
+	struct lockstat *s;
+	unsigned i;
+	int spl;
+
+	spl = lockstat_table_acquire();
+	for (i=LOCKSTAT_NRETIRED; i<LOCKSTAT_NRECORDS; i++) {
+		if (lockstat_records[i].ls_lock == NULL) {
+			break;
+		}
+	}
+	if (i == LOCKSTAT_NRECORDS) {
+		lockstat_nfull++;
+		lockstat_table_release(spl);
+		return &lockstat_full;
+	}
+	s = &lockstat_records[i];
+	s->ls_lock = lock;
+	s->ls_kind = kind;
+	for (i=0; i<LOCKSTAT_NAMELEN-1 && name[i] != 0; i++) {
+		s->ls_name[i] = name[i];
+	}
+	s->ls_name[i] = 0;
+	lockstat_clear(s);
+	s->ls_holdstart = 0;
+	lockstat_table_release(spl);
+
+	return s;
+}
+
+/*
+ * Count a contended acquisition at SITE. We keep the LOCKSTAT_NSITES
+ * busiest sites approximately: a new site replaces the least busy
+ * one and inherits its count (the "space-saving" scheme), so a site
+ * that is really hot can't be crowded out by a stream of others.
+ */
+static
+void
+lockstat_addsite(struct lockstat *s, const void *site)
+{
+	unsigned i, min;
+
+	min = 0;
+	for (i=0; i<LOCKSTAT_NSITES; i++) {
+		if (s->ls_sites[i].ss_pc == site) {
+			s->ls_sites[i].ss_count++;
+			return;
+		}
+		if (s->ls_sites[i].ss_count < s->ls_sites[min].ss_count) {
+			min = i;
+		}
+	}
+	s->ls_sites[min].ss_pc = site;
+	s->ls_sites[min].ss_count++;
+}
+
+/*
+ * Note that the acquirer found the lock held. Call each time around
+ * the wait loop; only the first call does anything.
+ */
+void
+lockstat_contended(struct lockstat_wait *w)
+{
+	if (!w->lw_contended) {
+		w->lw_contended = true;
+		w->lw_start = lockstat_now();
+	}
+}
+
+/*
+ * Note that the lock has been acquired (by a caller at SITE).
+ */
+void
+lockstat_acquired(struct lockstat **sp, const void *lock, unsigned kind,
+		  const char *name, const void *site,
+		  const struct lockstat_wait *w)
+{
+	struct lockstat *s;
+	uint64_t now;
+
+	s = *sp;
+	if (s == NULL) {
+		s = lockstat_alloc(lock, kind, name);
+		*sp = s;
+	}
+	if (s == &lockstat_full) {
+		return;
+	}
+
+	now = lockstat_now();
+	s->ls_nacquire++;
+	if (w->lw_contended) {
+		s->ls_ncontended++;
+		if (w->lw_start != 0) {
+			s->ls_waitns += now - w->lw_start;
+		}
+		lockstat_addsite(s, site);
+	}
+	s->ls_holdstart = now;
+}
+
+/*
+ * Note that the lock is about to be released.
+ */
+void
+lockstat_release(struct lockstat *s)
+{
+	uint64_t hold;
+
+	if (s == NULL || s == &lockstat_full || s->ls_holdstart == 0) {
+		return;
+	}
+	hold = lockstat_now() - s->ls_holdstart;
+	s->ls_holdns += hold;
+	if (hold > s->ls_maxholdns) {
+		s->ls_maxholdns = hold;
+	}
+	s->ls_holdstart = 0;
+}
+
+/*
+ * The lock is going away; fold its numbers into the retired totals
+ * and free the record.
+ */
+void
+lockstat_cleanup(struct lockstat **sp)
+{
+	struct lockstat *s, *r;
+	int spl;
+
+	s = *sp;
+	*sp = NULL;
+	if (s == NULL || s == &lockstat_full) {
+		return;
+	}
+	KASSERT(s->ls_kind < LOCKSTAT_NRETIRED);
+
+	spl = lockstat_table_acquire();
+	r = &lockstat_records[s->ls_kind];
+	r->ls_nacquire += s->ls_nacquire;
+	r->ls_ncontended += s->ls_ncontended;
+	r->ls_waitns += s->ls_waitns;
+	r->ls_holdns += s->ls_holdns;
+	if (s->ls_maxholdns > r->ls_maxholdns) {
+		r->ls_maxholdns = s->ls_maxholdns;
+	}
+	s->ls_lock = NULL;
+	lockstat_table_release(spl);
+}
+
+/*
+ * Print the locks with the most time spent waiting, busiest first.
+ */
+void
+lockstat_print(void)
+{
+	struct lockstat *snap, tmp;
+	unsigned i, j, num, nfull;
+	int spl;
+
+	snap = kmalloc(LOCKSTAT_NRECORDS * sizeof(*snap));
+	if (snap == NULL) {
+		kprintf("lockstat: Out of memory\n");
+		return;
+	}
+
+	/*
+	 * Copy out everything that's been contended. The counters are
+	 * updated under each lock rather than the table lock, so an
+	 * entry may be a little inconsistent; that's fine for this.
+	 */
+	num = 0;
+	spl = lockstat_table_acquire();
+	for (i=0; i<LOCKSTAT_NRECORDS; i++) {
+		if (i >= LOCKSTAT_NRETIRED &&
+		    lockstat_records[i].ls_lock == NULL) {
+			continue;
+		}
+		if (lockstat_records[i].ls_ncontended == 0) {
+			continue;
+		}
+		snap[num] = lockstat_records[i];
+		if (i < LOCKSTAT_NRETIRED) {
+			snap[num].ls_kind = i;
+		}
+		num++;
+	}
+	nfull = lockstat_nfull;
+	lockstat_table_release(spl);
+
+	/* insertion sort, by wait time and then by contention */
+	for (i=1; i<num; i++) {
+		tmp = snap[i];
+		for (j=i; j>0; j--) {
+			if (snap[j-1].ls_waitns > tmp.ls_waitns ||
+			    (snap[j-1].ls_waitns == tmp.ls_waitns &&
+			     snap[j-1].ls_ncontended >= tmp.ls_ncontended)) {
+				break;
+			}
+			snap[j] = snap[j-1];
+		}
+		snap[j] = tmp;
+	}
+
+	kprintf("%-4s %-16s %-10s %9s %9s %10s %10s %9s\n",
+		"kind", "name", "lock", "acquire", "contended",
+		"wait us", "hold us", "maxhold");
+	for (i=0; i<num && i<LOCKSTAT_NREPORT; i++) {
+		kprintf("%-4s %-16s %-10p %9u %9u %10llu %10llu %9llu\n",
+			lockstat_kindnames[snap[i].ls_kind],
+			snap[i].ls_lock != NULL ? snap[i].ls_name : "(destroyed)",
+			snap[i].ls_lock,
+			snap[i].ls_nacquire, snap[i].ls_ncontended,
+			(unsigned long long)(snap[i].ls_waitns / 1000),
+			(unsigned long long)(snap[i].ls_holdns / 1000),
+			(unsigned long long)(snap[i].ls_maxholdns / 1000));
+		for (j=0; j<LOCKSTAT_NSITES; j++) {
+			if (snap[i].ls_sites[j].ss_count == 0) {
+				continue;
+			}
+			kprintf("     waited at %p: %u\n",
+				snap[i].ls_sites[j].ss_pc,
+				snap[i].ls_sites[j].ss_count);
+		}
+	}
+	if (num > LOCKSTAT_NREPORT) {
+		kprintf("(%u more contended locks not shown)\n",
+			num - LOCKSTAT_NREPORT);
+	}
+	if (nfull > 0) {
+		kprintf("(%u locks not tracked: table full)\n", nfull);
+	}
+
+	kfree(snap);
+}
+
+/*
+ * Zero all the counters.
+ */
+void
+lockstat_reset(void)
+{
+	unsigned i;
+	int spl;
+
+	spl = lockstat_table_acquire();
+	for (i=0; i<LOCKSTAT_NRECORDS; i++) {
+		lockstat_clear(&lockstat_records[i]);
+	}
+	lockstat_nfull = 0;
+	lockstat_table_release(spl);
+}
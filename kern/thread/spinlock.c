@@ -52,6 +52,7 @@ spinlock_init(struct spinlock *splk)
 {
 	spinlock_data_set(&splk->splk_lock, 0);
 	splk->splk_holder = NULL;
+	LOCKSTAT_INIT(&splk->splk_stat);
 	HANGMAN_LOCKABLEINIT(&splk->splk_hangman, "spinlock");
 }
 
@@ -63,6 +64,7 @@ spinlock_cleanup(struct spinlock *splk)
 {
 	KASSERT(splk->splk_holder == NULL);
 	KASSERT(spinlock_data_get(&splk->splk_lock) == 0);
+	LOCKSTAT_CLEANUP(&splk->splk_stat);
 }
 
 /*
@@ -76,6 +78,7 @@ void
 spinlock_acquire(struct spinlock *splk)
 {
 	struct cpu *mycpu;
+	LOCKSTAT_WAITVAR(lsw);
 
 	splraise(IPL_NONE, IPL_HIGH);
 
@@ -105,9 +108,11 @@ spinlock_acquire(struct spinlock *splk)
 		 * we don't.
 		 */
 		if (spinlock_data_get(&splk->splk_lock) != 0) {
+			LOCKSTAT_CONTENDED(lsw);
 			continue;
 		}
 		if (spinlock_data_testandset(&splk->splk_lock) != 0) {
+			LOCKSTAT_CONTENDED(lsw);
 			continue;
 		}
 		break;
@@ -118,6 +123,8 @@ spinlock_acquire(struct spinlock *splk)
 
 	if (CURCPU_EXISTS()) {
 		HANGMAN_ACQUIRE(&curcpu->c_hangman, &splk->splk_hangman);
+		LOCKSTAT_ACQUIRED(&splk->splk_stat, splk, LOCKSTAT_SPINLOCK,
+				  "spinlock", lsw);
 	}
 }
 
@@ -133,6 +140,7 @@ spinlock_release(struct spinlock *splk)
 		KASSERT(curcpu->c_spinlocks > 0);
 		curcpu->c_spinlocks--;
 		HANGMAN_RELEASE(&curcpu->c_hangman, &splk->splk_hangman);
+		LOCKSTAT_RELEASE(splk->splk_stat);
 	}
 
 	splk->splk_holder = NULL;
@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2016
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Per-cpu event counters. See statcounter.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <cpu.h>
+#include <current.h>
+#include <statcounter.h>
+
+void
+statcounters_init(struct statcounters *sc,
+		  const char *const *names, unsigned num)
+{
+	KASSERT(num <= STATCOUNTER_MAX);
+
+	sc->sc_names = names;
+	sc->sc_num = num;
+	statcounters_reset(sc);
+}
+
+/*
+ * Add AMOUNT to counter WHICH in this cpu's row. Interrupts are off
+ * so we can neither be switched to another cpu partway through nor
+ * lose an update made from an interrupt handler on this one. Before
+ * curcpu is set up there's only one cpu running, so use row 0.
+ */
+void
+statcounter_add(struct statcounters *sc, unsigned which, unsigned amount)
+{
+	unsigned cpu;
+	int spl;
+
+	KASSERT(which < sc->sc_num);
+
+	spl = splhigh();
+	cpu = CURCPU_EXISTS() ? curcpu->c_number : 0;
+	KASSERT(cpu < STATCOUNTER_MAXCPUS);
+	sc->sc_counts[cpu][which] += amount;
+	splx(spl);
+}
+
+void
+statcounters_sum(const struct statcounters *sc, unsigned *counts)
+{
+	unsigned cpu, i;
+
+	for (i=0; i<sc->sc_num; i++) {
+		counts[i] = 0;
+	}
+	for (cpu=0; cpu<STATCOUNTER_MAXCPUS; cpu++) {
+		for (i=0; i<sc->sc_num; i++) {
+			counts[i] += sc->sc_counts[cpu][i];
+		}
+	}
+}
+
+void
+statcounters_print(const struct statcounters *sc, const char *prefix,
+		   const unsigned *counts)
+{
+	unsigned i;
+
+	for (i=0; i<sc->sc_num; i++) {
+		kprintf("%s %s %u\n", prefix, sc->sc_names[i], counts[i]);
+	}
+}
+
+/*
+ * Zero every row. A count added on another cpu while this runs may
+ * survive the reset or be lost; either is fine for statistics.
+ */
+void
+statcounters_reset(struct statcounters *sc)
+{
+	unsigned cpu, i;
+
+	for (cpu=0; cpu<STATCOUNTER_MAXCPUS; cpu++) {
+		for (i=0; i<sc->sc_num; i++) {
+			sc->sc_counts[cpu][i] = 0;
+		}
+	}
+}
@@ -38,6 +38,8 @@
 #include <wchan.h>
 #include <thread.h>
 #include <current.h>
+#include <clock.h>
+#include <cpu.h>
 #include <synch.h>
 
 ////////////////////////////////////////////////////////////
@@ -69,6 +71,7 @@ sem_create(const char *name, unsigned initial_count)
 
 	spinlock_init(&sem->sem_lock);
 	sem->sem_count = initial_count;
+	LOCKSTAT_INIT(&sem->sem_stat);
 
 	return sem;
 }
@@ -79,6 +82,7 @@ sem_destroy(struct semaphore *sem)
 	KASSERT(sem != NULL);
 
 	/* wchan_cleanup will assert if anyone's waiting on it */
+	LOCKSTAT_CLEANUP(&sem->sem_stat);
 	spinlock_cleanup(&sem->sem_lock);
 	wchan_destroy(sem->sem_wchan);
 	kfree(sem->sem_name);
@@ -88,6 +92,8 @@ sem_destroy(struct semaphore *sem)
 void
 P(struct semaphore *sem)
 {
+	LOCKSTAT_WAITVAR(lsw);
+
 	KASSERT(sem != NULL);
 
 	/*
@@ -113,10 +119,13 @@ P(struct semaphore *sem)
 		 * Exercise: how would you implement strict FIFO
 		 * ordering?
 		 */
+		LOCKSTAT_CONTENDED(lsw);
 		wchan_sleep(sem->sem_wchan, &sem->sem_lock);
 	}
 	KASSERT(sem->sem_count > 0);
 	sem->sem_count--;
+	LOCKSTAT_ACQUIRED(&sem->sem_stat, sem, LOCKSTAT_SEM, sem->sem_name,
+			  lsw);
 	spinlock_release(&sem->sem_lock);
 }
 
@@ -138,6 +147,51 @@ V(struct semaphore *sem)
 //
 // Lock.
 
+/*
+ * Spinning parameters. A waiter spins in bursts of LOCK_SPIN_BURST
+ * polls of lk_holder, without lk_lock held. Between bursts it takes
+ * lk_lock again and checks that the holder is still running on
+ * another cpu (the holder can't go away while we hold lk_lock, so
+ * this is safe). After LOCK_SPIN_MAXBURSTS bursts it sleeps anyway.
+ */
+#define LOCK_SPIN_BURST		64
+#define LOCK_SPIN_MAXBURSTS	32
+
+/* List of all locks, for statistics. */
+static struct spinlock lock_list_lock = SPINLOCK_INITIALIZER;
+static struct lock *lock_list;
+
+/*
+ * Nanoseconds since START.
+ */
+static
+uint64_t
+lock_elapsed(const struct timespec *start)
+{
+	struct timespec now, diff;
+
+	gettime(&now);
+	timespec_sub(&now, start, &diff);
+	return diff.tv_sec * (uint64_t)1000000000 + diff.tv_nsec;
+}
+
+/*
+ * Check if the holder is running on some other cpu, in which case it
+ * is worth spinning. Must hold lk_lock.
+ */
+static
+bool
+lock_holder_running(struct lock *lock)
+{
+	struct thread *holder;
+
+	KASSERT(spinlock_do_i_hold(&lock->lk_lock));
+
+	holder = lock->lk_holder;
+	return holder != NULL && holder->t_state == S_RUN &&
+		holder->t_cpu != curcpu->c_self;
+}
+
 struct lock *
 lock_create(const char *name)
 {
@@ -164,6 +218,22 @@ lock_create(const char *name)
 	}
 	spinlock_init(&lock->lk_lock);
 	lock->lk_holder = NULL;
+	LOCKSTAT_INIT(&lock->lk_stat);
+
+	lock->lk_nacquire = 0;
+	lock->lk_ncontended = 0;
+	lock->lk_nsleep = 0;
+	lock->lk_spinns = 0;
+	lock->lk_sleepns = 0;
+
+	spinlock_acquire(&lock_list_lock);
+	lock->lk_prev = NULL;
+	lock->lk_next = lock_list;
+	if (lock_list != NULL) {
+		lock_list->lk_prev = lock;
+	}
+	lock_list = lock;
+	spinlock_release(&lock_list_lock);
 
 	return lock;
 }
@@ -174,6 +244,20 @@ lock_destroy(struct lock *lock)
 	KASSERT(lock != NULL);
 
 	KASSERT(lock->lk_holder == NULL);
+
+	spinlock_acquire(&lock_list_lock);
+	if (lock->lk_prev != NULL) {
+		lock->lk_prev->lk_next = lock->lk_next;
+	}
+	else {
+		lock_list = lock->lk_next;
+	}
+	if (lock->lk_next != NULL) {
+		lock->lk_next->lk_prev = lock->lk_prev;
+	}
+	spinlock_release(&lock_list_lock);
+
+	LOCKSTAT_CLEANUP(&lock->lk_stat);
 	spinlock_cleanup(&lock->lk_lock);
 	wchan_destroy(lock->lk_wchan);
 
@@ -184,6 +268,11 @@ lock_destroy(struct lock *lock)
 void
 lock_acquire(struct lock *lock)
 {
+	struct timespec start;
+	unsigned bursts, i;
+	bool timed;
+	LOCKSTAT_WAITVAR(lsw);
+
 	DEBUGASSERT(lock != NULL);
 	KASSERT(curthread->t_in_interrupt == false);
 
@@ -193,11 +282,49 @@ lock_acquire(struct lock *lock)
 	HANGMAN_WAIT(&curthread->t_hangman, &lock->lk_hangman);
 
 	KASSERT(lock->lk_holder != curthread);
-	while (lock->lk_holder != NULL) {
-		/* As in the semaphore. */
-		wchan_sleep(lock->lk_wchan, &lock->lk_lock);
+	lock->lk_nacquire++;
+	if (lock->lk_holder != NULL) {
+		LOCKSTAT_CONTENDED(lsw);
+		lock->lk_ncontended++;
+		/* (there may be no clock yet very early in boot) */
+		timed = gettime_available();
+		if (timed) {
+			gettime(&start);
+		}
+
+		/* Spin while the holder is running elsewhere. */
+		bursts = 0;
+		while (lock_holder_running(lock) &&
+		       bursts < LOCK_SPIN_MAXBURSTS) {
+			spinlock_release(&lock->lk_lock);
+			for (i=0; i<LOCK_SPIN_BURST; i++) {
+				if (lock->lk_holder == NULL) {
+					break;
+				}
+			}
+			bursts++;
+			spinlock_acquire(&lock->lk_lock);
+		}
+		if (timed && bursts > 0) {
+			lock->lk_spinns += lock_elapsed(&start);
+			gettime(&start);
+		}
+
+		/* Otherwise, or if that didn't work, sleep. */
+		if (lock->lk_holder != NULL) {
+			lock->lk_nsleep++;
+			while (lock->lk_holder != NULL) {
+				/* As in the semaphore. */
+				wchan_sleep(lock->lk_wchan, &lock->lk_lock);
+			}
+			if (timed) {
+				lock->lk_sleepns += lock_elapsed(&start);
+			}
+		}
 	}
 	lock->lk_holder = curthread;
+	LOCKSTAT_ACQUIRED(&lock->lk_stat, lock, LOCKSTAT_LOCK, lock->lk_name,
+			  lsw);
 
 	/* Call this (atomically) once the lock is acquired */
 	HANGMAN_ACQUIRE(&curthread->t_hangman, &lock->lk_hangman);
@@ -213,6 +340,7 @@ lock_release(struct lock *lock)
 	spinlock_acquire(&lock->lk_lock);
 
 	KASSERT(lock->lk_holder == curthread);
+	LOCKSTAT_RELEASE(lock->lk_stat);
 	lock->lk_holder = NULL;
 	wchan_wakeone(lock->lk_wchan, &lock->lk_lock);
 
@@ -236,6 +364,289 @@ lock_do_i_hold(struct lock *lock)
 	return ret;
 }
 
+/*
+ * Lock statistics. We copy out the (up to) LOCKSNAP_MAX most
+ * contended locks under lock_list_lock and print them afterwards,
+ * since printing can sleep. The counters are read without each
+ * lock's lk_lock, so the numbers may be very slightly stale.
+ *
+ * These are always kept and cover only sleep locks; they're for
+ * tuning the spin-then-sleep policy above (how often spinning was
+ * enough, and what it cost). The optional profiler in lockstat.c is
+ * separate: it covers spinlocks and semaphores too, and records hold
+ * times and call sites, which is too expensive to leave on.
+ */
+#define LOCKSNAP_MAX		32
+#define LOCKSNAP_NAMELEN	24
+
+struct lock_snap {
+	char snap_name[LOCKSNAP_NAMELEN];
+	unsigned snap_nacquire;
+	unsigned snap_ncontended;
+	unsigned snap_nsleep;
+	uint64_t snap_spinns;
+	uint64_t snap_sleepns;
+};
+
+void
+lock_printstats(bool all)
+{
+	struct lock_snap *stats;
+	struct lock *lock;
+	unsigned num, total, i, j;
+
+	stats = kmalloc(LOCKSNAP_MAX * sizeof(*stats));
+	if (stats == NULL) {
+		kprintf("lock_printstats: Out of memory\n");
+		return;
+	}
+
+	num = total = 0;
+	spinlock_acquire(&lock_list_lock);
+	for (lock = lock_list; lock != NULL; lock = lock->lk_next) {
+		if (!all && lock->lk_ncontended == 0) {
+			continue;
+		}
+		total++;
+
+		/* insertion sort by contended acquisitions, descending */
+		for (i = num; i > 0; i--) {
+			if (stats[i-1].snap_ncontended >= lock->lk_ncontended) {
+				break;
+			}
+		}
+		if (i >= LOCKSNAP_MAX) {
+			continue;
+		}
+		j = (num < LOCKSNAP_MAX) ? num++ : LOCKSNAP_MAX - 1;
+		for (; j > i; j--) {
+			stats[j] = stats[j-1];
+		}
+		snprintf(stats[i].snap_name, sizeof(stats[i].snap_name), "%s",
+			 lock->lk_name);
+		stats[i].snap_nacquire = lock->lk_nacquire;
+		stats[i].snap_ncontended = lock->lk_ncontended;
+		stats[i].snap_nsleep = lock->lk_nsleep;
+		stats[i].snap_spinns = lock->lk_spinns;
+		stats[i].snap_sleepns = lock->lk_sleepns;
+	}
+	spinlock_release(&lock_list_lock);
+
+	kprintf("%-24s %10s %10s %10s %12s %12s\n", "lock", "acquire",
+		"contended", "slept", "spin us", "sleep us");
+	for (i=0; i<num; i++) {
+		kprintf("%-24s %10u %10u %10u %12llu %12llu\n",
+			stats[i].snap_name, stats[i].snap_nacquire,
+			stats[i].snap_ncontended, stats[i].snap_nsleep,
+			(unsigned long long)(stats[i].snap_spinns / 1000),
+			(unsigned long long)(stats[i].snap_sleepns / 1000));
+	}
+	if (total > num) {
+		kprintf("(%u more not shown)\n", total - num);
+	}
+
+	kfree(stats);
+}
+
+void
+lock_resetstats(void)
+{
+	struct lock *lock;
+
+	spinlock_acquire(&lock_list_lock);
+	for (lock = lock_list; lock != NULL; lock = lock->lk_next) {
+		spinlock_acquire(&lock->lk_lock);
+		lock->lk_nacquire = 0;
+		lock->lk_ncontended = 0;
+		lock->lk_nsleep = 0;
+		lock->lk_spinns = 0;
+		lock->lk_sleepns = 0;
+		spinlock_release(&lock->lk_lock);
+	}
+	spinlock_release(&lock_list_lock);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Reader-writer lock.
+
+struct rwlock *
+rwlock_create(const char *name)
+{
+	struct rwlock *rw;
+
+	rw = kmalloc(sizeof(*rw));
+	if (rw == NULL) {
+		return NULL;
+	}
+
+	rw->rwlock_name = kstrdup(name);
+	if (rw->rwlock_name == NULL) {
+		kfree(rw);
+		return NULL;
+	}
+
+	HANGMAN_LOCKABLEINIT(&rw->rw_hangman, rw->rwlock_name);
+
+	rw->rw_readwchan = wchan_create(rw->rwlock_name);
+	if (rw->rw_readwchan == NULL) {
+		kfree(rw->rwlock_name);
+		kfree(rw);
+		return NULL;
+	}
+	rw->rw_writewchan = wchan_create(rw->rwlock_name);
+	if (rw->rw_writewchan == NULL) {
+		wchan_destroy(rw->rw_readwchan);
+		kfree(rw->rwlock_name);
+		kfree(rw);
+		return NULL;
+	}
+
+	spinlock_init(&rw->rw_lock);
+	rw->rw_readers = 0;
+	rw->rw_readwait = 0;
+	rw->rw_writewait = 0;
+	rw->rw_readgen = 0;
+	rw->rw_writer = NULL;
+
+	return rw;
+}
+
+void
+rwlock_destroy(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+
+	KASSERT(rw->rw_readers == 0);
+	KASSERT(rw->rw_writer == NULL);
+	KASSERT(rw->rw_readwait == 0);
+	KASSERT(rw->rw_writewait == 0);
+
+	spinlock_cleanup(&rw->rw_lock);
+	wchan_destroy(rw->rw_writewchan);
+	wchan_destroy(rw->rw_readwchan);
+
+	kfree(rw->rwlock_name);
+	kfree(rw);
+}
+
+void
+rwlock_acquire_read(struct rwlock *rw)
+{
+	unsigned gen;
+
+	DEBUGASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_writer != curthread);
+
+	HANGMAN_WAIT(&curthread->t_hangman, &rw->rw_hangman);
+
+	if (rw->rw_writer == NULL && rw->rw_writewait == 0) {
+		rw->rw_readers++;
+	}
+	else {
+		/*
+		 * Wait for the next batch of readers to be let in.
+		 * Whoever does that counts us in rw_readers, so we
+		 * don't need to recheck anything once it's happened.
+		 */
+		rw->rw_readwait++;
+		gen = rw->rw_readgen;
+		while (rw->rw_readgen == gen) {
+			wchan_sleep(rw->rw_readwchan, &rw->rw_lock);
+		}
+	}
+
+	HANGMAN_ACQUIRESHARED(&curthread->t_hangman, &rw->rw_hangman);
+
+	spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_release_read(struct rwlock *rw)
+{
+	DEBUGASSERT(rw != NULL);
+
+	spinlock_acquire(&rw->rw_lock);
+
+	KASSERT(rw->rw_readers > 0);
+	KASSERT(rw->rw_writer == NULL);
+	rw->rw_readers--;
+	if (rw->rw_readers == 0 && rw->rw_writewait > 0) {
+		wchan_wakeone(rw->rw_writewchan, &rw->rw_lock);
+	}
+
+	spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_acquire_write(struct rwlock *rw)
+{
+	DEBUGASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_writer != curthread);
+
+	HANGMAN_WAIT(&curthread->t_hangman, &rw->rw_hangman);
+
+	if (rw->rw_writer != NULL || rw->rw_readers > 0) {
+		rw->rw_writewait++;
+		while (rw->rw_writer != NULL || rw->rw_readers > 0) {
+			wchan_sleep(rw->rw_writewchan, &rw->rw_lock);
+		}
+		rw->rw_writewait--;
+	}
+	rw->rw_writer = curthread;
+
+	HANGMAN_ACQUIRE(&curthread->t_hangman, &rw->rw_hangman);
+
+	spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_release_write(struct rwlock *rw)
+{
+	DEBUGASSERT(rw != NULL);
+
+	spinlock_acquire(&rw->rw_lock);
+
+	KASSERT(rw->rw_writer == curthread);
+	KASSERT(rw->rw_readers == 0);
+	rw->rw_writer = NULL;
+
+	if (rw->rw_readwait > 0) {
+		/* Let in everyone who queued up behind us. */
+		rw->rw_readers = rw->rw_readwait;
+		rw->rw_readwait = 0;
+		rw->rw_readgen++;
+		wchan_wakeall(rw->rw_readwchan, &rw->rw_lock);
+	}
+	else if (rw->rw_writewait > 0) {
+		wchan_wakeone(rw->rw_writewchan, &rw->rw_lock);
+	}
+
+	HANGMAN_RELEASE(&curthread->t_hangman, &rw->rw_hangman);
+
+	spinlock_release(&rw->rw_lock);
+}
+
+bool
+rwlock_do_i_hold_write(struct rwlock *rw)
+{
+	bool ret;
+
+	DEBUGASSERT(rw != NULL);
+
+	spinlock_acquire(&rw->rw_lock);
+	ret = (rw->rw_writer == curthread);
+	spinlock_release(&rw->rw_lock);
+
+	return ret;
+}
+
 ////////////////////////////////////////////////////////////
 //
 // CV
@@ -41,6 +41,7 @@
 #include <array.h>
 #include <cpu.h>
 #include <spl.h>
+#include <clock.h>
 #include <spinlock.h>
 #include <wchan.h>
 #include <thread.h>
@@ -58,6 +59,17 @@
 /* Magic number used as a guard value on kernel thread stacks. */
 #define THREAD_STACK_MAGIC 0xbaadf00d
 
+/*
+ * Scheduler tuning, in hardclocks. The quantum doubles at each
+ * priority level down; a thread that has been waiting on the run
+ * queue for SCHED_AGE_HARDCLOCKS is moved up a level.
+ */
+#define SCHED_QUANTUM(prio)	(1U << (prio))
+#define SCHED_AGE_HARDCLOCKS	50
+
+/* Cache affinity tunable; see thread.h. */
+unsigned sched_migrate_cost = 2;
+
 /* Wait channel. A wchan is protected by an associated, passed-in spinlock. */
 struct wchan {
 	const char *wc_name;		/* name for this channel */
@@ -143,8 +155,25 @@ thread_create(const char *name)
 	thread->t_context = NULL;
 	thread->t_cpu = NULL;
 	thread->t_proc = NULL;
+	thread->t_ustack = 0;
+	thread->t_sleepchan = wchan_create("clocksleep");
+	if (thread->t_sleepchan == NULL) {
+		kfree(thread->t_name);
+		kfree(thread);
+		return NULL;
+	}
 	HANGMAN_ACTORINIT(&thread->t_hangman, thread->t_name);
 
+	/* Scheduler fields: new threads start at the top */
+	thread->t_prio = 0;
+	thread->t_quantum = SCHED_QUANTUM(0);
+	thread->t_readystamp = 0;
+	thread->t_runticks = 0;
+	thread->t_waitticks = 0;
+	thread->t_lastcpu = NULL;
+	thread->t_lastran = 0;
+	thread->t_migrations = 0;
+
 	/* Interrupt state fields */
 	thread->t_in_interrupt = false;
 	thread->t_curspl = IPL_HIGH;
@@ -168,6 +197,7 @@ cpu_create(unsigned hardware_number)
 {
 	struct cpu *c;
 	int result;
+	unsigned i;
 	char namebuf[16];
 
 	c = kmalloc(sizeof(*c));
@@ -182,13 +212,22 @@ cpu_create(unsigned hardware_number)
 	threadlist_init(&c->c_zombies);
 	c->c_hardclocks = 0;
 	c->c_spinlocks = 0;
+	c->c_idleclocks = 0;
+	c->c_steals = 0;
+	timerwheel_init(&c->c_timers);
+	c->c_tickless = false;
+	c->c_ticklessstart = 0;
 
 	c->c_isidle = false;
-	threadlist_init(&c->c_runqueue);
+	for (i=0; i<SCHED_NPRIO; i++) {
+		threadlist_init(&c->c_runqueue[i]);
+	}
+	c->c_nready = 0;
 	spinlock_init(&c->c_runqueue_lock);
 
 	c->c_ipi_pending = 0;
 	c->c_numshootdown = 0;
+	c->c_tlbas = NULL;
 	spinlock_init(&c->c_ipi_lock);
 
 	result = cpuarray_add(&allcpus, c, &c->c_number);
@@ -282,6 +321,7 @@ thread_destroy(struct thread *thread)
 	}
 	threadlistnode_cleanup(&thread->t_listnode);
 	thread_machdep_cleanup(&thread->t_machdep);
+	wchan_destroy(thread->t_sleepchan);
 
 	/* sheer paranoia */
 	thread->t_wchan_name = "DESTROYED";
@@ -317,6 +357,9 @@ exorcise(void)
 void
 thread_panic(void)
 {
+	struct threadlist *tl;
+	unsigned i;
+
 	/*
 	 * Kill off other CPUs.
 	 *
@@ -331,9 +374,13 @@ thread_panic(void)
 	 * to.  Instead, blat the list structure by hand, and take the
 	 * risk that it might not be quite atomic.
 	 */
-	curcpu->c_runqueue.tl_count = 0;
-	curcpu->c_runqueue.tl_head.tln_next = &curcpu->c_runqueue.tl_tail;
-	curcpu->c_runqueue.tl_tail.tln_prev = &curcpu->c_runqueue.tl_head;
+	for (i=0; i<SCHED_NPRIO; i++) {
+		tl = &curcpu->c_runqueue[i];
+		tl->tl_count = 0;
+		tl->tl_head.tln_next = &tl->tl_tail;
+		tl->tl_tail.tln_prev = &tl->tl_head;
+	}
+	curcpu->c_nready = 0;
 
 	/*
 	 * Ideally, we want to make sure sleeping threads don't wake
@@ -445,6 +492,146 @@ thread_start_cpus(void)
 	cpu_startup_sem = NULL;
 }
 
+/*
+ * Run queue helpers. The caller must hold the cpu's runqueue lock.
+ */
+
+/* Number of threads ready to run on C. */
+static
+unsigned
+runqueue_count(struct cpu *c)
+{
+	return c->c_nready;
+}
+
+/* Queue T at the back of its priority level on C. */
+static
+void
+runqueue_add(struct cpu *c, struct thread *t)
+{
+	KASSERT(t->t_prio < SCHED_NPRIO);
+	t->t_readystamp = c->c_hardclocks;
+	threadlist_addtail(&c->c_runqueue[t->t_prio], t);
+	c->c_nready++;
+}
+
+/* Take the next thread to run: the first one at the highest level. */
+static
+struct thread *
+runqueue_remhead(struct cpu *c)
+{
+	struct thread *t;
+	unsigned i;
+
+	for (i=0; i<SCHED_NPRIO; i++) {
+		t = threadlist_remhead(&c->c_runqueue[i]);
+		if (t != NULL) {
+			c->c_nready--;
+			t->t_waitticks += c->c_hardclocks - t->t_readystamp;
+			return t;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Check if a thread's cache footprint has probably gone cold: it
+ * hasn't run for at least sched_migrate_cost hardclocks (counted on
+ * the cpu it ran on), or has never run. Such a thread loses little
+ * by being moved to another cpu.
+ */
+static
+bool
+thread_iscold(struct thread *t)
+{
+	if (t->t_lastcpu == NULL) {
+		return true;
+	}
+	return t->t_lastcpu->c_hardclocks - t->t_lastran >=
+		sched_migrate_cost;
+}
+
+/*
+ * Take a thread to move to another cpu. Prefer the cold thread that
+ * would otherwise run last (searching from the tail of the lowest
+ * level up); if they're all warm, take the last one anyway.
+ */
+static
+struct thread *
+runqueue_remvictim(struct cpu *c)
+{
+	struct thread *t;
+	unsigned i;
+
+	for (i=SCHED_NPRIO; i-- > 0; ) {
+		THREADLIST_FORALL_REV(t, c->c_runqueue[i]) {
+			if (thread_iscold(t)) {
+				threadlist_remove(&c->c_runqueue[i], t);
+				c->c_nready--;
+				return t;
+			}
+		}
+	}
+	for (i=SCHED_NPRIO; i-- > 0; ) {
+		t = threadlist_remtail(&c->c_runqueue[i]);
+		if (t != NULL) {
+			c->c_nready--;
+			return t;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Choose the cpu to wake a sleeping thread on. Normally that's the
+ * one it last belonged to. But if that cpu is busy, the thread's
+ * cache footprint there has gone cold anyway, and another cpu is
+ * idle, wake it on the idle one instead of making it wait. (All of
+ * System/161's cpus are equally close, so any idle cpu will do.)
+ *
+ * The idle checks are unlocked hints. The one thing that must be
+ * checked properly is that the home cpu isn't still running on the
+ * thread's stack: a cpu that goes idle stays on the stack of the
+ * thread that went to sleep, with c_curthread still pointing at it,
+ * and it does so without its runqueue lock.
+ */
+static
+struct cpu *
+thread_wakeup_cpu(struct thread *target)
+{
+	struct cpu *home, *c, *idle;
+	unsigned i;
+	bool busy;
+
+	home = target->t_cpu;
+	if (home->c_isidle || !thread_iscold(target)) {
+		return home;
+	}
+
+	idle = NULL;
+	for (i=0; i<cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c != home && c->c_isidle) {
+			idle = c;
+			break;
+		}
+	}
+	if (idle == NULL) {
+		return home;
+	}
+
+	spinlock_acquire(&home->c_runqueue_lock);
+	busy = home->c_curthread == target;
+	spinlock_release(&home->c_runqueue_lock);
+	if (busy) {
+		return home;
+	}
+
+	target->t_cpu = idle;
+	target->t_migrations++;
+	return idle;
+}
+
 /*
  * Make a thread runnable.
  *
@@ -457,7 +644,12 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 	struct cpu *targetcpu;
 
 	/* Lock the run queue of the target thread's cpu. */
-	targetcpu = target->t_cpu;
+	if (target->t_state == S_SLEEP && !already_have_lock) {
+		targetcpu = thread_wakeup_cpu(target);
+	}
+	else {
+		targetcpu = target->t_cpu;
+	}
 
 	if (already_have_lock) {
 		/* The target thread's cpu should be already locked. */
@@ -467,9 +659,19 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 		spinlock_acquire(&targetcpu->c_runqueue_lock);
 	}
 
+	/*
+	 * A thread waking up from sleep gets a boost: it gave up the
+	 * cpu before its quantum ran out, so it's likely interactive
+	 * or I/O-bound.
+	 */
+	if (target->t_state == S_SLEEP && target->t_prio > 0) {
+		target->t_prio--;
+		target->t_quantum = SCHED_QUANTUM(target->t_prio);
+	}
+
 	/* Target thread is now ready to run; put it on the run queue. */
 	target->t_state = S_READY;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
+	runqueue_add(targetcpu, target);
 
 	if (targetcpu->c_isidle && targetcpu != curcpu->c_self) {
 		/*
@@ -484,6 +686,67 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 	}
 }
 
+/*
+ * Work stealing. Called by a cpu that is about to go idle, without
+ * its own runqueue lock held (two cpus stealing from each other would
+ * otherwise deadlock). Picks the peer with the most ready threads,
+ * going by the unlocked c_nready hints so only that one runqueue lock
+ * is taken, and takes the thread at the tail of its lowest nonempty
+ * level, preferring one whose cache has gone cold (runqueue_remvictim).
+ *
+ * Peers that are themselves idle are left alone; they're about to run
+ * whatever is on their queues (and in the window while one unidles,
+ * its own curthread can be on its run queue, which must not move).
+ *
+ * Returns the stolen thread, now belonging to this cpu but not on any
+ * queue, or NULL.
+ */
+static
+struct thread *
+thread_steal(void)
+{
+	struct cpu *c, *victim;
+	struct thread *t;
+	unsigned i, n, most;
+
+	victim = NULL;
+	most = 0;
+	for (i=0; i<cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c == curcpu->c_self) {
+			continue;
+		}
+		n = c->c_nready;
+		if (n > most && !c->c_isidle) {
+			victim = c;
+			most = n;
+		}
+	}
+	if (victim == NULL) {
+		return NULL;
+	}
+
+	t = NULL;
+	spinlock_acquire(&victim->c_runqueue_lock);
+	if (!victim->c_isidle) {
+		t = runqueue_remvictim(victim);
+	}
+	if (t != NULL) {
+		KASSERT(t != victim->c_curthread);
+		t->t_waitticks += victim->c_hardclocks - t->t_readystamp;
+		t->t_cpu = curcpu->c_self;
+		t->t_migrations++;
+	}
+	spinlock_release(&victim->c_runqueue_lock);
+
+	if (t != NULL) {
+		curcpu->c_steals++;
+		DEBUG(DB_THREADS, "Stole thread %s: cpu %u -> %u",
+		      t->t_name, victim->c_number, curcpu->c_number);
+	}
+	return t;
+}
+
 /*
  * Create a new thread based on an existing one.
  *
@@ -591,7 +854,7 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 
 	/* Micro-optimization: if nothing to do, just return */
-	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
+	if (newstate == S_READY && runqueue_count(curcpu) == 0) {
 		spinlock_release(&curcpu->c_runqueue_lock);
 		splx(spl);
 		return;
@@ -625,10 +888,11 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	cur->t_state = newstate;
 
 	/*
-	 * Get the next thread. While there isn't one, call cpu_idle().
+	 * Get the next thread. While there isn't one, try to steal one
+	 * from a busier cpu, and failing that call cpu_idle().
 	 * curcpu->c_isidle must be true when cpu_idle is
-	 * called. Unlock the runqueue while idling too, to make sure
-	 * things can be added to it.
+	 * called. Unlock the runqueue while stealing or idling too, to
+	 * make sure things can be added to it.
 	 *
 	 * Note that we don't need to unlock the runqueue atomically
 	 * with idling; becoming unidle requires receiving an
@@ -644,10 +908,15 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	/* The current cpu is now idle. */
 	curcpu->c_isidle = true;
 	do {
-		next = threadlist_remhead(&curcpu->c_runqueue);
+		next = runqueue_remhead(curcpu);
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
-			cpu_idle();
+			next = thread_steal();
+			if (next == NULL) {
+				clock_idle_enter();
+				cpu_idle();
+				clock_idle_exit();
+			}
 			spinlock_acquire(&curcpu->c_runqueue_lock);
 		}
 	} while (next == NULL);
@@ -660,6 +929,8 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	 * assume the compiler will optimize one away if they're the
 	 * same.
 	 */
+	cur->t_lastcpu = curcpu->c_self;
+	cur->t_lastran = curcpu->c_hardclocks;
 	curcpu->c_curthread = next;
 	curthread = next;
 
@@ -821,17 +1092,186 @@ thread_yield(void)
 /*
  * Scheduler.
  *
- * This is called periodically from hardclock(). It should reshuffle
- * the current CPU's run queue by job priority.
+ * This is a multi-level feedback queue. Each cpu has SCHED_NPRIO run
+ * queues, and always runs the first thread from the highest-priority
+ * nonempty one. Threads start at the top level. A thread that runs
+ * for a whole quantum without blocking is moved down a level, where
+ * the quantum is twice as long; a thread woken from sleep is moved up
+ * one (see thread_make_runnable). So CPU hogs sink to the bottom and
+ * interactive threads stay near the top and get to run promptly when
+ * they wake up.
+ *
+ * To keep the hogs from starving, schedule() moves any thread that has
+ * been waiting on the run queue for SCHED_AGE_HARDCLOCKS up a level.
+ *
+ * Each thread also accumulates the time it has spent running and the
+ * time it has spent waiting to run; thread_printsched shows these.
  */
 
+/*
+ * This is called from hardclock() on every tick.
+ */
+void
+thread_timeslice(void)
+{
+	struct thread *cur;
+	bool preempt;
+	unsigned i;
+
+	/* Nothing to charge if we interrupted the idle loop. */
+	if (curcpu->c_isidle) {
+		curcpu->c_idleclocks++;
+		return;
+	}
+
+	cur = curthread;
+	preempt = false;
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	cur->t_runticks++;
+	if (cur->t_quantum > 0) {
+		cur->t_quantum--;
+	}
+	if (cur->t_quantum == 0) {
+		/* Used its whole quantum: demote and go to the back. */
+		if (cur->t_prio < SCHED_NPRIO - 1) {
+			cur->t_prio++;
+		}
+		cur->t_quantum = SCHED_QUANTUM(cur->t_prio);
+		preempt = true;
+	}
+	else {
+		/* Otherwise only give way to a higher level. */
+		for (i=0; i<cur->t_prio; i++) {
+			if (!threadlist_isempty(&curcpu->c_runqueue[i])) {
+				preempt = true;
+				break;
+			}
+		}
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
+
+	if (preempt) {
+		thread_yield();
+	}
+}
+
+/*
+ * This is called periodically from hardclock(). It ages the current
+ * CPU's run queues: threads that have waited too long move up.
+ */
 void
 schedule(void)
 {
-	/*
-	 * You can write this. If we do nothing, threads will run in
-	 * round-robin fashion.
-	 */
+	struct threadlist *tl;
+	struct thread *t, *next;
+	unsigned prio;
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	for (prio=1; prio<SCHED_NPRIO; prio++) {
+		tl = &curcpu->c_runqueue[prio];
+		for (t = tl->tl_head.tln_next->tln_self; t != NULL; t = next) {
+			next = t->t_listnode.tln_next->tln_self;
+			if (curcpu->c_hardclocks - t->t_readystamp <
+			    SCHED_AGE_HARDCLOCKS) {
+				continue;
+			}
+			threadlist_remove(tl, t);
+			curcpu->c_nready--;
+			t->t_waitticks += curcpu->c_hardclocks -
+				t->t_readystamp;
+			t->t_prio = prio - 1;
+			t->t_quantum = SCHED_QUANTUM(t->t_prio);
+			runqueue_add(curcpu, t);
+		}
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
+}
+
+/*
+ * Print each cpu's utilization and steal count, and its current thread
+ * and run queues with each thread's priority and accounting. The entries are copied out first so we
+ * don't print while holding a runqueue lock.
+ */
+#define PRINTSCHED_MAX 32
+
+struct schedsnap {
+	char name[24];
+	unsigned prio, runticks, waitticks, migrations;
+	bool running;
+};
+
+static
+unsigned
+schedsnap_add(struct schedsnap *snap, unsigned n, struct thread *t,
+	      bool running)
+{
+	if (n >= PRINTSCHED_MAX) {
+		return n;
+	}
+	snprintf(snap[n].name, sizeof(snap[n].name), "%s", t->t_name);
+	snap[n].prio = t->t_prio;
+	snap[n].runticks = t->t_runticks;
+	snap[n].waitticks = t->t_waitticks;
+	snap[n].migrations = t->t_migrations;
+	snap[n].running = running;
+	return n + 1;
+}
+
+void
+thread_printsched(void)
+{
+	struct schedsnap *snap;
+	struct cpu *c;
+	struct thread *t;
+	unsigned i, j, n, total, prio, clocks, idle;
+
+	snap = kmalloc(PRINTSCHED_MAX * sizeof(*snap));
+	if (snap == NULL) {
+		kprintf("thread_printsched: Out of memory\n");
+		return;
+	}
+
+	for (i=0; i<cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		n = 0;
+		spinlock_acquire(&c->c_runqueue_lock);
+		if (!c->c_isidle) {
+			n = schedsnap_add(snap, n, c->c_curthread, true);
+		}
+		for (prio=0; prio<SCHED_NPRIO; prio++) {
+			THREADLIST_FORALL(t, c->c_runqueue[prio]) {
+				n = schedsnap_add(snap, n, t, false);
+			}
+		}
+		total = runqueue_count(c);
+		clocks = c->c_hardclocks;
+		idle = c->c_idleclocks;
+		spinlock_release(&c->c_runqueue_lock);
+
+		kprintf("cpu%u: %u%% busy (idle %u of %u hardclocks), "
+			"%u steals\n", c->c_number,
+			clocks ? 100 - (100 * idle) / clocks : 0,
+			idle, clocks, c->c_steals);
+
+		if (n > 0) {
+			kprintf("%-4s %-23s %4s %10s %10s %5s\n", "cpu",
+				"thread", "prio", "run ticks", "wait ticks",
+				"migr");
+		}
+		for (j=0; j<n; j++) {
+			kprintf("%-4u %-23s %4u %10u %10u %5u%s\n",
+				c->c_number, snap[j].name, snap[j].prio,
+				snap[j].runticks, snap[j].waitticks,
+				snap[j].migrations,
+				snap[j].running ? " (running)" : "");
+		}
+		if (n == PRINTSCHED_MAX) {
+			kprintf("cpu%u: %u threads ready in all\n",
+				c->c_number, total);
+		}
+	}
+	kfree(snap);
 }
 
 /*
@@ -841,6 +1281,10 @@ schedule(void)
  * CPU is busy and other CPUs are idle, or less busy, it should move
  * threads across to those other other CPUs.
  *
+ * A cpu that runs out of work doesn't wait for this; it steals from
+ * the busiest peer right away (see thread_steal). So this is now just
+ * a slower background rebalance between cpus that are all busy.
+ *
  * Migrating threads isn't free because of cache affinity; a thread's
  * working cache set will end up having to be moved to the other CPU,
  * which is fairly slow. The tradeoff between this performance loss
@@ -854,7 +1298,7 @@ schedule(void)
 void
 thread_consider_migration(void)
 {
-	unsigned my_count, total_count, one_share, to_send;
+	unsigned my_count, total_count, one_share, to_send, count;
 	unsigned i, numcpus;
 	struct cpu *c;
 	struct threadlist victims;
@@ -865,9 +1309,10 @@ thread_consider_migration(void)
 	for (i=0; i<numcpus; i++) {
 		c = cpuarray_get(&allcpus, i);
 		spinlock_acquire(&c->c_runqueue_lock);
-		total_count += c->c_runqueue.tl_count;
+		count = runqueue_count(c);
+		total_count += count;
 		if (c == curcpu->c_self) {
-			my_count = c->c_runqueue.tl_count;
+			my_count = count;
 		}
 		spinlock_release(&c->c_runqueue_lock);
 	}
@@ -881,7 +1326,10 @@ thread_consider_migration(void)
 	threadlist_init(&victims);
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 	for (i=0; i<to_send; i++) {
-		t = threadlist_remtail(&curcpu->c_runqueue);
+		/* cold, low-priority threads first */
+		t = runqueue_remvictim(curcpu);
+		/* charge the wait so far; runqueue_add restamps it */
+		t->t_waitticks += curcpu->c_hardclocks - t->t_readystamp;
 		threadlist_addhead(&victims, t);
 	}
 	spinlock_release(&curcpu->c_runqueue_lock);
@@ -892,7 +1340,7 @@ thread_consider_migration(void)
 			continue;
 		}
 		spinlock_acquire(&c->c_runqueue_lock);
-		while (c->c_runqueue.tl_count < one_share && to_send > 0) {
+		while (runqueue_count(c) < one_share && to_send > 0) {
 			t = threadlist_remhead(&victims);
 			/*
 			 * Ordinarily, curthread will not appear on
@@ -923,7 +1371,8 @@ thread_consider_migration(void)
 			}
 
 			t->t_cpu = c;
-			threadlist_addtail(&c->c_runqueue, t);
+			t->t_migrations++;
+			runqueue_add(c, t);
 			DEBUG(DB_THREADS,
 			      "Migrated thread %s: cpu %u -> %u",
 			      t->t_name, curcpu->c_number, c->c_number);
@@ -947,7 +1396,7 @@ thread_consider_migration(void)
 	if (!threadlist_isempty(&victims)) {
 		spinlock_acquire(&curcpu->c_runqueue_lock);
 		while ((t = threadlist_remhead(&victims)) != NULL) {
-			threadlist_addtail(&curcpu->c_runqueue, t);
+			runqueue_add(curcpu, t);
 		}
 		spinlock_release(&curcpu->c_runqueue_lock);
 	}
@@ -1135,6 +1584,11 @@ ipi_broadcast(int code)
 
 /*
  * Send a TLB shootdown IPI to the specified CPU.
+ *
+ * If the target's queue is full, wait for it to drain. The caller
+ * must have interrupts on and hold no spinlocks, so that shootdowns
+ * sent to us meanwhile get handled; otherwise two cpus shooting at
+ * each other could wait forever.
  */
 void
 ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
@@ -1143,23 +1597,17 @@ ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 
 	spinlock_acquire(&target->c_ipi_lock);
 
-	n = target->c_numshootdown;
-	if (n == TLBSHOOTDOWN_MAX) {
-		/*
-		 * If you have problems with this panic going off,
-		 * consider: (1) increasing the maximum, (2) putting
-		 * logic here to sleep until space appears (may
-		 * interact awkwardly with VM system locking), (3)
-		 * putting logic here to coalesce requests together,
-		 * and/or (4) improving VM system state tracking to
-		 * reduce the number of unnecessary shootdowns.
-		 */
-		panic("ipi_tlbshootdown: Too many shootdowns queued\n");
-	}
-	else {
-		target->c_shootdown[n] = *mapping;
-		target->c_numshootdown = n+1;
+	while ((n = target->c_numshootdown) == TLBSHOOTDOWN_MAX) {
+		KASSERT(curcpu->c_spinlocks == 1);
+		spinlock_release(&target->c_ipi_lock);
+		KASSERT(curthread->t_curspl == 0);
+		while (target->c_numshootdown == TLBSHOOTDOWN_MAX) {
+			/* spin */
+		}
+		spinlock_acquire(&target->c_ipi_lock);
 	}
+	target->c_shootdown[n] = *mapping;
+	target->c_numshootdown = n+1;
 
 	target->c_ipi_pending |= (uint32_t)1 << IPI_TLBSHOOTDOWN;
 	mainbus_send_ipi(target);
@@ -1167,6 +1615,21 @@ ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 	spinlock_release(&target->c_ipi_lock);
 }
 
+/*
+ * Send the same TLB shootdown to each CPU in a mask of cpu numbers.
+ */
+void
+ipi_tlbshootdown_mask(uint32_t cpus, const struct tlbshootdown *mapping)
+{
+	unsigned i;
+
+	for (i=0; i < cpuarray_num(&allcpus); i++) {
+		if (cpus & ((uint32_t)1 << i)) {
+			ipi_tlbshootdown(cpuarray_get(&allcpus, i), mapping);
+		}
+	}
+}
+
 /*
  * Handle an incoming interprocessor interrupt.
  */
@@ -1204,9 +1667,9 @@ interprocessor_interrupt(void)
 	}
 	if (bits & (1U << IPI_TLBSHOOTDOWN)) {
 		/*
-		 * Note: depending on your VM system locking you might
-		 * need to release the ipi lock while calling
-		 * vm_tlbshootdown.
+		 * vm_tlbshootdown takes only the address space's
+		 * TLB spinlock, which is never held while sending, so
+		 * it's safe to keep the ipi lock.
 		 */
 		for (i=0; i<curcpu->c_numshootdown; i++) {
 			vm_tlbshootdown(&curcpu->c_shootdown[i]);
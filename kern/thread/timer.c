@@ -0,0 +1,272 @@
+/*
+ * Copyright (c) 2016
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Timer wheels. See timer.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <current.h>
+#include <timer.h>
+
+/* Ticks covered by levels 0 through L. */
+#define TW_SPAN(l)	((uint64_t)1 << (TW_SLOTBITS * ((l) + 1)))
+
+/* Slot index of tick T at level L. */
+#define TW_INDEX(t, l)	((unsigned)((t) >> (TW_SLOTBITS * (l))) & (TW_SLOTS - 1))
+
+/*
+ * Put T on wheel TW according to how far away it is. T->tm_expire
+ * must not be in the past. Timers farther out than the whole wheel
+ * reaches are put in the farthest slot and sorted out again when
+ * that slot is cascaded.
+ */
+static
+void
+tw_insert(struct timerwheel *tw, struct timer *t)
+{
+	struct timer **slot;
+	uint64_t delta, when;
+	unsigned level;
+
+	KASSERT(spinlock_do_i_hold(&tw->tw_lock));
+	KASSERT(t->tm_expire >= tw->tw_now);
+
+	delta = t->tm_expire - tw->tw_now;
+	when = t->tm_expire;
+	for (level = 0; level < TW_LEVELS - 1; level++) {
+		if (delta < TW_SPAN(level)) {
+			break;
+		}
+	}
+	if (delta >= TW_SPAN(TW_LEVELS - 1)) {
+		when = tw->tw_now + TW_SPAN(TW_LEVELS - 1) - 1;
+	}
+
+	slot = &tw->tw_slots[level][TW_INDEX(when, level)];
+	t->tm_next = *slot;
+	if (t->tm_next != NULL) {
+		t->tm_next->tm_pprev = &t->tm_next;
+	}
+	t->tm_pprev = slot;
+	*slot = t;
+}
+
+/*
+ * Take T off whatever slot it's on.
+ */
+static
+void
+tw_unlink(struct timer *t)
+{
+	*t->tm_pprev = t->tm_next;
+	if (t->tm_next != NULL) {
+		t->tm_next->tm_pprev = t->tm_pprev;
+	}
+	t->tm_next = NULL;
+	t->tm_pprev = NULL;
+}
+
+/*
+ * Redistribute the timers in slot INDEX of LEVEL to lower levels.
+ */
+static
+void
+tw_cascade(struct timerwheel *tw, unsigned level, unsigned index)
+{
+	struct timer *t, *next;
+
+	t = tw->tw_slots[level][index];
+	tw->tw_slots[level][index] = NULL;
+	while (t != NULL) {
+		next = t->tm_next;
+		tw_insert(tw, t);
+		t = next;
+	}
+}
+
+void
+timer_init(struct timer *t, void (*func)(void *), void *data)
+{
+	t->tm_next = NULL;
+	t->tm_pprev = NULL;
+	t->tm_expire = 0;
+	t->tm_cpu = NULL;
+	t->tm_func = func;
+	t->tm_data = data;
+}
+
+void
+timer_start(struct timer *t, unsigned ticks)
+{
+	struct timerwheel *tw;
+	struct cpu *c;
+	int s;
+
+	KASSERT(t->tm_cpu == NULL);
+
+	if (ticks == 0) {
+		ticks = 1;
+	}
+
+	/*
+	 * Stay on this cpu until the timer is on its wheel; otherwise
+	 * it might land on the wheel of a cpu that has just gone idle
+	 * and stopped its clock.
+	 */
+	s = splhigh();
+	c = curcpu->c_self;
+	tw = &c->c_timers;
+	spinlock_acquire(&tw->tw_lock);
+	t->tm_expire = tw->tw_now + ticks;
+	t->tm_cpu = c;
+	tw_insert(tw, t);
+	tw->tw_count++;
+	spinlock_release(&tw->tw_lock);
+	splx(s);
+}
+
+bool
+timer_cancel(struct timer *t)
+{
+	struct timerwheel *tw;
+	struct cpu *c;
+
+	/*
+	 * tm_cpu only changes with the wheel locked, so check it
+	 * again once we have the lock.
+	 */
+	while (1) {
+		c = t->tm_cpu;
+		if (c == NULL) {
+			return false;
+		}
+		tw = &c->c_timers;
+		spinlock_acquire(&tw->tw_lock);
+		if (t->tm_cpu == c) {
+			tw_unlink(t);
+			t->tm_cpu = NULL;
+			KASSERT(tw->tw_count > 0);
+			tw->tw_count--;
+			spinlock_release(&tw->tw_lock);
+			return true;
+		}
+		spinlock_release(&tw->tw_lock);
+	}
+}
+
+void
+timerwheel_init(struct timerwheel *tw)
+{
+	unsigned i, j;
+
+	spinlock_init(&tw->tw_lock);
+	tw->tw_now = 0;
+	tw->tw_count = 0;
+	for (i=0; i<TW_LEVELS; i++) {
+		for (j=0; j<TW_SLOTS; j++) {
+			tw->tw_slots[i][j] = NULL;
+		}
+	}
+}
+
+void
+timerwheel_advance(unsigned nticks)
+{
+	struct timerwheel *tw;
+	struct timer **slot, *t;
+	unsigned level;
+
+	tw = &curcpu->c_timers;
+	spinlock_acquire(&tw->tw_lock);
+	while (nticks > 0) {
+		nticks--;
+		tw->tw_now++;
+		if (tw->tw_count == 0) {
+			continue;
+		}
+
+		/* Going into a new slot at level 1 or above: cascade. */
+		for (level = 1; level < TW_LEVELS; level++) {
+			if (TW_INDEX(tw->tw_now, level - 1) != 0) {
+				break;
+			}
+			tw_cascade(tw, level, TW_INDEX(tw->tw_now, level));
+		}
+
+		/*
+		 * Fire everything in this tick's slot. Drop the lock
+		 * to call each one, so it can restart itself (which
+		 * puts it in a later slot) or start or cancel others.
+		 */
+		slot = &tw->tw_slots[0][TW_INDEX(tw->tw_now, 0)];
+		while (*slot != NULL) {
+			t = *slot;
+			KASSERT(t->tm_expire == tw->tw_now);
+			tw_unlink(t);
+			t->tm_cpu = NULL;
+			tw->tw_count--;
+			spinlock_release(&tw->tw_lock);
+			t->tm_func(t->tm_data);
+			spinlock_acquire(&tw->tw_lock);
+		}
+	}
+	spinlock_release(&tw->tw_lock);
+}
+
+unsigned
+timerwheel_idleticks(unsigned max)
+{
+	struct timerwheel *tw;
+	unsigned n;
+
+	tw = &curcpu->c_timers;
+	spinlock_acquire(&tw->tw_lock);
+	if (tw->tw_count == 0) {
+		spinlock_release(&tw->tw_lock);
+		return max;
+	}
+
+	/*
+	 * Stop at the first tick with something in its slot, or that
+	 * starts a new level-1 slot and so may bring timers down.
+	 */
+	for (n = 1; n < max; n++) {
+		if (TW_INDEX(tw->tw_now + n, 0) == 0 ||
+		    tw->tw_slots[0][TW_INDEX(tw->tw_now + n, 0)] != NULL) {
+			break;
+		}
+	}
+	spinlock_release(&tw->tw_lock);
+	return n;
+}
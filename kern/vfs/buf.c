@@ -0,0 +1,1262 @@
+/*
+ * Copyright (c) 2016
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Block buffer cache. See buf.h.
+ *
+ * Buffers live in pages of BUF_PERPAGE buffers each (struct bufpage),
+ * so the cache grows and shrinks a page at a time and the reclaimer
+ * can hand whole pages back to the VM system.
+ *
+ * A buffer with an identity (b_dev != NULL) is on its hash chain.
+ * If nobody holds it, it is also on the LRU list, least recently
+ * used first; a buffer being written back by buf_sync, the flusher
+ * or eviction stays on the LRU list while held, so writing it
+ * doesn't disturb the replacement order. A buffer without an
+ * identity is on the free list.
+ *
+ * Dirty buffers are also on the dirty list, in the order they were
+ * first dirtied, so the oldest are written first. Writing to a
+ * buffer that is already dirty just coalesces with the pending
+ * write. The flusher thread writes back buffers that have been
+ * dirty longer than buf_flushage seconds, and kicks in early when
+ * more than buf_dirtybg buffers are dirty; past buf_dirtyhard,
+ * threads releasing buffers write back the oldest themselves until
+ * the count comes down again.
+ *
+ * buf_prefetch puts blocks on a small queue for the read-ahead
+ * thread, which reads them in while the caller gets on with
+ * something else. Buffers it fills are marked b_prefetched until
+ * somebody reads them, so we can tell how much of it was useful.
+ *
+ * buf_lock protects all the lists and every buffer that isn't held.
+ * It is never held across I/O or memory allocation; buf_cv is
+ * signalled whenever a buffer is released.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <synch.h>
+#include <uio.h>
+#include <clock.h>
+#include <timer.h>
+#include <current.h>
+#include <thread.h>
+#include <vm.h>
+#include <device.h>
+#include <reclaim.h>
+#include <statcounter.h>
+#include <buf.h>
+
+/* Buffers per page of buffers. */
+#define BUF_PERPAGE		(PAGE_SIZE / BUF_SIZE)
+
+/* Number of hash chains. */
+#define BUF_HASHSIZE		256
+
+/* Default cache size, in buffers. */
+#define BUF_DEFAULTMAX		128
+
+/* Default flusher settings. */
+#define BUF_DEFAULTAGE		5	/* seconds before writing back */
+#define BUF_DEFAULTDIRTYPCT	25	/* dirty percent to flush early */
+
+/* Size of the read-ahead queue. */
+#define BUF_RAQUEUE		32
+
+struct buf {
+	struct buf *b_hashnext;		/* hash chain */
+	struct buf *b_lruprev;		/* LRU or free list */
+	struct buf *b_lrunext;
+	struct buf *b_dirtyprev;	/* dirty list */
+	struct buf *b_dirtynext;
+	struct device *b_dev;		/* device, or NULL if unused */
+	daddr_t b_block;		/* block number on b_dev */
+	void *b_data;			/* BUF_SIZE bytes of data */
+	struct thread *b_holder;	/* thread holding it, if any */
+	bool b_valid;			/* b_data holds the block's contents */
+	bool b_dirty;			/* b_data needs to be written */
+	bool b_prefetched;		/* read ahead and not used yet */
+	time_t b_dirtytime;		/* when it became dirty */
+};
+
+struct bufpage {
+	struct bufpage *bp_next;
+	vaddr_t bp_va;			/* page holding the data */
+	struct buf bp_bufs[BUF_PERPAGE];
+};
+
+struct buflist {
+	struct buf *bl_head;
+	struct buf *bl_tail;
+};
+
+struct bufra {
+	struct device *ra_dev;		/* NULL if cancelled */
+	daddr_t ra_block;
+};
+
+static struct lock *buf_lock;
+static struct cv *buf_cv;
+static struct buf *buf_hashtable[BUF_HASHSIZE];
+static struct buflist buf_lru;
+static struct buflist buf_freelist;
+static struct buf *buf_dirtyhead;
+static struct buf *buf_dirtytail;
+static struct bufpage *buf_pages;
+static unsigned buf_nbufs;
+static unsigned buf_ndirty;
+static unsigned buf_maxbufs = BUF_DEFAULTMAX;
+
+/* Flusher state and tunables. */
+static struct semaphore *buf_flushsem;
+static struct timer buf_flushtimer;
+static bool buf_flusharmed;		/* timer started and not handled */
+static bool buf_flushkicked;		/* woken early, not yet run */
+static unsigned buf_flushage = BUF_DEFAULTAGE;
+static unsigned buf_dirtypct = BUF_DEFAULTDIRTYPCT;
+static unsigned buf_dirtybg;
+static unsigned buf_dirtyhard;
+
+/* Read-ahead queue. */
+static struct cv *buf_racv;
+static struct bufra buf_raqueue[BUF_RAQUEUE];
+static unsigned buf_rahead;		/* first entry */
+static unsigned buf_racount;		/* number of entries */
+static struct device *buf_radev;	/* device being read ahead on */
+
+/*
+ * Statistics.
+ */
+enum bufstat_counter {
+	BS_HIT,			/* buf_read found the block */
+	BS_MISS,		/* buf_read had to read it */
+	BS_READ,		/* blocks read from disk */
+	BS_WRITE,		/* blocks written to disk */
+	BS_EVICT,		/* buffers reused for another block */
+	BS_WRITEBACK,		/* ...that had to be written first */
+	BS_FLUSH,		/* blocks written by the flusher */
+	BS_THROTTLE,		/* releases that had to write back */
+	BS_SYNC,		/* buf_sync calls */
+	BS_SYNCUSEC,		/* total time spent in them */
+	BS_RAREAD,		/* blocks read ahead */
+	BS_RAHIT,		/* ...that were then read */
+	BS_RAWASTE,		/* ...that were dropped unread */
+	BS_RADROP,		/* read-aheads dropped, queue full */
+	BS_RECLAIM,		/* pages given back under memory pressure */
+	BS_NCOUNTERS
+};
+
+static const char *const bufstat_names[BS_NCOUNTERS] = {
+	[BS_HIT] = "hits",
+	[BS_MISS] = "misses",
+	[BS_READ] = "reads",
+	[BS_WRITE] = "writes",
+	[BS_EVICT] = "evictions",
+	[BS_WRITEBACK] = "writebacks",
+	[BS_FLUSH] = "flushed",
+	[BS_THROTTLE] = "throttled",
+	[BS_SYNC] = "syncs",
+	[BS_SYNCUSEC] = "syncusec",
+	[BS_RAREAD] = "readahead",
+	[BS_RAHIT] = "rahits",
+	[BS_RAWASTE] = "rawasted",
+	[BS_RADROP] = "radropped",
+	[BS_RECLAIM] = "reclaimed",
+};
+
+static struct statcounters bufstat =
+	STATCOUNTERS_INITIALIZER(bufstat_names, BS_NCOUNTERS);
+
+static
+void
+bufstat_add(enum bufstat_counter which, unsigned amount)
+{
+	statcounter_add(&bufstat, which, amount);
+}
+
+////////////////////////////////////////////////////////////
+// Lists and hashing
+
+static
+void
+buflist_remove(struct buflist *bl, struct buf *b)
+{
+	if (b->b_lruprev != NULL) {
+		b->b_lruprev->b_lrunext = b->b_lrunext;
+	}
+	else {
+		KASSERT(bl->bl_head == b);
+		bl->bl_head = b->b_lrunext;
+	}
+	if (b->b_lrunext != NULL) {
+		b->b_lrunext->b_lruprev = b->b_lruprev;
+	}
+	else {
+		KASSERT(bl->bl_tail == b);
+		bl->bl_tail = b->b_lruprev;
+	}
+	b->b_lruprev = b->b_lrunext = NULL;
+}
+
+static
+void
+buflist_addtail(struct buflist *bl, struct buf *b)
+{
+	b->b_lruprev = bl->bl_tail;
+	b->b_lrunext = NULL;
+	if (bl->bl_tail != NULL) {
+		bl->bl_tail->b_lrunext = b;
+	}
+	else {
+		bl->bl_head = b;
+	}
+	bl->bl_tail = b;
+}
+
+static
+void
+buf_dirtyremove(struct buf *b)
+{
+	if (b->b_dirtyprev != NULL) {
+		b->b_dirtyprev->b_dirtynext = b->b_dirtynext;
+	}
+	else {
+		KASSERT(buf_dirtyhead == b);
+		buf_dirtyhead = b->b_dirtynext;
+	}
+	if (b->b_dirtynext != NULL) {
+		b->b_dirtynext->b_dirtyprev = b->b_dirtyprev;
+	}
+	else {
+		KASSERT(buf_dirtytail == b);
+		buf_dirtytail = b->b_dirtyprev;
+	}
+	b->b_dirtyprev = b->b_dirtynext = NULL;
+	KASSERT(buf_ndirty > 0);
+	buf_ndirty--;
+}
+
+static
+void
+buf_dirtyadd(struct buf *b)
+{
+	b->b_dirtyprev = buf_dirtytail;
+	b->b_dirtynext = NULL;
+	if (buf_dirtytail != NULL) {
+		buf_dirtytail->b_dirtynext = b;
+	}
+	else {
+		buf_dirtyhead = b;
+	}
+	buf_dirtytail = b;
+	buf_ndirty++;
+}
+
+static
+time_t
+buf_now(void)
+{
+	struct timespec ts;
+
+	gettime(&ts);
+	return ts.tv_sec;
+}
+
+static
+unsigned
+buf_hash(struct device *dev, daddr_t block)
+{
+	return (block + ((uintptr_t)dev >> 4) * 31) % BUF_HASHSIZE;
+}
+
+static
+struct buf *
+buf_lookup(struct device *dev, daddr_t block)
+{
+	struct buf *b;
+
+	for (b = buf_hashtable[buf_hash(dev, block)]; b; b = b->b_hashnext) {
+		if (b->b_dev == dev && b->b_block == block) {
+			return b;
+		}
+	}
+	return NULL;
+}
+
+static
+void
+buf_hashremove(struct buf *b)
+{
+	struct buf **bp;
+
+	bp = &buf_hashtable[buf_hash(b->b_dev, b->b_block)];
+	while (*bp != b) {
+		KASSERT(*bp != NULL);
+		bp = &(*bp)->b_hashnext;
+	}
+	*bp = b->b_hashnext;
+	b->b_hashnext = NULL;
+}
+
+/*
+ * Take away a buffer's identity and put it on the free list. It must
+ * not be on the LRU list. Any dirty contents are lost.
+ */
+static
+void
+buf_forget(struct buf *b)
+{
+	KASSERT(lock_do_i_hold(buf_lock));
+	KASSERT(b->b_dev != NULL);
+	KASSERT(b->b_holder == NULL);
+
+	buf_hashremove(b);
+	if (b->b_dirty) {
+		buf_dirtyremove(b);
+	}
+	if (b->b_prefetched) {
+		bufstat_add(BS_RAWASTE, 1);
+	}
+	b->b_dev = NULL;
+	b->b_block = 0;
+	b->b_valid = false;
+	b->b_dirty = false;
+	buflist_addtail(&buf_freelist, b);
+}
+
+////////////////////////////////////////////////////////////
+// Disk I/O
+
+/*
+ * Read or write a block, retrying I/O errors.
+ */
+static
+int
+buf_devio(struct device *dev, daddr_t block, void *data, enum uio_rw rw)
+{
+	struct iovec iov;
+	struct uio ku;
+	int result;
+	int tries=0;
+
+	KASSERT(!lock_do_i_hold(buf_lock));
+
+	DEBUG(DB_VFS, "buf: %s %u\n", rw == UIO_READ ? "read" : "write",
+	      block);
+
+ retry:
+	uio_kinit(&iov, &ku, data, BUF_SIZE, ((off_t)block)*BUF_SIZE, rw);
+	result = DEVOP_IO(dev, &ku);
+	if (result == EINVAL) {
+		/*
+		 * This means the sector we requested was out of range,
+		 * or the seek address we gave wasn't sector-aligned,
+		 * or a couple of other things that are our fault.
+		 */
+		panic("buf: block %u: DEVOP_IO returned EINVAL\n", block);
+	}
+	if (result == EIO) {
+		if (tries == 0) {
+			tries++;
+			kprintf("buf: block %u I/O error, retrying\n", block);
+			goto retry;
+		}
+		else if (tries < 10) {
+			tries++;
+			goto retry;
+		}
+		else {
+			kprintf("buf: block %u I/O error, giving up "
+				"after %d retries\n", block, tries);
+		}
+	}
+	if (result == 0) {
+		bufstat_add(rw == UIO_READ ? BS_READ : BS_WRITE, 1);
+	}
+	return result;
+}
+
+/*
+ * Write back a dirty buffer that nobody holds. Called with buf_lock
+ * held; drops it during the I/O. The buffer stays where it is on the
+ * LRU list. If the write fails, the buffer goes to the back of the
+ * dirty list to be tried again later.
+ */
+static
+int
+buf_writeout(struct buf *b)
+{
+	int result;
+
+	KASSERT(lock_do_i_hold(buf_lock));
+	KASSERT(b->b_holder == NULL);
+	KASSERT(b->b_dirty);
+
+	b->b_holder = curthread;
+	lock_release(buf_lock);
+
+	result = buf_devio(b->b_dev, b->b_block, b->b_data, UIO_WRITE);
+
+	lock_acquire(buf_lock);
+	buf_dirtyremove(b);
+	if (result == 0) {
+		b->b_dirty = false;
+	}
+	else {
+		b->b_dirtytime = buf_now();
+		buf_dirtyadd(b);
+	}
+	b->b_holder = NULL;
+	cv_broadcast(buf_cv, buf_lock);
+	return result;
+}
+
+/*
+ * Write back dirty buffers, oldest first, until no more than TARGET
+ * are dirty and none left were dirtied at or before CUTOFF. Stops at
+ * the first error. Returns the number written.
+ */
+static
+unsigned
+buf_writeoldest(unsigned target, time_t cutoff)
+{
+	struct buf *b;
+	unsigned count = 0;
+
+	KASSERT(lock_do_i_hold(buf_lock));
+
+ again:
+	for (b = buf_dirtyhead; b != NULL; b = b->b_dirtynext) {
+		if (buf_ndirty <= target && b->b_dirtytime > cutoff) {
+			/* the rest are younger still */
+			break;
+		}
+		if (b->b_holder != NULL) {
+			continue;
+		}
+		if (buf_writeout(b)) {
+			break;
+		}
+		count++;
+		/* the list may have changed while unlocked */
+		goto again;
+	}
+	return count;
+}
+
+////////////////////////////////////////////////////////////
+// Growing and shrinking
+
+/*
+ * Add a page of buffers to the cache. Called without buf_lock.
+ */
+static
+int
+buf_grow(void)
+{
+	struct bufpage *bp;
+	struct buf *b;
+	vaddr_t va;
+	unsigned i;
+
+	bp = kmalloc(sizeof(*bp));
+	if (bp == NULL) {
+		return ENOMEM;
+	}
+	va = alloc_kpages(1);
+	if (va == 0) {
+		kfree(bp);
+		return ENOMEM;
+	}
+
+	lock_acquire(buf_lock);
+	if (buf_nbufs >= buf_maxbufs) {
+		/* Somebody else got there first. */
+		lock_release(buf_lock);
+		free_kpages(va);
+		kfree(bp);
+		return 0;
+	}
+	bp->bp_va = va;
+	for (i=0; i<BUF_PERPAGE; i++) {
+		b = &bp->bp_bufs[i];
+		b->b_hashnext = NULL;
+		b->b_dirtyprev = b->b_dirtynext = NULL;
+		b->b_dirtytime = 0;
+		b->b_prefetched = false;
+		b->b_dev = NULL;
+		b->b_block = 0;
+		b->b_data = (char *)va + i*BUF_SIZE;
+		b->b_holder = NULL;
+		b->b_valid = false;
+		b->b_dirty = false;
+		buflist_addtail(&buf_freelist, b);
+	}
+	bp->bp_next = buf_pages;
+	buf_pages = bp;
+	buf_nbufs += BUF_PERPAGE;
+	lock_release(buf_lock);
+
+	return 0;
+}
+
+/*
+ * Check if a page of buffers can be freed without writing anything.
+ */
+static
+bool
+buf_pageidle(struct bufpage *bp)
+{
+	unsigned i;
+
+	for (i=0; i<BUF_PERPAGE; i++) {
+		if (bp->bp_bufs[i].b_holder != NULL ||
+		    bp->bp_bufs[i].b_dirty) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Free up to NPAGES pages whose buffers are all clean and unheld.
+ * Returns the number freed.
+ */
+static
+unsigned
+buf_shrink(unsigned npages)
+{
+	struct bufpage **bpp, *bp;
+	struct buf *b;
+	unsigned i, freed;
+
+	KASSERT(lock_do_i_hold(buf_lock));
+
+	freed = 0;
+	bpp = &buf_pages;
+	while ((bp = *bpp) != NULL && freed < npages) {
+		if (!buf_pageidle(bp)) {
+			bpp = &bp->bp_next;
+			continue;
+		}
+		*bpp = bp->bp_next;
+		for (i=0; i<BUF_PERPAGE; i++) {
+			b = &bp->bp_bufs[i];
+			if (b->b_dev != NULL) {
+				buflist_remove(&buf_lru, b);
+				buf_hashremove(b);
+				if (b->b_prefetched) {
+					bufstat_add(BS_RAWASTE, 1);
+				}
+			}
+			else {
+				buflist_remove(&buf_freelist, b);
+			}
+		}
+		buf_nbufs -= BUF_PERPAGE;
+		free_kpages(bp->bp_va);
+		kfree(bp);
+		freed++;
+	}
+	return freed;
+}
+
+/*
+ * Reclaim hook: drop pages of clean cached blocks.
+ */
+static
+unsigned
+buf_reclaim(unsigned npages)
+{
+	unsigned freed;
+
+	/*
+	 * We never allocate memory with buf_lock held, so this
+	 * shouldn't happen; but if it does, don't deadlock.
+	 */
+	if (lock_do_i_hold(buf_lock)) {
+		return 0;
+	}
+
+	lock_acquire(buf_lock);
+	freed = buf_shrink(npages);
+	lock_release(buf_lock);
+
+	bufstat_add(BS_RECLAIM, freed);
+	return freed;
+}
+
+static struct reclaimer buf_reclaimer = {
+	.rc_name = "bufcache",
+	.rc_cost = RECLAIM_COST_CLEAN,
+	.rc_func = buf_reclaim,
+};
+
+////////////////////////////////////////////////////////////
+// Getting buffers
+
+/*
+ * Make a buffer available on the free list by evicting the least
+ * recently used block nobody is holding. Called with buf_lock held;
+ * may drop it, so the caller must look up its block again afterwards.
+ */
+static
+int
+buf_evict(void)
+{
+	struct buf *b;
+	int result;
+
+	KASSERT(lock_do_i_hold(buf_lock));
+
+	for (b = buf_lru.bl_head; b != NULL; b = b->b_lrunext) {
+		if (b->b_holder == NULL) {
+			break;
+		}
+	}
+	if (b == NULL) {
+		/* Every buffer is in use; wait for one to come back. */
+		cv_wait(buf_cv, buf_lock);
+		return 0;
+	}
+
+	if (b->b_dirty) {
+		/*
+		 * Write it back. It stays at the head of the LRU list
+		 * and we'll get it on the next try, unless somebody
+		 * uses it in the meantime.
+		 */
+		result = buf_writeout(b);
+		if (result) {
+			return result;
+		}
+		bufstat_add(BS_WRITEBACK, 1);
+		return 0;
+	}
+
+	buflist_remove(&buf_lru, b);
+	buf_forget(b);
+	bufstat_add(BS_EVICT, 1);
+	return 0;
+}
+
+/*
+ * Find the buffer for a block, or give it one, and hold it.
+ */
+static
+int
+buf_find(struct device *dev, daddr_t block, struct buf **ret)
+{
+	struct buf *b;
+	bool cangrow = true;
+	int result;
+
+	KASSERT(dev->d_blocksize == BUF_SIZE);
+
+	lock_acquire(buf_lock);
+ again:
+	b = buf_lookup(dev, block);
+	if (b != NULL) {
+		if (b->b_holder != NULL) {
+			/* Asking twice would wait forever */
+			KASSERT(b->b_holder != curthread);
+			cv_wait(buf_cv, buf_lock);
+			goto again;
+		}
+		buflist_remove(&buf_lru, b);
+		b->b_holder = curthread;
+		lock_release(buf_lock);
+		*ret = b;
+		return 0;
+	}
+
+	b = buf_freelist.bl_head;
+	if (b == NULL) {
+		if (cangrow && buf_nbufs < buf_maxbufs) {
+			lock_release(buf_lock);
+			result = buf_grow();
+			lock_acquire(buf_lock);
+			if (result) {
+				/* Out of memory; make do with what we have */
+				cangrow = false;
+			}
+		}
+		else {
+			result = buf_evict();
+			if (result) {
+				lock_release(buf_lock);
+				return result;
+			}
+		}
+		goto again;
+	}
+
+	buflist_remove(&buf_freelist, b);
+	b->b_dev = dev;
+	b->b_block = block;
+	b->b_holder = curthread;
+	b->b_valid = false;
+	b->b_dirty = false;
+	b->b_prefetched = false;
+	b->b_hashnext = buf_hashtable[buf_hash(dev, block)];
+	buf_hashtable[buf_hash(dev, block)] = b;
+	lock_release(buf_lock);
+
+	*ret = b;
+	return 0;
+}
+
+int
+buf_read(struct device *dev, daddr_t block, struct buf **ret)
+{
+	struct buf *b;
+	int result;
+
+	result = buf_find(dev, block, &b);
+	if (result) {
+		return result;
+	}
+
+	if (b->b_valid) {
+		bufstat_add(BS_HIT, 1);
+		if (b->b_prefetched) {
+			bufstat_add(BS_RAHIT, 1);
+			b->b_prefetched = false;
+		}
+	}
+	else {
+		bufstat_add(BS_MISS, 1);
+		result = buf_devio(dev, block, b->b_data, UIO_READ);
+		if (result) {
+			buf_release(b);
+			return result;
+		}
+		b->b_valid = true;
+	}
+
+	*ret = b;
+	return 0;
+}
+
+void
+buf_prefetch(struct device *dev, daddr_t block)
+{
+	struct bufra *ra;
+
+	KASSERT(dev->d_blocksize == BUF_SIZE);
+
+	lock_acquire(buf_lock);
+	if (buf_lookup(dev, block) == NULL) {
+		if (buf_racount < BUF_RAQUEUE) {
+			ra = &buf_raqueue[(buf_rahead + buf_racount) %
+					  BUF_RAQUEUE];
+			ra->ra_dev = dev;
+			ra->ra_block = block;
+			buf_racount++;
+			cv_signal(buf_racv, buf_lock);
+		}
+		else {
+			bufstat_add(BS_RADROP, 1);
+		}
+	}
+	lock_release(buf_lock);
+}
+
+/*
+ * Read-ahead thread: take requests off the queue and read them in.
+ */
+static
+void
+buf_rathread(void *junk1, unsigned long junk2)
+{
+	struct device *dev;
+	daddr_t block;
+	struct buf *b;
+	int result;
+
+	(void)junk1;
+	(void)junk2;
+
+	while (1) {
+		lock_acquire(buf_lock);
+		while (buf_racount == 0) {
+			cv_wait(buf_racv, buf_lock);
+		}
+		dev = buf_raqueue[buf_rahead].ra_dev;
+		block = buf_raqueue[buf_rahead].ra_block;
+		buf_rahead = (buf_rahead + 1) % BUF_RAQUEUE;
+		buf_racount--;
+		/* tell buf_detach we're using the device */
+		buf_radev = dev;
+		lock_release(buf_lock);
+
+		if (dev != NULL && buf_find(dev, block, &b) == 0) {
+			if (!b->b_valid) {
+				result = buf_devio(dev, block, b->b_data,
+						   UIO_READ);
+				if (result == 0) {
+					b->b_valid = true;
+					b->b_prefetched = true;
+					bufstat_add(BS_RAREAD, 1);
+				}
+			}
+			buf_release(b);
+		}
+
+		lock_acquire(buf_lock);
+		buf_radev = NULL;
+		cv_broadcast(buf_cv, buf_lock);
+		lock_release(buf_lock);
+	}
+}
+
+int
+buf_get(struct device *dev, daddr_t block, struct buf **ret)
+{
+	return buf_find(dev, block, ret);
+}
+
+void *
+buf_map(struct buf *b)
+{
+	KASSERT(b->b_holder == curthread);
+	return b->b_data;
+}
+
+void
+buf_markdirty(struct buf *b)
+{
+	KASSERT(b->b_holder == curthread);
+	b->b_valid = true;
+	if (b->b_dirty) {
+		/* Coalesces with the write already pending. */
+		return;
+	}
+
+	lock_acquire(buf_lock);
+	b->b_dirty = true;
+	b->b_dirtytime = buf_now();
+	buf_dirtyadd(b);
+	if (!buf_flusharmed) {
+		buf_flusharmed = true;
+		timer_start(&buf_flushtimer, HZ);
+	}
+	if (buf_ndirty > buf_dirtybg && !buf_flushkicked) {
+		buf_flushkicked = true;
+		V(buf_flushsem);
+	}
+	lock_release(buf_lock);
+}
+
+void
+buf_release(struct buf *b)
+{
+	KASSERT(b->b_holder == curthread);
+
+	lock_acquire(buf_lock);
+	b->b_holder = NULL;
+	if (b->b_valid) {
+		buflist_addtail(&buf_lru, b);
+	}
+	else {
+		/* Never got filled in; nothing worth keeping. */
+		buf_forget(b);
+	}
+	cv_broadcast(buf_cv, buf_lock);
+
+	if (buf_ndirty > buf_dirtyhard) {
+		/* Too far behind for the flusher; help out. */
+		bufstat_add(BS_THROTTLE, 1);
+		buf_writeoldest(buf_dirtyhard, 0);
+	}
+	lock_release(buf_lock);
+}
+
+void
+buf_invalidate(struct device *dev, daddr_t block)
+{
+	struct buf *b;
+
+	lock_acquire(buf_lock);
+ again:
+	b = buf_lookup(dev, block);
+	if (b != NULL) {
+		if (b->b_holder != NULL) {
+			KASSERT(b->b_holder != curthread);
+			cv_wait(buf_cv, buf_lock);
+			goto again;
+		}
+		buflist_remove(&buf_lru, b);
+		buf_forget(b);
+	}
+	lock_release(buf_lock);
+}
+
+////////////////////////////////////////////////////////////
+// Syncing
+
+/*
+ * Write back every dirty buffer for DEV (all devices if NULL). If
+ * one is held, wait for it: it may be on its way to disk from the
+ * flusher or an eviction, and we can't return until it gets there.
+ */
+int
+buf_sync(struct device *dev)
+{
+	struct timespec before, after, diff;
+	struct buf *b;
+	int result = 0;
+
+	gettime(&before);
+
+	lock_acquire(buf_lock);
+ again:
+	for (b = buf_dirtyhead; b != NULL; b = b->b_dirtynext) {
+		if (dev != NULL && b->b_dev != dev) {
+			continue;
+		}
+		if (b->b_holder != NULL) {
+			KASSERT(b->b_holder != curthread);
+			cv_wait(buf_cv, buf_lock);
+			goto again;
+		}
+		result = buf_writeout(b);
+		if (result) {
+			break;
+		}
+		/* the list may have changed while unlocked */
+		goto again;
+	}
+	lock_release(buf_lock);
+
+	gettime(&after);
+	timespec_sub(&after, &before, &diff);
+	bufstat_add(BS_SYNC, 1);
+	bufstat_add(BS_SYNCUSEC, diff.tv_sec * 1000000 + diff.tv_nsec / 1000);
+
+	return result;
+}
+
+/*
+ * Write back one block. As in buf_sync, if someone holds it we wait
+ * and look again.
+ */
+int
+buf_syncblock(struct device *dev, daddr_t block)
+{
+	struct buf *b;
+	int result = 0;
+
+	lock_acquire(buf_lock);
+ again:
+	b = buf_lookup(dev, block);
+	if (b != NULL && b->b_dirty) {
+		if (b->b_holder != NULL) {
+			KASSERT(b->b_holder != curthread);
+			cv_wait(buf_cv, buf_lock);
+			goto again;
+		}
+		result = buf_writeout(b);
+	}
+	lock_release(buf_lock);
+
+	return result;
+}
+
+int
+buf_detach(struct device *dev)
+{
+	struct bufpage *bp;
+	struct bufra *ra;
+	struct buf *b;
+	unsigned i;
+	int result;
+
+	/* Cancel read-ahead, and wait out any in progress. */
+	lock_acquire(buf_lock);
+	for (i=0; i<buf_racount; i++) {
+		ra = &buf_raqueue[(buf_rahead + i) % BUF_RAQUEUE];
+		if (ra->ra_dev == dev) {
+			ra->ra_dev = NULL;
+		}
+	}
+	while (buf_radev == dev) {
+		cv_wait(buf_cv, buf_lock);
+	}
+	lock_release(buf_lock);
+
+	result = buf_sync(dev);
+	if (result) {
+		return result;
+	}
+
+	lock_acquire(buf_lock);
+	for (bp = buf_pages; bp != NULL; bp = bp->bp_next) {
+		for (i=0; i<BUF_PERPAGE; i++) {
+			b = &bp->bp_bufs[i];
+			if (b->b_dev != dev) {
+				continue;
+			}
+			KASSERT(b->b_holder == NULL);
+			KASSERT(!b->b_dirty);
+			buflist_remove(&buf_lru, b);
+			buf_forget(b);
+		}
+	}
+	lock_release(buf_lock);
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// Flusher
+
+/*
+ * Timer function: runs in interrupt context, so all it can do is
+ * wake up the flusher.
+ */
+static
+void
+buf_flushtick(void *junk)
+{
+	(void)junk;
+	V(buf_flushsem);
+}
+
+/*
+ * Flusher thread. Woken by the timer about once a second while
+ * anything is dirty, and early by buf_markdirty when the dirty count
+ * passes buf_dirtybg.
+ */
+static
+void
+buf_flushthread(void *junk1, unsigned long junk2)
+{
+	unsigned count;
+
+	(void)junk1;
+	(void)junk2;
+
+	while (1) {
+		P(buf_flushsem);
+
+		lock_acquire(buf_lock);
+		buf_flushkicked = false;
+		count = buf_writeoldest(buf_dirtybg,
+					buf_now() - (time_t)buf_flushage);
+
+		/* Keep the timer going only while there's work. */
+		timer_cancel(&buf_flushtimer);
+		if (buf_ndirty > 0) {
+			timer_start(&buf_flushtimer, HZ);
+		}
+		else {
+			buf_flusharmed = false;
+		}
+		lock_release(buf_lock);
+
+		bufstat_add(BS_FLUSH, count);
+	}
+}
+
+/*
+ * Recompute the dirty thresholds. The hard limit is twice the
+ * background one, but leaves at least a page of buffers clean so
+ * there is always something cheap to evict.
+ */
+static
+void
+buf_setthresholds(void)
+{
+	KASSERT(lock_do_i_hold(buf_lock));
+
+	buf_dirtybg = buf_maxbufs * buf_dirtypct / 100;
+	buf_dirtyhard = buf_dirtybg * 2;
+	if (buf_dirtyhard > buf_maxbufs - BUF_PERPAGE) {
+		buf_dirtyhard = buf_maxbufs - BUF_PERPAGE;
+	}
+	if (buf_dirtybg > buf_dirtyhard) {
+		buf_dirtybg = buf_dirtyhard;
+	}
+}
+
+void
+buf_setflush(unsigned age, unsigned dirtypct)
+{
+	if (dirtypct > 100) {
+		dirtypct = 100;
+	}
+
+	lock_acquire(buf_lock);
+	buf_flushage = age;
+	buf_dirtypct = dirtypct;
+	buf_setthresholds();
+	lock_release(buf_lock);
+
+	/* Let the flusher apply the new settings right away. */
+	V(buf_flushsem);
+}
+
+void
+buf_getflush(unsigned *age, unsigned *dirtypct)
+{
+	lock_acquire(buf_lock);
+	*age = buf_flushage;
+	*dirtypct = buf_dirtypct;
+	lock_release(buf_lock);
+}
+
+////////////////////////////////////////////////////////////
+// Setup and statistics
+
+unsigned
+buf_setmax(unsigned nbufs)
+{
+	unsigned excess;
+
+	nbufs = ROUNDUP(nbufs, BUF_PERPAGE);
+	if (nbufs == 0) {
+		nbufs = BUF_PERPAGE;
+	}
+
+	lock_acquire(buf_lock);
+	buf_maxbufs = nbufs;
+	buf_setthresholds();
+	excess = buf_nbufs > nbufs ? buf_nbufs - nbufs : 0;
+	lock_release(buf_lock);
+
+	if (excess > 0) {
+		/* Only clean pages can go; get everything clean first. */
+		(void)buf_sync(NULL);
+		lock_acquire(buf_lock);
+		if (buf_nbufs > buf_maxbufs) {
+			buf_shrink((buf_nbufs - buf_maxbufs) / BUF_PERPAGE);
+		}
+		lock_release(buf_lock);
+	}
+	return nbufs;
+}
+
+void
+buf_bootstrap(void)
+{
+	int result;
+
+	buf_lock = lock_create("bufcache");
+	if (buf_lock == NULL) {
+		panic("buf_bootstrap: Out of memory\n");
+	}
+	buf_cv = cv_create("bufcache");
+	if (buf_cv == NULL) {
+		panic("buf_bootstrap: Out of memory\n");
+	}
+	buf_flushsem = sem_create("bufflush", 0);
+	if (buf_flushsem == NULL) {
+		panic("buf_bootstrap: Out of memory\n");
+	}
+	buf_racv = cv_create("readahead");
+	if (buf_racv == NULL) {
+		panic("buf_bootstrap: Out of memory\n");
+	}
+	timer_init(&buf_flushtimer, buf_flushtick, NULL);
+
+	lock_acquire(buf_lock);
+	buf_setthresholds();
+	lock_release(buf_lock);
+
+	reclaim_register(&buf_reclaimer);
+
+	result = thread_fork("bufflush", NULL, buf_flushthread, NULL, 0);
+	if (result) {
+		panic("buf_bootstrap: thread_fork: %s\n", strerror(result));
+	}
+	result = thread_fork("readahead", NULL, buf_rathread, NULL, 0);
+	if (result) {
+		panic("buf_bootstrap: thread_fork: %s\n", strerror(result));
+	}
+}
+
+void
+buf_resetstats(void)
+{
+	statcounters_reset(&bufstat);
+}
+
+void
+buf_printstats(void)
+{
+	unsigned counts[BS_NCOUNTERS];
+	unsigned nbufs, maxbufs, ncached, ndirty;
+	struct bufpage *bp;
+	unsigned i;
+
+	lock_acquire(buf_lock);
+	nbufs = buf_nbufs;
+	maxbufs = buf_maxbufs;
+	ndirty = buf_ndirty;
+	ncached = 0;
+	for (bp = buf_pages; bp != NULL; bp = bp->bp_next) {
+		for (i=0; i<BUF_PERPAGE; i++) {
+			if (bp->bp_bufs[i].b_dev != NULL) {
+				ncached++;
+			}
+		}
+	}
+	lock_release(buf_lock);
+
+	statcounters_sum(&bufstat, counts);
+	statcounters_print(&bufstat, "bufstat", counts);
+	kprintf("bufstat buffers %u\n", nbufs);
+	kprintf("bufstat maxbuffers %u\n", maxbufs);
+	kprintf("bufstat cached %u\n", ncached);
+	kprintf("bufstat dirty %u\n", ndirty);
+	if (counts[BS_SYNC] > 0) {
+		kprintf("bufstat syncavgusec %u\n",
+			counts[BS_SYNCUSEC] / counts[BS_SYNC]);
+	}
+	if (counts[BS_RAREAD] > 0) {
+		kprintf("bufstat rahitpercent %u\n",
+			counts[BS_RAHIT] * 100 / counts[BS_RAREAD]);
+	}
+	if (counts[BS_HIT] + counts[BS_MISS] > 0) {
+		kprintf("bufstat hitpercent %u\n", counts[BS_HIT] * 100 /
+			(counts[BS_HIT] + counts[BS_MISS]));
+	}
+}
+
+void
+buf_getrastats(unsigned *nread, unsigned *nhit)
+{
+	unsigned counts[BS_NCOUNTERS];
+
+	statcounters_sum(&bufstat, counts);
+	*nread = counts[BS_RAREAD];
+	*nhit = counts[BS_RAHIT];
+}
@@ -0,0 +1,429 @@
+/*
+ * Copyright (c) 2016
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Name lookup cache. See namecache.h.
+ *
+ * A fixed pool of entries, hashed on (directory, name) and kept on
+ * an LRU list; when the pool runs out the least recently used entry
+ * is reused. Long names, "." and "..", and lookups in vnodes that
+ * aren't on a filesystem (devices) are never cached.
+ *
+ * Dropping an entry's references can reclaim vnodes, which calls
+ * into the filesystem, so it is never done with nc_lock held: the
+ * vnodes are collected and released afterwards.
+ *
+ * nc_lock also protects vn_ncgen in every vnode.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <synch.h>
+#include <vnode.h>
+#include <statcounter.h>
+#include <namecache.h>
+
+/* Longest name cached. */
+#define NC_NAMELEN	31
+
+/* Number of entries and hash chains. */
+#define NC_SIZE		256
+#define NC_HASHSIZE	128
+
+/* Entries purged per trip through the lock. */
+#define NC_BATCH	16
+
+struct ncentry {
+	struct ncentry *nc_hashnext;	/* hash chain */
+	struct ncentry *nc_lruprev;	/* LRU list (or free list) */
+	struct ncentry *nc_lrunext;
+	struct vnode *nc_dir;		/* directory; NULL if unused */
+	struct vnode *nc_vn;		/* result; NULL if negative */
+	uint32_t nc_hash;
+	char nc_name[NC_NAMELEN+1];
+};
+
+static struct lock *nc_lock;
+static struct ncentry nc_entries[NC_SIZE];
+static struct ncentry *nc_hashtable[NC_HASHSIZE];
+static struct ncentry *nc_lruhead;		/* least recently used */
+static struct ncentry *nc_lrutail;		/* most recently used */
+static struct ncentry *nc_freelist;
+
+/*
+ * Statistics.
+ */
+enum ncstat_counter {
+	NCS_HIT,		/* found a vnode */
+	NCS_NEGHIT,		/* found that the name doesn't exist */
+	NCS_MISS,		/* had to ask the filesystem */
+	NCS_ENTER,		/* entries made */
+	NCS_EVICT,		/* entries reused for something else */
+	NCS_REMOVE,		/* entries invalidated */
+	NCS_STALE,		/* entries not made: directory changed */
+	NCS_NCOUNTERS
+};
+
+static const char *const ncstat_names[NCS_NCOUNTERS] = {
+	[NCS_HIT] = "hits",
+	[NCS_NEGHIT] = "neghits",
+	[NCS_MISS] = "misses",
+	[NCS_ENTER] = "entered",
+	[NCS_EVICT] = "evicted",
+	[NCS_REMOVE] = "removed",
+	[NCS_STALE] = "stale",
+};
+
+static struct statcounters ncstat =
+	STATCOUNTERS_INITIALIZER(ncstat_names, NCS_NCOUNTERS);
+
+static
+void
+ncstat_add(enum ncstat_counter which, unsigned amount)
+{
+	statcounter_add(&ncstat, which, amount);
+}
+
+////////////////////////////////////////////////////////////
+// Internals
+
+static
+bool
+nc_cacheable(struct vnode *dir, const char *name)
+{
+	if (dir->vn_fs == NULL) {
+		return false;
+	}
+	if (!strcmp(name, ".") || !strcmp(name, "..")) {
+		return false;
+	}
+	return strlen(name) <= NC_NAMELEN;
+}
+
+static
+uint32_t
+nc_hash(struct vnode *dir, const char *name)
+{
+	uint32_t hash = 2166136261U ^ (uint32_t)((uintptr_t)dir >> 4);
+
+	while (*name != 0) {
+		hash ^= (unsigned char)*name++;
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+static
+void
+nc_lruremove(struct ncentry *e)
+{
+	if (e->nc_lruprev != NULL) {
+		e->nc_lruprev->nc_lrunext = e->nc_lrunext;
+	}
+	else {
+		nc_lruhead = e->nc_lrunext;
+	}
+	if (e->nc_lrunext != NULL) {
+		e->nc_lrunext->nc_lruprev = e->nc_lruprev;
+	}
+	else {
+		nc_lrutail = e->nc_lruprev;
+	}
+	e->nc_lruprev = e->nc_lrunext = NULL;
+}
+
+static
+void
+nc_lruappend(struct ncentry *e)
+{
+	e->nc_lruprev = nc_lrutail;
+	e->nc_lrunext = NULL;
+	if (nc_lrutail != NULL) {
+		nc_lrutail->nc_lrunext = e;
+	}
+	else {
+		nc_lruhead = e;
+	}
+	nc_lrutail = e;
+}
+
+static
+struct ncentry *
+nc_find(struct vnode *dir, const char *name, uint32_t hash)
+{
+	struct ncentry *e;
+
+	for (e = nc_hashtable[hash % NC_HASHSIZE]; e; e = e->nc_hashnext) {
+		if (e->nc_hash == hash && e->nc_dir == dir &&
+		    !strcmp(e->nc_name, name)) {
+			return e;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Take an entry out of use and put it on the free list. Its two
+ * references are handed back in DROP[0] and DROP[1] for the caller
+ * to release once it has let go of nc_lock.
+ */
+static
+void
+nc_unlink(struct ncentry *e, struct vnode **drop)
+{
+	struct ncentry **ep;
+
+	KASSERT(lock_do_i_hold(nc_lock));
+	KASSERT(e->nc_dir != NULL);
+
+	ep = &nc_hashtable[e->nc_hash % NC_HASHSIZE];
+	while (*ep != e) {
+		KASSERT(*ep != NULL);
+		ep = &(*ep)->nc_hashnext;
+	}
+	*ep = e->nc_hashnext;
+	e->nc_hashnext = NULL;
+	nc_lruremove(e);
+
+	drop[0] = e->nc_dir;
+	drop[1] = e->nc_vn;
+	e->nc_dir = NULL;
+	e->nc_vn = NULL;
+
+	e->nc_lrunext = nc_freelist;
+	nc_freelist = e;
+}
+
+/*
+ * Release references collected by nc_unlink.
+ */
+static
+void
+nc_drop(struct vnode **drop, unsigned num)
+{
+	unsigned i;
+
+	KASSERT(!lock_do_i_hold(nc_lock));
+
+	for (i=0; i<num; i++) {
+		if (drop[i] != NULL) {
+			VOP_DECREF(drop[i]);
+		}
+	}
+}
+
+/*
+ * Purge every entry that refers to VN, or whose directory is on FS.
+ */
+static
+void
+nc_purge(struct vnode *vn, struct fs *fs)
+{
+	struct vnode *drop[NC_BATCH * 2];
+	struct ncentry *e, *next;
+	unsigned num;
+
+	do {
+		num = 0;
+		lock_acquire(nc_lock);
+		if (vn != NULL) {
+			/* keep lookups in progress from adding more */
+			vn->vn_ncgen++;
+		}
+		for (e = nc_lruhead; e != NULL && num < NC_BATCH; e = next) {
+			next = e->nc_lrunext;
+			if ((vn != NULL && (e->nc_dir == vn || e->nc_vn == vn))
+			    || (fs != NULL && e->nc_dir->vn_fs == fs)) {
+				nc_unlink(e, &drop[num * 2]);
+				num++;
+			}
+		}
+		lock_release(nc_lock);
+
+		ncstat_add(NCS_REMOVE, num);
+		nc_drop(drop, num * 2);
+	} while (num == NC_BATCH);
+}
+
+////////////////////////////////////////////////////////////
+// Interface
+
+bool
+namecache_lookup(struct vnode *dir, const char *name, struct vnode **ret,
+		 unsigned *gen)
+{
+	struct ncentry *e;
+	uint32_t hash;
+
+	*gen = 0;
+	if (!nc_cacheable(dir, name)) {
+		return false;
+	}
+	hash = nc_hash(dir, name);
+
+	lock_acquire(nc_lock);
+	e = nc_find(dir, name, hash);
+	if (e == NULL) {
+		*gen = dir->vn_ncgen;
+		lock_release(nc_lock);
+		ncstat_add(NCS_MISS, 1);
+		return false;
+	}
+	nc_lruremove(e);
+	nc_lruappend(e);
+	if (e->nc_vn != NULL) {
+		VOP_INCREF(e->nc_vn);
+	}
+	*ret = e->nc_vn;
+	lock_release(nc_lock);
+
+	ncstat_add(*ret != NULL ? NCS_HIT : NCS_NEGHIT, 1);
+	return true;
+}
+
+void
+namecache_enter(struct vnode *dir, const char *name, struct vnode *vn,
+		unsigned gen)
+{
+	struct vnode *drop[2] = { NULL, NULL };
+	struct ncentry *e;
+	uint32_t hash;
+
+	if (!nc_cacheable(dir, name)) {
+		return;
+	}
+	hash = nc_hash(dir, name);
+
+	lock_acquire(nc_lock);
+	if (dir->vn_ncgen != gen) {
+		/* DIR changed while VN was being looked up. */
+		lock_release(nc_lock);
+		ncstat_add(NCS_STALE, 1);
+		return;
+	}
+	if (nc_find(dir, name, hash) != NULL) {
+		/* Somebody else got there first. */
+		lock_release(nc_lock);
+		return;
+	}
+	if (nc_freelist == NULL) {
+		nc_unlink(nc_lruhead, drop);
+		ncstat_add(NCS_EVICT, 1);
+	}
+	e = nc_freelist;
+	nc_freelist = e->nc_lrunext;
+
+	VOP_INCREF(dir);
+	e->nc_dir = dir;
+	if (vn != NULL) {
+		VOP_INCREF(vn);
+	}
+	e->nc_vn = vn;
+	e->nc_hash = hash;
+	strcpy(e->nc_name, name);
+	e->nc_hashnext = nc_hashtable[hash % NC_HASHSIZE];
+	nc_hashtable[hash % NC_HASHSIZE] = e;
+	nc_lruappend(e);
+	lock_release(nc_lock);
+
+	ncstat_add(NCS_ENTER, 1);
+	nc_drop(drop, 2);
+}
+
+void
+namecache_remove(struct vnode *dir, const char *name)
+{
+	struct vnode *drop[2] = { NULL, NULL };
+	struct ncentry *e;
+
+	if (!nc_cacheable(dir, name)) {
+		return;
+	}
+
+	lock_acquire(nc_lock);
+	dir->vn_ncgen++;
+	e = nc_find(dir, name, nc_hash(dir, name));
+	if (e != NULL) {
+		nc_unlink(e, drop);
+	}
+	lock_release(nc_lock);
+
+	if (e != NULL) {
+		ncstat_add(NCS_REMOVE, 1);
+		nc_drop(drop, 2);
+	}
+}
+
+void
+namecache_purge(struct vnode *vn)
+{
+	nc_purge(vn, NULL);
+}
+
+void
+namecache_purgefs(struct fs *fs)
+{
+	nc_purge(NULL, fs);
+}
+
+void
+namecache_bootstrap(void)
+{
+	unsigned i;
+
+	nc_lock = lock_create("namecache");
+	if (nc_lock == NULL) {
+		panic("namecache_bootstrap: Out of memory\n");
+	}
+	for (i=0; i<NC_SIZE; i++) {
+		nc_entries[i].nc_lrunext = nc_freelist;
+		nc_freelist = &nc_entries[i];
+	}
+}
+
+void
+namecache_resetstats(void)
+{
+	statcounters_reset(&ncstat);
+}
+
+void
+namecache_printstats(void)
+{
+	unsigned counts[NCS_NCOUNTERS];
+	unsigned lookups;
+
+	statcounters_sum(&ncstat, counts);
+	statcounters_print(&ncstat, "ncstat", counts);
+	lookups = counts[NCS_HIT] + counts[NCS_NEGHIT] + counts[NCS_MISS];
+	if (lookups > 0) {
+		kprintf("ncstat hitpercent %u\n",
+			(counts[NCS_HIT] + counts[NCS_NEGHIT]) * 100 / lookups);
+	}
+}
@@ -29,18 +29,26 @@
 
 /*
  * VFS operations relating to pathname translation
+ *
+ * Lookups take no VFS-wide lock. The filesystems lock their own
+ * directories for VOP_LOOKUP and VOP_LOOKPARENT, the name cache has
+ * its own lock and generation numbers (see namecache.h), and the
+ * device list has knowndevs_lock. bootfs_vnode has bootfs_lock.
  */
 
 #include <types.h>
 #include <kern/errno.h>
 #include <limits.h>
 #include <lib.h>
+#include <spinlock.h>
 #include <synch.h>
 #include <vfs.h>
 #include <fs.h>
 #include <vnode.h>
+#include <namecache.h>
 
 static struct vnode *bootfs_vnode = NULL;
+static struct spinlock bootfs_lock = SPINLOCK_INITIALIZER;
 
 /*
  * Helper function for actually changing bootfs_vnode.
@@ -51,8 +59,10 @@ change_bootfs(struct vnode *newvn)
 {
 	struct vnode *oldvn;
 
+	spinlock_acquire(&bootfs_lock);
 	oldvn = bootfs_vnode;
 	bootfs_vnode = newvn;
+	spinlock_release(&bootfs_lock);
 
 	if (oldvn != NULL) {
 		VOP_DECREF(oldvn);
@@ -75,14 +85,11 @@ vfs_setbootfs(const char *fsname)
 	int result;
 	struct vnode *newguy;
 
-	vfs_biglock_acquire();
-
 	snprintf(tmp, sizeof(tmp)-1, "%s", fsname);
 	s = strchr(tmp, ':');
 	if (s) {
 		/* If there's a colon, it must be at the end */
 		if (strlen(s)>0) {
-			vfs_biglock_release();
 			return EINVAL;
 		}
 	}
@@ -92,19 +99,16 @@ vfs_setbootfs(const char *fsname)
 
 	result = vfs_chdir(tmp);
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
 	result = vfs_getcurdir(&newguy);
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
 	change_bootfs(newguy);
 
-	vfs_biglock_release();
 	return 0;
 }
 
@@ -114,9 +118,7 @@ vfs_setbootfs(const char *fsname)
 void
 vfs_clearbootfs(void)
 {
-	vfs_biglock_acquire();
 	change_bootfs(NULL);
-	vfs_biglock_release();
 }
 
 
@@ -133,8 +135,6 @@ getdevice(char *path, char **subpath, struct vnode **startvn)
 	struct vnode *vn;
 	int result;
 
-	KASSERT(vfs_biglock_do_i_hold());
-
 	/*
 	 * Entirely empty filenames aren't legal.
 	 */
@@ -195,11 +195,14 @@ getdevice(char *path, char **subpath, struct vnode **startvn)
 	KASSERT(colon==0 || slash==0);
 
 	if (path[0]=='/') {
+		spinlock_acquire(&bootfs_lock);
 		if (bootfs_vnode==NULL) {
+			spinlock_release(&bootfs_lock);
 			return ENOENT;
 		}
 		VOP_INCREF(bootfs_vnode);
 		*startvn = bootfs_vnode;
+		spinlock_release(&bootfs_lock);
 	}
 	else {
 		KASSERT(path[0]==':');
@@ -234,6 +237,82 @@ getdevice(char *path, char **subpath, struct vnode **startvn)
 	return 0;
 }
 
+/*
+ * Look up a single pathname component NAME in DIR, going through the
+ * name cache. Successful lookups and ENOENT are both remembered.
+ */
+static
+int
+lookup_component(struct vnode *dir, char *name, struct vnode **ret)
+{
+	unsigned gen;
+	int result;
+
+	if (namecache_lookup(dir, name, ret, &gen)) {
+		return *ret != NULL ? 0 : ENOENT;
+	}
+
+	result = VOP_LOOKUP(dir, name, ret);
+	if (result == 0) {
+		namecache_enter(dir, name, *ret, gen);
+	}
+	else if (result == ENOENT) {
+		namecache_enter(dir, name, NULL, gen);
+	}
+	return result;
+}
+
+/*
+ * Walk PATH from STARTVN (whose reference is consumed) one component
+ * at a time, stopping before the last component. Returns the
+ * directory reached in *RETDIR and the last component in *RETNAME;
+ * trailing slashes are dropped, so *RETNAME is empty only if PATH
+ * contained nothing but slashes. PATH is modified in place.
+ *
+ * Device vnodes don't belong to a filesystem and interpret the rest
+ * of the path themselves, so it is passed to them whole.
+ */
+static
+int
+lookup_walk(struct vnode *startvn, char *path,
+	    struct vnode **retdir, char **retname)
+{
+	struct vnode *dir, *next;
+	char *slash;
+	size_t len;
+	int result;
+
+	dir = startvn;
+	if (dir->vn_fs == NULL) {
+		*retdir = dir;
+		*retname = path;
+		return 0;
+	}
+
+	len = strlen(path);
+	while (len > 0 && path[len-1] == '/') {
+		path[--len] = 0;
+	}
+
+	while ((slash = strchr(path, '/')) != NULL) {
+		*slash = 0;
+		result = lookup_component(dir, path, &next);
+		VOP_DECREF(dir);
+		if (result) {
+			return result;
+		}
+		dir = next;
+		path = slash + 1;
+		while (*path == '/') {
+			path++;
+		}
+	}
+
+	*retdir = dir;
+	*retname = path;
+	return 0;
+}
+
 /*
  * Name-to-vnode translation.
  * (In BSD, both of these are subsumed by namei().)
@@ -243,14 +322,16 @@ int
 vfs_lookparent(char *path, struct vnode **retval,
 	       char *buf, size_t buflen)
 {
-	struct vnode *startvn;
+	struct vnode *startvn, *dir;
 	int result;
 
-	vfs_biglock_acquire();
-
 	result = getdevice(path, &path, &startvn);
 	if (result) {
-		vfs_biglock_release();
+		return result;
+	}
+
+	result = lookup_walk(startvn, path, &dir, &path);
+	if (result) {
 		return result;
 	}
 
@@ -263,38 +344,42 @@ vfs_lookparent(char *path, struct vnode **retval,
 		result = EINVAL;
 	}
 	else {
-		result = VOP_LOOKPARENT(startvn, path, retval, buf, buflen);
+		result = VOP_LOOKPARENT(dir, path, retval, buf, buflen);
 	}
 
-	VOP_DECREF(startvn);
+	VOP_DECREF(dir);
 
-	vfs_biglock_release();
 	return result;
 }
 
 int
 vfs_lookup(char *path, struct vnode **retval)
 {
-	struct vnode *startvn;
+	struct vnode *startvn, *dir;
 	int result;
 
-	vfs_biglock_acquire();
-
 	result = getdevice(path, &path, &startvn);
 	if (result) {
-		vfs_biglock_release();
+		return result;
+	}
+
+	result = lookup_walk(startvn, path, &dir, &path);
+	if (result) {
 		return result;
 	}
 
 	if (strlen(path)==0) {
-		*retval = startvn;
-		vfs_biglock_release();
+		*retval = dir;
 		return 0;
 	}
 
-	result = VOP_LOOKUP(startvn, path, retval);
+	if (dir->vn_fs == NULL) {
+		result = VOP_LOOKUP(dir, path, retval);
+	}
+	else {
+		result = lookup_component(dir, path, retval);
+	}
 
-	VOP_DECREF(startvn);
-	vfs_biglock_release();
+	VOP_DECREF(dir);
 	return result;
 }
@@ -29,6 +29,13 @@
 
 /*
  * High-level VFS operations on pathnames.
+ *
+ * Operations that change a directory drop the name cache entries
+ * they affect once the change is made. That also bumps the
+ * directory's name cache generation, so a vfs_lookup that asked the
+ * filesystem before the change can't re-cache the old answer after
+ * it (see namecache.h). No VFS-level lock is held across the
+ * filesystem operation itself.
  */
 
 #include <types.h>
@@ -38,6 +45,7 @@
 #include <lib.h>
 #include <vfs.h>
 #include <vnode.h>
+#include <namecache.h>
 
 
 /* Does most of the work for open(). */
@@ -74,6 +82,7 @@ vfs_open(char *path, int openflags, mode_t mode, struct vnode **ret)
 		}
 
 		result = VOP_CREAT(dir, name, excl, mode, &vn);
+		namecache_remove(dir, name);
 
 		VOP_DECREF(dir);
 	}
@@ -146,6 +155,7 @@ vfs_remove(char *path)
 	}
 
 	result = VOP_REMOVE(dir, name);
+	namecache_remove(dir, name);
 	VOP_DECREF(dir);
 
 	return result;
@@ -179,6 +189,8 @@ vfs_rename(char *oldpath, char *newpath)
 	}
 
 	result = VOP_RENAME(olddir, oldname, newdir, newname);
+	namecache_remove(olddir, oldname);
+	namecache_remove(newdir, newname);
 
 	VOP_DECREF(newdir);
 	VOP_DECREF(olddir);
@@ -213,6 +225,7 @@ vfs_link(char *oldpath, char *newpath)
 	}
 
 	result = VOP_LINK(newdir, newname, oldfile);
+	namecache_remove(newdir, newname);
 
 	VOP_DECREF(newdir);
 	VOP_DECREF(oldfile);
@@ -240,6 +253,7 @@ vfs_symlink(const char *contents, char *path)
 	}
 
 	result = VOP_SYMLINK(newdir, newname, contents);
+	namecache_remove(newdir, newname);
 	VOP_DECREF(newdir);
 
 	return result;
@@ -286,6 +300,7 @@ vfs_mkdir(char *path, mode_t mode)
 	}
 
 	result = VOP_MKDIR(parent, name, mode);
+	namecache_remove(parent, name);
 
 	VOP_DECREF(parent);
 
@@ -298,8 +313,9 @@ vfs_mkdir(char *path, mode_t mode)
 int
 vfs_rmdir(char *path)
 {
-	struct vnode *parent;
+	struct vnode *parent, *dir;
 	char name[NAME_MAX+1];
+	char tmp[NAME_MAX+1];
 	int result;
 
 	result = vfs_lookparent(path, &parent, name, sizeof(name));
@@ -307,7 +323,23 @@ vfs_rmdir(char *path)
 		return result;
 	}
 
+	/*
+	 * Get the directory itself (from the filesystem, as the cache
+	 * may not have it) so the entries inside it can be dropped.
+	 */
+	strcpy(tmp, name);
+	if (VOP_LOOKUP(parent, tmp, &dir)) {
+		dir = NULL;
+	}
 	result = VOP_RMDIR(parent, name);
+	namecache_remove(parent, name);
+	if (dir != NULL) {
+		/* drop the (negative) entries inside the directory */
+		if (result == 0) {
+			namecache_purge(dir);
+		}
+		VOP_DECREF(dir);
+	}
 
 	VOP_DECREF(parent);
 
@@ -32,7 +32,9 @@
  #include <lib.h>
  #include <spl.h>
  #include <spinlock.h>
+ #include <synch.h>
  #include <current.h>
+ #include <thread.h>
  #include <mips/tlb.h>
  #include <addrspace.h>
  #include <vm.h>
@@ -60,9 +62,26 @@
       * Initialize as needed.
       */
      as->as_regions = NULL; /* region initialisation */
+     as->as_stackslots = 0;
+     as->as_stacksdefined = 0;
+     spinlock_init(&as->as_tlblock);
+     as->as_cpus = 0;
+     as->as_regionlock = rwlock_create("as_regions");
+     if (as->as_regionlock == NULL) {
+         kfree(as);
+         return NULL;
+     }
+     as->as_ptlock = lock_create("as_pagetable");
+     if (as->as_ptlock == NULL) {
+         rwlock_destroy(as->as_regionlock);
+         kfree(as);
+         return NULL;
+     }
      /* PD initialisation */
      paddr_t ***pd = (paddr_t ***)alloc_kpages(1);
      if(pd == NULL) {
+         lock_destroy(as->as_ptlock);
+         rwlock_destroy(as->as_regionlock);
          kfree(as);
          as = NULL;
          return NULL;
@@ -92,12 +111,14 @@
      if (old == NULL) {
          return EINVAL;
      }
+     rwlock_acquire_read(old->as_regionlock);
      struct region *old_region = old->as_regions;
      struct region *new_region = newas->as_regions;
  
      while (old_region != NULL) {
          struct region *temp = kmalloc(sizeof(struct region));
          if (temp == NULL) {
+             rwlock_release_read(old->as_regionlock);
              as_destroy(newas);
              return ENOMEM;
          }
@@ -118,7 +139,19 @@
          new_region = temp;
          old_region = old_region->next;
      }
+     /*
+      * Stacks of threads other than the caller come along too, so the
+      * regions stay defined, but the child has only one thread: the
+      * copy of the caller (as_copy is only used by fork). Its slot is
+      * the only one in use; the others are free for threadfork.
+      */
+     newas->as_stackslots = curthread->t_ustack == 0 ? 0 :
+         (uint32_t)1 << curthread->t_ustack;
+     newas->as_stacksdefined = old->as_stacksdefined;
+     lock_acquire(old->as_ptlock);
      int result = copyPTE(old, newas);
+     lock_release(old->as_ptlock);
+     rwlock_release_read(old->as_regionlock);
      if (result) {
          as_destroy(newas);
          return result;
@@ -135,6 +168,9 @@
          return;
      }
 
+     /* Nobody may use the pages, or hang on to us, once they're freed. */
+     vm_shootdown_detach(as);
+
      struct region *temp = NULL;
      struct region *head = as->as_regions;
      while (head != NULL) {
@@ -144,8 +180,11 @@
      }
     
     as->as_regions = NULL; 
+    lock_destroy(as->as_ptlock);
+    rwlock_destroy(as->as_regionlock);
     vm_freePTE(as -> pagetable);
     as->pagetable = NULL;
+    spinlock_cleanup(&as->as_tlblock);
     kfree(as);
     as = NULL;
  }
@@ -153,7 +192,6 @@
  void
  as_activate(void)
  {
-     int i, spl;
      struct addrspace *as;
  
      as = proc_getas();
@@ -165,28 +203,15 @@
          return;
      }
  
-     /*
-      * Write this. Copied from dumbvm.c
-      */
-     /* Disable interrupts on this CPU while frobbing the TLB. */
-     spl = splhigh();
- 
-     for (i=0; i<NUM_TLB; i++) {
-         tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
-     }
- 
-     splx(spl);
+     /* Flushes the TLB only if it held some other address space */
+     vm_tlbactivate(as);
  }
  
  void
  as_deactivate(void)
  {
-     /*
-      * Write this. For many designs it won't need to actually do
-      * anything. See proc.c for an explanation of why it (might)
-      * be needed.
-      */
-     as_activate();
+     /* Forget the address space we had; proc_destroy is freeing it. */
+     vm_tlbactivate(NULL);
  }
  
  /*
@@ -231,15 +256,10 @@
      new->writeable_prev = writeable;
      new->executable = executable;
  
-	new -> next = as -> as_regions;
-	as -> as_regions = new;
-     
-     (void)as;
-     (void)vaddr;
-     (void)memsize;
-     (void)readable;
-     (void)writeable;
-     (void)executable;
+     rwlock_acquire_write(as->as_regionlock);
+     new->next = as->as_regions;
+     as->as_regions = new;
+     rwlock_release_write(as->as_regionlock);
      return 0;
  }
  
@@ -249,12 +269,14 @@
      /*
       * Write this.
       */
+     rwlock_acquire_write(as->as_regionlock);
      struct region *curr = as->as_regions;
      while (curr != NULL) { // change readonly to rw
          // curr->writeable_prev = curr->writeable;
          curr->writeable = 1;
          curr = curr->next;
      }
+     rwlock_release_write(as->as_regionlock);
  
      (void)as;
      return 0;
@@ -269,18 +291,16 @@
      if (as == NULL) {
          return EFAULT;
      }
+     rwlock_acquire_write(as->as_regionlock);
      struct region *curr = as->as_regions;
      while (curr != NULL) {
          // set permissions back to old one
          curr->writeable = curr->writeable_prev;
          curr = curr->next;
      }
-     int spl = splhigh();
-     for (int i = 0; i<NUM_TLB; i++) {
-         tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
-     } 
-     splx(spl);
-     (void)as;
+     rwlock_release_write(as->as_regionlock);
+     // Drop any writable entries loaded while loading, on every CPU
+     vm_shootdown(as);
      return 0;
  }
  
@@ -300,3 +320,55 @@
      // read write to 1, exectuable to 0
      return as_define_region(as, *stackptr - USER_STACK_SIZE, USER_STACK_SIZE, 1, 1, 0);
  }
+
+ int
+ as_define_threadstack(struct addrspace *as, unsigned *slotret, vaddr_t *stackptr)
+ {
+     unsigned slot;
+     uint32_t bit;
+     bool needregion;
+     vaddr_t top;
+     int result;
+
+     rwlock_acquire_write(as->as_regionlock);
+     for (slot = 1; slot < THREADSTACK_MAX; slot++) {
+         if ((as->as_stackslots & ((uint32_t)1 << slot)) == 0) break;
+     }
+     if (slot == THREADSTACK_MAX) {
+         rwlock_release_write(as->as_regionlock);
+         return EMPROC;
+     }
+     bit = (uint32_t)1 << slot;
+     as->as_stackslots |= bit;
+     needregion = (as->as_stacksdefined & bit) == 0;
+     as->as_stacksdefined |= bit;
+     rwlock_release_write(as->as_regionlock);
+
+     // Slots are reused, so only the first thread in each one defines it
+     top = USERSTACK - slot * THREADSTACK_STRIDE;
+     if (needregion) {
+         result = as_define_region(as, top - USER_STACK_SIZE, USER_STACK_SIZE, 1, 1, 0);
+         if (result) {
+             rwlock_acquire_write(as->as_regionlock);
+             as->as_stackslots &= ~bit;
+             as->as_stacksdefined &= ~bit;
+             rwlock_release_write(as->as_regionlock);
+             return result;
+         }
+     }
+
+     *slotret = slot;
+     *stackptr = top;
+     return 0;
+ }
+
+ void
+ as_release_threadstack(struct addrspace *as, unsigned slot)
+ {
+     KASSERT(slot > 0 && slot < THREADSTACK_MAX);
+
+     rwlock_acquire_write(as->as_regionlock);
+     KASSERT(as->as_stackslots & ((uint32_t)1 << slot));
+     as->as_stackslots &= ~((uint32_t)1 << slot);
+     rwlock_release_write(as->as_regionlock);
+ }
@@ -142,12 +142,51 @@ copycheck(const_userptr_t userptr, size_t len, size_t *stoplen)
 	return 0;
 }
 
+/*
+ * Bulk copy helper for copyin and copyout. Large copies are done in
+ * windows of VM_PREFAULT_PAGES pages; the user side of each window is
+ * pre-faulted first so that the copy itself runs without taking a
+ * trap on each page. Short copies (within one page) skip this, since
+ * at most one fault could be saved. Prefaulting is advisory: if it
+ * fails, the copy goes ahead and faults normally, so errors come back
+ * through copyfail exactly as before.
+ *
+ * Must be called with tm_badfaultfunc/tm_copyjmp set up.
+ */
+static
+void
+copybulk(void *dest, const void *src, vaddr_t uaddr, size_t len,
+	 int faulttype)
+{
+	size_t chunk;
+
+	if ((uaddr & PAGE_FRAME) == ((uaddr + len - 1) & PAGE_FRAME)) {
+		memcpy(dest, src, len);
+		return;
+	}
+
+	while (len > 0) {
+		/* up to the end of the window that starts at uaddr's page */
+		chunk = (uaddr & PAGE_FRAME) + VM_PREFAULT_PAGES * PAGE_SIZE
+			- uaddr;
+		if (chunk > len) {
+			chunk = len;
+		}
+		vm_prefault(uaddr, chunk, faulttype);
+		memcpy(dest, src, chunk);
+		dest = (char *)dest + chunk;
+		src = (const char *)src + chunk;
+		uaddr += chunk;
+		len -= chunk;
+	}
+}
+
 /*
  * copyin
  *
  * Copy a block of memory of length LEN from user-level address USERSRC
  * to kernel address DEST. We can use memcpy because it's protected by
- * the tm_badfaultfunc/copyfail logic.
+ * the tm_badfaultfunc/copyfail logic; see copybulk.
  */
 int
 copyin(const_userptr_t usersrc, void *dest, size_t len)
@@ -172,7 +211,10 @@ copyin(const_userptr_t usersrc, void *dest, size_t len)
 		return EFAULT;
 	}
 
-	memcpy(dest, (const void *)usersrc, len);
+	if (len > 0) {
+		copybulk(dest, (const void *)usersrc, (vaddr_t)usersrc, len,
+			 VM_FAULT_READ);
+	}
 
 	curthread->t_machdep.tm_badfaultfunc = NULL;
 	return 0;
@@ -183,7 +225,7 @@ copyin(const_userptr_t usersrc, void *dest, size_t len)
  *
  * Copy a block of memory of length LEN from kernel address SRC to
  * user-level address USERDEST. We can use memcpy because it's
- * protected by the tm_badfaultfunc/copyfail logic.
+ * protected by the tm_badfaultfunc/copyfail logic; see copybulk.
  */
 int
 copyout(const void *src, userptr_t userdest, size_t len)
@@ -208,7 +250,10 @@ copyout(const void *src, userptr_t userdest, size_t len)
 		return EFAULT;
 	}
 
-	memcpy((void *)userdest, src, len);
+	if (len > 0) {
+		copybulk((void *)userdest, src, (vaddr_t)userdest, len,
+			 VM_FAULT_WRITE);
+	}
 
 	curthread->t_machdep.tm_badfaultfunc = NULL;
 	return 0;
@@ -31,6 +31,7 @@
 #include <lib.h>
 #include <spinlock.h>
 #include <vm.h>
+#include <reclaim.h>
 
 /*
  * Kernel malloc.
@@ -242,7 +243,11 @@ allocpagerefpage(struct kheap_root *root)
 		spinlock_release(&kmalloc_spinlock);
 		free_kpages(va);
 		spinlock_acquire(&kmalloc_spinlock);
-		/* Once allocated it isn't ever freed. */
+		/*
+		 * It can only be freed again by kheap_reclaim, which
+		 * won't touch it now that our caller has marked an
+		 * entry on it in use.
+		 */
 		KASSERT(root->page != NULL);
 		return;
 	}
@@ -338,6 +343,60 @@ freepageref(struct pageref *p)
 
 ////////////////////////////////////////
 
+/*
+ * Reclaim hook: give back pageref pages that no longer hold any
+ * pagerefs. (The subpage pages themselves are released as soon as
+ * they become empty, in subpage_kfree, so there's nothing to do for
+ * those.)
+ */
+static
+unsigned
+kheap_reclaim(unsigned npages)
+{
+	unsigned whichroot, freed;
+	struct kheap_root *root;
+	vaddr_t va;
+
+	freed = 0;
+	spinlock_acquire(&kmalloc_spinlock);
+	for (whichroot=0; whichroot < NUM_PAGEREFPAGES; whichroot++) {
+		if (freed >= npages) {
+			break;
+		}
+		root = &kheaproots[whichroot];
+		if (root->page == NULL || root->numinuse > 0) {
+			continue;
+		}
+		va = (vaddr_t)root->page;
+		root->page = NULL;
+
+		/* Call free_kpages without kmalloc_spinlock. */
+		spinlock_release(&kmalloc_spinlock);
+		free_kpages(va);
+		spinlock_acquire(&kmalloc_spinlock);
+		freed++;
+	}
+	spinlock_release(&kmalloc_spinlock);
+
+	return freed;
+}
+
+static struct reclaimer kheap_reclaimer = {
+	.rc_name = "kmalloc",
+	.rc_cost = RECLAIM_COST_FREE,
+	.rc_func = kheap_reclaim,
+};
+
+/*
+ * Hook kmalloc into the reclaim machinery. Called once during boot,
+ * after reclaim_bootstrap.
+ */
+void
+kheap_bootstrap(void)
+{
+	reclaim_register(&kheap_reclaimer);
+}
+
 /*
  * Each pageref is on two linked lists: one list of pages of blocks of
  * that same size, and one of all blocks.
@@ -0,0 +1,326 @@
+/*
+ * Copyright (c) 2016
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Memory-pressure reclaim: registry of reclaim hooks, direct reclaim
+ * for the page allocator, and a background thread that tries to keep
+ * the free page count above a low watermark.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <clock.h>
+#include <thread.h>
+#include <current.h>
+#include <cpu.h>
+#include <vm.h>
+#include <reclaim.h>
+#include <vmstat.h>
+
+/*
+ * The list of reclaimers is kept sorted by increasing cost. It is
+ * protected by reclaim_lock, which is only held briefly and never
+ * across a reclaimer callback, so reclaimers can themselves allocate
+ * memory. Each reclaimer is marked busy while it runs so that it is
+ * never entered twice at once (either by two threads or recursively
+ * through the allocator). The list is only changed while no pass is
+ * running, so a pass can follow rc_next without the lock.
+ */
+static struct lock *reclaim_lock;
+static struct cv *reclaim_cv;
+static struct reclaimer *reclaimers;
+static unsigned reclaim_passes;		/* passes in progress */
+
+/*
+ * Background thread state. reclaim_kicked is set when the thread has
+ * been woken and not yet finished, so we don't pile up V()s.
+ */
+static struct spinlock reclaim_spinlock = SPINLOCK_INITIALIZER;
+static struct semaphore *reclaim_sem;
+static bool reclaim_kicked;
+static unsigned reclaim_lowmark;
+static unsigned reclaim_highmark;
+
+/* Statistics (protected by reclaim_lock) */
+static unsigned reclaim_ndirect;	/* direct reclaim passes */
+static unsigned reclaim_nbackground;	/* background passes */
+static unsigned reclaim_nfailed;	/* passes that freed nothing */
+
+////////////////////////////////////////////////////////////
+// registry
+
+/*
+ * Wait until no reclaim pass is running. Must hold reclaim_lock.
+ */
+static
+void
+reclaim_quiesce(void)
+{
+	while (reclaim_passes > 0) {
+		cv_wait(reclaim_cv, reclaim_lock);
+	}
+}
+
+void
+reclaim_register(struct reclaimer *rc)
+{
+	struct reclaimer **pp;
+
+	KASSERT(reclaim_lock != NULL);
+	KASSERT(rc->rc_func != NULL);
+
+	rc->rc_calls = 0;
+	rc->rc_pages = 0;
+	rc->rc_busy = false;
+
+	lock_acquire(reclaim_lock);
+	reclaim_quiesce();
+	for (pp = &reclaimers; *pp != NULL; pp = &(*pp)->rc_next) {
+		if ((*pp)->rc_cost > rc->rc_cost) {
+			break;
+		}
+	}
+	rc->rc_next = *pp;
+	*pp = rc;
+	lock_release(reclaim_lock);
+}
+
+void
+reclaim_unregister(struct reclaimer *rc)
+{
+	struct reclaimer **pp;
+
+	lock_acquire(reclaim_lock);
+	reclaim_quiesce();
+	for (pp = &reclaimers; *pp != NULL; pp = &(*pp)->rc_next) {
+		if (*pp == rc) {
+			*pp = rc->rc_next;
+			rc->rc_next = NULL;
+			lock_release(reclaim_lock);
+			return;
+		}
+	}
+	panic("reclaim_unregister: %s not registered\n", rc->rc_name);
+}
+
+////////////////////////////////////////////////////////////
+// reclaim passes
+
+/*
+ * Return true if it is safe for the current thread to sleep here.
+ */
+static
+bool
+reclaim_cansleep(void)
+{
+	if (reclaim_lock == NULL) {
+		/* too early in boot */
+		return false;
+	}
+	if (curthread->t_in_interrupt || curthread->t_curspl > 0) {
+		return false;
+	}
+	if (curcpu->c_spinlocks > 0) {
+		return false;
+	}
+	if (lock_do_i_hold(reclaim_lock)) {
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Run the reclaimers, cheapest first, until NPAGES have been freed.
+ */
+static
+unsigned
+reclaim_pass(unsigned npages, unsigned *counter)
+{
+	struct reclaimer *rc;
+	unsigned got, total;
+
+	lock_acquire(reclaim_lock);
+	reclaim_passes++;
+	(*counter)++;
+	lock_release(reclaim_lock);
+
+	total = 0;
+	for (rc = reclaimers; rc != NULL && total < npages; rc = rc->rc_next) {
+		lock_acquire(reclaim_lock);
+		if (rc->rc_busy) {
+			lock_release(reclaim_lock);
+			continue;
+		}
+		rc->rc_busy = true;
+		lock_release(reclaim_lock);
+
+		got = rc->rc_func(npages - total);
+
+		lock_acquire(reclaim_lock);
+		rc->rc_busy = false;
+		rc->rc_calls++;
+		rc->rc_pages += got;
+		lock_release(reclaim_lock);
+
+		total += got;
+	}
+	vmstat_add(VMS_RECLAIM, total);
+
+	lock_acquire(reclaim_lock);
+	if (total == 0) {
+		reclaim_nfailed++;
+	}
+	KASSERT(reclaim_passes > 0);
+	reclaim_passes--;
+	if (reclaim_passes == 0) {
+		cv_broadcast(reclaim_cv, reclaim_lock);
+	}
+	lock_release(reclaim_lock);
+
+	return total;
+}
+
+unsigned
+reclaim_pages(unsigned npages)
+{
+	if (!reclaim_cansleep()) {
+		return 0;
+	}
+	return reclaim_pass(npages, &reclaim_ndirect);
+}
+
+////////////////////////////////////////////////////////////
+// background thread
+
+void
+reclaim_check(unsigned nfree)
+{
+	if (nfree >= reclaim_lowmark || reclaim_sem == NULL) {
+		return;
+	}
+
+	spinlock_acquire(&reclaim_spinlock);
+	if (reclaim_kicked) {
+		spinlock_release(&reclaim_spinlock);
+		return;
+	}
+	reclaim_kicked = true;
+	spinlock_release(&reclaim_spinlock);
+
+	V(reclaim_sem);
+}
+
+/*
+ * Wait to be kicked, then reclaim until we're back above the high
+ * watermark or nothing more comes back. If nothing comes back, wait
+ * a second before accepting another kick, so that an allocator
+ * running below the watermark doesn't keep us spinning uselessly.
+ */
+static
+void
+reclaim_thread(void *junk1, unsigned long junk2)
+{
+	unsigned nfree, got;
+
+	(void)junk1;
+	(void)junk2;
+
+	while (1) {
+		P(reclaim_sem);
+
+		got = 0;
+		nfree = kpages_nfree();
+		while (nfree < reclaim_highmark) {
+			got = reclaim_pass(reclaim_highmark - nfree,
+					   &reclaim_nbackground);
+			if (got == 0) {
+				break;
+			}
+			nfree = kpages_nfree();
+		}
+		if (got == 0 && nfree < reclaim_highmark) {
+			clocksleep(1);
+		}
+
+		spinlock_acquire(&reclaim_spinlock);
+		reclaim_kicked = false;
+		spinlock_release(&reclaim_spinlock);
+	}
+}
+
+void
+reclaim_bootstrap(void)
+{
+	int result;
+
+	reclaim_lock = lock_create("reclaim");
+	reclaim_cv = cv_create("reclaim");
+	reclaim_sem = sem_create("reclaim", 0);
+	if (reclaim_lock == NULL || reclaim_cv == NULL ||
+	    reclaim_sem == NULL) {
+		panic("reclaim_bootstrap: out of memory\n");
+	}
+
+	/*
+	 * Keep about 1/64 of memory free, but at least a handful of
+	 * pages; reclaim up to twice that once we start.
+	 */
+	reclaim_lowmark = kpages_nfree() / 64;
+	if (reclaim_lowmark < 8) {
+		reclaim_lowmark = 8;
+	}
+	reclaim_highmark = reclaim_lowmark * 2;
+
+	result = thread_fork("reclaim", NULL, reclaim_thread, NULL, 0);
+	if (result) {
+		panic("reclaim_bootstrap: thread_fork: %s\n",
+		      strerror(result));
+	}
+}
+
+void
+reclaim_printstats(void)
+{
+	struct reclaimer *rc;
+
+	lock_acquire(reclaim_lock);
+	kprintf("free pages: %u (low watermark %u, high %u)\n",
+		kpages_nfree(), reclaim_lowmark, reclaim_highmark);
+	kprintf("passes: %u direct, %u background, %u freed nothing\n",
+		reclaim_ndirect, reclaim_nbackground, reclaim_nfailed);
+	kprintf("%-16s %6s %8s %8s\n", "reclaimer", "cost", "calls",
+		"pages");
+	for (rc = reclaimers; rc != NULL; rc = rc->rc_next) {
+		kprintf("%-16s %6u %8u %8u\n", rc->rc_name, rc->rc_cost,
+			rc->rc_calls, rc->rc_pages);
+	}
+	lock_release(reclaim_lock);
+}
@@ -8,6 +8,11 @@
 #include <proc.h>
 #include <current.h>
 #include <spl.h>
+#include <cpu.h>
+#include <clock.h>
+#include <membar.h>
+#include <synch.h>
+#include <vmstat.h>
 
 /* Place your page table functions here */
 
@@ -40,38 +45,22 @@ void vm_bootstrap(void)
 }
 
 
-int
-vm_fault(int faulttype, vaddr_t faultaddress)
-{
-    // Returns EFAULT if faulttype is VM_FAULT_READONLY.
-    switch(faulttype) {
-        case VM_FAULT_READ:
-        case VM_FAULT_WRITE:
-            break;
-        case VM_FAULT_READONLY:
-            return EFAULT;
-        default:
-            return EINVAL;
-    }
-    if (curproc == NULL) {
-		/*
-		 * No process. This is probably a kernel fault early
-		 * in boot. Return EFAULT so as to panic instead of
-		 * getting into an infinite faulting loop.
-		 */
-        panic("no curproc\n");
-		return EFAULT;
-	}
-
-    struct addrspace *as = proc_getas();
-    if (as == NULL) {
-        return EFAULT;
-    }
+static int vm_ensurePT(paddr_t ***pt, vaddr_t vaddr);
 
+/*
+ * The guts of vm_fault; called with the region list held for reading.
+ *
+ * Threads of one process can fault on the same address space at
+ * once. A page that's already there is loaded without further
+ * locking (page table entries are single words and tables are never
+ * freed while the address space lives); filling in a missing one is
+ * done under as_ptlock, checking again once we have it.
+ */
+static int vm_faultas(struct addrspace *as, int faulttype, vaddr_t faultaddress) {
     paddr_t ***as_pagetable = as->pagetable;
-    bool new = false;
+    struct region *curr;
+    paddr_t pte;
     int result = 0;
-    uint32_t dirty = 0;
     // Get bits.
     uint32_t p1_bits = get_first_level_bits(faultaddress);
     uint32_t p2_bits = get_second_level_bits(faultaddress);
@@ -89,89 +78,262 @@ vm_fault(int faulttype, vaddr_t faultaddress)
     }
 
     // Look up Page Table
-    if (as_pagetable[p1_bits] == NULL) {
-        int res = lookup_region(as, faultaddress, faulttype); 
-        if(res) {
-            kfree(as_pagetable[p1_bits]);
-            as_pagetable[p1_bits] = NULL;
-            return res;
-        }
-        result = vm_initPT(as->pagetable, faultaddress);
-        if (result) return result;
-        new = true;
-    }
-    // Allocate frame
-    if (as_pagetable[p1_bits][p2_bits] == NULL) {
-        as_pagetable[p1_bits][p2_bits] = (paddr_t*)kmalloc(sizeof(paddr_t) * PAGETABLE_SIZE_2);
-        if (as_pagetable[p1_bits][p2_bits] == NULL) {
-            kfree(as_pagetable[p1_bits][p2_bits]);
-            as_pagetable[p1_bits][p2_bits] = NULL;
-            return ENOMEM;
-        }
-
-        for (int i = 0; i < PAGETABLE_SIZE_3; i++) {
-            as_pagetable[p1_bits][p2_bits][i] = 0;
-        }
+    pte = 0;
+    if (as_pagetable[p1_bits] != NULL && as_pagetable[p1_bits][p2_bits] != NULL) {
+        pte = as_pagetable[p1_bits][p2_bits][p3_bits];
     }
-    if (as_pagetable[p1_bits][p2_bits][p3_bits] == 0) {
-        struct region *curr = as->as_regions;
-
-        while(curr != NULL) {
+    if (pte == 0) {
+        for (curr = as->as_regions; curr != NULL; curr = curr->next) {
             if (faultaddress >= curr->vbase && faultaddress < (curr->vbase + (curr->sz))) {
-                if (curr->writeable) {
-                    dirty = TLBLO_DIRTY;
-                } else {
-                    dirty = 0;
-                }
                 break;
             }
-            curr = curr->next;
         }
         if (curr == NULL) {
-            if (new && as_pagetable[p1_bits] != NULL) {
-                kfree(as_pagetable[p1_bits]);
-                as_pagetable[p1_bits] = NULL;
-            }
             return EFAULT;
         }
-        if (curr->writeable) {
-            dirty = TLBLO_DIRTY;
-        } else {
-            dirty = 0;
+
+        lock_acquire(as->as_ptlock);
+        result = vm_ensurePT(as_pagetable, faultaddress);
+        if (result == 0 && as_pagetable[p1_bits][p2_bits][p3_bits] == 0) {
+            // Allocate frame
+            result = vm_addPTE(as_pagetable, faultaddress,
+                               curr->writeable ? TLBLO_DIRTY : 0);
         }
-        result = vm_addPTE(as->pagetable, faultaddress, dirty);
+        if (result == 0) {
+            pte = as_pagetable[p1_bits][p2_bits][p3_bits];
+        }
+        lock_release(as->as_ptlock);
         if (result) {
-            if (new && as->pagetable[p1_bits]) {
-                kfree(as->pagetable[p1_bits]);
-                as->pagetable[p1_bits] = NULL;
-            }
             return result;
         }
     }
     // Save into tlb
     int sql = splhigh();
-    tlb_random(faultaddress & PAGE_FRAME, as_pagetable[p1_bits][p2_bits][p3_bits]);
+    tlb_random(faultaddress & PAGE_FRAME, pte);
     splx(sql);
     return 0;
     
 }
 
+int
+vm_fault(int faulttype, vaddr_t faultaddress)
+{
+    vmstat_inc(VMS_TLBFAULT);
+
+    // Returns EFAULT if faulttype is VM_FAULT_READONLY.
+    switch(faulttype) {
+        case VM_FAULT_READ:
+        case VM_FAULT_WRITE:
+            break;
+        case VM_FAULT_READONLY:
+            return EFAULT;
+        default:
+            return EINVAL;
+    }
+    if (curproc == NULL) {
+		/*
+		 * No process. This is probably a kernel fault early
+		 * in boot. Return EFAULT so as to panic instead of
+		 * getting into an infinite faulting loop.
+		 */
+        panic("no curproc\n");
+		return EFAULT;
+	}
+
+    struct addrspace *as = proc_getas();
+    if (as == NULL) {
+        return EFAULT;
+    }
+
+    int result;
+
+    rwlock_acquire_read(as->as_regionlock);
+    result = vm_faultas(as, faulttype, faultaddress);
+    rwlock_release_read(as->as_regionlock);
+    return result;
+}
+
 /*
- * SMP-specific functions.  Unused in our UNSW configuration.
+ * SMP-specific functions.
+ *
+ * Each cpu remembers in c_tlbas which address space its TLB may hold
+ * entries for, and each address space keeps the set of cpus that
+ * remember it in as_cpus. Switching to a thread of the same address
+ * space (or to a kernel thread and back) keeps the TLB; anything that
+ * takes away or downgrades a mapping has to call vm_shootdown, which
+ * sends one batched request to each cpu in as_cpus and waits for them
+ * all to acknowledge.
  */
 
+/* as_cpus is a 32-bit mask */
+#define VM_MAXCPUS 32
+
+/*
+ * Make AS (which may be NULL) the address space this cpu's TLB is
+ * for, flushing it if that's a change.
+ */
+void
+vm_tlbactivate(struct addrspace *as)
+{
+	struct addrspace *old;
+	uint32_t mybit;
+	int i, spl;
+
+	/* Interrupts off so a shootdown can't see us half switched. */
+	spl = splhigh();
+
+	old = curcpu->c_tlbas;
+	if (old == as) {
+		splx(spl);
+		return;
+	}
+
+	KASSERT(curcpu->c_number < VM_MAXCPUS);
+	mybit = (uint32_t)1 << curcpu->c_number;
+	if (old != NULL) {
+		spinlock_acquire(&old->as_tlblock);
+		old->as_cpus &= ~mybit;
+		spinlock_release(&old->as_tlblock);
+	}
+	if (as != NULL) {
+		spinlock_acquire(&as->as_tlblock);
+		as->as_cpus |= mybit;
+		spinlock_release(&as->as_tlblock);
+	}
+	curcpu->c_tlbas = as;
+
+	for (i=0; i<NUM_TLB; i++) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+
+	splx(spl);
+}
+
+/*
+ * Carry out a shootdown on this cpu. Interrupts must be off.
+ */
+static
+void
+vm_tlbinvalidate(const struct tlbshootdown *ts)
+{
+	struct addrspace *as = ts->ts_as;
+	unsigned i;
+
+	if (curcpu->c_tlbas != as) {
+		/* Switched away since; the TLB was flushed then. */
+		return;
+	}
+
+	if (ts->ts_detach) {
+		spinlock_acquire(&as->as_tlblock);
+		as->as_cpus &= ~((uint32_t)1 << curcpu->c_number);
+		spinlock_release(&as->as_tlblock);
+		curcpu->c_tlbas = NULL;
+	}
+
+	for (i=0; i<NUM_TLB; i++) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+}
+
+/*
+ * Handle a shootdown from another cpu; called from
+ * interprocessor_interrupt.
+ */
 void
 vm_tlbshootdown(const struct tlbshootdown *ts)
 {
-	(void)ts;
-	panic("vm tried to do tlb shootdown?!\n");
+	vm_tlbinvalidate(ts);
+
+	/* ts_done is on the sender's stack, which goes once it sees this. */
+	membar_store_store();
+	ts->ts_done[curcpu->c_number] = true;
+}
+
+/*
+ * Flush AS from every cpu's TLB, and wait until that's done.
+ */
+static
+void
+vm_shootdown_send(struct addrspace *as, bool detach)
+{
+	struct tlbshootdown ts;
+	volatile bool done[VM_MAXCPUS];
+	struct timespec before, after, diff;
+	uint32_t others;
+	unsigned i, n;
+	int spl;
+
+	ts.ts_as = as;
+	ts.ts_detach = detach;
+	ts.ts_done = done;
+
+	/* This cpu first, and find out who else has it. */
+	spl = splhigh();
+	vm_tlbinvalidate(&ts);
+	spinlock_acquire(&as->as_tlblock);
+	others = as->as_cpus & ~((uint32_t)1 << curcpu->c_number);
+	spinlock_release(&as->as_tlblock);
+	splx(spl);
+
+	vmstat_inc(VMS_SHOOTDOWN);
+	if (others == 0) {
+		return;
+	}
+
+	/*
+	 * We're about to spin waiting for other cpus, who may be
+	 * waiting for us in turn; we have to be able to take their
+	 * shootdowns meanwhile.
+	 */
+	KASSERT(curthread->t_curspl == 0);
+	KASSERT(curcpu->c_spinlocks == 0);
+	KASSERT(!curthread->t_in_interrupt);
+
+	n = 0;
+	for (i=0; i<VM_MAXCPUS; i++) {
+		done[i] = false;
+		if (others & ((uint32_t)1 << i)) {
+			n++;
+		}
+	}
+
+	gettime(&before);
+	ipi_tlbshootdown_mask(others, &ts);
+	for (i=0; i<VM_MAXCPUS; i++) {
+		if (others & ((uint32_t)1 << i)) {
+			while (!done[i]) {
+				/* spin */
+			}
+		}
+	}
+	gettime(&after);
+
+	timespec_sub(&after, &before, &diff);
+	vmstat_inc(VMS_SHOOTDOWNWAIT);
+	vmstat_add(VMS_SHOOTDOWNIPI, n);
+	vmstat_add(VMS_SHOOTDOWNUSEC,
+		   diff.tv_sec * 1000000 + diff.tv_nsec / 1000);
+}
+
+void
+vm_shootdown(struct addrspace *as)
+{
+	vm_shootdown_send(as, false);
+}
+
+void
+vm_shootdown_detach(struct addrspace *as)
+{
+	vm_shootdown_send(as, true);
 }
 
 
 void vm_freePTE(paddr_t ***pte)
 {
-    // page table is associated with KUSEG which will not have an entry 'higher' than pt[127][63][63]
-    for (int i = 0; i < (PAGETABLE_SIZE / 2); i++) { 
+    // The level-1 index is taken from KVADDR_TO_PADDR(vaddr), so KUSEG
+    // addresses land in the *upper* half, pt[128..255]; scan all of it.
+    for (int i = 0; i < PAGETABLE_SIZE; i++) { 
         if (pte[i] == NULL) continue;
 
         for (int j = 0; j < PAGETABLE_SIZE_2; j ++) {
@@ -195,7 +357,7 @@ vaddr_t alloc_frame() {
     vaddr_t newVaddr = alloc_kpages(1);
 	if (newVaddr == 0) return 0;
 	/* zero out the frame */
-    bzero((void *) newVaddr, PAGE_SIZE);
+    pagezero((void *) newVaddr);
     return newVaddr;
 }
 
@@ -208,6 +370,10 @@ int copyPTE(struct addrspace *old, struct addrspace *newas) {
 		if (newas->pagetable[i] == NULL) {
 			return ENOMEM; // Out of memory
 		}
+		// clear first, so vm_freePTE can clean up after a failure
+		for (int j = 0; j < PAGETABLE_SIZE_2; j++) {
+			newas->pagetable[i][j] = NULL;
+		}
 
 		for (int j = 0; j < PAGETABLE_SIZE_2; j++) {
 			if (old->pagetable[i][j] == NULL) {
@@ -217,17 +383,17 @@ int copyPTE(struct addrspace *old, struct addrspace *newas) {
 			if (newas->pagetable[i][j] == NULL) {
 				return ENOMEM; // Out of memory
 			}
+			for (int k = 0; k < PAGETABLE_SIZE_3; k++) {
+				newas->pagetable[i][j][k] = 0;
+			}
 			for (int k = 0; k < PAGETABLE_SIZE_3; k++) {
 				if (old->pagetable[i][j][k]) { // Check if it is empty
-					vaddr_t newframe = alloc_frame();
+					vaddr_t newframe = alloc_kpages(1); // fully overwritten below
 					if (newframe == 0) {
 						return ENOMEM; // Out of memory
 					}
-                    if (memmove((void *)newframe, (const void *)PADDR_TO_KVADDR(old->pagetable[i][j][k] & PAGE_FRAME)
-                    , PAGE_SIZE) == NULL) { // fail memove
-                        vm_freePTE(newas->pagetable);
-                        return ENOMEM;
-                    }
+                    pagecopy((void *)newframe, (const void *)PADDR_TO_KVADDR(old->pagetable[i][j][k] & PAGE_FRAME));
+                    vmstat_inc(VMS_FORKCOPY);
                     newas->pagetable[i][j][k] = (KVADDR_TO_PADDR(newframe) & PAGE_FRAME) | (old->pagetable[i][j][k] & TLBLO_DIRTY) | TLBLO_VALID;
 				} else {
                     newas->pagetable[i][j][k] = 0;
@@ -260,12 +426,57 @@ int vm_addPTE(paddr_t ***oldPTE, vaddr_t faultaddress, uint32_t dirty) {
     vaddr_t vbase = alloc_kpages(1);
     if (vbase == 0) return ENOMEM;
     paddr_t pbase = KVADDR_TO_PADDR(vbase);
-    bzero((void *)PADDR_TO_KVADDR(pbase), PAGE_SIZE);
+    pagezero((void *)PADDR_TO_KVADDR(pbase));
+    vmstat_inc(VMS_ZEROFILL);
     
     oldPTE[p1_bits][p2_bits][p3_bits] = (pbase & PAGE_FRAME) | dirty | TLBLO_VALID;
     return 0;
 }
 
+// Allocate the 1st and 2nd level entries for vaddr if they aren't there yet
+static int vm_ensurePT(paddr_t ***pt, vaddr_t vaddr) {
+    uint32_t p1_bits = get_first_level_bits(vaddr);
+    uint32_t p2_bits = get_second_level_bits(vaddr);
+    int result;
+
+    if (pt[p1_bits] == NULL) {
+        result = vm_initPT(pt, vaddr);
+        if (result) return result;
+    }
+    if (pt[p1_bits][p2_bits] == NULL) {
+        pt[p1_bits][p2_bits] = kmalloc(sizeof(paddr_t) * PAGETABLE_SIZE_3);
+        if (pt[p1_bits][p2_bits] == NULL) return ENOMEM;
+        for (int i = 0; i < PAGETABLE_SIZE_3; i++) {
+            pt[p1_bits][p2_bits][i] = 0;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Install an already-filled frame (kernel address KFRAME, from
+ * alloc_kpages) as the page at VADDR in AS, allocating page table
+ * levels as needed. The frame then belongs to the address space and
+ * is freed along with it. Used by exec to hand over the argv pages.
+ */
+int vm_mapframe(struct addrspace *as, vaddr_t vaddr, vaddr_t kframe, bool writeable) {
+    uint32_t p1_bits = get_first_level_bits(vaddr);
+    uint32_t p2_bits = get_second_level_bits(vaddr);
+    uint32_t p3_bits = get_third_level_bits(vaddr);
+    int result;
+
+    KASSERT((vaddr & PAGE_FRAME) == vaddr);
+    KASSERT((kframe & PAGE_FRAME) == kframe);
+
+    result = vm_ensurePT(as->pagetable, vaddr);
+    if (result) return result;
+    KASSERT(as->pagetable[p1_bits][p2_bits][p3_bits] == 0);
+
+    as->pagetable[p1_bits][p2_bits][p3_bits] = (KVADDR_TO_PADDR(kframe) & PAGE_FRAME)
+        | (writeable ? TLBLO_DIRTY : 0) | TLBLO_VALID;
+    return 0;
+}
+
 // finds the region where the faultaddress is located and checks if it is valid
 int lookup_region(struct addrspace *as, vaddr_t vaddr, int faulttype) {
     struct region *curr = as->as_regions;
@@ -291,3 +502,94 @@ int lookup_region(struct addrspace *as, vaddr_t vaddr, int faulttype) {
 
     return 0;
 }
+
+/*
+ * Fault in the user range [START, START+LEN) of the current address
+ * space ahead of a bulk copy, so copyin/copyout don't take a separate
+ * trap for every page. The region list is walked once for the whole
+ * range rather than once per page, any missing page table entries are
+ * filled in, and the TLB entries are then loaded in one batch with
+ * interrupts off, before the region lock is dropped.
+ *
+ * The range may span at most VM_PREFAULT_PAGES pages (more would just
+ * evict each other from the TLB before the copy got to them).
+ *
+ * This is only a hint: on error the pages done so far are still
+ * loaded and the caller should go ahead with the copy anyway, which
+ * will fault normally and report the error the usual way.
+ */
+int vm_prefault(vaddr_t start, size_t len, int faulttype) {
+    uint32_t ehi[VM_PREFAULT_PAGES], elo[VM_PREFAULT_PAGES];
+    struct addrspace *as;
+    struct region *reg;
+    vaddr_t va, last;
+    unsigned n;
+    int result, spl, idx;
+
+    KASSERT(faulttype == VM_FAULT_READ || faulttype == VM_FAULT_WRITE);
+    if (len == 0) return 0;
+
+    as = proc_getas();
+    if (as == NULL) return EFAULT;
+
+    va = start & PAGE_FRAME;
+    last = (start + len - 1) & PAGE_FRAME;
+    KASSERT(last >= va);
+    KASSERT((last - va) / PAGE_SIZE < VM_PREFAULT_PAGES);
+
+    reg = NULL;
+    result = 0;
+    rwlock_acquire_read(as->as_regionlock);
+    for (n = 0; ; va += PAGE_SIZE) {
+        uint32_t p1_bits = get_first_level_bits(va);
+        uint32_t p2_bits = get_second_level_bits(va);
+        uint32_t p3_bits = get_third_level_bits(va);
+
+        // Only look the region up again when we walk off the last one
+        if (reg == NULL || va < reg->vbase || va >= reg->vbase + reg->sz) {
+            for (reg = as->as_regions; reg != NULL; reg = reg->next) {
+                if (va >= reg->vbase && va < reg->vbase + reg->sz) break;
+            }
+            if (reg == NULL) {
+                result = EFAULT;
+                break;
+            }
+        }
+        if (faulttype == VM_FAULT_WRITE ? !reg->writeable : !reg->readable) {
+            result = EPERM;
+            break;
+        }
+
+        lock_acquire(as->as_ptlock);
+        result = vm_ensurePT(as->pagetable, va);
+        if (result == 0 && as->pagetable[p1_bits][p2_bits][p3_bits] == 0) {
+            result = vm_addPTE(as->pagetable, va,
+                               reg->writeable ? TLBLO_DIRTY : 0);
+        }
+        lock_release(as->as_ptlock);
+        if (result) break;
+
+        ehi[n] = va;
+        elo[n] = as->pagetable[p1_bits][p2_bits][p3_bits];
+        n++;
+        if (va == last) break;
+    }
+
+    // Load everything we got, replacing any stale copy already there.
+    // This is still under as_regionlock, as in vm_faultas, so nothing
+    // can unmap these pages and shoot them down before they're loaded.
+    spl = splhigh();
+    for (unsigned i = 0; i < n; i++) {
+        idx = tlb_probe(ehi[i], 0);
+        if (idx >= 0) {
+            tlb_write(ehi[i], elo[i], idx);
+        } else {
+            tlb_random(ehi[i], elo[i]);
+        }
+    }
+    splx(spl);
+    rwlock_release_read(as->as_regionlock);
+    vmstat_add(VMS_PREFAULT, n);
+
+    return result;
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2016
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * VM event counters. See vmstat.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <statcounter.h>
+#include <vm.h>
+#include <vmstat.h>
+
+static const char *const vmstat_names[VMS_NCOUNTERS] = {
+	[VMS_TLBFAULT] = "tlbfaults",
+	[VMS_ZEROFILL] = "zerofill",
+	[VMS_PREFAULT] = "prefault",
+	[VMS_FORKCOPY] = "forkcopy",
+	[VMS_RECLAIM] = "reclaimed",
+	[VMS_KPAGEALLOC] = "kpagealloc",
+	[VMS_KPAGEFREE] = "kpagefree",
+	[VMS_SHOOTDOWN] = "shootdowns",
+	[VMS_SHOOTDOWNWAIT] = "shootdownwaits",
+	[VMS_SHOOTDOWNIPI] = "shootdownipis",
+	[VMS_SHOOTDOWNUSEC] = "shootdownusec",
+};
+
+static struct statcounters vmstat =
+	STATCOUNTERS_INITIALIZER(vmstat_names, VMS_NCOUNTERS);
+
+void
+vmstat_add(enum vmstat_counter which, unsigned amount)
+{
+	statcounter_add(&vmstat, which, amount);
+}
+
+void
+vmstat_reset(void)
+{
+	statcounters_reset(&vmstat);
+}
+
+void
+vmstat_print(void)
+{
+	unsigned counts[VMS_NCOUNTERS];
+
+	statcounters_sum(&vmstat, counts);
+	statcounters_print(&vmstat, "vmstat", counts);
+	kprintf("vmstat freepages %u\n", kpages_nfree());
+	if (counts[VMS_SHOOTDOWNWAIT] > 0) {
+		kprintf("vmstat shootdownavgusec %u\n",
+			counts[VMS_SHOOTDOWNUSEC] /
+			counts[VMS_SHOOTDOWNWAIT]);
+	}
+}
@@ -0,0 +1,251 @@
+#!/usr/pkg/bin/python2.7
+# fsimage.py - run filesystem tests and then examine the disk image
+# usage: fsimage.py [options]
+# options:
+#    --commands=LIST	Kernel commands to run, semicolon-separated
+#			(default "MOUNT; fs11 lhd1; fs12 lhd1; UNMOUNT")
+#    --image=FILE	Disk image of lhd1 (default LHD1.img)
+#    --format		Run host-mksfs on the image first
+#    --minrun=N		Flag files averaging fewer than N blocks per
+#			fragment (default 8)
+#    --hostbin=DIR	Where host-mksfs, host-dumpsfs and host-sfsck are
+#			(default: search the path)
+#    --conf=sys161.conf	Use alternate sys161 config
+#    --timeout=N	Global timeout, in seconds (default 600)
+#    --kernel=KERNEL	Choose kernel to run (default "kernel")
+#
+# Boots the kernel and runs the commands, which should leave files
+# behind on lhd1 and unmount it cleanly; the default runs the
+# interleaved write test ("fs11") and the freemap writeback test
+# ("fs12"), which are meant for this. Then:
+#
+# * Runs host-dumpsfs -r on the image and reads the "Fragments" line
+# it prints for each inode, which counts the runs of consecutive disk
+# blocks the file is stored in. Prints one line per regular file:
+#	fsimage NAME BLOCKS blocks FRAGMENTS fragments
+# and flags files of at least MINRUN blocks whose blocks per fragment
+# is below MINRUN.
+#
+# * Runs host-sfsck on a copy of the image (sfsck repairs what it
+# finds) and flags any complaint about the freemap or about a block
+# in use twice. Other complaints are shown but not flagged: sfsck
+# expects "." and ".." entries that this SFS doesn't make, so it
+# never comes out clean on the root directory.
+#
+# The exit status is 1 if anything was flagged or went wrong.
+#
+
+import sys
+import os
+import re
+import shutil
+import subprocess
+from optparse import OptionParser
+
+import runtest
+
+############################################################
+# global settings
+
+g_commands = "MOUNT; fs11 lhd1; fs12 lhd1; UNMOUNT"
+g_image = "LHD1.img"
+g_format = False
+g_minrun = 8
+g_hostbin = None
+g_conf = None
+g_timeout = 600
+g_kernel = None
+
+############################################################
+# host tools
+
+def hosttool(name):
+	if g_hostbin is None:
+		return "host-" + name
+	return os.path.join(g_hostbin, "host-" + name)
+# end hosttool
+
+#
+# Run a host tool; returns its output (with stderr too if MERGE is
+# set), or None if it failed to run. A nonzero exit is reported
+# unless MERGE is set, for tools like sfsck whose messages say more.
+#
+def runtool(args, merge=False):
+	if merge:
+		errout = subprocess.STDOUT
+	else:
+		errout = None
+	try:
+		proc = subprocess.Popen(args, stdout=subprocess.PIPE,
+			stderr=errout)
+	except OSError, e:
+		sys.stderr.write("fsimage.py: %s: %s\n" % (args[0], e))
+		return None
+	output = proc.communicate()[0]
+	if proc.returncode != 0 and not merge:
+		sys.stderr.write("fsimage.py: %s exited with %d\n" %
+			(args[0], proc.returncode))
+	return output
+# end runtool
+
+############################################################
+# dumpsfs output
+
+inodepat = re.compile(r"^Inode (\d+)(?: \((.*)\))?\s*$")
+typepat = re.compile(r"Type: \d+ \(([^)]*)\)")
+fragpat = re.compile(r"Fragments: (\d+) \((\d+) blocks\)")
+
+#
+# Pull the regular files out of dumpsfs -r output; returns a list
+# of (name, blocks, fragments).
+#
+def parse(text):
+	files = []
+	name = None
+	ftype = None
+	for line in text.split("\n"):
+		m = inodepat.match(line)
+		if m is not None:
+			name = m.group(2)
+			if name is None:
+				name = "inode %s" % m.group(1)
+			ftype = None
+			continue
+		m = typepat.search(line)
+		if m is not None:
+			ftype = m.group(1)
+		m = fragpat.search(line)
+		if m is not None and ftype == "regular file":
+			files.append((name, int(m.group(2)), int(m.group(1))))
+	return files
+# end parse
+
+#
+# Print the results; returns the number of files flagged.
+#
+def report(files, minrun):
+	bad = 0
+	totblocks = 0
+	totfrags = 0
+	for (name, blocks, frags) in files:
+		flag = ""
+		if blocks >= minrun and blocks < frags * minrun:
+			flag = "  <-- fragmented"
+			bad += 1
+		sys.stdout.write("fsimage %s %d blocks %d fragments%s\n" %
+			(name, blocks, frags, flag))
+		totblocks += blocks
+		totfrags += frags
+	sys.stdout.write("fsimage total %d blocks %d fragments\n" %
+		(totblocks, totfrags))
+	return bad
+# end report
+
+############################################################
+# sfsck output
+
+sfsckbadpat = re.compile(r"freemap|already in use")
+
+#
+# Run sfsck on a copy of the image and show what it says; returns
+# the number of freemap problems.
+#
+def checkimage(image):
+	copy = image + ".fsimage"
+	shutil.copyfile(image, copy)
+	text = runtool([hosttool("sfsck"), copy], merge=True)
+	os.remove(copy)
+	if text is None:
+		return 1
+	bad = 0
+	for line in text.split("\n"):
+		if line == "":
+			continue
+		flag = ""
+		if sfsckbadpat.search(line) is not None:
+			flag = "  <-- freemap"
+			bad += 1
+		sys.stdout.write("fsimage sfsck: %s%s\n" % (line, flag))
+	return bad
+# end checkimage
+
+############################################################
+# main
+
+def getargs():
+	global g_commands
+	global g_image
+	global g_format
+	global g_minrun
+	global g_hostbin
+	global g_conf
+	global g_timeout
+	global g_kernel
+
+	p = OptionParser()
+	p.add_option("-B", "--hostbin", dest="hostbin")
+	p.add_option("-c", "--conf", dest="conf")
+	p.add_option("-C", "--commands", dest="commands")
+	p.add_option("-f", "--format", dest="format", action="store_true")
+	p.add_option("-i", "--image", dest="image")
+	p.add_option("-k", "--kernel", dest="kernel")
+	p.add_option("-m", "--minrun", dest="minrun")
+	p.add_option("-t", "--timeout", dest="timeout")
+
+	(options, args) = p.parse_args()
+	if options.commands is not None:
+		g_commands = options.commands
+	if options.conf is not None:
+		g_conf = options.conf
+	if options.format is not None:
+		g_format = options.format
+	if options.hostbin is not None:
+		g_hostbin = options.hostbin
+	if options.image is not None:
+		g_image = options.image
+	if options.kernel is not None:
+		g_kernel = options.kernel
+	if options.minrun is not None:
+		g_minrun = int(options.minrun)
+	if options.timeout is not None:
+		g_timeout = int(options.timeout)
+
+	if len(args) != 0:
+		sys.stderr.write("Usage: fsimage.py [options]\n")
+		exit(1)
+# end getargs
+
+getargs()
+
+failed = False
+
+if g_format:
+	if runtool([hosttool("mksfs"), g_image, "fsimage"]) is None:
+		exit(1)
+
+# The tests run in the kernel; no progress monitoring.
+msg = runtest.run(g_commands, sys.stdout,
+	conf=g_conf,
+	progress=None,
+	timeout=g_timeout,
+	kernel=g_kernel)
+if msg is not None:
+	sys.stderr.write("fsimage.py: aborted with %s\n" % msg)
+	failed = True
+
+sys.stdout.write("\n")
+text = runtool([hosttool("dumpsfs"), "-r", g_image])
+if text is None:
+	exit(1)
+files = parse(text)
+if len(files) == 0:
+	sys.stderr.write("fsimage.py: no files found on %s\n" % g_image)
+	failed = True
+if report(files, g_minrun) > 0:
+	failed = True
+if checkimage(g_image) > 0:
+	failed = True
+
+if failed:
+	exit(1)
+exit(0)
@@ -0,0 +1,232 @@
+#!/usr/pkg/bin/python2.7
+# vmbench.py - run the VM benchmarks and compare against a baseline
+# usage: vmbench.py [options]
+# options:
+#    --configs=LIST	RAM:CPUS pairs to run, comma-separated
+#			(default 2M:1,8M:1,8M:4)
+#    --output=FILE	Write results to FILE
+#    --baseline=FILE	Compare results against FILE
+#    --threshold=PCT	Flag changes worse than PCT percent (default 10)
+#    --conf=sys161.conf	Use alternate sys161 config
+#    --timeout=N	Global timeout per configuration, in seconds
+#			(default 600)
+#    --kernel=KERNEL	Choose kernel to run (default "kernel")
+#
+# For each configuration, boots the kernel, runs the in-kernel
+# allocator benchmark (menu command "vb"), the concurrent lookup
+# benchmark ("lkb") and /testbin/vmbench, and collects the VM event
+# counters ("vs") accumulated over the run.
+#
+# The benchmarks print lines of the form
+#	vmbench NAME VALUE UNIT
+#	lookupbench NAME VALUE UNIT
+#	vmstat NAME VALUE
+# which are collected into results of the form
+#	RAM:CPUS/vmbench.NAME VALUE UNIT
+#	RAM:CPUS/lookupbench.NAME VALUE UNIT
+#	RAM:CPUS/vmstat.NAME VALUE count
+# one per line. This is also the format of the output and baseline
+# files, so a saved --output file can be used later as a --baseline.
+#
+# When comparing, results whose unit ends in "/s" are better when
+# higher; other timings are better when lower. Counters are shown but
+# never flagged. The exit status is 1 if any result got worse by
+# more than the threshold.
+#
+
+import sys
+import re
+from optparse import OptionParser
+
+import runtest
+
+############################################################
+# global settings
+
+g_configs = "2M:1,8M:1,8M:4"
+g_output = None
+g_baseline = None
+g_threshold = 10.0
+g_conf = None
+g_timeout = 600
+g_kernel = None
+
+g_commands = "vs reset; vb; lkb; s; /testbin/vmbench; exit; vs"
+
+############################################################
+# output capture
+
+#
+# Copy sys161 output to stdout while keeping it for parsing.
+#
+class Tee:
+	def __init__(self):
+		self.text = []
+
+	def write(self, data):
+		if not isinstance(data, str):
+			data = data.decode("latin-1")
+		self.text.append(data)
+		sys.stdout.write(data)
+
+	def flush(self):
+		sys.stdout.flush()
+
+	def lines(self):
+		return "".join(self.text).replace("\r", "").split("\n")
+# end Tee
+
+resultpat = re.compile(r"^(vmbench|lookupbench|vmstat) (\S+) (\d+)(?: (\S+))?\s*$")
+
+#
+# Pull results out of captured output; returns a list of
+# (name, value, unit).
+#
+def parse(lines):
+	results = []
+	for line in lines:
+		m = resultpat.match(line)
+		if m is None:
+			continue
+		unit = m.group(4)
+		if unit is None:
+			unit = "count"
+		results.append(("%s.%s" % (m.group(1), m.group(2)),
+				int(m.group(3)), unit))
+	return results
+# end parse
+
+############################################################
+# results files
+
+def writeresults(filename, results):
+	f = open(filename, "w")
+	for (key, value, unit) in results:
+		f.write("%s %d %s\n" % (key, value, unit))
+	f.close()
+# end writeresults
+
+def readresults(filename):
+	results = {}
+	f = open(filename, "r")
+	for line in f:
+		words = line.split()
+		if len(words) != 3:
+			continue
+		results[words[0]] = (int(words[1]), words[2])
+	f.close()
+	return results
+# end readresults
+
+#
+# Print a comparison; returns the number of regressions.
+#
+def compare(results, baseline, threshold):
+	bad = 0
+	sys.stdout.write("\n%-32s %12s %12s %8s\n" %
+		("result", "baseline", "now", "change"))
+	for (key, value, unit) in results:
+		if key not in baseline:
+			sys.stdout.write("%-32s %12s %12d %8s\n" %
+				(key, "-", value, "new"))
+			continue
+		(old, oldunit) = baseline[key]
+		if oldunit != unit:
+			sys.stdout.write("%-32s %12d %12d %8s\n" %
+				(key, old, value, "units?"))
+			continue
+		if old == 0:
+			change = 0.0
+		else:
+			change = (value - old) * 100.0 / old
+		flag = ""
+		if unit != "count":
+			if unit.endswith("/s"):
+				worse = -change
+			else:
+				worse = change
+			if worse > threshold:
+				flag = "  <-- worse"
+				bad += 1
+		sys.stdout.write("%-32s %12d %12d %+7.1f%%%s\n" %
+			(key, old, value, change, flag))
+	return bad
+# end compare
+
+############################################################
+# main
+
+def getargs():
+	global g_configs
+	global g_output
+	global g_baseline
+	global g_threshold
+	global g_conf
+	global g_timeout
+	global g_kernel
+
+	p = OptionParser()
+	p.add_option("-b", "--baseline", dest="baseline")
+	p.add_option("-c", "--conf", dest="conf")
+	p.add_option("-C", "--configs", dest="configs")
+	p.add_option("-k", "--kernel", dest="kernel")
+	p.add_option("-o", "--output", dest="output")
+	p.add_option("-t", "--timeout", dest="timeout")
+	p.add_option("-T", "--threshold", dest="threshold")
+
+	(options, args) = p.parse_args()
+	if options.baseline is not None:
+		g_baseline = options.baseline
+	if options.conf is not None:
+		g_conf = options.conf
+	if options.configs is not None:
+		g_configs = options.configs
+	if options.kernel is not None:
+		g_kernel = options.kernel
+	if options.output is not None:
+		g_output = options.output
+	if options.timeout is not None:
+		g_timeout = int(options.timeout)
+	if options.threshold is not None:
+		g_threshold = float(options.threshold)
+
+	if len(args) != 0:
+		sys.stderr.write("Usage: vmbench.py [options]\n")
+		exit(1)
+# end getargs
+
+getargs()
+
+results = []
+failed = False
+for config in g_configs.split(","):
+	(ram, cpus) = config.split(":")
+	tee = Tee()
+	# Benchmarks run in the kernel for a while; no progress monitoring.
+	msg = runtest.run(g_commands, tee,
+		conf=g_conf,
+		ram=ram,
+		cpus=int(cpus),
+		progress=None,
+		timeout=g_timeout,
+		kernel=g_kernel)
+	if msg is not None:
+		sys.stderr.write("vmbench.py: %s: aborted with %s\n" %
+			(config, msg))
+		failed = True
+	for (key, value, unit) in parse(tee.lines()):
+		results.append(("%s/%s" % (config, key), value, unit))
+
+if g_output is not None:
+	writeresults(g_output, results)
+if g_baseline is not None:
+	if compare(results, readresults(g_baseline), g_threshold) > 0:
+		failed = True
+else:
+	sys.stdout.write("\n")
+	for (key, value, unit) in results:
+		sys.stdout.write("%s %d %s\n" % (key, value, unit))
+
+if failed:
+	exit(1)
+exit(0)
@@ -415,6 +415,38 @@ void dumpfileblock(uint32_t fileblock, uint32_t diskblock)
 	}
 }
 
+/*
+ * Count the runs of consecutive disk blocks a file is stored in, as
+ * a measure of fragmentation. Holes don't break a run.
+ */
+static uint32_t fragprev;
+static unsigned fragcount, fragblocks;
+
+static
+void
+countfragblock(uint32_t fileblock, uint32_t diskblock)
+{
+	(void)fileblock;
+
+	if (diskblock == 0) {
+		return;
+	}
+	if (fragprev == 0 || diskblock != fragprev + 1) {
+		fragcount++;
+	}
+	fragprev = diskblock;
+	fragblocks++;
+}
+
+static
+void
+countfrags(const struct sfs_dinode *sfi)
+{
+	fragprev = 0;
+	fragcount = fragblocks = 0;
+	traverse(sfi, countfragblock);
+}
+
 static
 void
 dumpfile(uint32_t ino, const struct sfs_dinode *sfi)
@@ -449,6 +481,12 @@ dumpinode(uint32_t ino, const char *name)
 	dumpvalf("Type", "%u (%s)", SWAP16(sfi.sfi_type), typename);
 	dumpvalf("Size", "%u", SWAP32(sfi.sfi_size));
 	dumpvalf("Link count", "%u", SWAP16(sfi.sfi_linkcount));
+	if (SWAP16(sfi.sfi_type) == SFS_TYPE_FILE ||
+	    SWAP16(sfi.sfi_type) == SFS_TYPE_DIR) {
+		countfrags(&sfi);
+		dumpvalf("Fragments", "%u (%u blocks)",
+			 fragcount, fragblocks);
+	}
 	printf("\n");
 
         printf("    Direct blocks:\n");
@@ -0,0 +1,183 @@
+/*
+ * Copyright (c) 2016
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * execbench.c
+ *
+ * Measures execv latency as a function of the size of the argv.
+ *
+ * For each argv shape, forks a number of children that each exec
+ * this program again with that argv; the exec'd copy exits at once.
+ * The time per fork/exec/exit/wait cycle is reported, along with the
+ * difference from the cycle with an empty argv, which is roughly the
+ * cost of moving the argv itself.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/wait.h>
+#include <err.h>
+
+#define _PATH_MYSELF "/testbin/execbench"
+#define MARKER "-x"		/* argv[1] of the exec'd copies */
+
+#define NTRIALS 16
+
+/*
+ * argv shapes: NARGS arguments of ARGLEN characters each. Keep the
+ * total comfortably under ARG_MAX, leaving room for argv[0], the
+ * marker, and the terminators.
+ */
+static const struct {
+	unsigned nargs;
+	unsigned arglen;
+} shapes[] = {
+	{ 0, 0 },
+	{ 1, 16 },
+	{ 1, 512 },
+	{ 1, 1024 },
+	{ 2, 1024 },
+	{ 3, 1024 },
+	{ 64, 7 },
+	{ 256, 7 },
+};
+#define NSHAPES (sizeof(shapes) / sizeof(shapes[0]))
+
+static char argspace[ARG_MAX];
+static char *args[ARG_MAX / 2];
+
+/*
+ * Fill in args[] for the given shape.
+ */
+static
+void
+makeargs(unsigned nargs, unsigned arglen)
+{
+	char *p;
+	unsigned i;
+
+	if ((arglen + 1) * nargs + 64 > ARG_MAX) {
+		errx(1, "argv shape %u x %u does not fit in ARG_MAX",
+		     nargs, arglen);
+	}
+
+	args[0] = (char *)_PATH_MYSELF;
+	args[1] = (char *)MARKER;
+	p = argspace;
+	for (i=0; i<nargs; i++) {
+		memset(p, 'a' + i % 26, arglen);
+		p[arglen] = 0;
+		args[i+2] = p;
+		p += arglen + 1;
+	}
+	args[nargs+2] = NULL;
+}
+
+/*
+ * Return the current time in microseconds.
+ */
+static
+unsigned long long
+now(void)
+{
+	time_t secs;
+	unsigned long nsecs;
+
+	__time(&secs, &nsecs);
+	return secs * 1000000ULL + nsecs / 1000;
+}
+
+/*
+ * Do NTRIALS fork/exec/wait cycles with the current args[]; return
+ * the average time per cycle in microseconds.
+ */
+static
+unsigned long
+trial(void)
+{
+	unsigned long long start, end;
+	pid_t pid;
+	int i, status;
+
+	start = now();
+	for (i=0; i<NTRIALS; i++) {
+		pid = fork();
+		if (pid < 0) {
+			err(1, "fork");
+		}
+		if (pid == 0) {
+			execv(_PATH_MYSELF, args);
+			warn("execv");
+			_exit(1);
+		}
+		if (waitpid(pid, &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			errx(1, "child failed");
+		}
+	}
+	end = now();
+
+	return (end - start) / NTRIALS;
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned long us, baseline;
+	unsigned i;
+
+	if (argc >= 2 && !strcmp(argv[1], MARKER)) {
+		/* we are the exec'd copy */
+		return 0;
+	}
+
+	printf("execbench: %d fork/exec/exit/wait cycles per argv shape\n",
+	       NTRIALS);
+	printf("%6s %7s %8s %10s %10s\n", "nargs", "arglen", "bytes",
+	       "us/cycle", "+us");
+
+	baseline = 0;
+	for (i=0; i<NSHAPES; i++) {
+		makeargs(shapes[i].nargs, shapes[i].arglen);
+		us = trial();
+		if (i == 0) {
+			baseline = us;
+		}
+		printf("%6u %7u %8u %10lu %10ld\n",
+		       shapes[i].nargs, shapes[i].arglen,
+		       shapes[i].nargs * (shapes[i].arglen + 1),
+		       us, (long)us - (long)baseline);
+	}
+	return 0;
+}
@@ -0,0 +1,289 @@
+/*
+ * Copyright (c) 2016
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * futexpong.c
+ *
+ * Compares user-level semaphores built on futex_wait/futex_wake with
+ * the semfs ("sem:") semaphores that usemtest uses.
+ *
+ * First checks the futex calls' error cases and timeout. Then times
+ * NPAIRS V-then-P pairs three ways:
+ *	semfs	a write and a read on a sem: file, like usemtest
+ *	futex	a futex semaphore with nobody waiting, which never
+ *		enters the kernel
+ *	slow	the futex semaphore's contended path: a futex_wake
+ *		and a futex_wait that finds the value changed
+ * and reports microseconds per pair.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <err.h>
+
+#define NPAIRS 2000
+#define SEMNAME "sem:futexpong"
+#define TIMEOUT_MS 50
+
+/*
+ * Return the current time in microseconds.
+ */
+static
+unsigned long long
+now(void)
+{
+	time_t secs;
+	unsigned long nsecs;
+
+	__time(&secs, &nsecs);
+	return secs * 1000000ULL + nsecs / 1000;
+}
+
+/*
+ * Atomically replace *P with NEWVAL if it holds OLDVAL, using LL/SC
+ * the same way the kernel's spinlocks do. Returns nonzero on success.
+ * It can fail spuriously, so callers loop.
+ */
+static
+int
+cas(volatile int *p, int oldval, int newval)
+{
+	int x;
+	int y;
+
+	y = newval;
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 instructions */
+		".set volatile;"	/* avoid unwanted optimization */
+		"ll %0, 0(%2);"		/*   x = *p */
+		"bne %0, %3, 1f;"	/*   if (x != oldval) fail */
+		"sc %1, 0(%2);"		/*   *p = y; y = success? */
+		"1: .set pop"		/* restore assembler mode */
+		: "=&r" (x), "+r" (y) : "r" (p), "r" (oldval));
+	return x == oldval && y != 0;
+}
+
+////////////////////////////////////////////////////////////
+// futex semaphore
+
+/*
+ * fs_count is the semaphore count and the futex word; fs_waiters
+ * counts threads that may be in futex_wait, so V only calls into the
+ * kernel when someone might need waking.
+ */
+struct fsem {
+	volatile int fs_count;
+	volatile int fs_waiters;
+};
+
+static
+void
+atomic_add(volatile int *p, int n)
+{
+	int v;
+
+	do {
+		v = *p;
+	} while (!cas(p, v, v + n));
+}
+
+static
+void
+fsem_P(struct fsem *s)
+{
+	int v;
+
+	while (1) {
+		v = s->fs_count;
+		if (v > 0) {
+			if (cas(&s->fs_count, v, v - 1)) {
+				return;
+			}
+			continue;
+		}
+		atomic_add(&s->fs_waiters, 1);
+		if (futex_wait(&s->fs_count, 0, NULL) < 0 && errno != EAGAIN) {
+			err(1, "futex_wait");
+		}
+		atomic_add(&s->fs_waiters, -1);
+	}
+}
+
+static
+void
+fsem_V(struct fsem *s)
+{
+	atomic_add(&s->fs_count, 1);
+	if (s->fs_waiters > 0) {
+		if (futex_wake(&s->fs_count, 1) < 0) {
+			err(1, "futex_wake");
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////
+// checks
+
+static
+void
+checkerr(int result, int expected, const char *what)
+{
+	if (result != -1) {
+		errx(1, "%s: succeeded, expected %s", what,
+		     strerror(expected));
+	}
+	if (errno != expected) {
+		errx(1, "%s: got %s, expected %s", what, strerror(errno),
+		     strerror(expected));
+	}
+}
+
+static
+void
+checks(void)
+{
+	static volatile int word[2];
+	struct timespec ts;
+	unsigned long long start, elapsed;
+	int r;
+
+	word[0] = 5;
+	checkerr(futex_wait(&word[0], 6, NULL), EAGAIN, "wrong value");
+	checkerr(futex_wait((volatile int *)((char *)word + 1), 5, NULL),
+		 EINVAL, "misaligned");
+	checkerr(futex_wait(NULL, 0, NULL), EFAULT, "NULL address");
+
+	r = futex_wake(&word[0], 1);
+	if (r != 0) {
+		errx(1, "futex_wake with no waiters returned %d", r);
+	}
+
+	ts.tv_sec = 0;
+	ts.tv_nsec = TIMEOUT_MS * 1000000;
+	start = now();
+	checkerr(futex_wait(&word[0], 5, &ts), ETIMEDOUT, "timeout");
+	elapsed = now() - start;
+	if (elapsed < TIMEOUT_MS * 1000) {
+		errx(1, "timeout: woke after %llu us, expected %d",
+		     elapsed, TIMEOUT_MS * 1000);
+	}
+	printf("futexpong: %d ms timeout took %llu us\n", TIMEOUT_MS,
+	       elapsed);
+}
+
+////////////////////////////////////////////////////////////
+// timings
+
+static
+void
+report(const char *name, unsigned long long start)
+{
+	unsigned long long us;
+
+	us = now() - start;
+	printf("futexpong: %-5s %d pairs, %llu.%03llu us/pair\n", name,
+	       NPAIRS, us / NPAIRS, (us * 1000 / NPAIRS) % 1000);
+}
+
+static
+void
+time_semfs(void)
+{
+	unsigned long long start;
+	char c;
+	int fd, i;
+
+	fd = open(SEMNAME, O_RDWR|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", SEMNAME);
+	}
+	c = 0;
+	start = now();
+	for (i=0; i<NPAIRS; i++) {
+		if (write(fd, &c, 1) != 1) {
+			err(1, "%s: write", SEMNAME);
+		}
+		if (read(fd, &c, 1) != 1) {
+			err(1, "%s: read", SEMNAME);
+		}
+	}
+	report("semfs", start);
+	close(fd);
+	(void)remove(SEMNAME);
+}
+
+static
+void
+time_futex(void)
+{
+	static struct fsem s;
+	unsigned long long start;
+	int i;
+
+	start = now();
+	for (i=0; i<NPAIRS; i++) {
+		fsem_V(&s);
+		fsem_P(&s);
+	}
+	report("futex", start);
+}
+
+static
+void
+time_slow(void)
+{
+	static volatile int word;
+	unsigned long long start;
+	int i;
+
+	start = now();
+	for (i=0; i<NPAIRS; i++) {
+		if (futex_wake(&word, 1) < 0) {
+			err(1, "futex_wake");
+		}
+		if (futex_wait(&word, 1, NULL) == 0 || errno != EAGAIN) {
+			err(1, "futex_wait");
+		}
+	}
+	report("slow", start);
+}
+
+int
+main(void)
+{
+	checks();
+	time_semfs();
+	time_futex();
+	time_slow();
+	return 0;
+}
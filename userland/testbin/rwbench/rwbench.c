@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2016
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * rwbench.c
+ *
+ * Measures read and write system call throughput for large (1 MB)
+ * transfers, which is dominated by copyin/copyout and by faulting in
+ * the user buffer on the way.
+ *
+ * Writes a 1 MB buffer to a file NTRIALS times, then reads it back
+ * NTRIALS times, each time with a single call, and reports KB/s for
+ * each direction. The buffer is touched first so the numbers don't
+ * include zero-filling it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+
+#define DEFAULT_FILE "rwbench.dat"
+#define BUFSIZE (1024 * 1024)
+#define NTRIALS 8
+
+static char buf[BUFSIZE];
+
+/*
+ * Return the current time in microseconds.
+ */
+static
+unsigned long long
+now(void)
+{
+	time_t secs;
+	unsigned long nsecs;
+
+	__time(&secs, &nsecs);
+	return secs * 1000000ULL + nsecs / 1000;
+}
+
+/*
+ * Do NTRIALS whole-buffer transfers in direction DOWRITE; return the
+ * throughput in KB/s.
+ */
+static
+unsigned long
+trial(int fd, int dowrite)
+{
+	unsigned long long start, end;
+	ssize_t len;
+	int i;
+
+	start = now();
+	for (i=0; i<NTRIALS; i++) {
+		if (lseek(fd, 0, SEEK_SET) < 0) {
+			err(1, "lseek");
+		}
+		if (dowrite) {
+			len = write(fd, buf, BUFSIZE);
+		}
+		else {
+			len = read(fd, buf, BUFSIZE);
+		}
+		if (len < 0) {
+			err(1, "%s", dowrite ? "write" : "read");
+		}
+		if (len != BUFSIZE) {
+			errx(1, "%s: short count %ld", dowrite ? "write" : "read",
+			     (long)len);
+		}
+	}
+	end = now();
+
+	if (end == start) {
+		end++;
+	}
+	return (unsigned long)((unsigned long long)NTRIALS * BUFSIZE
+			       * 1000000ULL / 1024 / (end - start));
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *filename;
+	unsigned long wkb, rkb;
+	int fd;
+
+	if (argc > 2) {
+		errx(1, "Usage: rwbench [filename]");
+	}
+	filename = argc == 2 ? argv[1] : DEFAULT_FILE;
+
+	memset(buf, 'r', BUFSIZE);
+
+	fd = open(filename, O_RDWR|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", filename);
+	}
+
+	wkb = trial(fd, 1);
+	rkb = trial(fd, 0);
+
+	close(fd);
+	if (remove(filename) < 0) {
+		warn("remove %s", filename);
+	}
+
+	printf("rwbench: %d x %d KB transfers\n", NTRIALS, BUFSIZE / 1024);
+	printf("write: %lu KB/s\n", wkb);
+	printf("read:  %lu KB/s\n", rkb);
+	return 0;
+}
@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2016
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * threadmat.c
+ *
+ * matmult, with the work split across threads in one process.
+ *
+ * Usage: threadmat [nthreads]
+ *
+ * Each thread multiplies out every nthreads'th row of the result.
+ * The threads share the matrices, so unlike forking several
+ * processes nothing has to be copied. The main thread waits for them
+ * on a futex, checks the answer, and prints how long it took; run it
+ * with 1 and then with one thread per CPU to see the speedup.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <err.h>
+
+#define Dim 	72	/* same as matmult */
+#define RIGHT  8772192	/* correct answer */
+
+#define MAXTHREADS 16
+
+int A[Dim][Dim];
+int B[Dim][Dim];
+int C[Dim][Dim];
+int T[Dim][Dim][Dim];
+
+static int nthreads;
+static volatile int nextid;
+static volatile int remaining;
+
+/*
+ * Return the current time in microseconds.
+ */
+static
+unsigned long long
+now(void)
+{
+	time_t secs;
+	unsigned long nsecs;
+
+	__time(&secs, &nsecs);
+	return secs * 1000000ULL + nsecs / 1000;
+}
+
+/*
+ * Atomically replace *P with NEWVAL if it holds OLDVAL, using LL/SC
+ * as in futexpong. Can fail spuriously, so callers loop.
+ */
+static
+int
+cas(volatile int *p, int oldval, int newval)
+{
+	int x;
+	int y;
+
+	y = newval;
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 instructions */
+		".set volatile;"	/* avoid unwanted optimization */
+		"ll %0, 0(%2);"		/*   x = *p */
+		"bne %0, %3, 1f;"	/*   if (x != oldval) fail */
+		"sc %1, 0(%2);"		/*   *p = y; y = success? */
+		"1: .set pop"		/* restore assembler mode */
+		: "=&r" (x), "+r" (y) : "r" (p), "r" (oldval));
+	return x == oldval && y != 0;
+}
+
+/*
+ * Add N to *P; return the new value.
+ */
+static
+int
+atomic_add(volatile int *p, int n)
+{
+	int v;
+
+	do {
+		v = *p;
+	} while (!cas(p, v, v + n));
+	return v + n;
+}
+
+static
+void
+worker(void)
+{
+	int id, i, j, k;
+
+	id = atomic_add(&nextid, 1) - 1;
+
+	for (i = id; i < Dim; i += nthreads)
+		for (j = 0; j < Dim; j++)
+			for (k = 0; k < Dim; k++)
+				T[i][j][k] = A[i][k] * B[k][j];
+
+	for (i = id; i < Dim; i += nthreads)
+		for (j = 0; j < Dim; j++)
+			for (k = 0; k < Dim; k++)
+				C[i][j] += T[i][j][k];
+
+	if (atomic_add(&remaining, -1) == 0) {
+		futex_wake(&remaining, 1);
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned long long start, end;
+	int i, j, r, v;
+
+	nthreads = 4;
+	if (argc > 1) {
+		nthreads = atoi(argv[1]);
+	}
+	if (nthreads < 1 || nthreads > MAXTHREADS) {
+		errx(1, "Usage: threadmat [1-%d]", MAXTHREADS);
+	}
+
+	for (i = 0; i < Dim; i++)
+		for (j = 0; j < Dim; j++) {
+			A[i][j] = i;
+			B[i][j] = j;
+			C[i][j] = 0;
+		}
+
+	start = now();
+	remaining = nthreads;
+	for (i = 0; i < nthreads; i++) {
+		if (threadfork(worker)) {
+			err(1, "threadfork");
+		}
+	}
+	while ((v = remaining) != 0) {
+		futex_wait(&remaining, v, NULL);
+	}
+	end = now();
+
+	r = 0;
+	for (i = 0; i < Dim; i++)
+		r += C[i][i];
+
+	printf("threadmat: %d threads, %llu us\n", nthreads, end - start);
+	printf("answer is: %d (should be %d)\n", r, RIGHT);
+	if (r != RIGHT) {
+		printf("FAILED\n");
+		return 1;
+	}
+	printf("Passed.\n");
+	return 0;
+}
@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2016
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * threadwait.c
+ *
+ * Two threads of one process call waitpid on the same child.
+ *
+ * Usage: threadwait [rounds]
+ *
+ * In each round the main thread forks a child that sleeps briefly
+ * and exits, then starts two threads that both wait for it. Exactly
+ * one of them must get the child's exit status; the other must fail
+ * with ECHILD (it arrived while the first was waiting) or ESRCH (it
+ * arrived after the child was collected). Anything else, or a hang,
+ * is a failure.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+#include <sys/wait.h>
+
+#define NWAITERS 2
+
+enum { W_RUNNING, W_GOT, W_ECHILD, W_ESRCH, W_BAD };
+
+static pid_t kid;
+static int kidcode;
+static volatile int result[NWAITERS];
+
+static
+void
+waiter(void *arg)
+{
+	volatile int *res = arg;
+	int status;
+	pid_t r;
+
+	r = waitpid(kid, &status, 0);
+	if (r == kid && WIFEXITED(status) &&
+	    WEXITSTATUS(status) == kidcode) {
+		*res = W_GOT;
+	}
+	else if (r < 0 && errno == ECHILD) {
+		*res = W_ECHILD;
+	}
+	else if (r < 0 && errno == ESRCH) {
+		*res = W_ESRCH;
+	}
+	else {
+		*res = W_BAD;
+	}
+	futex_wake(res, 1);
+	threadexit();
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct timespec ts;
+	int rounds, round, i, v;
+	int got, echild, esrch;
+
+	rounds = 20;
+	if (argc > 1) {
+		rounds = atoi(argv[1]);
+	}
+
+	echild = esrch = 0;
+	for (round = 0; round < rounds; round++) {
+		kidcode = round % 100 + 1;
+		kid = fork();
+		if (kid < 0) {
+			err(1, "fork");
+		}
+		if (kid == 0) {
+			/* give both waiters time to get into waitpid */
+			ts.tv_sec = 0;
+			ts.tv_nsec = 50 * 1000 * 1000;
+			nanosleep(&ts, NULL);
+			_exit(kidcode);
+		}
+
+		for (i = 0; i < NWAITERS; i++) {
+			result[i] = W_RUNNING;
+			if (__threadfork(waiter, (void *)&result[i])) {
+				err(1, "threadfork");
+			}
+		}
+
+		got = 0;
+		for (i = 0; i < NWAITERS; i++) {
+			while ((v = result[i]) == W_RUNNING) {
+				futex_wait(&result[i], v, NULL);
+			}
+			switch (v) {
+			    case W_GOT: got++; break;
+			    case W_ECHILD: echild++; break;
+			    case W_ESRCH: esrch++; break;
+			    default:
+				errx(1, "round %d: waiter %d: bad result",
+				     round, i);
+			}
+		}
+		if (got != 1) {
+			errx(1, "round %d: %d waiters got the status",
+			     round, got);
+		}
+	}
+
+	printf("threadwait: %d rounds, %d ECHILD, %d ESRCH\n",
+	       rounds, echild, esrch);
+	printf("Passed.\n");
+	return 0;
+}
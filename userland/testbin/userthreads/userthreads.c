@@ -32,17 +32,12 @@
  * forks 3 threads off 2 to functions, each of which displays a string
  * every once in a while.
  *
- * This won't do much of anything unless you implement user-level
- * threads.
- *
- * It also makes various assumptions about the thread API. In
- * particular, it believes (1) that you create a thread by calling
- * "threadfork()" and passing the address for execution of the new
- * thread to begin at, (2) that if the parent thread exits any child
- * threads will keep running, and (3) child threads will exit if they
- * return from the function they started in. If any or all of these
- * assumptions are not met by your user-level threads, you will need
- * to patch this test accordingly.
+ * It uses the thread API in libc: you create a thread by calling
+ * "threadfork()" and passing the function for the new thread to run,
+ * and a thread that returns from that function exits. Exiting the
+ * process (including returning from main) takes all the threads with
+ * it, so the parent thread leaves with threadexit() instead, and the
+ * others keep running.
  *
  * This is also a rather basic test and you'll probably want to write
  * some more of your own.
@@ -80,7 +75,7 @@ main(int argc, char *argv[])
     }
 
     printf("Parent has left.\n");
-    return 0;
+    threadexit();
 }
 
 /* multiple threads will simply print out the global variable.
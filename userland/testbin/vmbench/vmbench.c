@@ -0,0 +1,256 @@
+/*
+ * Copyright (c) 2016
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * vmbench.c
+ *
+ * Userland VM benchmarks: demand-zero fault cost, TLB refill cost,
+ * and fork and exec latency. (Allocator throughput is measured inside
+ * the kernel by the "vb" menu command.)
+ *
+ * Results are printed one per line as
+ *	vmbench <name> <value> <unit>
+ * for testscripts/vmbench.py to collect.
+ *
+ * Usage: vmbench [fault|tlb|fork|exec]...
+ * With no arguments, runs all of them.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <err.h>
+
+#define _PATH_MYSELF "/testbin/vmbench"
+#define MARKER "-x"		/* argv[1] of the exec'd copies */
+
+#define PAGESIZE 4096
+#define NPAGES 128		/* twice what the TLB can map */
+#define NTRIALS 16
+#define TLBPASSES 16
+
+/*
+ * faultbuf is only ever touched by forked children, so every child
+ * starts with it unmapped. tlbbuf is touched by the parent, so forks
+ * have that much more to copy.
+ */
+static char faultbuf[NPAGES * PAGESIZE];
+static char tlbbuf[NPAGES * PAGESIZE];
+
+/*
+ * Return the current time in microseconds.
+ */
+static
+unsigned long long
+now(void)
+{
+	time_t secs;
+	unsigned long nsecs;
+
+	__time(&secs, &nsecs);
+	return secs * 1000000ULL + nsecs / 1000;
+}
+
+static
+void
+report(const char *name, unsigned long value, const char *unit)
+{
+	printf("vmbench %s %lu %s\n", name, value, unit);
+}
+
+/*
+ * Run NTRIALS fork/wait cycles in which the child calls FUNC (if not
+ * null) and exits. Returns the total time in microseconds.
+ */
+static
+unsigned long long
+forkloop(void (*func)(void))
+{
+	unsigned long long start;
+	pid_t pid;
+	int i, status;
+
+	start = now();
+	for (i=0; i<NTRIALS; i++) {
+		pid = fork();
+		if (pid < 0) {
+			err(1, "fork");
+		}
+		if (pid == 0) {
+			if (func != NULL) {
+				func();
+			}
+			_exit(0);
+		}
+		if (waitpid(pid, &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			errx(1, "child failed");
+		}
+	}
+	return now() - start;
+}
+
+static
+void
+touchfaultbuf(void)
+{
+	unsigned i;
+
+	for (i=0; i<NPAGES; i++) {
+		faultbuf[i * PAGESIZE] = 1;
+	}
+}
+
+/*
+ * Demand-zero faults: time children that touch every page of
+ * faultbuf, less the time of children that do nothing.
+ */
+static
+void
+bench_fault(void)
+{
+	unsigned long long base, touch;
+
+	base = forkloop(NULL);
+	touch = forkloop(touchfaultbuf);
+	if (touch <= base) {
+		touch = base + 1;
+	}
+	report("fault", (touch - base) * 1000 / (NTRIALS * NPAGES), "ns");
+}
+
+/*
+ * TLB refills: cycle through more pages than the TLB holds, one word
+ * per page, so most accesses miss.
+ */
+static
+void
+bench_tlb(void)
+{
+	unsigned long long start, end;
+	volatile char *p = tlbbuf;
+	unsigned i, j;
+
+	start = now();
+	for (j=0; j<TLBPASSES; j++) {
+		for (i=0; i<NPAGES; i++) {
+			(void)p[i * PAGESIZE];
+		}
+	}
+	end = now();
+	report("tlb", (end - start) * 1000 / (TLBPASSES * NPAGES), "ns");
+}
+
+static
+void
+bench_fork(void)
+{
+	report("fork", forkloop(NULL) / NTRIALS, "us");
+}
+
+static
+void
+execself(void)
+{
+	char *args[3];
+
+	args[0] = (char *)_PATH_MYSELF;
+	args[1] = (char *)MARKER;
+	args[2] = NULL;
+	execv(_PATH_MYSELF, args);
+	warn("execv");
+	_exit(1);
+}
+
+/*
+ * fork+exec+exit+wait, less plain fork+exit+wait.
+ */
+static
+void
+bench_exec(void)
+{
+	unsigned long long base, ex;
+
+	base = forkloop(NULL);
+	ex = forkloop(execself);
+	if (ex <= base) {
+		ex = base + 1;
+	}
+	report("exec", (ex - base) / NTRIALS, "us");
+}
+
+static const struct {
+	const char *name;
+	void (*func)(void);
+} benches[] = {
+	{ "fault", bench_fault },
+	{ "tlb", bench_tlb },
+	{ "fork", bench_fork },
+	{ "exec", bench_exec },
+};
+#define NBENCHES (sizeof(benches) / sizeof(benches[0]))
+
+int
+main(int argc, char *argv[])
+{
+	unsigned i;
+	int j;
+
+	if (argc >= 2 && !strcmp(argv[1], MARKER)) {
+		/* we are the exec'd copy */
+		return 0;
+	}
+
+	/* map all of tlbbuf, so the tlb and fork numbers include it */
+	memset(tlbbuf, 1, sizeof(tlbbuf));
+
+	if (argc == 1) {
+		for (i=0; i<NBENCHES; i++) {
+			benches[i].func();
+		}
+		return 0;
+	}
+
+	for (j=1; j<argc; j++) {
+		for (i=0; i<NBENCHES; i++) {
+			if (!strcmp(argv[j], benches[i].name)) {
+				break;
+			}
+		}
+		if (i == NBENCHES) {
+			errx(1, "Usage: vmbench [fault|tlb|fork|exec]...");
+		}
+		benches[i].func();
+	}
+	return 0;
+}